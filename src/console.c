@@ -1,22 +1,110 @@
 #include "console.h"
 #include "stdmem.h"
 #include "fonts.h"
-#include "keyboard.h"
-#include "port.h"
+#include "smp.h"
+#include "sched.h"
+#include "spinlock.h"
+#include "seqlock.h"
+#include "vmm.h"
+#include "task.h"
+#include "pmm.h"
+#include "timer.h"
+#include "memops.h"
+#include "shell.h"
 #include <stdint.h>
 #include <stdarg.h>
 #include <stdbool.h>
 
+// Output path: printf formats into a line on the caller's stack and hands
+// whole lines to a ring of its CPU; one renderer thread owns the
+// framebuffer and draws the lines of all CPUs in timestamp order. Nothing
+// shared is locked or written while formatting.
+#define CONSOLE_LINE_MAX   120      // Characters per published line
+#define CONSOLE_LINE_RUNS  8        // Colour changes per published line
+#define CONSOLE_RING_LINES 64       // Lines buffered per CPU (power of two)
+
+enum console_line_kind {
+    CONSOLE_LINE_TEXT = 0,
+    CONSOLE_LINE_CLEAR,
+    CONSOLE_LINE_SUSPEND,       // Stop drawing, keep recording cells
+    CONSOLE_LINE_RESUME         // Redraw everything from the cells
+};
+
+// Characters from start on use these colours
+struct console_run {
+    uint32_t fg;
+    uint32_t bg;
+    uint8_t start;
+};
+
+struct console_line {
+    uint64_t tsc;
+    uint8_t kind;
+    bool newline;               // Ends the line; otherwise more may follow
+    uint8_t len;
+    uint8_t runs;
+    char text[CONSOLE_LINE_MAX];
+    struct console_run run[CONSOLE_LINE_RUNS];
+};
+
+// Single producer (its CPU, interrupts off) and single consumer (the renderer)
+struct console_ring {
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    uint64_t dropped;           // Lines lost to a full ring in atomic context
+    struct console_line lines[CONSOLE_RING_LINES];
+};
+
+// Character cell as last written, so the renderer can redraw the screen
+// after someone else had the framebuffer
+struct console_cell {
+    char c;
+    uint32_t fg;
+    uint32_t bg;
+};
+
 static struct console_state console;
 
+// Framebuffer and cursor: held by printf before the renderer runs, by the
+// renderer for each line after that, and for good by panic()
+static spinlock_t console_lock = SPINLOCK_INIT_NAMED("console");
+static volatile int panic_cpu = -1;     // CPU drawing a panic report
+
+// How long panic() waits for the lock; its holder may be the CPU that died
+#define PANIC_LOCK_SPINS 10000000
+
+static struct console_ring* rings[MAX_CPUS];
+static volatile bool renderer_ready = false;
+static volatile bool renderer_idle = false;
+static struct waitqueue renderer_wq = WAITQUEUE_INIT;
+static volatile uint32_t advance_waiters = 0;  // Threads waiting on the renderer
+static struct waitqueue advance_wq = WAITQUEUE_INIT;
+static int open_line_cpu = -1;  // CPU whose unfinished line is on screen
+static uint64_t lines_rendered = 0;
+
+// Cell grid (from the renderer's start on) and whether the framebuffer is
+// lent out; both belong to the renderer
+static struct console_cell* cells = NULL;
+static size_t cell_cols = 0;
+static size_t cell_rows = 0;
+static bool display_suspended = false;
+static volatile uint32_t suspend_acks = 0;
+
+// Geometry and font, read lock-free by anything that wants a consistent
+// view of them; only font loading writes
+static seqlock_t console_geometry = SEQLOCK_INIT;
+
 int load_font(struct psf_font* font, void* font_data, size_t font_size) {
+    write_seqlock(&console_geometry);
     if (psf_load_font(font, font_data, font_size) != 0) {
+        write_sequnlock(&console_geometry);
         return -1;
     }
     
     // Update console dimensions based on new font size
     console.width = (console.fb->width / (font->width * console.scale));
     console.height = (console.fb->height / (font->height * console.scale));
+    write_sequnlock(&console_geometry);
     return 0;
 }
 
@@ -38,33 +126,60 @@ void init_shell(struct limine_framebuffer* framebuffer) {
         // PSF font loading failed
         printf("PSF font loading failed!\nFalling back to VGA font\n", RED, BLACK);
         // PSF font loading failed, fall back to VGA font
+        write_seqlock(&console_geometry);
         console.font.width = 8;  // VGA font is 8x16
         console.font.height = 16;
         console.font.glyph_buffer = vga_font; 
         console.font.glyph_count = 256;
         console.font.glyph_size = 16;
         console.font.version = 0;  // Use 0 to indicate VGA font
+        write_sequnlock(&console_geometry);
     } else {
         // PSF font loaded successfully
         printf("PSF font loaded successfully!\n", BLUE, BLACK);
     }
 
     // Calculate console dimensions based on font size
+    write_seqlock(&console_geometry);
     console.width = (console.fb->width / (console.font.width * console.scale));
     console.height = (console.fb->height / (console.font.height * console.scale));
+    write_sequnlock(&console_geometry);
 }
 
-void console_clear(void) {
-    volatile uint32_t* fb = console.fb->address;
-    for (size_t i = 0; i < console.fb->height; i++) {
-        for (size_t j = 0; j < console.fb->width; j++) {
-            fb[i * (console.fb->pitch / 4) + j] = console.bg_color;
-        }
+// Fill framebuffer rows [begin, end) with the background colour
+static void clear_rows(size_t begin, size_t end, void* arg) {
+    (void)arg;
+    uint32_t* fb = console.fb->address;
+    for (size_t i = begin; i < end; i++) {
+        fast_fill32(&fb[i * (console.fb->pitch / 4)], console.bg_color, console.fb->width);
+    }
+}
+
+static void set_cell(size_t x, size_t y, char c, uint32_t fg, uint32_t bg) {
+    if (cells != NULL && x < cell_cols && y < cell_rows) {
+        cells[y * cell_cols + x] = (struct console_cell){ .c = c, .fg = fg, .bg = bg };
+    }
+}
+
+// Always under the console lock, so no parallel_for: it may sleep
+static void clear_screen(void) {
+    if (!display_suspended) {
+        clear_rows(0, console.fb->height, NULL);
+    }
+    for (size_t i = 0; i < cell_cols * cell_rows; i++) {
+        cells[i] = (struct console_cell){ .c = ' ', .fg = console.fg_color, .bg = console.bg_color };
     }
     console.cursor_x = 0;
     console.cursor_y = 0;
 }
 
+static void console_publish(struct console_line* line);
+
+void console_clear(void) {
+    struct console_line line = { .kind = CONSOLE_LINE_CLEAR, .newline = true };
+    console_publish(&line);
+}
+
 static void draw_char(char c, size_t x, size_t y, unsigned int fg_color, unsigned int bg_color) {    
     if (!console.font.glyph_buffer) return;  // No font loaded
     
@@ -95,7 +210,7 @@ static void draw_char(char c, size_t x, size_t y, unsigned int fg_color, unsigne
     }
 }
 
-void putChar(char c, unsigned int fg_color, unsigned int bg_color) {
+static void put_char(char c, unsigned int fg_color, unsigned int bg_color) {
     if (c == '\n') {
         console.cursor_x = 0;
         console.cursor_y++;
@@ -110,7 +225,10 @@ void putChar(char c, unsigned int fg_color, unsigned int bg_color) {
             console.cursor_x = console.width - 1;
         }
     } else {
-        draw_char(c, console.cursor_x, console.cursor_y, fg_color, bg_color);
+        set_cell(console.cursor_x, console.cursor_y, c, fg_color, bg_color);
+        if (!display_suspended) {
+            draw_char(c, console.cursor_x, console.cursor_y, fg_color, bg_color);
+        }
         console.cursor_x++;
     }
     
@@ -121,7 +239,277 @@ void putChar(char c, unsigned int fg_color, unsigned int bg_color) {
     
     if (console.cursor_y >= console.height) {
         // Basic scrolling - just clear for now
-        console_clear();
+        clear_screen();
+    }
+}
+
+// Clear the screen and draw the cells that differ from it
+static void repaint(void) {
+    clear_rows(0, console.fb->height, NULL);
+    for (size_t y = 0; y < cell_rows; y++) {
+        for (size_t x = 0; x < cell_cols; x++) {
+            const struct console_cell* cell = &cells[y * cell_cols + x];
+            if (cell->c != ' ' || cell->bg != console.bg_color) {
+                draw_char(cell->c, x, y, cell->fg, cell->bg);
+            }
+        }
+    }
+}
+
+// Draw a published line from cpu at the cursor
+static void render_line(const struct console_line* line, int cpu) {
+    if (line->kind == CONSOLE_LINE_CLEAR) {
+        clear_screen();
+        open_line_cpu = -1;
+        return;
+    }
+    if (line->kind == CONSOLE_LINE_SUSPEND) {
+        display_suspended = true;
+        __atomic_add_fetch(&suspend_acks, 1, __ATOMIC_RELEASE);
+        return;
+    }
+    if (line->kind == CONSOLE_LINE_RESUME) {
+        display_suspended = false;
+        repaint();
+        return;
+    }
+
+    // Never continue another CPU's unfinished line
+    if (open_line_cpu >= 0 && open_line_cpu != cpu && console.cursor_x != 0) {
+        put_char('\n', console.fg_color, console.bg_color);
+    }
+    size_t run = 0;
+    for (size_t i = 0; i < line->len; i++) {
+        while (run + 1 < line->runs && line->run[run + 1].start <= i) {
+            run++;
+        }
+        put_char(line->text[i], line->run[run].fg, line->run[run].bg);
+    }
+    open_line_cpu = line->newline ? -1 : cpu;
+    lines_rendered++;
+}
+
+// Whether the caller may sleep until the renderer catches up
+static bool console_can_wait(void) {
+    struct cpu* cpu = this_cpu();
+    return irqs_enabled() && cpu->irq_depth == 0 && cpu->preempt_count == 0 &&
+           cpu->current != NULL && cpu->current != cpu->idle;
+}
+
+// Sleep until the renderer moves *counter on from seen; callers recheck
+static void renderer_wait(volatile uint32_t* counter, uint32_t seen) {
+    struct wait_entry entry = { 0 };
+    wait_prepare(&advance_wq, &entry);
+    __atomic_add_fetch(&advance_waiters, 1, __ATOMIC_RELAXED);
+    // Pairs with the fence in the renderer after each line
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(counter, __ATOMIC_ACQUIRE) == seen) {
+        schedule();
+    }
+    __atomic_sub_fetch(&advance_waiters, 1, __ATOMIC_RELAXED);
+    wait_finish(&advance_wq, &entry);
+}
+
+static void console_publish(struct console_line* line) {
+    // panic() holds console_lock and draws itself, nothing may be queued
+    if (__atomic_load_n(&panic_cpu, __ATOMIC_RELAXED) == (int)cpu_id()) {
+        line->tsc = rdtsc();
+        render_line(line, (int)cpu_id());
+        return;
+    }
+    if (!__atomic_load_n(&renderer_ready, __ATOMIC_ACQUIRE)) {
+        uint64_t flags = spin_lock_irqsave(&console_lock);
+        line->tsc = rdtsc();
+        render_line(line, (int)cpu_id());
+        spin_unlock_irqrestore(&console_lock, flags);
+        return;
+    }
+
+    for (;;) {
+        // Interrupts off: the ring belongs to this CPU and an interrupt
+        // handler printing in between must not see it half updated
+        uint64_t flags = irq_save();
+        struct console_ring* ring = rings[cpu_id()];
+        uint32_t head = ring->head;
+        uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        if (head - tail < CONSOLE_RING_LINES) {
+            struct console_line* slot = &ring->lines[head % CONSOLE_RING_LINES];
+            line->tsc = rdtsc();
+            memcpy(slot, line, offsetof(struct console_line, text) + line->len);
+            memcpy(slot->run, line->run, line->runs * sizeof(struct console_run));
+            __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+            irq_restore(flags);
+            break;
+        }
+        irq_restore(flags);
+
+        if (!console_can_wait()) {
+            __atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        // Any CPU's ring may be ours by the time this returns
+        renderer_wait(&ring->tail, tail);
+    }
+
+    // Pairs with the fence in the renderer before it sleeps
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&renderer_idle, __ATOMIC_RELAXED)) {
+        waitqueue_wake_all(&renderer_wq);
+    }
+}
+
+// Start a new line (or continuation) in the same state
+static void line_reset(struct console_line* line) {
+    line->kind = CONSOLE_LINE_TEXT;
+    line->newline = false;
+    line->len = 0;
+    line->runs = 0;
+}
+
+static void line_putc(struct console_line* line, char c, uint32_t fg, uint32_t bg) {
+    if (line->len == CONSOLE_LINE_MAX) {
+        console_publish(line);
+        line_reset(line);
+    }
+    if (line->runs == 0 || line->run[line->runs - 1].fg != fg || line->run[line->runs - 1].bg != bg) {
+        if (line->runs == CONSOLE_LINE_RUNS) {
+            console_publish(line);
+            line_reset(line);
+        }
+        line->run[line->runs++] = (struct console_run){ .fg = fg, .bg = bg, .start = line->len };
+    }
+    line->text[line->len++] = c;
+    if (c == '\n') {
+        line->newline = true;
+        console_publish(line);
+        line_reset(line);
+    }
+}
+
+static void line_puts(struct console_line* line, const char* str, uint32_t fg, uint32_t bg) {
+    while (*str) {
+        line_putc(line, *str++, fg, bg);
+    }
+}
+
+// Oldest line of all rings, preferring the CPU whose line is still open
+static struct console_ring* next_ring(int* cpu) {
+    struct console_ring* best = NULL;
+
+    if (open_line_cpu >= 0) {
+        struct console_ring* ring = rings[open_line_cpu];
+        if (ring != NULL && ring->tail != __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)) {
+            *cpu = open_line_cpu;
+            return ring;
+        }
+    }
+    for (unsigned int i = 0; i < cpu_count(); i++) {
+        struct console_ring* ring = rings[i];
+        if (ring == NULL || ring->tail == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)) {
+            continue;
+        }
+        if (best == NULL || ring->lines[ring->tail % CONSOLE_RING_LINES].tsc <
+                            best->lines[best->tail % CONSOLE_RING_LINES].tsc) {
+            best = ring;
+            *cpu = (int)i;
+        }
+    }
+    return best;
+}
+
+static void console_renderer(void* arg) {
+    (void)arg;
+
+    for (;;) {
+        struct console_ring* ring;
+        int cpu;
+        while ((ring = next_ring(&cpu)) != NULL) {
+            // Preemption off while a line is drawn, so whoever else has to
+            // draw (a fatal error report) never waits on a switched-out renderer
+            spin_lock(&console_lock);
+            render_line(&ring->lines[ring->tail % CONSOLE_RING_LINES], cpu);
+            spin_unlock(&console_lock);
+            __atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_RELEASE);
+            // Pairs with the fence in renderer_wait()
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            if (__atomic_load_n(&advance_waiters, __ATOMIC_RELAXED) != 0) {
+                waitqueue_wake_all(&advance_wq);
+            }
+        }
+
+        struct wait_entry entry = { 0 };
+        wait_prepare(&renderer_wq, &entry);
+        __atomic_store_n(&renderer_idle, true, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (next_ring(&cpu) == NULL) {
+            schedule();
+        }
+        __atomic_store_n(&renderer_idle, false, __ATOMIC_RELAXED);
+        wait_finish(&renderer_wq, &entry);
+    }
+}
+
+void console_suspend(void) {
+    uint32_t acks = __atomic_load_n(&suspend_acks, __ATOMIC_ACQUIRE);
+    struct console_line line = { .kind = CONSOLE_LINE_SUSPEND, .newline = true };
+    console_publish(&line);
+    // Lines ahead of ours may still be drawing
+    while (__atomic_load_n(&suspend_acks, __ATOMIC_ACQUIRE) == acks) {
+        renderer_wait(&suspend_acks, acks);
+    }
+}
+
+void console_resume(void) {
+    struct console_line line = { .kind = CONSOLE_LINE_RESUME, .newline = true };
+    console_publish(&line);
+}
+
+struct limine_framebuffer* console_framebuffer(void) {
+    return console.fb;
+}
+
+void console_start_renderer(void) {
+    size_t pages = (sizeof(struct console_ring) + PAGE_SIZE - 1) / PAGE_SIZE;
+
+    // The grid starts blank: the boot log before this point is not kept
+    size_t grid_pages = (console.width * console.height * sizeof(struct console_cell) + PAGE_SIZE - 1) / PAGE_SIZE;
+    uint64_t grid = pmm_alloc_pages(grid_pages);
+    if (grid != 0) {
+        struct console_cell* blank = phys_to_virt(grid);
+        for (size_t i = 0; i < console.width * console.height; i++) {
+            blank[i] = (struct console_cell){ .c = ' ', .fg = console.fg_color, .bg = console.bg_color };
+        }
+        uint64_t flags = spin_lock_irqsave(&console_lock);
+        cells = blank;
+        cell_cols = console.width;
+        cell_rows = console.height;
+        spin_unlock_irqrestore(&console_lock, flags);
+    }
+
+    for (unsigned int i = 0; i < cpu_count(); i++) {
+        if (!cpus[i].online) {
+            continue;
+        }
+        uint64_t phys = pmm_alloc_pages(pages);
+        if (phys == 0) {
+            printf("Console: no memory for output rings\n", RED, BLACK);
+            return;
+        }
+        rings[i] = phys_to_virt(phys);
+        memset(rings[i], 0, sizeof(struct console_ring));
+    }
+    if (thread_create("console", console_renderer, NULL, THREAD_PRIO_HIGH, THREAD_ANY_CPU) == NULL) {
+        return;
+    }
+    __atomic_store_n(&renderer_ready, true, __ATOMIC_RELEASE);
+}
+
+void putChar(char c, unsigned int fg_color, unsigned int bg_color) {
+    struct console_line line;
+    line_reset(&line);
+    line_putc(&line, c, fg_color, bg_color);
+    if (line.len > 0) {
+        console_publish(&line);
     }
 }
 
@@ -213,11 +601,9 @@ static int uint_to_hex_upper(unsigned int value, char* buffer) {
     return pos;
 }
 
-// Improved printf function with format specifiers
-void printf(const char* format, unsigned int fg_color, unsigned int bg_color, ...) {
-    va_list args;
-    va_start(args, bg_color);
-    
+// Format into line, publishing each finished line on the way
+static void format_line(struct console_line* line, const char* format,
+                        unsigned int fg_color, unsigned int bg_color, va_list args) {
     char buffer[32];
     const char* ptr = format;
     
@@ -230,187 +616,166 @@ void printf(const char* format, unsigned int fg_color, unsigned int bg_color, ..
                 case 'i': {
                     int value = va_arg(args, int);
                     int_to_str(value, buffer, 10);
-                    for (char* b = buffer; *b; b++) {
-                        putChar(*b, fg_color, bg_color);
-                    }
+                    line_puts(line, buffer, fg_color, bg_color);
                     break;
                 }
                 
                 case 'u': {
                     unsigned int value = va_arg(args, unsigned int);
                     uint_to_str(value, buffer, 10);
-                    for (char* b = buffer; *b; b++) {
-                        putChar(*b, fg_color, bg_color);
-                    }
+                    line_puts(line, buffer, fg_color, bg_color);
                     break;
                 }
                 
                 case 'x': {
                     unsigned int value = va_arg(args, unsigned int);
                     uint_to_str(value, buffer, 16);
-                    for (char* b = buffer; *b; b++) {
-                        putChar(*b, fg_color, bg_color);
-                    }
+                    line_puts(line, buffer, fg_color, bg_color);
                     break;
                 }
                 
                 case 'X': {
                     unsigned int value = va_arg(args, unsigned int);
                     uint_to_hex_upper(value, buffer);
-                    for (char* b = buffer; *b; b++) {
-                        putChar(*b, fg_color, bg_color);
-                    }
+                    line_puts(line, buffer, fg_color, bg_color);
                     break;
                 }
                 
                 case 'c': {
                     char value = (char)va_arg(args, int);
-                    putChar(value, fg_color, bg_color);
+                    line_putc(line, value, fg_color, bg_color);
                     break;
                 }
                 
                 case 's': {
                     char* str = va_arg(args, char*);
-                    if (str) {
-                        while (*str) {
-                            putChar(*str++, fg_color, bg_color);
-                        }
-                    } else {
-                        // Handle NULL pointer
-                        const char* null_str = "(null)";
-                        while (*null_str) {
-                            putChar(*null_str++, fg_color, bg_color);
-                        }
-                    }
+                    // Handle NULL pointer
+                    line_puts(line, str ? str : "(null)", fg_color, bg_color);
                     break;
                 }
                 
                 case 'p': {
                     void* ptr_val = va_arg(args, void*);
-                    putChar('0', fg_color, bg_color);
-                    putChar('x', fg_color, bg_color);
+                    line_putc(line, '0', fg_color, bg_color);
+                    line_putc(line, 'x', fg_color, bg_color);
                     uint_to_str((uintptr_t)ptr_val, buffer, 16);
-                    for (char* b = buffer; *b; b++) {
-                        putChar(*b, fg_color, bg_color);
-                    }
+                    line_puts(line, buffer, fg_color, bg_color);
                     break;
                 }
                 
                 case '%': {
-                    putChar('%', fg_color, bg_color);
+                    line_putc(line, '%', fg_color, bg_color);
                     break;
                 }
                 
                 default: {
                     // Unknown format specifier, just print it
-                    putChar('%', fg_color, bg_color);
-                    putChar(*ptr, fg_color, bg_color);
+                    line_putc(line, '%', fg_color, bg_color);
+                    line_putc(line, *ptr, fg_color, bg_color);
                     break;
                 }
             }
         } else {
-            putChar(*ptr, fg_color, bg_color);
+            line_putc(line, *ptr, fg_color, bg_color);
         }
         ptr++;
     }
-    
+    // What is left of an unfinished line goes out now, the rest of it
+    // follows with the next call
+    if (line->len > 0) {
+        console_publish(line);
+    }
+}
+
+// Improved printf function with format specifiers
+void printf(const char* format, unsigned int fg_color, unsigned int bg_color, ...) {
+    va_list args;
+    va_start(args, bg_color);
+    struct console_line line;
+    line_reset(&line);
+    format_line(&line, format, fg_color, bg_color, args);
     va_end(args);
 }
 
-void shell(void) {
-    char input_buffer[256];
-    int buffer_pos = 0;
-    
-    printf("valern> ", GREEN, BLACK);
-    
-    while (true) {
-        char c = keyboard_getchar();
-        
-        switch (c) {
-            case KEY_ENTER:
-                printf("\n", WHITE, BLACK);
-                input_buffer[buffer_pos] = '\0';
-                process_command(input_buffer);
-                buffer_pos = 0;
-                printf("valern> ", GREEN, BLACK);
-                break;
-                
-            case KEY_BACKSPACE:
-                if (buffer_pos > 0) {
-                    buffer_pos--;
-                    printf("\b \b", WHITE, BLACK); // Move back, print space, move back
-                }
-                break;
-                
-            case CTRL_C:
-                printf("^C\n", RED, BLACK);
-                buffer_pos = 0;
-                printf("valern> ", GREEN, BLACK);
-                break;
-                
-            case CTRL_L:
-                console_clear();
-                printf("valern> ", GREEN, BLACK);
-                for (int i = 0; i < buffer_pos; i++) {
-                    printf("%c", WHITE, BLACK, input_buffer[i]);
-                }
-                break;
-                
-            default:
-                if (c >= 32 && c <= 126 && buffer_pos < sizeof(input_buffer) - 1) {
-                    input_buffer[buffer_pos++] = c;
-                    printf("%c", WHITE, BLACK, c);
-                }
-                break;
-        }
+void panic(const char* format, ...) {
+    irq_save();
+    preempt_disable();      // A failed trylock must not schedule away
+    // Wait a while for the renderer or a printf to finish its line, then
+    // draw regardless: the holder may never come back
+    for (uint64_t spins = 0; spins < PANIC_LOCK_SPINS && !spin_trylock(&console_lock); spins++) {
+        cpu_relax();
+    }
+    __atomic_store_n(&panic_cpu, (int)cpu_id(), __ATOMIC_RELAXED);
+    display_suspended = false;
+
+    if (console.fb != NULL) {
+        va_list args;
+        va_start(args, format);
+        struct console_line line;
+        line_reset(&line);
+        format_line(&line, format, RED, BLACK, args);
+        va_end(args);
+    }
+    for (;;) {
+        asm volatile("cli\n\thlt");
+    }
+}
+
+static void cmd_clear(int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+    console_clear();
+}
+
+static void cmd_hello(int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+    printf("Hello from Valern OS!\n", GREEN, BLACK);
+}
+
+static void cmd_test(int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+    // Demonstrate the new printf capabilities
+    printf("Testing printf formatting:\n", BLUE, BLACK);
+    printf("Integer: %d\n", WHITE, BLACK, 42);
+    printf("Negative: %d\n", WHITE, BLACK, -123);
+    printf("Unsigned: %u\n", WHITE, BLACK, 3000000000U);
+    printf("Hex lowercase: 0x%x\n", WHITE, BLACK, 255);
+    printf("Hex uppercase: 0x%X\n", WHITE, BLACK, 255);
+    printf("Character: %c\n", WHITE, BLACK, 'A');
+    printf("String: %s\n", WHITE, BLACK, "Hello World!");
+    printf("Pointer: %p\n", WHITE, BLACK, (void*)0x12345678);
+    printf("Percent: 100%%\n", WHITE, BLACK);
+}
+
+static void cmd_info(int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+    struct console_state snapshot;
+    uint32_t seq;
+    do {
+        seq = read_seqbegin(&console_geometry);
+        memcpy(&snapshot, &console, sizeof(snapshot));
+    } while (read_seqretry(&console_geometry, seq));
+
+    printf("Valern OS System Information:\n", GREEN, BLACK);
+    printf("Console dimensions: %dx%d characters\n", WHITE, BLACK, snapshot.width, snapshot.height);
+    printf("Font size: %dx%d pixels\n", WHITE, BLACK, snapshot.font.width, snapshot.font.height);
+    printf("Framebuffer: %dx%d pixels\n", WHITE, BLACK, snapshot.fb->width, snapshot.fb->height);
+    printf("Scale factor: %dx\n", WHITE, BLACK, snapshot.scale);
+    printf("Font version: %d\n", WHITE, BLACK, snapshot.font.version);
+    printf("Glyph count: %d\n", WHITE, BLACK, snapshot.font.glyph_count);
+
+    uint64_t dropped = 0;
+    for (unsigned int i = 0; i < cpu_count(); i++) {
+        dropped += rings[i] ? rings[i]->dropped : 0;
     }
+    printf("Console output: %u lines rendered, %u dropped\n", WHITE, BLACK,
+           (unsigned int)lines_rendered, (unsigned int)dropped);
 }
 
-void process_command(const char* command) {
-    if (strcmp(command, "help") == 0) {
-        printf("Available commands:\n", WHITE, BLACK);
-        printf("  help    - Show this help message\n", GRAY, BLACK);
-        printf("  clear   - Clear the screen\n", GRAY, BLACK);
-        printf("  hello   - Say hello\n", GRAY, BLACK);
-        printf("  test    - Test printf formatting\n", GRAY, BLACK);
-        printf("  info    - Show system information\n", GRAY, BLACK);
-        printf("  reboot  - Reboot the system\n", GRAY, BLACK);
-    }
-    else if (strcmp(command, "clear") == 0) {
-        console_clear();
-    }
-    else if (strcmp(command, "hello") == 0) {
-        printf("Hello from Valern OS!\n", GREEN, BLACK);
-    }
-    else if (strcmp(command, "test") == 0) {
-        // Demonstrate the new printf capabilities
-        printf("Testing printf formatting:\n", BLUE, BLACK);
-        printf("Integer: %d\n", WHITE, BLACK, 42);
-        printf("Negative: %d\n", WHITE, BLACK, -123);
-        printf("Unsigned: %u\n", WHITE, BLACK, 3000000000U);
-        printf("Hex lowercase: 0x%x\n", WHITE, BLACK, 255);
-        printf("Hex uppercase: 0x%X\n", WHITE, BLACK, 255);
-        printf("Character: %c\n", WHITE, BLACK, 'A');
-        printf("String: %s\n", WHITE, BLACK, "Hello World!");
-        printf("Pointer: %p\n", WHITE, BLACK, (void*)0x12345678);
-        printf("Percent: 100%%\n", WHITE, BLACK);
-    }
-    else if (strcmp(command, "info") == 0) {
-        printf("Valern OS System Information:\n", GREEN, BLACK);
-        printf("Console dimensions: %dx%d characters\n", WHITE, BLACK, console.width, console.height);
-        printf("Font size: %dx%d pixels\n", WHITE, BLACK, console.font.width, console.font.height);
-        printf("Framebuffer: %dx%d pixels\n", WHITE, BLACK, console.fb->width, console.fb->height);
-        printf("Scale factor: %dx\n", WHITE, BLACK, console.scale);
-        printf("Font version: %d\n", WHITE, BLACK, console.font.version);
-        printf("Glyph count: %d\n", WHITE, BLACK, console.font.glyph_count);
-    }
-    else if (strcmp(command, "reboot") == 0) {
-        printf("Rebooting...\n", BLUE, BLACK);
-        // Simple reboot via keyboard controller
-        outb(0x64, 0xFE);
-    }
-    else if (strlen(command) > 0) {
-        printf("Unknown command: %s\n", RED, BLACK, command);
-        printf("Type 'help' for available commands.\n", GRAY, BLACK);
-    }
-}
\ No newline at end of file
+SHELL_COMMAND(clear, "clear", "Clear the screen", cmd_clear);
+SHELL_COMMAND(hello, "hello", "Say hello", cmd_hello);
+SHELL_COMMAND(test, "test", "Test printf formatting", cmd_test);
+SHELL_COMMAND(info, "info", "Show system information", cmd_info);
\ No newline at end of file
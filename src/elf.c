@@ -0,0 +1,139 @@
+#include "elf.h"
+#include "process.h"
+#include "modules.h"
+#include "vmm.h"
+#include "pmm.h"
+#include "stdmem.h"
+#include "console.h"
+#include "shell.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Module string of a program: the prefix followed by its name
+#define PROGRAM_PREFIX     "program "
+#define PROGRAM_PREFIX_LEN 8
+
+static bool header_ok(const struct elf64_header* eh, size_t size) {
+    if (size < sizeof(struct elf64_header) || eh->magic != ELF_MAGIC || eh->class != ELF_CLASS64 ||
+        eh->data != ELF_DATA_LSB || eh->type != ELF_TYPE_EXEC || eh->machine != ELF_MACHINE_X86_64) {
+        return false;
+    }
+    return eh->phentsize == sizeof(struct elf64_phdr) && eh->phoff <= size &&
+           eh->phnum <= (size - eh->phoff) / sizeof(struct elf64_phdr);
+}
+
+// Record the PT_LOAD segments as regions, returns false on a bad segment
+// or an entry point outside the executable ones
+static bool add_segments(struct process* proc, const struct elf64_header* eh, size_t size, uint64_t image_phys) {
+    const struct elf64_phdr* phdrs = (const struct elf64_phdr*)((const uint8_t*)eh + eh->phoff);
+    bool entry_ok = false;
+
+    for (size_t i = 0; i < eh->phnum; i++) {
+        const struct elf64_phdr* ph = &phdrs[i];
+        if (ph->type != ELF_PT_LOAD || ph->memsz == 0) {
+            continue;
+        }
+        // File offset and address must agree within a page for the file
+        // pages to be mapped directly
+        if (ph->filesz > ph->memsz || ph->offset > size || ph->filesz > size - ph->offset ||
+            ((ph->offset - ph->vaddr) & (PAGE_SIZE - 1)) || ph->memsz > USER_TOP || ph->vaddr > USER_TOP - ph->memsz) {
+            return false;
+        }
+        uint64_t start = ph->vaddr & ~(uint64_t)(PAGE_SIZE - 1);
+        uint64_t file_phys = image_phys + ph->offset - (ph->vaddr - start);
+        uint32_t flags = ((ph->flags & ELF_PF_W) ? REGION_WRITE : 0) | ((ph->flags & ELF_PF_X) ? REGION_EXEC : 0);
+        if (process_add_region(proc, start, ph->vaddr + ph->memsz, file_phys, ph->vaddr + ph->filesz, flags) != 0) {
+            return false;
+        }
+        if ((flags & REGION_EXEC) && eh->entry >= ph->vaddr && eh->entry < ph->vaddr + ph->memsz) {
+            entry_ok = true;
+        }
+    }
+    return entry_ok;
+}
+
+struct process* elf_load(const char* name, const void* image, size_t size) {
+    const struct elf64_header* eh = image;
+    uint64_t image_phys = virt_to_phys(image);
+
+    // Pages of the image are mapped as they are, so it must start on one
+    if (!header_ok(eh, size) || (image_phys & (PAGE_SIZE - 1))) {
+        return NULL;
+    }
+    struct process* proc = process_create(name);
+    if (proc == NULL) {
+        return NULL;
+    }
+    // Nothing is mapped yet: the first instruction faults in the first page
+    if (add_segments(proc, eh, size, image_phys)) {
+        proc->stack_top = process_add_stack(proc);
+    }
+    if (proc->stack_top == 0) {
+        process_destroy(proc);
+        return NULL;
+    }
+    proc->entry = eh->entry;
+    return proc;
+}
+
+struct process* program_load(const char* name) {
+    size_t next = 0;
+    struct limine_file* module;
+
+    while ((module = modules_find(PROGRAM_PREFIX, &next)) != NULL) {
+        if (strcmp(module->string + PROGRAM_PREFIX_LEN, name) == 0) {
+            return elf_load(name, module->address, module->size);
+        }
+    }
+    return NULL;
+}
+
+const char* program_name(size_t index) {
+    size_t next = 0;
+    struct limine_file* module;
+
+    while ((module = modules_find(PROGRAM_PREFIX, &next)) != NULL) {
+        if (index-- == 0) {
+            return module->string + PROGRAM_PREFIX_LEN;
+        }
+    }
+    return NULL;
+}
+
+static void cmd_run(int argc, char** argv) {
+    if (argc < 2) {
+        printf("Programs:\n", WHITE, BLACK);
+        for (size_t i = 0; program_name(i); i++) {
+            printf("  %s\n", GRAY, BLACK, program_name(i));
+        }
+        return;
+    }
+    struct process* proc = program_load(argv[1]);
+    if (proc == NULL) {
+        printf("Cannot load program: %s\n", RED, BLACK, argv[1]);
+        return;
+    }
+    if (process_start(proc, proc->entry, proc->stack_top, 0) != 0) {
+        process_destroy(proc);
+        printf("Cannot start program: %s\n", RED, BLACK, argv[1]);
+        return;
+    }
+    struct process_stats stats;
+    int64_t code = process_wait(proc, &stats);
+    printf("%s exited with %d: %u faults, %u private pages, %u shared, %u copied on write\n",
+           code == 0 ? GREEN : RED, BLACK, argv[1], (int)code, (unsigned int)stats.faults,
+           (unsigned int)stats.private_pages, (unsigned int)stats.shared_pages, (unsigned int)stats.cow_copies);
+}
+
+static void complete_run(int argc, char** argv, struct shell_completion* comp) {
+    (void)argv;
+    if (argc != 1) {
+        return;
+    }
+    for (size_t i = 0; program_name(i); i++) {
+        shell_complete_add(comp, program_name(i));
+    }
+}
+
+SHELL_COMMAND_ARGS(run, "run", "List programs, 'run <name>' runs one", cmd_run, complete_run);
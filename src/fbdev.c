@@ -0,0 +1,78 @@
+#include "fbdev.h"
+#include "console.h"
+#include "process.h"
+#include "syscall.h"
+#include "vmm.h"
+#include "pmm.h"
+#include "spinlock.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+static spinlock_t fbdev_lock = SPINLOCK_INIT_NAMED("fbdev");
+static struct process* owner = NULL;
+
+// Pages the framebuffer spans, from the page holding its first pixel
+static size_t fb_pages(const struct limine_framebuffer* fb) {
+    uint64_t offset = virt_to_phys(fb->address) & (PAGE_SIZE - 1);
+    return (offset + fb->pitch * fb->height + PAGE_SIZE - 1) / PAGE_SIZE;
+}
+
+// Unmap from proc and hand the screen back to the console
+static void give_back(struct process* proc, size_t pages) {
+    vmm_unmap_user(proc->pml4, FB_USER_BASE, pages);
+
+    uint64_t flags = spin_lock_irqsave(&fbdev_lock);
+    owner = NULL;
+    spin_unlock_irqrestore(&fbdev_lock, flags);
+    console_resume();
+}
+
+int64_t fbdev_acquire(struct process* proc, struct fb_info* info) {
+    struct limine_framebuffer* fb = console_framebuffer();
+    size_t pages = fb_pages(fb);
+    if (pages * PAGE_SIZE > FB_USER_SIZE) {
+        return -ENOMEM;
+    }
+
+    uint64_t flags = spin_lock_irqsave(&fbdev_lock);
+    if (owner != NULL) {
+        spin_unlock_irqrestore(&fbdev_lock, flags);
+        return -EBUSY;
+    }
+    owner = proc;
+    spin_unlock_irqrestore(&fbdev_lock, flags);
+
+    // Nothing of the console's may land on top of the owner's pixels
+    console_suspend();
+
+    // PTE_DEVICE: a forked child does not inherit the mapping
+    uint64_t phys = virt_to_phys(fb->address);
+    uint64_t base = phys & ~(uint64_t)(PAGE_SIZE - 1);
+    for (size_t i = 0; i < pages; i++) {
+        if (vmm_map_user(proc->pml4, FB_USER_BASE + i * PAGE_SIZE, base + i * PAGE_SIZE,
+                         PTE_WRITABLE | PTE_NX | PTE_WC | PTE_SHARED | PTE_DEVICE) != 0) {
+            give_back(proc, i);
+            return -ENOMEM;
+        }
+    }
+
+    info->address = FB_USER_BASE + (phys - base);
+    info->width = (uint32_t)fb->width;
+    info->height = (uint32_t)fb->height;
+    info->pitch = (uint32_t)fb->pitch;
+    info->bpp = fb->bpp;
+    return (int64_t)info->address;
+}
+
+int fbdev_release(struct process* proc) {
+    uint64_t flags = spin_lock_irqsave(&fbdev_lock);
+    bool owned = owner == proc;
+    spin_unlock_irqrestore(&fbdev_lock, flags);
+
+    if (!owned) {
+        return -1;
+    }
+    give_back(proc, fb_pages(console_framebuffer()));
+    return 0;
+}
@@ -0,0 +1,269 @@
+#include "fpu.h"
+#include "cpu.h"
+#include "sched.h"
+#include "interrupts.h"
+#include "console.h"
+#include "pmm.h"
+#include "stdmem.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define CR0_MP          (1ULL << 1)
+#define CR0_EM          (1ULL << 2)
+#define CR0_TS          (1ULL << 3)
+#define CR0_NE          (1ULL << 5)
+#define CR4_OSFXSR      (1ULL << 9)
+#define CR4_OSXMMEXCPT  (1ULL << 10)
+#define CR4_OSXSAVE     (1ULL << 18)
+
+#define CPUID_FEAT_ECX_XSAVE    (1U << 26)
+#define CPUID_FEAT_ECX_AVX      (1U << 28)
+#define CPUID_EXT_EBX_AVX2      (1U << 5)   // Leaf 7
+#define CPUID_XSAVE_EAX_OPT     (1U << 0)   // Leaf 0xD, sub-leaf 1
+
+#define XCR0_X87        (1ULL << 0)
+#define XCR0_SSE        (1ULL << 1)
+#define XCR0_AVX        (1ULL << 2)
+
+// Legacy area fields that must hold their reset values in a fresh state
+#define FXSAVE_SIZE     512
+#define FXSAVE_FCW      0
+#define FXSAVE_MXCSR    24
+#define FCW_DEFAULT     0x037F
+#define MXCSR_DEFAULT   0x1F80
+
+static bool use_xsave = false;
+static bool use_xsaveopt = false;
+static bool has_avx = false;
+static bool has_avx2 = false;
+static uint64_t xcr0 = XCR0_X87 | XCR0_SSE;
+static size_t state_size = FXSAVE_SIZE;
+
+struct fpu_cpu {
+    struct thread* owner;       // Thread whose state is in the registers
+    bool ready;
+    bool ts;                    // CR0.TS as last written
+    bool in_kernel;             // Inside kernel_fpu_begin/end
+    struct fpu_stats stats;
+} __attribute__((aligned(64)));
+
+static struct fpu_cpu fpu_cpus[MAX_CPUS];
+
+static inline uint64_t read_cr0(void) {
+    uint64_t cr0;
+    asm volatile("mov %0, cr0" : "=r"(cr0));
+    return cr0;
+}
+
+static inline void clts(void) {
+    asm volatile("clts" ::: "memory");
+}
+
+static inline void stts(void) {
+    asm volatile("mov cr0, %0" : : "r"(read_cr0() | CR0_TS) : "memory");
+}
+
+static void save_state(void* area) {
+    if (use_xsaveopt) {
+        asm volatile("xsaveopt64 [%0]" : : "r"(area), "a"(0xFFFFFFFF), "d"(0xFFFFFFFF) : "memory");
+    } else if (use_xsave) {
+        asm volatile("xsave64 [%0]" : : "r"(area), "a"(0xFFFFFFFF), "d"(0xFFFFFFFF) : "memory");
+    } else {
+        asm volatile("fxsave64 [%0]" : : "r"(area) : "memory");
+    }
+}
+
+static void restore_state(const void* area) {
+    if (use_xsave) {
+        asm volatile("xrstor64 [%0]" : : "r"(area), "a"(0xFFFFFFFF), "d"(0xFFFFFFFF) : "memory");
+    } else {
+        asm volatile("fxrstor64 [%0]" : : "r"(area) : "memory");
+    }
+}
+
+// Save area in the initial state. An all-zero XSAVE header marks every
+// component as initial, only the control words need their reset values.
+static void* alloc_state(void) {
+    uint64_t phys = pmm_alloc_page();
+    if (phys == 0) {
+        return NULL;
+    }
+    uint8_t* area = phys_to_virt(phys);
+    memset(area, 0, state_size);
+    *(uint16_t*)(area + FXSAVE_FCW) = FCW_DEFAULT;
+    *(uint32_t*)(area + FXSAVE_MXCSR) = MXCSR_DEFAULT;
+    return area;
+}
+
+// #NM: a thread touched the FPU while another thread's state is loaded
+static void fpu_trap(struct interrupt_frame* frame) {
+    struct fpu_cpu* fc = &fpu_cpus[cpu_id()];
+    struct thread* self = thread_current();
+
+    clts();
+    fc->ts = false;
+    fc->stats.traps++;
+    if (fc->owner == self) {
+        return;
+    }
+    if (self->fpu_state == NULL) {
+        self->fpu_state = alloc_state();
+        if (self->fpu_state == NULL) {
+            panic("CPU %u: no memory for the FPU state of %s at %p\n", cpu_id(),
+                  self->name, (void*)frame->rip);
+        }
+    }
+    if (fc->owner) {
+        save_state(fc->owner->fpu_state);
+        fc->stats.saves++;
+    }
+    restore_state(self->fpu_state);
+    fc->owner = self;
+}
+
+static void detect(void) {
+    uint32_t a, b, c, d;
+
+    cpuid(0, 0, &a, &b, &c, &d);
+    uint32_t max_leaf = a;
+    cpuid(1, 0, &a, &b, &c, &d);
+    uint32_t features = c;
+    if (!(features & CPUID_FEAT_ECX_XSAVE) || max_leaf < 0xD) {
+        return;
+    }
+    use_xsave = true;
+
+    // Enable AVX only if XSAVE can switch its state too
+    cpuid(0xD, 0, &a, &b, &c, &d);
+    if ((features & CPUID_FEAT_ECX_AVX) && (a & XCR0_AVX)) {
+        xcr0 |= XCR0_AVX;
+        has_avx = true;
+        if (max_leaf >= 7) {
+            cpuid(7, 0, &a, &b, &c, &d);
+            has_avx2 = (b & CPUID_EXT_EBX_AVX2) != 0;
+        }
+    }
+    cpuid(0xD, 1, &a, &b, &c, &d);
+    use_xsaveopt = (a & CPUID_XSAVE_EAX_OPT) != 0;
+}
+
+void fpu_init_cpu(void) {
+    struct cpu* cpu = this_cpu();
+    struct fpu_cpu* fc = &fpu_cpus[cpu->id];
+
+    if (cpu->id == 0) {
+        detect();
+        exception_register(EXCEPTION_NM, fpu_trap);
+    }
+
+    // Native x87 errors, no emulation; TS traps FPU and SSE instructions
+    asm volatile("mov cr0, %0" : : "r"((read_cr0() & ~CR0_EM) | CR0_MP | CR0_NE) : "memory");
+
+    uint64_t cr4;
+    asm volatile("mov %0, cr4" : "=r"(cr4));
+    cr4 |= CR4_OSFXSR | CR4_OSXMMEXCPT;
+    if (use_xsave) {
+        cr4 |= CR4_OSXSAVE;
+    }
+    asm volatile("mov cr4, %0" : : "r"(cr4) : "memory");
+
+    if (use_xsave) {
+        asm volatile("xsetbv" : : "c"(0), "a"((uint32_t)xcr0), "d"((uint32_t)(xcr0 >> 32)) : "memory");
+        if (cpu->id == 0) {
+            // Size of the components just enabled
+            uint32_t a, b, c, d;
+            cpuid(0xD, 0, &a, &b, &c, &d);
+            state_size = b;
+        }
+    }
+    asm volatile("fninit" ::: "memory");
+
+    stts();
+    fc->ts = true;
+    fc->owner = NULL;
+    fc->ready = true;
+}
+
+bool fpu_has_avx(void) {
+    return has_avx;
+}
+
+bool fpu_has_avx2(void) {
+    return has_avx2;
+}
+
+size_t fpu_state_size(void) {
+    return state_size;
+}
+
+bool fpu_has_xsave(void) {
+    return use_xsave;
+}
+
+bool fpu_has_xsaveopt(void) {
+    return use_xsaveopt;
+}
+
+bool kernel_fpu_usable(void) {
+    struct cpu* cpu = this_cpu();
+    struct fpu_cpu* fc = &fpu_cpus[cpu->id];
+    return fc->ready && !fc->in_kernel && cpu->irq_depth == 0;
+}
+
+void kernel_fpu_begin(void) {
+    preempt_disable();
+    struct fpu_cpu* fc = &fpu_cpus[cpu_id()];
+
+    clts();
+    fc->ts = false;
+    fc->in_kernel = true;
+    fc->stats.kernel_sections++;
+    // The owner reloads its state through #NM after kernel_fpu_end()
+    if (fc->owner) {
+        save_state(fc->owner->fpu_state);
+        fc->stats.saves++;
+        fc->owner = NULL;
+    }
+}
+
+void kernel_fpu_end(void) {
+    struct fpu_cpu* fc = &fpu_cpus[cpu_id()];
+
+    fc->in_kernel = false;
+    stts();
+    fc->ts = true;
+    preempt_enable();
+}
+
+void fpu_switch(struct thread* next) {
+    struct fpu_cpu* fc = &fpu_cpus[cpu_id()];
+    bool ts = fc->owner != next;
+
+    // Writing CR0 serializes, skip it when TS already has the right value
+    if (!fc->ready || ts == fc->ts) {
+        return;
+    }
+    if (ts) {
+        stts();
+    } else {
+        clts();
+    }
+    fc->ts = ts;
+}
+
+void fpu_thread_exit(struct thread* self) {
+    struct fpu_cpu* fc = &fpu_cpus[cpu_id()];
+
+    if (fc->owner == self) {
+        fc->owner = NULL;
+    }
+    if (self->fpu_state) {
+        pmm_free_page(virt_to_phys(self->fpu_state));
+        self->fpu_state = NULL;
+    }
+}
+
+void fpu_get_stats(unsigned int cpu, struct fpu_stats* stats) {
+    *stats = fpu_cpus[cpu].stats;
+}
@@ -1,4 +1,6 @@
 #include "gdt.h"
+#include "cpu.h"
+#include "stdmem.h"
 #include <stddef.h>
 #include <stdbool.h>
 
@@ -17,16 +19,20 @@ struct GDTPtr {
     uint64_t base;
 } __attribute__((packed));
 
-// Extended GDT with TSS (assumes Limine provides first 5 entries)
-struct ExtendedGDT {
-    struct GDTEntry existing[5];  // Limine's entries (null, kernel code/data, user code/data)
-    struct GDTEntry tss_low;      // TSS descriptor low part
+// Per-CPU GDT. Every CPU gets its own copy so the TSS descriptor (whose
+// busy bit is set by ltr) and the TSS itself are never shared.
+struct CPUGDT {
+    struct GDTEntry null;
+    struct GDTEntry kernel_code;  // 0x08
+    struct GDTEntry kernel_data;  // 0x10
+    struct GDTEntry user_data;    // 0x18
+    struct GDTEntry user_code;    // 0x20
+    struct GDTEntry tss_low;      // 0x28, TSS descriptor low part
     struct GDTEntry tss_high;     // TSS descriptor high part (64-bit extension)
-} __attribute__((packed));
+} __attribute__((packed, aligned(16)));
 
-// TSS instance
-static struct TSS tss = {0};
-static struct ExtendedGDT* current_gdt = NULL;
+static struct CPUGDT gdts[MAX_CPUS];
+static struct TSS tss[MAX_CPUS] __attribute__((aligned(64)));
 
 // Helper function to set a GDT entry
 static void gdt_set_gate(struct GDTEntry* entry, uint32_t base, uint32_t limit, uint8_t access, uint8_t gran) {
@@ -38,84 +44,87 @@ static void gdt_set_gate(struct GDTEntry* entry, uint32_t base, uint32_t limit,
     entry->access = access;
 }
 
-// Get current GDT base address
-static uint64_t get_current_gdt_base(void) {
-    struct GDTPtr gdtr;
-    __asm__ volatile("sgdt %0" : "=m"(gdtr));
-    return gdtr.base;
-}
+void gdt_init_cpu(unsigned int cpu, uint64_t kernel_stack_top) {
+    struct CPUGDT* gdt = &gdts[cpu];
+    struct TSS* t = &tss[cpu];
+
+    memset(gdt, 0, sizeof(struct CPUGDT));
+    gdt_set_gate(&gdt->kernel_code, 0, 0xFFFFF, GDT_PRESENT | GDT_CODE | GDT_RING0, GDT_GRAN_LONG);
+    gdt_set_gate(&gdt->kernel_data, 0, 0xFFFFF, GDT_PRESENT | GDT_DATA | GDT_RING0, GDT_GRAN_DATA);
+    gdt_set_gate(&gdt->user_data, 0, 0xFFFFF, GDT_PRESENT | GDT_DATA | GDT_RING3, GDT_GRAN_DATA);
+    gdt_set_gate(&gdt->user_code, 0, 0xFFFFF, GDT_PRESENT | GDT_CODE | GDT_RING3, GDT_GRAN_LONG);
 
-void gdt_init_tss(void) {
-    // Get the current GDT that Limine set up
-    uint64_t gdt_base = get_current_gdt_base();
-    current_gdt = (struct ExtendedGDT*)gdt_base;
-    
-    // Clear TSS
-    memset(&tss, 0, sizeof(struct TSS));
-    
     // Set up TSS with default values
-    tss.iopb_offset = sizeof(struct TSS);  // No I/O permission bitmap
-    
-    // You can set ring 0 stack pointer here if needed
-    // tss.rsp0 = (uint64_t)kernel_stack_top;
-    
+    memset(t, 0, sizeof(struct TSS));
+    t->iopb_offset = sizeof(struct TSS);  // No I/O permission bitmap
+    t->rsp0 = kernel_stack_top;
+
     // Configure TSS descriptor (takes 2 GDT entries in 64-bit mode)
-    uint64_t tss_base = (uint64_t)&tss;
+    uint64_t tss_base = (uint64_t)t;
     uint32_t tss_limit = sizeof(struct TSS) - 1;
-    
-    // TSS Low descriptor (entry 5, selector 0x28)
-    gdt_set_gate(&current_gdt->tss_low, 
-                 tss_base & 0xFFFFFFFF, 
+
+    gdt_set_gate(&gdt->tss_low,
+                 tss_base & 0xFFFFFFFF,
                  tss_limit,
-                 GDT_PRESENT | GDT_TSS, 
+                 GDT_TSS,
                  0x0);
-    
-    // TSS High descriptor (entry 6) - contains upper 32 bits of base address
-    struct GDTEntry* tss_high = &current_gdt->tss_high;
-    tss_high->base_low = (tss_base >> 32) & 0xFFFF;
-    tss_high->base_middle = (tss_base >> 48) & 0xFF;
-    tss_high->base_high = (tss_base >> 56) & 0xFF;
-    tss_high->access = 0;
-    tss_high->granularity = 0;
-    tss_high->limit_low = 0;
-    
-    // Update GDT limit to include TSS entries
-    struct GDTPtr gdtr;
-    __asm__ volatile("sgdt %0" : "=m"(gdtr));
-    gdtr.limit = sizeof(struct ExtendedGDT) - 1;
+
+    // TSS High descriptor - contains upper 32 bits of base address
+    gdt->tss_high.limit_low = (tss_base >> 32) & 0xFFFF;
+    gdt->tss_high.base_low = (tss_base >> 48) & 0xFFFF;
+
+    struct GDTPtr gdtr = {
+        .limit = sizeof(struct CPUGDT) - 1,
+        .base = (uint64_t)gdt,
+    };
     __asm__ volatile("lgdt %0" : : "m"(gdtr));
-    
-    // Load TSS (selector 0x28 = entry 5)
-    __asm__ volatile("ltr %0" : : "r"((uint16_t)0x28));
+
+    // Reload CS with a far return, then the data segments. This clears the
+    // GS base, so the caller sets it up afterwards.
+    __asm__ volatile(
+        "push %0\n"
+        "lea rax, [rip + 1f]\n"
+        "push rax\n"
+        "lretq\n"
+        "1:\n"
+        "mov ds, %w1\n"
+        "mov es, %w1\n"
+        "mov ss, %w1\n"
+        "mov fs, %w1\n"
+        "mov gs, %w1\n"
+        :
+        : "i"(GDT_KERNEL_CODE), "r"((uint64_t)GDT_KERNEL_DATA)
+        : "rax", "memory");
+
+    __asm__ volatile("ltr %0" : : "r"((uint16_t)GDT_TSS_SELECTOR));
 }
 
 // Set the ring 0 stack pointer in TSS (call this when switching tasks)
 void tss_set_kernel_stack(uint64_t stack_top) {
-    tss.rsp0 = stack_top;
+    tss[cpu_id()].rsp0 = stack_top;
 }
 
-// Get TSS pointer for direct manipulation if needed
+// Get the executing CPU's TSS for direct manipulation if needed
 struct TSS* get_tss(void) {
-    return &tss;
+    return &tss[cpu_id()];
 }
 
-// Limine segment selectors (these should match what Limine sets up)
 uint16_t gdt_get_code_segment(void) {
-    return 0x08;  // Kernel code segment (entry 1)
+    return GDT_KERNEL_CODE;
 }
 
 uint16_t gdt_get_data_segment(void) {
-    return 0x10;  // Kernel data segment (entry 2)
+    return GDT_KERNEL_DATA;
 }
 
 uint16_t gdt_get_user_code_segment(void) {
-    return 0x18;  // User code segment (entry 3)
+    return GDT_USER_CODE;
 }
 
 uint16_t gdt_get_user_data_segment(void) {
-    return 0x20;  // User data segment (entry 4)
+    return GDT_USER_DATA;
 }
 
 uint16_t gdt_get_tss_segment(void) {
-    return 0x28;  // TSS segment (entry 5)
+    return GDT_TSS_SELECTOR;
 }
\ No newline at end of file
@@ -0,0 +1,130 @@
+#include "idle.h"
+#include "cpu.h"
+#include "timer.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define CPUID_LEAF_FEATURES     1
+#define CPUID_LEAF_MWAIT        5
+#define CPUID_FEAT_ECX_MONITOR  (1U << 3)
+#define CPUID_MWAIT_ECX_EXT     (1U << 0)   // Sub-state enumeration valid
+
+// Idle time from which entering each C-state (by number) pays off. The
+// exit latency of deeper states grows roughly in the same proportion.
+static const uint32_t cstate_residency_us[IDLE_MAX_CSTATES] = {
+    0, 0, 20, 100, 200, 400, 800, 1600
+};
+
+static bool mwait_ok = false;
+static struct idle_cstate cstates[IDLE_MAX_CSTATES];
+static size_t nr_cstates = 0;
+
+struct idle_cpu {
+    uint64_t predict_us;        // Moving average of recent idle periods
+    uint64_t usage[IDLE_MAX_CSTATES];
+    volatile uint32_t quiet;    // Monitored by idle_halt(), never written
+} __attribute__((aligned(64)));
+
+static struct idle_cpu idle_cpus[MAX_CPUS];
+
+void idle_init(void) {
+    uint32_t a, b, c, d;
+
+    cpuid(0, 0, &a, &b, &c, &d);
+    if (a < CPUID_LEAF_MWAIT) {
+        return;
+    }
+    cpuid(CPUID_LEAF_FEATURES, 0, &a, &b, &c, &d);
+    if (!(c & CPUID_FEAT_ECX_MONITOR)) {
+        return;
+    }
+
+    // EDX holds the number of sub-states of C0..C7, four bits each. Take
+    // the first sub-state of every C-state that has one; without the
+    // enumeration only the C1 hint is safe.
+    cpuid(CPUID_LEAF_MWAIT, 0, &a, &b, &c, &d);
+    cstates[0] = (struct idle_cstate){ .cstate = 1, .hint = 0x00, .residency_us = 0 };
+    nr_cstates = 1;
+    if (c & CPUID_MWAIT_ECX_EXT) {
+        for (uint8_t n = 2; n < IDLE_MAX_CSTATES; n++) {
+            if ((d >> (n * 4)) & 0xF) {
+                cstates[nr_cstates++] = (struct idle_cstate){
+                    .cstate = n,
+                    .hint = (uint8_t)((n - 1) << 4),
+                    .residency_us = cstate_residency_us[n],
+                };
+            }
+        }
+    }
+    mwait_ok = true;
+}
+
+bool idle_mwait_supported(void) {
+    return mwait_ok;
+}
+
+size_t idle_cstate_count(void) {
+    return nr_cstates;
+}
+
+const struct idle_cstate* idle_cstate_get(size_t index) {
+    return index < nr_cstates ? &cstates[index] : NULL;
+}
+
+// Deepest C-state the predicted idle time pays for
+static size_t pick_cstate(uint64_t predict_us) {
+    size_t index = 0;
+    while (index + 1 < nr_cstates && cstates[index + 1].residency_us <= predict_us) {
+        index++;
+    }
+    return index;
+}
+
+static void park(volatile uint32_t* line, volatile bool* wake_pending, bool doorbell) {
+    struct cpu* cpu = this_cpu();
+
+    if (!mwait_ok) {
+        asm volatile("sti\n\thlt" ::: "memory");
+        return;
+    }
+
+    struct idle_cpu* ic = &idle_cpus[cpu->id];
+    size_t index = pick_cstate(ic->predict_us);
+
+    if (doorbell) {
+        // Pairs with the fence in the waker: either it sees us parked and
+        // rings, or we see its wakeup below
+        __atomic_store_n(&cpu->idle_mwait, true, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    }
+    asm volatile("monitor" : : "a"(line), "c"(0), "d"(0) : "memory");
+
+    uint64_t start = rdtsc();
+    if (wake_pending == NULL || !*wake_pending) {
+        // sti takes effect after mwait starts, so a pending interrupt
+        // wakes it instead of being taken before
+        asm volatile("sti\n\tmwait" : : "a"((uint32_t)cstates[index].hint), "c"(0) : "memory");
+    } else {
+        asm volatile("sti" ::: "memory");
+    }
+    uint64_t idle_us = tsc_to_ns(rdtsc() - start) / 1000;
+
+    if (doorbell) {
+        __atomic_store_n(&cpu->idle_mwait, false, __ATOMIC_RELAXED);
+    }
+    ic->predict_us = (ic->predict_us * 7 + idle_us) / 8;
+    ic->usage[index]++;
+}
+
+void idle_wait(volatile uint32_t* doorbell, volatile bool* wake_pending) {
+    park(doorbell, wake_pending, true);
+}
+
+void idle_halt(void) {
+    park(&idle_cpus[cpu_id()].quiet, NULL, false);
+}
+
+uint64_t idle_cstate_usage(unsigned int cpu, size_t index) {
+    return cpu < MAX_CPUS && index < IDLE_MAX_CSTATES ? idle_cpus[cpu].usage[index] : 0;
+}
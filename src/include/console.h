@@ -32,10 +32,26 @@ struct console_state {
 int load_font(struct psf_font* font, void* font_data, size_t font_size);
 void init_shell(struct limine_framebuffer* framebuffer);
 void console_clear(void);
+
+// Hand the framebuffer to the renderer thread; until then printf draws
+// directly. Needs the scheduler and all CPUs online.
+void console_start_renderer(void);
+
+// Lend the framebuffer out: the renderer stops drawing once the output
+// queued so far is on screen (console_suspend() returns then), but keeps
+// recording what it would have drawn. console_resume() takes it back and
+// redraws the console from those cells.
+void console_suspend(void);
+void console_resume(void);
+
+struct limine_framebuffer* console_framebuffer(void);
 void putChar(char c, unsigned int fg_color, unsigned int bg_color);
 void printf(const char* format, unsigned int fg_color, unsigned int bg_color, ...);
-void shell(void);
-void process_command(const char* command);
+
+// Report a fatal error and halt this CPU. Draws straight to the framebuffer
+// under the console lock instead of queueing for the renderer, which may
+// never run again.
+__attribute__((noreturn)) void panic(const char* format, ...);
 
 #endif // CONSOLE_H
 
@@ -0,0 +1,138 @@
+#ifndef __VALERN_CPU_H
+#define __VALERN_CPU_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Upper bound on the number of CPUs the kernel keeps per-CPU state for
+#define MAX_CPUS 64
+
+// RFLAGS interrupt enable bit
+#define RFLAGS_IF 0x200
+
+// Model specific registers
+#define MSR_PAT            0x277
+#define MSR_EFER           0xC0000080
+#define MSR_STAR           0xC0000081
+#define MSR_LSTAR          0xC0000082
+#define MSR_FMASK          0xC0000084
+#define MSR_FS_BASE        0xC0000100
+#define MSR_GS_BASE        0xC0000101
+#define MSR_KERNEL_GS_BASE 0xC0000102
+
+#define EFER_SCE           (1ULL << 0)     // SYSCALL/SYSRET enabled
+#define EFER_NXE           (1ULL << 11)    // No-execute bit honoured
+
+// Offsets of the fields the syscall entry code reaches through GS
+#define CPU_SYSCALL_RSP    8
+#define CPU_USER_RSP       16
+
+struct thread;
+
+// Per-CPU data area, reached through the GS base of each CPU. In user mode
+// the GS base is the user's and this area sits in KERNEL_GS_BASE; every
+// entry from ring 3 swaps them first.
+struct cpu {
+    struct cpu* self;           // Must stay first, read through gs:[0]
+    uint64_t syscall_rsp;       // Kernel stack of the current thread
+    uint64_t user_rsp;          // User stack pointer while entering a syscall
+    unsigned int id;            // Index into cpus[], 0 is the BSP
+    uint32_t lapic_id;
+    uint64_t stack_top;         // Top of this CPU's boot/idle stack
+    volatile bool online;
+
+    // Scheduler state
+    struct thread* current;     // Thread running on this CPU, NULL before sched_init_cpu()
+    struct thread* idle;
+    volatile bool need_resched; // Reschedule at the next preemption point
+    uint32_t irq_depth;         // Nesting of irq_dispatch() on this CPU
+    uint32_t preempt_count;     // Preemption disabled while non-zero
+    uint64_t rcu_qs_seq;        // Last RCU grace period this CPU has seen
+    volatile bool idle_mwait;   // Parked in MWAIT: a doorbell write wakes it
+    volatile uint64_t active_pml4; // Address space loaded in CR3
+} __attribute__((aligned(64)));
+
+_Static_assert(offsetof(struct cpu, syscall_rsp) == CPU_SYSCALL_RSP, "syscall entry offsets");
+_Static_assert(offsetof(struct cpu, user_rsp) == CPU_USER_RSP, "syscall entry offsets");
+
+static inline uint64_t rdmsr(uint32_t msr) {
+    uint32_t lo, hi;
+    asm volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t value) {
+    asm volatile("wrmsr" : : "c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)) : "memory");
+}
+
+static inline void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t* a, uint32_t* b, uint32_t* c, uint32_t* d) {
+    asm volatile("cpuid" : "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d) : "a"(leaf), "c"(subleaf));
+}
+
+// Read the time stamp counter
+static inline uint64_t rdtsc(void) {
+    uint32_t lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+// Spin-wait hint for busy loops
+static inline void cpu_relax(void) {
+    asm volatile("pause" ::: "memory");
+}
+
+// Disable interrupts and return the previous RFLAGS
+static inline uint64_t irq_save(void) {
+    uint64_t flags;
+    asm volatile("pushfq\n\tpop %0\n\tcli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+// Restore the interrupt flag saved by irq_save()
+static inline void irq_restore(uint64_t flags) {
+    if (flags & RFLAGS_IF) {
+        asm volatile("sti" ::: "memory");
+    }
+}
+
+static inline bool irqs_enabled(void) {
+    uint64_t flags;
+    asm volatile("pushfq\n\tpop %0" : "=r"(flags));
+    return (flags & RFLAGS_IF) != 0;
+}
+
+// Per-CPU area of the executing CPU
+static inline struct cpu* this_cpu(void) {
+    struct cpu* cpu;
+    asm volatile("mov %0, qword ptr gs:[0]" : "=r"(cpu));
+    return cpu;
+}
+
+// Index of the executing CPU
+static inline unsigned int cpu_id(void) {
+    unsigned int id;
+    asm volatile("mov %0, dword ptr gs:[%c1]" : "=r"(id) : "i"(offsetof(struct cpu, id)));
+    return id;
+}
+
+// Reschedule if one is due and the current context may be preempted
+// (defined by the scheduler)
+void preempt_schedule(void);
+
+// Preemption is per CPU: spinlock holders and code touching per-CPU data
+// keep the current thread from being switched out
+static inline void preempt_disable(void) {
+    this_cpu()->preempt_count++;
+    asm volatile("" ::: "memory");
+}
+
+static inline void preempt_enable(void) {
+    asm volatile("" ::: "memory");
+    struct cpu* cpu = this_cpu();
+    if (--cpu->preempt_count == 0 && cpu->need_resched) {
+        preempt_schedule();
+    }
+}
+
+#endif // __VALERN_CPU_H
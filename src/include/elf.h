@@ -0,0 +1,69 @@
+#ifndef __VALERN_ELF_H
+#define __VALERN_ELF_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "process.h"
+
+// ELF64 executables. Programs ship as Limine modules with the string
+// "program <name>"; loading one only records its segments as regions of a
+// new process, the pages come in on first touch straight from the module.
+
+#define ELF_MAGIC       0x464C457F  // "\x7FELF", little endian
+#define ELF_CLASS64     2
+#define ELF_DATA_LSB    1
+#define ELF_TYPE_EXEC   2
+#define ELF_MACHINE_X86_64 62
+
+#define ELF_PT_LOAD     1
+
+#define ELF_PF_X        0x1
+#define ELF_PF_W        0x2
+#define ELF_PF_R        0x4
+
+struct elf64_header {
+    uint32_t magic;
+    uint8_t class;
+    uint8_t data;
+    uint8_t version;
+    uint8_t abi;
+    uint8_t abi_version;
+    uint8_t pad[7];
+    uint16_t type;
+    uint16_t machine;
+    uint32_t version2;
+    uint64_t entry;
+    uint64_t phoff;             // Program header table offset
+    uint64_t shoff;
+    uint32_t flags;
+    uint16_t ehsize;
+    uint16_t phentsize;
+    uint16_t phnum;
+    uint16_t shentsize;
+    uint16_t shnum;
+    uint16_t shstrndx;
+} __attribute__((packed));
+
+struct elf64_phdr {
+    uint32_t type;
+    uint32_t flags;
+    uint64_t offset;            // Segment data in the file
+    uint64_t vaddr;
+    uint64_t paddr;
+    uint64_t filesz;
+    uint64_t memsz;             // Beyond filesz is zero-filled (.bss)
+    uint64_t align;
+} __attribute__((packed));
+
+// Set up a process for an executable image that stays in memory for as
+// long as the process may fault on it. Returns NULL if the image is not a
+// loadable x86-64 executable or out of memory.
+struct process* elf_load(const char* name, const void* image, size_t size);
+
+// Load the program module called name
+struct process* program_load(const char* name);
+
+// Names of the program modules, by index; NULL past the last one
+const char* program_name(size_t index);
+
+#endif // __VALERN_ELF_H
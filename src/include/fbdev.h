@@ -0,0 +1,37 @@
+#ifndef __VALERN_FBDEV_H
+#define __VALERN_FBDEV_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Framebuffer device. One process at a time may map the framebuffer into
+// its address space (write-combining) and draw on it directly. While it
+// holds it the console keeps its output in its cell grid without drawing;
+// when the process releases the framebuffer or exits, the mapping is torn
+// down and the console redraws itself.
+
+// Where the framebuffer shows up in the owner's address space
+#define FB_USER_BASE     0x0000700000000000ULL
+#define FB_USER_SIZE     0x0000000040000000ULL
+
+// Layout handed to the owner
+struct fb_info {
+    uint64_t address;           // First pixel
+    uint32_t width;             // Pixels
+    uint32_t height;
+    uint32_t pitch;             // Bytes per row
+    uint32_t bpp;
+};
+
+struct process;
+
+// Map the framebuffer into proc and take it from the console. Returns the
+// user address of the first pixel, -EBUSY if another process has it or
+// -ENOMEM.
+int64_t fbdev_acquire(struct process* proc, struct fb_info* info);
+
+// Give the framebuffer back to the console; -1 if proc does not hold it
+int fbdev_release(struct process* proc);
+
+#endif // __VALERN_FBDEV_H
@@ -0,0 +1,51 @@
+#ifndef __VALERN_FPU_H
+#define __VALERN_FPU_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// FPU/SSE/AVX state. The kernel is built without vector instructions
+// except in a few translation units, which run between kernel_fpu_begin()
+// and kernel_fpu_end(). Thread state is switched lazily: a context switch
+// only sets CR0.TS, and the first FPU instruction of a thread that does not
+// own the registers traps (#NM) to save the owner's state and load its own.
+
+// Enable the FPU on the executing CPU; the BSP also detects the features
+void fpu_init_cpu(void);
+
+// Vector extensions the kernel may use
+bool fpu_has_avx(void);
+bool fpu_has_avx2(void);
+
+// Save area size, and whether it is saved with XSAVE(OPT) or FXSAVE
+size_t fpu_state_size(void);
+bool fpu_has_xsave(void);
+bool fpu_has_xsaveopt(void);
+
+// Whether the caller may use vector registers: not from interrupt context,
+// not nested, not before fpu_init_cpu() on this CPU
+bool kernel_fpu_usable(void);
+
+// Borrow the vector registers. Saves the state of the thread that owns
+// them and disables preemption; the section must not sleep.
+void kernel_fpu_begin(void);
+void kernel_fpu_end(void);
+
+struct thread;
+
+// Context switch to next: trap its first FPU use unless it owns the state
+void fpu_switch(struct thread* next);
+
+// The calling thread is exiting: drop its state (interrupts disabled)
+void fpu_thread_exit(struct thread* self);
+
+struct fpu_stats {
+    uint64_t traps;             // #NM taken
+    uint64_t saves;             // Owner state written back
+    uint64_t kernel_sections;   // kernel_fpu_begin() calls
+};
+
+void fpu_get_stats(unsigned int cpu, struct fpu_stats* stats);
+
+#endif // __VALERN_FPU_H
@@ -3,15 +3,34 @@
 
 #include <stdint.h>
 
-// GDT Access Flags (kept for TSS setup)
+// GDT Access Flags
 #define GDT_PRESENT    0x80
-#define GDT_TSS        0x89
+#define GDT_RING0      0x00
+#define GDT_RING3      0x60
+#define GDT_CODE       0x1A   // Code segment, readable
+#define GDT_DATA       0x12   // Data segment, writable
+#define GDT_TSS        0x89   // Present, available 64-bit TSS
+
+// GDT granularity nibble: 4 KiB pages, long mode code / 32-bit data
+#define GDT_GRAN_LONG  0xA0
+#define GDT_GRAN_DATA  0xC0
+
+// Segment selectors (same layout on every CPU). SYSRET loads SS and CS
+// from fixed offsets of one STAR base, so user data must precede user code.
+#define GDT_KERNEL_CODE  0x08
+#define GDT_KERNEL_DATA  0x10
+#define GDT_USER_DATA    0x18
+#define GDT_USER_CODE    0x20
+#define GDT_TSS_SELECTOR 0x28
+
+// Requested privilege level of selectors loaded for ring 3
+#define GDT_RPL_USER     3
 
 // TSS structure for 64-bit mode
 struct TSS {
     uint32_t reserved0;
     uint64_t rsp0;        // Stack pointer for ring 0
-    uint64_t rsp1;        // Stack pointer for ring 1  
+    uint64_t rsp1;        // Stack pointer for ring 1
     uint64_t rsp2;        // Stack pointer for ring 2
     uint64_t reserved1;
     uint64_t ist[7];      // Interrupt stack table
@@ -20,20 +39,21 @@ struct TSS {
     uint16_t iopb_offset; // I/O map base address
 } __attribute__((packed));
 
-// Initialize TSS in existing GDT
-void gdt_init_tss(void);
+// Build and load the GDT and TSS of a CPU, reloading all segment registers.
+// Runs on the CPU itself; GS must be set up again afterwards.
+void gdt_init_cpu(unsigned int cpu, uint64_t kernel_stack_top);
 
-// Set kernel stack in TSS (for privilege level switches)
+// Set kernel stack in the executing CPU's TSS (for privilege level switches)
 void tss_set_kernel_stack(uint64_t stack_top);
 
-// Get TSS pointer for direct access
+// Get the executing CPU's TSS for direct access
 struct TSS* get_tss(void);
 
-// Segment selector functions (Limine's layout)
+// Segment selector functions
 uint16_t gdt_get_code_segment(void);      // 0x08
-uint16_t gdt_get_data_segment(void);      // 0x10  
-uint16_t gdt_get_user_code_segment(void); // 0x18
-uint16_t gdt_get_user_data_segment(void); // 0x20
+uint16_t gdt_get_data_segment(void);      // 0x10
+uint16_t gdt_get_user_code_segment(void); // 0x20
+uint16_t gdt_get_user_data_segment(void); // 0x18
 uint16_t gdt_get_tss_segment(void);       // 0x28
 
 #endif // __VALERN_GDT_MINIMAL_H
\ No newline at end of file
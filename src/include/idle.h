@@ -0,0 +1,43 @@
+#ifndef __VALERN_IDLE_H
+#define __VALERN_IDLE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// CPU idle states. With MONITOR/MWAIT an idle CPU parks on a doorbell
+// cache line, so a remote wakeup is a plain memory write instead of an
+// IPI, and the C-state is picked from how long the CPU is expected to
+// stay idle. Without it idling falls back to hlt.
+
+#define IDLE_MAX_CSTATES 8
+
+struct idle_cstate {
+    uint8_t cstate;             // C1, C2, ...
+    uint8_t hint;               // MWAIT hint (EAX)
+    uint32_t residency_us;      // Idle time for which it pays off
+};
+
+// Detect MONITOR/MWAIT and the C-states it offers (once, on the BSP)
+void idle_init(void);
+
+// Whether idle CPUs use MWAIT
+bool idle_mwait_supported(void);
+
+// C-states available to MWAIT, shallowest first
+size_t idle_cstate_count(void);
+const struct idle_cstate* idle_cstate_get(size_t index);
+
+// Park the executing CPU until *doorbell is written or an interrupt
+// arrives. Called with interrupts disabled after checking for work;
+// wake_pending is rechecked once the monitor is armed, so a wakeup between
+// the check and the park is not lost. Returns with interrupts enabled.
+void idle_wait(volatile uint32_t* doorbell, volatile bool* wake_pending);
+
+// Wait for an interrupt: like "sti; hlt", called with interrupts disabled
+void idle_halt(void);
+
+// Times the executing CPU's idle periods ended in each C-state
+uint64_t idle_cstate_usage(unsigned int cpu, size_t index);
+
+#endif // __VALERN_IDLE_H
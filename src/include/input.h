@@ -0,0 +1,87 @@
+#ifndef __VALERN_INPUT_H
+#define __VALERN_INPUT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Event types
+#define EV_SYN 0x00
+#define EV_KEY 0x01
+#define EV_REL 0x02
+
+// EV_SYN codes
+#define SYN_REPORT 0
+
+// EV_REL codes
+#define REL_X      0x00
+#define REL_Y      0x01
+#define REL_WHEEL  0x08
+
+// EV_KEY codes for buttons (keys use the KC_* codes from keymap.h)
+#define BTN_LEFT   0x110
+#define BTN_RIGHT  0x111
+#define BTN_MIDDLE 0x112
+
+// EV_KEY values
+#define KEY_VALUE_RELEASE 0
+#define KEY_VALUE_PRESS   1
+#define KEY_VALUE_REPEAT  2
+
+struct input_event {
+    uint64_t timestamp;   // TSC value when the event was generated
+    uint16_t type;        // EV_*
+    uint16_t code;
+    int32_t value;
+    uint16_t modifiers;   // KEYMOD_* state for keyboard EV_KEY events
+    uint16_t raw;         // Device-specific raw code (keyboard scancode)
+    uint32_t reserved;
+};
+
+// Events kept per device; readers more than this far behind lose the oldest
+#define INPUT_RING_SIZE 256
+
+#define MAX_INPUT_DEVICES 8
+
+// Input device. Each device has exactly one producer (its bottom half),
+// which publishes into the ring; any number of readers follow it with
+// their own cursor.
+struct input_device {
+    const char* name;
+    struct input_event ring[INPUT_RING_SIZE];
+    uint64_t head;          // Events published since registration
+    uint32_t readers;       // Open handles
+};
+
+// A reader's subscription to one device
+struct input_handle {
+    struct input_device* dev;
+    uint64_t cursor;        // Next event sequence number to read
+    uint64_t dropped;       // Events lost because the reader fell behind
+};
+
+// Register a device so readers can find it
+int input_register_device(struct input_device* dev);
+
+// Look up devices by name or index
+struct input_device* input_find_device(const char* name);
+size_t input_device_count(void);
+struct input_device* input_get_device(size_t index);
+
+// Publish a batch of events (producer side, one producer per device)
+void input_publish(struct input_device* dev, const struct input_event* events, size_t count);
+
+// Subscribe to a device; the reader sees events published from now on
+void input_open(struct input_handle* handle, struct input_device* dev);
+void input_close(struct input_handle* handle);
+
+// Copy up to max pending events into events, returns the number copied
+size_t input_read(struct input_handle* handle, struct input_event* events, size_t max);
+
+// Check for pending events without consuming them
+bool input_pending(const struct input_handle* handle);
+
+// Sleep until at least one of the handles has pending events
+void input_wait(struct input_handle* handles, size_t count);
+
+#endif // __VALERN_INPUT_H
@@ -1,10 +1,62 @@
 #ifndef __VALERN_INTERRUPTS_H
 #define __VALERN_INTERRUPTS_H
 
+#include <stdint.h>
+
+// Legacy PIC IRQs are remapped to interrupts 0x20-0x2F
+#define IRQ_BASE  0x20
+#define IRQ_COUNT 16
+
+// Local APIC interrupts follow the legacy lines (vectors 0x30-0x3F)
+#define LOCAL_IRQ_BASE        16
+#define LOCAL_IRQ_COUNT       16
+#define LOCAL_IRQ_TIMER       16    // LAPIC one-shot timer
+#define LOCAL_IRQ_RESCHEDULE  17    // IPI: a thread became ready on this CPU
+#define LOCAL_IRQ_TLB         18    // IPI: TLB shootdown queued for this CPU
+
+// CPU exceptions occupy vectors 0-31
+#define EXCEPTION_COUNT       32
+#define EXCEPTION_NM          7     // Device not available: FPU use with CR0.TS set
+#define EXCEPTION_PF          14    // Page fault, address in CR2
+
+// IRQ top-half handler, runs with interrupts disabled
+typedef void (*irq_handler_t)(void);
+
+// Registers saved on exception entry, lowest address first
+struct interrupt_frame {
+    uint64_t r15, r14, r13, r12, r11, r10, r9, r8;
+    uint64_t rbp, rdi, rsi, rdx, rcx, rbx, rax;
+    uint64_t vector;
+    uint64_t error;             // 0 for exceptions without an error code
+    uint64_t rip, cs, rflags, rsp, ss;
+};
+
+// Exception handler, runs with interrupts disabled in the faulting context.
+// Returning resumes the faulting instruction.
+typedef void (*exception_handler_t)(struct interrupt_frame* frame);
+
 // Initialize interrupt system (IDT and PIC)
 void interrupts_init(void);
 
-// Keyboard interrupt service routine
-void keyboard_isr(void);
+// Load the shared IDT on an application processor
+void interrupts_init_ap(void);
+
+// Install a handler for an IRQ line and unmask it on the PIC
+void irq_register_handler(uint8_t irq, irq_handler_t handler);
+
+// Install a handler for a local APIC interrupt (same on every CPU)
+void irq_register_local(uint8_t irq, irq_handler_t handler);
+
+// Install a handler for a CPU exception. Exceptions without one report the
+// fault and stop the CPU.
+void exception_register(uint8_t vector, exception_handler_t handler);
+
+// Default action for an exception a handler could not resolve: kill the
+// user process it came from, or report it and stop the CPU
+__attribute__((noreturn)) void exception_unhandled(struct interrupt_frame* frame);
+
+// Mask/unmask an IRQ line on the PIC
+void irq_mask(uint8_t irq);
+void irq_unmask(uint8_t irq);
 
 #endif // __VALERN_INTERRUPTS_H
\ No newline at end of file
@@ -16,13 +16,23 @@
 #define CTRL_C 3
 #define CTRL_D 4
 #define CTRL_L 12
+#define CTRL_R 18
 #define CTRL_Z 26
 
-// Initialize keyboard driver
-void keyboard_init(void);
+// Modifier bits in input_event.modifiers of keyboard events
+#define KEYMOD_SHIFT       0x01
+#define KEYMOD_CTRL        0x02
+#define KEYMOD_ALT         0x04
+#define KEYMOD_CAPS_LOCK   0x08
+#define KEYMOD_NUM_LOCK    0x10
+#define KEYMOD_SCROLL_LOCK 0x20
+#define KEYMOD_ALTGR       0x40
+
+struct input_event;
+struct input_device;
 
-// Keyboard interrupt handler (to be called from IDT)
-void keyboard_interrupt_handler(void);
+// Initialize keyboard driver and bind it to the first PS/2 port
+void keyboard_init(void);
 
 // Check if a key is available in buffer
 bool keyboard_has_key(void);
@@ -33,12 +43,26 @@ char keyboard_getchar(void);
 // Get character from keyboard (non-blocking, returns 0 if no key)
 char keyboard_getchar_nonblock(void);
 
+// Input device keyboard events are published to
+struct input_device* keyboard_input_device(void);
+
+// Character typed by a keyboard input event, 0 if none
+char keyboard_event_to_char(const struct input_event* ev);
+
 // Modifier key state functions
 bool keyboard_shift_pressed(void);
 bool keyboard_ctrl_pressed(void);
 bool keyboard_alt_pressed(void);
 bool keyboard_caps_lock_active(void);
 
+// Key repeat configuration. Hardware typematic: rate 0-31 (30 to 2
+// characters per second) and delay 0-3 (250 to 1000 ms). Software repeat
+// generates repeats from the timer and sets the hardware to its slowest
+// rate. All return 0 on success, -1 if the keyboard did not acknowledge.
+int keyboard_set_typematic(uint8_t rate, uint8_t delay);
+int keyboard_set_soft_repeat(uint32_t delay_ms, uint32_t rate_hz);
+int keyboard_disable_repeat(void);
+
 // Clear keyboard input buffer
 void keyboard_clear_buffer(void);
 
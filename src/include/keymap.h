@@ -0,0 +1,162 @@
+#ifndef __VALERN_KEYMAP_H
+#define __VALERN_KEYMAP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Layout-independent key codes (numbered like Linux input key codes)
+#define KC_NONE        0
+#define KC_ESC         1
+#define KC_1           2
+#define KC_2           3
+#define KC_3           4
+#define KC_4           5
+#define KC_5           6
+#define KC_6           7
+#define KC_7           8
+#define KC_8           9
+#define KC_9           10
+#define KC_0           11
+#define KC_MINUS       12
+#define KC_EQUAL       13
+#define KC_BACKSPACE   14
+#define KC_TAB         15
+#define KC_Q           16
+#define KC_W           17
+#define KC_E           18
+#define KC_R           19
+#define KC_T           20
+#define KC_Y           21
+#define KC_U           22
+#define KC_I           23
+#define KC_O           24
+#define KC_P           25
+#define KC_LEFTBRACE   26
+#define KC_RIGHTBRACE  27
+#define KC_ENTER       28
+#define KC_LEFTCTRL    29
+#define KC_A           30
+#define KC_S           31
+#define KC_D           32
+#define KC_F           33
+#define KC_G           34
+#define KC_H           35
+#define KC_J           36
+#define KC_K           37
+#define KC_L           38
+#define KC_SEMICOLON   39
+#define KC_APOSTROPHE  40
+#define KC_GRAVE       41
+#define KC_LEFTSHIFT   42
+#define KC_BACKSLASH   43
+#define KC_Z           44
+#define KC_X           45
+#define KC_C           46
+#define KC_V           47
+#define KC_B           48
+#define KC_N           49
+#define KC_M           50
+#define KC_COMMA       51
+#define KC_DOT         52
+#define KC_SLASH       53
+#define KC_RIGHTSHIFT  54
+#define KC_KPASTERISK  55
+#define KC_LEFTALT     56
+#define KC_SPACE       57
+#define KC_CAPSLOCK    58
+#define KC_F1          59
+#define KC_F2          60
+#define KC_F3          61
+#define KC_F4          62
+#define KC_F5          63
+#define KC_F6          64
+#define KC_F7          65
+#define KC_F8          66
+#define KC_F9          67
+#define KC_F10         68
+#define KC_NUMLOCK     69
+#define KC_SCROLLLOCK  70
+#define KC_KP7         71
+#define KC_KP8         72
+#define KC_KP9         73
+#define KC_KPMINUS     74
+#define KC_KP4         75
+#define KC_KP5         76
+#define KC_KP6         77
+#define KC_KPPLUS      78
+#define KC_KP1         79
+#define KC_KP2         80
+#define KC_KP3         81
+#define KC_KP0         82
+#define KC_KPDOT       83
+#define KC_102ND       86
+#define KC_F11         87
+#define KC_F12         88
+#define KC_KPENTER     96
+#define KC_RIGHTCTRL   97
+#define KC_KPSLASH     98
+#define KC_SYSRQ       99
+#define KC_RIGHTALT    100
+#define KC_HOME        102
+#define KC_UP          103
+#define KC_PAGEUP      104
+#define KC_LEFT        105
+#define KC_RIGHT       106
+#define KC_END         107
+#define KC_DOWN        108
+#define KC_PAGEDOWN    109
+#define KC_INSERT      110
+#define KC_DELETE      111
+#define KC_PAUSE       119
+#define KC_LEFTMETA    125
+#define KC_RIGHTMETA   126
+#define KC_COMPOSE     127
+
+#define KC_COUNT       128
+
+#define KEYMAP_NAME_LEN 16
+#define MAX_KEYMAPS     8
+
+// Keycode to character tables for one layout
+struct keymap {
+    char name[KEYMAP_NAME_LEN];
+    uint8_t caps[KC_COUNT / 8];   // Bitmap of keys affected by caps lock
+    uint8_t normal[KC_COUNT];
+    uint8_t shift[KC_COUNT];
+    uint8_t altgr[KC_COUNT];      // 0: fall back to normal/shift
+};
+
+// On-disk keymap format, shipped as a Limine module with the string "keymap"
+#define KEYMAP_FILE_MAGIC   "VKMP"
+#define KEYMAP_FILE_VERSION 1
+
+struct keymap_file {
+    char magic[4];
+    uint16_t version;
+    uint16_t reserved;
+    char name[KEYMAP_NAME_LEN];
+    uint8_t caps[KC_COUNT / 8];
+    uint8_t normal[KC_COUNT];
+    uint8_t shift[KC_COUNT];
+    uint8_t altgr[KC_COUNT];
+} __attribute__((packed));
+
+// Register the built-in layout and load any keymap modules
+void keymap_init(void);
+
+// Load a keymap from a keymap_file image, returns 0 on success
+int keymap_load(const void* data, size_t size);
+
+// Select the active keymap by name, returns 0 on success
+int keymap_select(const char* name);
+
+// Active keymap and the list of loaded ones
+const struct keymap* keymap_active(void);
+size_t keymap_count(void);
+const struct keymap* keymap_get(size_t index);
+
+// Translate a key code to a character using KEYMOD_* modifier bits
+char keymap_translate(uint8_t keycode, uint8_t modifiers);
+
+#endif // __VALERN_KEYMAP_H
@@ -0,0 +1,30 @@
+#ifndef __VALERN_LAPIC_H
+#define __VALERN_LAPIC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Local APIC interrupt vectors (see interrupts.h for the IRQ numbers)
+#define LAPIC_SPURIOUS_VECTOR 0xFF
+
+// Enable the local APIC of the executing CPU. The first call (on the BSP)
+// picks x2APIC or xAPIC mode and calibrates the timer against the TSC.
+void lapic_init(void);
+
+// Signal end of interrupt
+void lapic_eoi(void);
+
+// APIC ID of the executing CPU
+uint32_t lapic_id(void);
+
+// Arm the timer to fire once after us microseconds / stop it
+void lapic_timer_oneshot(uint64_t us);
+void lapic_timer_stop(void);
+
+// Send a fixed interrupt to another CPU
+void lapic_send_ipi(uint32_t apic_id, uint8_t vector);
+
+// Whether the APIC runs in x2APIC mode
+bool lapic_x2apic(void);
+
+#endif // __VALERN_LAPIC_H
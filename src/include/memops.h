@@ -0,0 +1,31 @@
+#ifndef __VALERN_MEMOPS_H
+#define __VALERN_MEMOPS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Bulk memory operations. Large enough requests run the widest vector
+// kernel the CPU has (picked once at boot); small ones, and callers that
+// cannot use the FPU (interrupt context), take the scalar path.
+
+// Pick the kernels, after fpu_init_cpu() on the BSP
+void memops_init(void);
+
+// "AVX2", "SSE2", or "scalar" before memops_init()
+const char* memops_level(void);
+
+void fast_memset(void* dst, int value, size_t size);
+void fast_memcpy(void* dst, const void* src, size_t size);
+
+// Store count copies of a 32-bit value (framebuffer pixels)
+void fast_fill32(uint32_t* dst, uint32_t value, size_t count);
+
+// Sum of the little-endian 32-bit words of data (a partial last word is
+// zero-padded), folded with end-around carry to 32 bits
+uint32_t mem_checksum(const void* data, size_t size);
+
+// The scalar versions, for comparison
+void scalar_fill32(uint32_t* dst, uint32_t value, size_t count);
+uint32_t scalar_checksum(const void* data, size_t size);
+
+#endif // __VALERN_MEMOPS_H
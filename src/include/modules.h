@@ -0,0 +1,17 @@
+#ifndef __VALERN_MODULES_H
+#define __VALERN_MODULES_H
+
+#include <stddef.h>
+#include <limine.h>
+
+// Number of modules loaded by Limine
+size_t modules_count(void);
+
+// Module by index, NULL if out of range
+struct limine_file* modules_get(size_t index);
+
+// First module whose string starts with prefix, starting at index *next.
+// On success *next is set past the returned module so calls can be chained.
+struct limine_file* modules_find(const char* prefix, size_t* next);
+
+#endif // __VALERN_MODULES_H
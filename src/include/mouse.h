@@ -0,0 +1,22 @@
+#ifndef __VALERN_MOUSE_H
+#define __VALERN_MOUSE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+struct input_device;
+
+// Bind the mouse driver to the auxiliary PS/2 port (IRQ12). The mouse is
+// set up asynchronously once the PS/2 probe finds it.
+void mouse_init(void);
+
+// Whether a mouse was found and is reporting
+bool mouse_present(void);
+
+// Whether the mouse reports a scroll wheel (IntelliMouse, 4-byte packets)
+bool mouse_has_wheel(void);
+
+// Input device mouse events are published to
+struct input_device* mouse_input_device(void);
+
+#endif // __VALERN_MOUSE_H
@@ -0,0 +1,80 @@
+#ifndef __VALERN_PIPE_H
+#define __VALERN_PIPE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "sched.h"
+#include "spinlock.h"
+
+// Pipes between processes. Data is queued as segments in order: small
+// writes are copied into an inline ring, whole page-aligned pages are not
+// copied at all. The writer's page is shared copy-on-write with the pipe
+// and, if the reader's buffer is page-aligned too, mapped into the reader
+// in place of its page. Either side pays for a copy only if it writes to
+// the page while the other still has it.
+//
+// A message pipe (PIPE_MESSAGE) keeps write boundaries: a read returns at
+// most one message; a longer one is delivered over several reads.
+
+#define PIPE_RING_SIZE   2048
+#define PIPE_SEGMENTS    32
+
+// pipe_create() flags
+#define PIPE_MESSAGE     0x1
+
+// Segment flags
+#define SEGMENT_END      0x1    // Last segment of a message
+
+struct pipe_segment {
+    uint64_t phys;              // Lent page, 0 for bytes in the ring
+    uint32_t offset;            // Read position in the page
+    uint32_t len;               // Bytes left
+    uint32_t flags;
+};
+
+struct pipe {
+    spinlock_t lock;
+    uint32_t flags;
+    uint32_t readers;           // Open ends
+    uint32_t writers;
+    uint32_t refs;              // Open ends plus closers still waking waiters
+    bool reading;               // A reader (writer) is inside pipe_read()
+    bool writing;               // (pipe_write()); the others wait
+    struct waitqueue read_wq;   // Data, end of file or the read side free
+    struct waitqueue write_wq;  // Space, no readers or the write side free
+    struct pipe_segment segments[PIPE_SEGMENTS];
+    size_t seg_head;
+    size_t seg_count;
+    size_t ring_head;
+    size_t ring_used;
+    uint8_t ring[PIPE_RING_SIZE];
+};
+
+struct pipe_stats {
+    uint64_t bytes_copied;      // Through the ring or into the reader
+    uint64_t pages_lent;        // Writer pages queued without a copy
+    uint64_t pages_flipped;     // Pages mapped into the reader
+};
+
+struct process;
+
+// New pipe with one read and one write end open, NULL if out of memory
+struct pipe* pipe_create(uint32_t flags);
+
+// Another reference to an end (fork), and dropping one. The pipe is freed
+// once the last end is closed and no closer is still using it.
+void pipe_open(struct pipe* pipe, bool write);
+void pipe_close(struct pipe* pipe, bool write);
+
+// Write len bytes from user memory of proc; blocks while the pipe is full.
+// Returns len, or -EPIPE/-EFAULT if nothing was written.
+int64_t pipe_write(struct pipe* pipe, struct process* proc, uint64_t buf, size_t len);
+
+// Read up to len bytes into user memory of proc; blocks until data arrives.
+// Returns the bytes read, 0 at end of file or -EFAULT.
+int64_t pipe_read(struct pipe* pipe, struct process* proc, uint64_t buf, size_t len);
+
+void pipe_get_stats(struct pipe_stats* stats);
+
+#endif // __VALERN_PIPE_H
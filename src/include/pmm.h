@@ -0,0 +1,49 @@
+#ifndef __VALERN_PMM_H
+#define __VALERN_PMM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define PAGE_SIZE  4096
+#define PAGE_SHIFT 12
+
+// Offset of the bootloader's higher-half direct map of physical memory
+extern uint64_t hhdm_offset;
+
+static inline void* phys_to_virt(uint64_t phys) {
+    return (void*)(phys + hhdm_offset);
+}
+
+static inline uint64_t virt_to_phys(const void* virt) {
+    return (uint64_t)virt - hhdm_offset;
+}
+
+// Build the page bitmap from the bootloader memory map
+void pmm_init(void);
+
+// Allocate count physically contiguous pages, returns the physical
+// address or 0 if no run that long is free
+uint64_t pmm_alloc_pages(size_t count);
+uint64_t pmm_alloc_page(void);
+
+// Free pages obtained from pmm_alloc_pages()
+void pmm_free_pages(uint64_t phys, size_t count);
+void pmm_free_page(uint64_t phys);
+
+// Frames shared between address spaces (copy-on-write) carry a count of
+// their extra owners; a frame fresh from pmm_alloc_page() has one owner.
+void pmm_page_get(uint64_t phys);
+
+// Drop an owner, freeing the frame with the last one. Returns true if the
+// frame was freed.
+bool pmm_page_put(uint64_t phys);
+
+// Owners beyond the first
+uint32_t pmm_page_shares(uint64_t phys);
+
+// Page counts for statistics
+size_t pmm_total_pages(void);
+size_t pmm_free_page_count(void);
+
+#endif // __VALERN_PMM_H
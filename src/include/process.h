@@ -0,0 +1,171 @@
+#ifndef __VALERN_PROCESS_H
+#define __VALERN_PROCESS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "sched.h"
+#include "vmm.h"
+#include "pmm.h"
+#include "rcu.h"
+#include "syscall.h"
+#include "pipe.h"
+
+// User processes: an address space and the thread that runs in it. The
+// thread is an ordinary kernel thread that drops to ring 3; it comes back
+// on its kernel stack for syscalls, interrupts and faults.
+//
+// process_fork() duplicates a process copy-on-write: only the page tables
+// are copied, every private page is shared read-only between parent and
+// child (pmm counts its owners), and the first write to one copies it. A
+// page whose other owners are gone is made writable again without a copy.
+
+#define PROCESS_NAME_LEN      16
+
+// Default user stack, just under the top of user space. Demand paged, so
+// only the pages a program touches take memory.
+#define USER_STACK_TOP        (USER_TOP - PAGE_SIZE)
+#define USER_STACK_PAGES      256
+
+#define PROCESS_MAX_REGIONS   16
+#define PROCESS_MAX_FILES     16
+
+// vm_region flags
+#define REGION_WRITE          0x1
+#define REGION_EXEC           0x2
+
+// Part of an address space that is filled in on page fault. Pages below
+// file_end come from a file image that stays in memory (file_phys backs
+// start): read faults map it directly, the first write copies the page.
+// Everything else in the region is zero-filled.
+struct vm_region {
+    uint64_t start;             // Page aligned
+    uint64_t end;
+    uint64_t file_end;          // start for anonymous memory
+    uint64_t file_phys;
+    uint32_t flags;
+};
+
+// Open pipe end, indexed by file descriptor
+struct process_file {
+    struct pipe* pipe;          // NULL if the descriptor is free
+    bool write;
+};
+
+struct process_stats {
+    uint64_t faults;            // Page faults resolved
+    uint64_t private_pages;     // Pages allocated for the process
+    uint64_t shared_pages;      // File pages mapped without a copy
+    uint64_t cow_copies;        // Pages copied on write after a fork
+};
+
+enum process_state {
+    PROCESS_NEW = 0,    // Being set up, not started
+    PROCESS_RUNNING,
+    PROCESS_ZOMBIE      // Exited, waiting for process_wait()
+};
+
+struct process {
+    uint32_t pid;
+    char name[PROCESS_NAME_LEN];
+    uint64_t pml4;
+    volatile enum process_state state;
+    int64_t exit_code;
+    struct thread* thread;
+    uint64_t entry;             // Set by the loader
+    uint64_t stack_top;
+    struct syscall_frame regs;  // User registers the thread starts with
+    struct process* parent;     // Forking process, NULL once it exits
+    bool orphan;                // Freed on exit, nobody waits for it
+    struct rcu_head free_head;
+    struct waitqueue exit_wq;
+    struct vm_region regions[PROCESS_MAX_REGIONS];
+    size_t region_count;
+    struct process_file files[PROCESS_MAX_FILES];
+    struct process_stats stats;
+    struct process* next;       // Process list
+};
+
+// New process with an empty address space (but for the vDSO pages), NULL
+// if out of memory
+struct process* process_create(const char* name);
+
+// Back [virt, virt + size) with zeroed pages. flags are PTE_ bits
+// (PTE_WRITABLE, PTE_NX); returns -1 if out of memory.
+int process_map(struct process* proc, uint64_t virt, size_t size, uint64_t flags);
+
+// Add a demand-paged region; returns -1 if it overlaps another, leaves
+// user space or there are too many
+int process_add_region(struct process* proc, uint64_t start, uint64_t end,
+                       uint64_t file_phys, uint64_t file_end, uint32_t flags);
+
+// Add the default stack region, returns the initial stack pointer or 0
+uint64_t process_add_stack(struct process* proc);
+
+// Make the page at addr accessible (for writing, if write): fault it in
+// from its region or copy a shared file page. Returns -1 if the access is
+// not allowed.
+int process_fault(struct process* proc, uint64_t addr, bool write);
+
+// Share the (present, private) page at virt with another address space:
+// it becomes copy-on-write here and gains an owner for the borrower.
+// Returns the frame, or 0 for file pages and unmapped addresses.
+uint64_t process_share_page(struct process* proc, uint64_t virt);
+
+// Map a frame from process_share_page() at virt, in place of the page
+// there, copy-on-write. Takes over the borrower's ownership; returns -1
+// (keeping nothing) if virt is not in a writable region.
+int process_adopt_page(struct process* proc, uint64_t virt, uint64_t phys);
+
+// Page fault handling for user processes
+void process_init(void);
+
+// Copy into mapped user memory of a process that is not running
+int process_copy_to(struct process* proc, uint64_t virt, const void* src, size_t size);
+
+// Start the process at entry with rsp = stack_top and rdi = arg
+int process_start(struct process* proc, uint64_t entry, uint64_t stack_top, uint64_t arg);
+
+// Install a pipe end as the lowest free descriptor, -1 if none is free
+int process_add_file(struct process* proc, struct pipe* pipe, bool write);
+
+// Open file at fd, NULL if fd is not open
+struct process_file* process_get_file(struct process* proc, uint64_t fd);
+
+// Close fd, returns -1 if it was not open
+int process_close_file(struct process* proc, uint64_t fd);
+
+// Copy-on-write duplicate of parent, started with the user registers regs
+// but rax = 0. Open files are shared with the parent. The child belongs to parent: it is reaped with
+// process_wait_child(), or freed on exit once parent is gone. NULL if out
+// of memory.
+struct process* process_fork(struct process* parent, const struct syscall_frame* regs);
+
+// Wait for the child pid of parent (see process_wait()), -ECHILD if
+// parent has no such child
+int64_t process_wait_child(struct process* parent, uint32_t pid);
+
+// Wait for a started process to exit, free it and return its exit code.
+// stats (may be NULL) receives its memory statistics.
+int64_t process_wait(struct process* proc, struct process_stats* stats);
+
+// Free a process that was never started
+void process_destroy(struct process* proc);
+
+// Process of the calling thread, NULL for kernel threads
+struct process* process_current(void);
+
+// End the calling process
+__attribute__((noreturn)) void process_exit(int64_t code);
+
+// Context switch: load next's address space and syscall stack
+void process_switch(struct thread* next);
+
+// A thread of a process has been switched away from for the last time
+void process_thread_dead(struct thread* t);
+
+// Whether [ptr, ptr + size) is user memory the current process may access.
+// Faults in the pages, so the kernel can then touch them directly.
+bool user_access_ok(uint64_t ptr, size_t size, bool write);
+
+#endif // __VALERN_PROCESS_H
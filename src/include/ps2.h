@@ -0,0 +1,100 @@
+#ifndef __VALERN_PS2_H
+#define __VALERN_PS2_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// 8042 PS/2 controller ports
+#define PS2_DATA_PORT    0x60
+#define PS2_STATUS_PORT  0x64
+#define PS2_COMMAND_PORT 0x64
+
+// Status register bits
+#define PS2_STATUS_OUTPUT_FULL 0x01
+#define PS2_STATUS_INPUT_FULL  0x02
+#define PS2_STATUS_AUX_DATA    0x20   // Output byte came from the second port
+
+// Controller configuration byte bits
+#define PS2_CONFIG_PORT1_IRQ       0x01
+#define PS2_CONFIG_PORT2_IRQ       0x02
+#define PS2_CONFIG_PORT1_CLOCK_OFF 0x10
+#define PS2_CONFIG_PORT2_CLOCK_OFF 0x20
+#define PS2_CONFIG_TRANSLATION     0x40
+
+// Controller commands
+#define PS2_CMD_READ_CONFIG   0x20
+#define PS2_CMD_WRITE_CONFIG  0x60
+#define PS2_CMD_DISABLE_PORT2 0xA7
+#define PS2_CMD_ENABLE_PORT2  0xA8
+#define PS2_CMD_TEST_PORT2    0xA9
+#define PS2_CMD_SELF_TEST     0xAA
+#define PS2_CMD_TEST_PORT1    0xAB
+#define PS2_CMD_DISABLE_PORT1 0xAD
+#define PS2_CMD_ENABLE_PORT1  0xAE
+#define PS2_CMD_WRITE_PORT2   0xD4
+
+// Controller replies
+#define PS2_SELF_TEST_PASSED  0x55
+#define PS2_PORT_TEST_PASSED  0x00
+
+// Device commands and replies
+#define PS2_DEV_RESET         0xFF
+#define PS2_REPLY_ACK         0xFA
+#define PS2_REPLY_RESEND      0xFE
+#define PS2_REPLY_BAT_PASSED  0xAA
+
+// Ports
+#define PS2_PORT1     0
+#define PS2_PORT2     1
+#define PS2_NUM_PORTS 2
+
+// Port state
+enum ps2_port_state {
+    PS2_PORT_ABSENT = 0,    // No controller channel, or the interface test failed
+    PS2_PORT_PROBING,       // Device reset in progress
+    PS2_PORT_READY,         // Device answered, driver attached
+    PS2_PORT_NO_DEVICE      // Channel works but no device answered
+};
+
+// Driver callbacks for a port. byte runs in the IRQ top half for every
+// byte that is not part of a command transfer. attach runs in the PS/2
+// bottom half once the device has passed its reset; id holds the bytes
+// it sent after the BAT code (empty for keyboards, 0x00 for a mouse).
+struct ps2_driver {
+    void (*byte)(uint8_t data);
+    void (*attach)(int port, const uint8_t* id, size_t id_len);
+};
+
+// Completion of an asynchronous transfer: status 0 on success, -1 on
+// timeout or too many resends. Runs in the PS/2 bottom half.
+typedef void (*ps2_done_t)(int port, int status, const uint8_t* reply, size_t reply_len, void* data);
+
+// Bring up the controller: self-test, port tests, flush. Every wait is
+// bounded; returns -1 if there is no working controller.
+int ps2_controller_init(void);
+
+// Bind a driver to a port (before ps2_probe_start())
+void ps2_register_driver(int port, const struct ps2_driver* driver);
+
+// Reset the devices on all working ports in parallel and return at once;
+// drivers are attached from the bottom half as devices answer
+void ps2_probe_start(void);
+
+// Port state and controller summary
+enum ps2_port_state ps2_port_state(int port);
+bool ps2_controller_present(void);
+
+// Send bytes to the device on a port, each one expecting an ACK, then
+// collect up to reply_len reply bytes. The asynchronous form returns at
+// once (-1 if the port is busy); the synchronous one needs interrupts
+// enabled and returns the number of reply bytes or -1.
+int ps2_send_async(int port, const uint8_t* bytes, size_t count, size_t reply_len, ps2_done_t done, void* data);
+int ps2_send(int port, const uint8_t* bytes, size_t count, uint8_t* reply, size_t reply_len);
+
+// Bounded low-level access, return -1 on timeout
+int ps2_write_command(uint8_t command);
+int ps2_write_data(uint8_t data);
+int ps2_read_data(uint8_t* data);
+
+#endif // __VALERN_PS2_H
@@ -0,0 +1,55 @@
+#ifndef __VALERN_RCU_H
+#define __VALERN_RCU_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "cpu.h"
+
+// Read-copy-update for read-mostly data reached through a pointer.
+// Readers run with preemption disabled and take no lock; a writer
+// publishes a new copy with rcu_assign_pointer() and may free the old one
+// once every CPU has passed a quiescent state (a context switch, the idle
+// loop, or an interrupt that arrived outside any read section), which
+// means no reader can still hold the old pointer.
+//
+//     rcu_read_lock();
+//     const struct config* cfg = rcu_dereference(active_config);
+//     ... use cfg, do not sleep ...
+//     rcu_read_unlock();
+
+// Grace period counter, bumped by every synchronize_rcu()
+extern volatile uint64_t rcu_gp_seq;
+
+struct rcu_head {
+    struct rcu_head* next;
+    void (*func)(struct rcu_head* head);
+};
+
+static inline void rcu_read_lock(void) {
+    preempt_disable();
+}
+
+static inline void rcu_read_unlock(void) {
+    preempt_enable();
+}
+
+#define rcu_dereference(p) __atomic_load_n(&(p), __ATOMIC_CONSUME)
+#define rcu_assign_pointer(p, v) __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+
+// The executing CPU is outside any read section (called by the scheduler)
+static inline void rcu_quiescent(void) {
+    struct cpu* cpu = this_cpu();
+    __atomic_store_n(&cpu->rcu_qs_seq, __atomic_load_n(&rcu_gp_seq, __ATOMIC_RELAXED), __ATOMIC_RELEASE);
+}
+
+// Wait until every reader that may have seen an old pointer is done.
+// Thread context only, never inside a read section.
+void synchronize_rcu(void);
+
+// Call func(head) after a grace period, from the RCU thread
+void call_rcu(struct rcu_head* head, void (*func)(struct rcu_head* head));
+
+// Start the thread that runs call_rcu() callbacks
+void rcu_init(void);
+
+#endif // __VALERN_RCU_H
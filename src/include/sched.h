@@ -0,0 +1,140 @@
+#ifndef __VALERN_SCHED_H
+#define __VALERN_SCHED_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "spinlock.h"
+
+// Thread priorities, higher runs first. Threads of equal priority share
+// the CPU in time slices.
+#define THREAD_PRIORITIES     32
+#define THREAD_PRIO_IDLE      0     // Only the per-CPU idle threads
+#define THREAD_PRIO_LOW       4
+#define THREAD_PRIO_NORMAL    16
+#define THREAD_PRIO_HIGH      24
+
+// Kernel stack (and thread control block) size
+#define THREAD_STACK_PAGES    4
+
+// Length of a time slice
+#define SCHED_SLICE_US        10000
+
+// Any CPU, for thread_create()
+#define THREAD_ANY_CPU        (-1)
+
+#define THREAD_NAME_LEN       16
+
+enum thread_state {
+    THREAD_READY = 0,   // On a run queue
+    THREAD_RUNNING,     // Executing on its CPU
+    THREAD_BLOCKED,     // Waiting to be woken
+    THREAD_DEAD         // Exited, freed once switched away from
+};
+
+struct process;
+
+// Kernel thread. The control block lives at the top of the thread's stack
+// allocation; the stack grows down from just below it.
+struct thread {
+    uint64_t rsp;                   // Saved stack pointer while switched out
+    uint64_t stack_top;
+    uint64_t stack_phys;            // Base of the stack allocation
+    uint32_t id;
+    char name[THREAD_NAME_LEN];
+    volatile enum thread_state state;
+    uint8_t priority;
+    unsigned int cpu;               // Run queue the thread belongs to
+    uint64_t switches;              // Times switched in
+    uint64_t runtime_ns;            // Time spent running
+    uint64_t last_switch_tsc;
+    void* fpu_state;                // FPU save area, allocated on first use
+    struct process* process;        // User process, NULL for kernel threads
+    struct thread* rq_prev;         // Run queue links
+    struct thread* rq_next;
+    struct thread* all_next;        // Global thread list
+};
+
+// Wait queue: threads sleeping until a condition they check becomes true
+struct wait_entry {
+    struct thread* thread;
+    struct wait_entry* next;
+    bool queued;
+};
+
+struct waitqueue {
+    spinlock_t lock;
+    struct wait_entry* head;
+};
+
+#define WAITQUEUE_INIT { .lock = SPINLOCK_INIT, .head = NULL }
+
+typedef void (*thread_func_t)(void* arg);
+
+// Turn the boot context of the executing CPU into its idle thread and
+// start its preemption timer. Runs once on every CPU.
+void sched_init_cpu(void);
+
+// Idle loop of the executing CPU, never returns
+__attribute__((noreturn)) void sched_idle(void);
+
+// Create a thread and make it runnable on cpu (or THREAD_ANY_CPU)
+struct thread* thread_create(const char* name, thread_func_t func, void* arg, uint8_t priority, int cpu);
+
+// Thread running on the executing CPU
+struct thread* thread_current(void);
+
+// End the calling thread
+__attribute__((noreturn)) void thread_exit(void);
+
+// Give up the CPU to threads of the same or higher priority
+void thread_yield(void);
+
+// Sleep for at least ms milliseconds
+void thread_sleep(uint64_t ms);
+
+// Make a blocked thread runnable, returns false if it was not blocked
+bool thread_wake(struct thread* t);
+
+// Switch to the next thread. Called with or without interrupts enabled,
+// never with a spinlock held.
+void schedule(void);
+
+// Preemption point on interrupt exit (interrupts disabled)
+void sched_preempt_irq(void);
+
+// Waiting: the condition is checked after wait_prepare(), so a wakeup
+// between the check and schedule() is never lost.
+//
+//     struct wait_entry w = { 0 };
+//     for (;;) {
+//         wait_prepare(&wq, &w);
+//         if (condition) break;
+//         schedule();
+//     }
+//     wait_finish(&wq, &w);
+void wait_prepare(struct waitqueue* wq, struct wait_entry* w);
+void wait_finish(struct waitqueue* wq, struct wait_entry* w);
+void waitqueue_wake_all(struct waitqueue* wq);
+
+// Wake the first waiter that is actually asleep, returns false if none was
+bool waitqueue_wake_one(struct waitqueue* wq);
+
+// Snapshot of a thread for listings
+struct thread_info {
+    uint32_t id;
+    char name[THREAD_NAME_LEN];
+    enum thread_state state;
+    uint8_t priority;
+    unsigned int cpu;
+    uint64_t switches;
+    uint64_t runtime_ns;
+};
+
+// Copy up to max entries of the thread list, returns the number copied
+size_t sched_snapshot(struct thread_info* out, size_t max);
+
+// Context switches performed on a CPU
+uint64_t sched_switch_count(unsigned int cpu);
+
+#endif // __VALERN_SCHED_H
@@ -0,0 +1,69 @@
+#ifndef __VALERN_SEQLOCK_H
+#define __VALERN_SEQLOCK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "cpu.h"
+#include "spinlock.h"
+
+// Sequence lock for small, read-mostly data. Writers serialise on the
+// spinlock and make the sequence odd while they change the data; readers
+// take no lock and write nothing, they copy the data and retry if the
+// sequence moved under them.
+//
+//     uint32_t seq;
+//     do {
+//         seq = read_seqbegin(&sl);
+//         copy = data;
+//     } while (read_seqretry(&sl, seq));
+//
+// Readers must only copy: the data can be half-written until the retry
+// check says otherwise.
+typedef struct {
+    volatile uint32_t sequence;
+    spinlock_t lock;
+} seqlock_t;
+
+#define SEQLOCK_INIT { .sequence = 0, .lock = SPINLOCK_INIT }
+#define SEQLOCK_INIT_NAMED(name) { .sequence = 0, .lock = SPINLOCK_INIT_NAMED(name) }
+
+static inline uint32_t read_seqbegin(const seqlock_t* sl) {
+    uint32_t seq;
+    while ((seq = __atomic_load_n(&sl->sequence, __ATOMIC_ACQUIRE)) & 1) {
+        cpu_relax();
+    }
+    return seq;
+}
+
+static inline bool read_seqretry(const seqlock_t* sl, uint32_t seq) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&sl->sequence, __ATOMIC_RELAXED) != seq;
+}
+
+static inline void write_seqlock(seqlock_t* sl) {
+    spin_lock(&sl->lock);
+    __atomic_store_n(&sl->sequence, sl->sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void write_sequnlock(seqlock_t* sl) {
+    __atomic_store_n(&sl->sequence, sl->sequence + 1, __ATOMIC_RELEASE);
+    spin_unlock(&sl->lock);
+}
+
+// For data an interrupt handler writes; a handler must never read a
+// seqlock its own CPU may hold for writing, it would spin forever
+static inline uint64_t write_seqlock_irqsave(seqlock_t* sl) {
+    uint64_t flags = irq_save();
+    write_seqlock(sl);
+    return flags;
+}
+
+static inline void write_sequnlock_irqrestore(seqlock_t* sl, uint64_t flags) {
+    preempt_disable();
+    write_sequnlock(sl);
+    irq_restore(flags);
+    preempt_enable();
+}
+
+#endif // __VALERN_SEQLOCK_H
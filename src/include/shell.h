@@ -0,0 +1,86 @@
+#ifndef __VALERN_SHELL_H
+#define __VALERN_SHELL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Shell commands. Each subsystem defines its own with SHELL_COMMAND(): the
+// entries land in a linker section that shell_init() hashes by name, so a
+// command costs one hash and a short chain walk to find however many there
+// are, and adding one touches only the file that implements it. Commands
+// can also be added at run time with shell_register().
+//
+// Tab completes command names from a prefix trie of the registered names
+// and arguments through the command's completer, if it has one.
+
+#define SHELL_MAX_ARGS      16
+#define SHELL_MAX_COMMANDS  128
+#define SHELL_HASH_BUCKETS  64      // Power of two
+#define SHELL_LINE_MAX      1024    // Input line, terminator included
+#define SHELL_HISTORY       32      // Lines kept for Up/Down and Ctrl+R
+#define SHELL_TRIE_NODES    1024    // Command name characters, shared prefixes once
+#define SHELL_COMPLETE_LIST 512     // Candidates listed when Tab is ambiguous
+
+// argv[0] is the command name; the strings point into the input line and
+// argv[argc] is NULL
+typedef void (*shell_handler_t)(int argc, char** argv);
+
+// Candidates for the word under the cursor, collected by completers
+struct shell_completion {
+    const char* word;           // Typed so far
+    size_t word_len;
+    size_t matches;
+    char common[64];            // Longest prefix all matches share
+    size_t common_len;
+    char list[SHELL_COMPLETE_LIST];
+    size_t list_len;
+};
+
+// Offer the candidates for argument argc of a command; argv[0..argc) are
+// the arguments before it
+typedef void (*shell_completer_t)(int argc, char** argv, struct shell_completion* comp);
+
+struct shell_command {
+    const char* name;
+    const char* help;           // One line for 'help'
+    shell_handler_t handler;
+    shell_completer_t complete; // NULL: arguments are not completed
+    struct shell_command* next; // Hash chain
+};
+
+// Define a command at file scope; id only has to be unique in the file
+#define SHELL_COMMAND(id, cmd_name, cmd_help, cmd_handler)                        \
+    SHELL_COMMAND_ARGS(id, cmd_name, cmd_help, cmd_handler, NULL)
+
+// The same with a completer for its arguments
+#define SHELL_COMMAND_ARGS(id, cmd_name, cmd_help, cmd_handler, cmd_complete)     \
+    static struct shell_command shell_command_##id = {                            \
+        .name = cmd_name, .help = cmd_help, .handler = cmd_handler,               \
+        .complete = cmd_complete,                                                 \
+    };                                                                            \
+    __attribute__((used, section(".shell_commands")))                             \
+    static struct shell_command* const shell_command_##id##_entry = &shell_command_##id
+
+// Hash the commands defined with SHELL_COMMAND()
+void shell_init(void);
+
+// Add a command; cmd needs static storage. -1 if the name is taken or the
+// table is full.
+int shell_register(struct shell_command* cmd);
+
+struct shell_command* shell_find(const char* name);
+
+// Offer candidate to a completion; ignored unless it starts with the word
+void shell_complete_add(struct shell_completion* comp, const char* candidate);
+
+// Offer the command names that start with the word
+void shell_complete_command(struct shell_completion* comp);
+
+// Split line into arguments in place and run the command it names
+void shell_execute(char* line);
+
+// The interactive shell on the keyboard and console, never returns
+void shell(void);
+
+#endif // __VALERN_SHELL_H
@@ -0,0 +1,23 @@
+#ifndef __VALERN_SIMD_H
+#define __VALERN_SIMD_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Vector kernels. simd.c is the only file built with SSE enabled (AVX2
+// variants are marked per function), so these may only run between
+// kernel_fpu_begin() and kernel_fpu_end(), on a CPU with the extension.
+// Use the memops.h wrappers, which pick a variant and fall back to scalar.
+
+void simd_fill32_sse2(uint32_t* dst, uint32_t value, size_t count);
+void simd_fill32_avx2(uint32_t* dst, uint32_t value, size_t count);
+
+// Forward copy, regions must not overlap
+void simd_copy_sse2(void* dst, const void* src, size_t size);
+void simd_copy_avx2(void* dst, const void* src, size_t size);
+
+// 64-bit sum of the little-endian 32-bit words, see mem_checksum()
+uint64_t simd_sum32_sse2(const void* data, size_t size);
+uint64_t simd_sum32_avx2(const void* data, size_t size);
+
+#endif // __VALERN_SIMD_H
@@ -0,0 +1,27 @@
+#ifndef __VALERN_SMP_H
+#define __VALERN_SMP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "cpu.h"
+
+// Size of each AP's kernel stack
+#define CPU_STACK_SIZE 16384
+
+// Per-CPU areas, indexed by cpu_id()
+extern struct cpu cpus[MAX_CPUS];
+
+// Set up the BSP's GDT, TSS and per-CPU area. Must run before anything
+// that calls cpu_id().
+void smp_init_bsp(void);
+
+// Start all application processors reported by the bootloader and wait
+// until they are online. Returns the number of CPUs online.
+unsigned int smp_start_aps(void);
+
+// Number of CPUs reported by the bootloader / currently online
+unsigned int cpu_count(void);
+unsigned int cpu_online_count(void);
+
+#endif // __VALERN_SMP_H
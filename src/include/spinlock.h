@@ -0,0 +1,304 @@
+#ifndef __VALERN_SPINLOCK_H
+#define __VALERN_SPINLOCK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "cpu.h"
+
+// Lock contention statistics. A lock created with one of the *_NAMED
+// initialisers counts its acquisitions, how often it had to wait, and how
+// long it was waited for and held (in TSC cycles). Named locks must have
+// static storage; they show up in the lock list on first use.
+struct lock_stats {
+    const char* name;
+    uint64_t acquisitions;
+    uint64_t contended;         // Acquisitions that had to wait
+    uint64_t wait_tsc;
+    uint64_t max_wait_tsc;
+    uint64_t hold_tsc;          // Exclusive holds only
+    uint64_t max_hold_tsc;
+    struct lock_stats* next;
+    uint32_t registered;
+};
+
+#define LOCK_STATS(lock_name) (&(struct lock_stats){ .name = (lock_name) })
+
+// Record an acquisition that started spinning at start and got the lock at now
+void lock_stat_acquired(struct lock_stats* stats, uint64_t start, uint64_t now, bool contended);
+
+// Record the end of an exclusive hold that began at since
+void lock_stat_released(struct lock_stats* stats, uint64_t since);
+
+// Locks that have statistics and were used at least once
+size_t lockstat_count(void);
+struct lock_stats* lockstat_get(size_t index);
+
+// Zero the counters of every listed lock
+void lockstat_reset(void);
+
+// Ticket spinlock: CPUs get the lock in the order they asked for it. The
+// plain variants disable preemption, the irqsave variants also disable
+// interrupts and must be used for any lock an interrupt handler or tasklet
+// can take.
+typedef struct {
+    union {
+        volatile uint32_t value;
+        struct {
+            volatile uint16_t owner;    // Ticket being served
+            volatile uint16_t next;     // Next ticket handed out
+        };
+    };
+    struct lock_stats* stats;
+    uint64_t acquired_at;
+} spinlock_t;
+
+#define SPINLOCK_INIT { .value = 0 }
+#define SPINLOCK_INIT_NAMED(name) { .value = 0, .stats = LOCK_STATS(name) }
+
+// Lock without touching preemption, for the scheduler's own locks
+static inline void raw_spin_lock(spinlock_t* lock) {
+    uint64_t start = lock->stats ? rdtsc() : 0;
+    uint16_t ticket = __atomic_fetch_add(&lock->next, 1, __ATOMIC_RELAXED);
+    bool contended = false;
+    uint16_t owner;
+
+    while ((owner = __atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE)) != ticket) {
+        // Back off in proportion to the place in line, so waiters do not
+        // all hammer the line the holder is about to write
+        for (uint16_t i = (uint16_t)(ticket - owner); i; i--) {
+            cpu_relax();
+        }
+        contended = true;
+    }
+    if (lock->stats) {
+        lock->acquired_at = rdtsc();
+        lock_stat_acquired(lock->stats, start, lock->acquired_at, contended);
+    }
+}
+
+static inline void raw_spin_unlock(spinlock_t* lock) {
+    if (lock->stats) {
+        lock_stat_released(lock->stats, lock->acquired_at);
+    }
+    __atomic_store_n(&lock->owner, (uint16_t)(lock->owner + 1), __ATOMIC_RELEASE);
+}
+
+static inline bool spin_trylock(spinlock_t* lock) {
+    preempt_disable();
+    uint32_t value = __atomic_load_n(&lock->value, __ATOMIC_RELAXED);
+    // Free when the ticket being served is the next one handed out
+    if ((value & 0xFFFF) == (value >> 16) &&
+        __atomic_compare_exchange_n(&lock->value, &value, value + 0x10000, false,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        if (lock->stats) {
+            lock->acquired_at = rdtsc();
+            lock_stat_acquired(lock->stats, lock->acquired_at, lock->acquired_at, false);
+        }
+        return true;
+    }
+    preempt_enable();
+    return false;
+}
+
+static inline bool spin_is_locked(spinlock_t* lock) {
+    uint32_t value = __atomic_load_n(&lock->value, __ATOMIC_RELAXED);
+    return (value & 0xFFFF) != (value >> 16);
+}
+
+static inline void spin_lock(spinlock_t* lock) {
+    preempt_disable();
+    raw_spin_lock(lock);
+}
+
+static inline void spin_unlock(spinlock_t* lock) {
+    raw_spin_unlock(lock);
+    preempt_enable();
+}
+
+static inline uint64_t spin_lock_irqsave(spinlock_t* lock) {
+    uint64_t flags = irq_save();
+    spin_lock(lock);
+    return flags;
+}
+
+// Interrupts come back on before preemption does, so a reschedule that
+// became due inside the critical section happens right here
+static inline void spin_unlock_irqrestore(spinlock_t* lock, uint64_t flags) {
+    raw_spin_unlock(lock);
+    irq_restore(flags);
+    preempt_enable();
+}
+
+// MCS queue lock: every waiter spins on its own node, so a contended lock
+// costs one cache line transfer per handover instead of one per waiter.
+// The node is passed again to unlock and must stay put until then (a
+// local variable of the locking function is fine).
+struct mcs_node {
+    struct mcs_node* volatile next;
+    volatile uint32_t locked;
+} __attribute__((aligned(64)));
+
+typedef struct {
+    struct mcs_node* volatile tail;
+    struct lock_stats* stats;
+    uint64_t acquired_at;
+} mcs_lock_t;
+
+#define MCS_LOCK_INIT { .tail = NULL }
+#define MCS_LOCK_INIT_NAMED(name) { .tail = NULL, .stats = LOCK_STATS(name) }
+
+static inline void mcs_lock(mcs_lock_t* lock, struct mcs_node* node) {
+    preempt_disable();
+    uint64_t start = lock->stats ? rdtsc() : 0;
+
+    node->next = NULL;
+    node->locked = 1;
+    struct mcs_node* prev = __atomic_exchange_n(&lock->tail, node, __ATOMIC_ACQ_REL);
+    if (prev != NULL) {
+        __atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+        while (__atomic_load_n(&node->locked, __ATOMIC_ACQUIRE)) {
+            cpu_relax();
+        }
+    }
+    if (lock->stats) {
+        lock->acquired_at = rdtsc();
+        lock_stat_acquired(lock->stats, start, lock->acquired_at, prev != NULL);
+    }
+}
+
+static inline void mcs_unlock(mcs_lock_t* lock, struct mcs_node* node) {
+    if (lock->stats) {
+        lock_stat_released(lock->stats, lock->acquired_at);
+    }
+
+    struct mcs_node* next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE);
+    if (next == NULL) {
+        struct mcs_node* expected = node;
+        if (__atomic_compare_exchange_n(&lock->tail, &expected, NULL, false,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+            preempt_enable();
+            return;
+        }
+        // A waiter swapped itself in but has not linked up yet
+        while ((next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE)) == NULL) {
+            cpu_relax();
+        }
+    }
+    __atomic_store_n(&next->locked, 0, __ATOMIC_RELEASE);
+    preempt_enable();
+}
+
+static inline uint64_t mcs_lock_irqsave(mcs_lock_t* lock, struct mcs_node* node) {
+    uint64_t flags = irq_save();
+    mcs_lock(lock, node);
+    return flags;
+}
+
+static inline void mcs_unlock_irqrestore(mcs_lock_t* lock, struct mcs_node* node, uint64_t flags) {
+    preempt_disable();
+    mcs_unlock(lock, node);
+    irq_restore(flags);
+    preempt_enable();
+}
+
+// Reader-writer spinlock for read-mostly data. Any number of readers or
+// one writer; a waiting writer holds off new readers so it cannot starve.
+#define RWLOCK_WRITER   0x80000000U
+#define RWLOCK_PENDING  0x40000000U     // A writer is waiting
+#define RWLOCK_READERS  0x3FFFFFFFU
+
+typedef struct {
+    volatile uint32_t value;
+    struct lock_stats* stats;
+    uint64_t acquired_at;               // Of the writer
+} rwlock_t;
+
+#define RWLOCK_INIT { .value = 0 }
+#define RWLOCK_INIT_NAMED(name) { .value = 0, .stats = LOCK_STATS(name) }
+
+static inline void read_lock(rwlock_t* lock) {
+    preempt_disable();
+    uint64_t start = lock->stats ? rdtsc() : 0;
+    bool contended = false;
+
+    for (;;) {
+        uint32_t value = __atomic_load_n(&lock->value, __ATOMIC_RELAXED);
+        if (!(value & (RWLOCK_WRITER | RWLOCK_PENDING)) &&
+            __atomic_compare_exchange_n(&lock->value, &value, value + 1, true,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            break;
+        }
+        contended = true;
+        cpu_relax();
+    }
+    if (lock->stats) {
+        lock_stat_acquired(lock->stats, start, rdtsc(), contended);
+    }
+}
+
+static inline void read_unlock(rwlock_t* lock) {
+    __atomic_sub_fetch(&lock->value, 1, __ATOMIC_RELEASE);
+    preempt_enable();
+}
+
+static inline void write_lock(rwlock_t* lock) {
+    preempt_disable();
+    uint64_t start = lock->stats ? rdtsc() : 0;
+    bool contended = false;
+
+    for (;;) {
+        uint32_t value = __atomic_load_n(&lock->value, __ATOMIC_RELAXED);
+        if ((value & ~RWLOCK_PENDING) == 0) {
+            if (__atomic_compare_exchange_n(&lock->value, &value, RWLOCK_WRITER, true,
+                                            __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (!(value & RWLOCK_PENDING)) {
+            __atomic_fetch_or(&lock->value, RWLOCK_PENDING, __ATOMIC_RELAXED);
+        }
+        contended = true;
+        cpu_relax();
+    }
+    if (lock->stats) {
+        lock->acquired_at = rdtsc();
+        lock_stat_acquired(lock->stats, start, lock->acquired_at, contended);
+    }
+}
+
+// Other writers still waiting set the pending bit again themselves
+static inline void write_unlock(rwlock_t* lock) {
+    if (lock->stats) {
+        lock_stat_released(lock->stats, lock->acquired_at);
+    }
+    __atomic_and_fetch(&lock->value, ~RWLOCK_WRITER, __ATOMIC_RELEASE);
+    preempt_enable();
+}
+
+static inline uint64_t read_lock_irqsave(rwlock_t* lock) {
+    uint64_t flags = irq_save();
+    read_lock(lock);
+    return flags;
+}
+
+static inline void read_unlock_irqrestore(rwlock_t* lock, uint64_t flags) {
+    preempt_disable();
+    read_unlock(lock);
+    irq_restore(flags);
+    preempt_enable();
+}
+
+static inline uint64_t write_lock_irqsave(rwlock_t* lock) {
+    uint64_t flags = irq_save();
+    write_lock(lock);
+    return flags;
+}
+
+static inline void write_unlock_irqrestore(rwlock_t* lock, uint64_t flags) {
+    preempt_disable();
+    write_unlock(lock);
+    irq_restore(flags);
+    preempt_enable();
+}
+
+#endif // __VALERN_SPINLOCK_H
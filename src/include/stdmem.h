@@ -8,6 +8,7 @@ void *memset(void *s, int c, size_t n);
 void *memmove(void *dest, const void *src, size_t n);
 int memcmp(const void *s1, const void *s2, size_t n);
 int strcmp(const char* s1, const char* s2);
+int strncmp(const char* s1, const char* s2, size_t n);
 size_t strlen(const char* str);
 
 #endif // STDMEM_H
\ No newline at end of file
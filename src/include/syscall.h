@@ -0,0 +1,75 @@
+#ifndef __VALERN_SYSCALL_H
+#define __VALERN_SYSCALL_H
+
+#include <stdint.h>
+
+// System calls enter through SYSCALL and return through SYSRET: no IDT
+// lookup, no interrupt frame. ABI: number in rax, arguments in rdi, rsi,
+// rdx, r10, r8, r9, result in rax (negative error codes). rcx and r11 are
+// clobbered, everything else is preserved.
+
+#define SYS_NOP         0       // Returns 0 (round-trip benchmarks)
+#define SYS_EXIT        1       // exit(code)
+#define SYS_WRITE       2       // write(buf, len): to the console
+#define SYS_YIELD       3
+#define SYS_GETPID      4
+#define SYS_SLEEP       5       // sleep(ms)
+#define SYS_FORK        6       // Child pid to the parent, 0 to the child
+#define SYS_WAIT        7       // wait(pid): exit code of a forked child
+#define SYS_PIPE        8       // pipe(fds[2], flags): read and write end
+#define SYS_SEND        9       // send(fd, buf, len): write to a pipe
+#define SYS_RECV        10      // recv(fd, buf, len): read from a pipe
+#define SYS_CLOSE       11      // close(fd)
+#define SYS_FB_ACQUIRE  12      // fb_acquire(info*): map the framebuffer
+#define SYS_FB_RELEASE  13      // Give the framebuffer back to the console
+#define SYS_COUNT       14
+
+// Error results
+#define EBADF           9
+#define ECHILD          10
+#define ENOMEM          12
+#define EFAULT          14
+#define EBUSY           16
+#define EINVAL          22
+#define EMFILE          24
+#define EPIPE           32
+#define ENOSYS          38
+
+// User registers saved on syscall entry, lowest address first
+struct syscall_frame {
+    uint64_t r15, r14, r13, r12, rbp, rbx;
+    uint64_t r9, r8, r10, rdx, rsi, rdi;
+    uint64_t rax;               // Number on entry, result on return
+    uint64_t rip;               // From rcx
+    uint64_t rflags;            // From r11
+    uint64_t rsp;
+};
+
+typedef int64_t (*syscall_handler_t)(struct syscall_frame* frame);
+
+// Program the SYSCALL MSRs of the executing CPU
+void syscall_init_cpu(void);
+
+// Round trips of SYS_NOP from a user process, returns cycles per call or
+// 0 if the process could not be started
+uint64_t syscall_bench(uint64_t iterations);
+
+// Reads of the vDSO clock from a user process, returns cycles per read or
+// 0 if the process could not be started
+uint64_t vdso_bench(uint64_t iterations);
+
+// Fork, exit and wait cycles of a user process with FORK_BENCH_PAGES
+// touched pages, returns cycles per iteration or 0 if it failed
+#define FORK_BENCH_PAGES 64
+uint64_t fork_bench(uint64_t iterations);
+
+// Page-aligned PIPE_BENCH_BYTES sends from a process to a forked reader,
+// returns cycles per send or 0 if it failed
+#define PIPE_BENCH_BYTES 65536
+uint64_t pipe_bench(uint64_t iterations);
+
+// Full-screen fills by a process that holds the framebuffer, returns
+// cycles per frame or 0 if it failed
+uint64_t fb_bench(uint64_t frames);
+
+#endif // __VALERN_SYSCALL_H
@@ -0,0 +1,56 @@
+#ifndef __VALERN_TASK_H
+#define __VALERN_TASK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Work-stealing task runtime. Each CPU runs one worker thread with a
+// Chase-Lev deque: the worker pushes and pops its own tasks at the bottom,
+// idle workers steal from the top of the others. Tasks submitted from
+// outside a worker go through a shared injection queue. Workers with
+// nothing to do sleep, so their CPU halts in the idle thread.
+
+typedef void (*task_func_t)(void* arg);
+typedef void (*range_func_t)(size_t begin, size_t end, void* arg);
+
+// Fork-join group: counts the tasks spawned into it that have not finished.
+// Lives on the spawner's stack; a finishing task never touches it after
+// dropping the count, so it can go away as soon as the wait returns.
+struct task_group {
+    volatile int64_t pending;
+};
+
+#define TASK_GROUP_INIT { .pending = 0 }
+
+// Start one worker per online CPU
+void task_runtime_init(void);
+
+// Whether the workers are running (before that everything runs inline)
+bool task_runtime_ready(void);
+
+// Run fn(arg) as a task of group. Thread context only; from interrupt
+// context or with preemption disabled the work runs inline.
+void task_spawn(struct task_group* group, task_func_t fn, void* arg);
+
+// Wait until every task of group has finished. A worker runs other tasks
+// while it waits, any other thread sleeps.
+void task_group_wait(struct task_group* group);
+
+// Run body over [begin, end) in chunks of at most grain elements spread
+// over all CPUs, returns when every chunk is done
+void parallel_for(size_t begin, size_t end, size_t grain, range_func_t body, void* arg);
+
+// memset split across all CPUs
+void parallel_memset(void* dst, int value, size_t size);
+
+// Per-CPU runtime counters
+struct task_stats {
+    uint64_t executed;      // Tasks run by this CPU's worker
+    uint64_t stolen;        // Of those, taken from another worker's deque
+    uint64_t sleeps;        // Times the worker went to sleep for lack of work
+};
+
+void task_get_stats(unsigned int cpu, struct task_stats* stats);
+
+#endif // __VALERN_TASK_H
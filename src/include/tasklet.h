@@ -0,0 +1,32 @@
+#ifndef __VALERN_TASKLET_H
+#define __VALERN_TASKLET_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Tasklet state bits
+#define TASKLET_STATE_PENDING 0x01
+
+// Deferred work item. An interrupt handler (top half) schedules a tasklet,
+// and the tasklet function (bottom half) runs later on the same CPU with
+// interrupts enabled. A tasklet is queued at most once until it has run.
+struct tasklet {
+    void (*func)(void* data);
+    void* data;
+    volatile uint32_t state;
+};
+
+#define TASKLET_INIT(fn, arg) { .func = (fn), .data = (arg), .state = 0 }
+
+// Queue a tasklet on the current CPU (safe from interrupt context)
+void tasklet_schedule(struct tasklet* t);
+
+// Run all tasklets queued on the current CPU. Called on interrupt exit with
+// interrupts disabled; they are enabled while tasklets run and disabled
+// again before returning.
+void tasklet_run_pending(void);
+
+// Check whether the current CPU has queued tasklets
+bool tasklet_has_pending(void);
+
+#endif // __VALERN_TASKLET_H
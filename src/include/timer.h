@@ -0,0 +1,53 @@
+#ifndef __VALERN_TIMER_H
+#define __VALERN_TIMER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Tick rate of the periodic PIT interrupt (1 tick = 1 ms)
+#define TIMER_HZ 1000
+
+// Software timer. The callback runs in the timer tasklet (bottom half
+// context, interrupts enabled) once the expiry tick has passed.
+struct timer {
+    uint64_t expires;           // Tick at which the timer fires
+    void (*func)(void* data);
+    void* data;
+    struct timer* next;
+    bool pending;
+    bool running;               // Callback in progress
+};
+
+#define TIMER_INIT(fn, arg) { .expires = 0, .func = (fn), .data = (arg), .next = 0, .pending = false, .running = false }
+
+// Calibrate the TSC and start the periodic tick on IRQ0
+void timer_init(void);
+
+// Ticks (milliseconds) since timer_init()
+uint64_t timer_ticks(void);
+
+// TSC frequency in Hz measured at boot
+uint64_t timer_tsc_hz(void);
+
+// Convert TSC cycles to nanoseconds / microseconds to TSC cycles
+uint64_t tsc_to_ns(uint64_t cycles);
+uint64_t us_to_tsc(uint64_t us);
+
+// Nanoseconds since boot, from the TSC
+uint64_t timer_ns(void);
+
+// Busy-wait for the given number of microseconds
+void timer_udelay(uint64_t us);
+
+// Arm a timer to fire delay_ms from now (re-arms if already pending)
+void timer_start(struct timer* t, uint64_t delay_ms);
+
+// Disarm a pending timer, returns true if it was pending. The callback may
+// still be running on another CPU.
+bool timer_cancel(struct timer* t);
+
+// Disarm and wait for a callback in progress to return, so the timer can
+// go away. Not from the timer's own callback or from interrupt context.
+bool timer_cancel_sync(struct timer* t);
+
+#endif // __VALERN_TIMER_H
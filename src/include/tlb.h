@@ -0,0 +1,56 @@
+#ifndef __VALERN_TLB_H
+#define __VALERN_TLB_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// TLB shootdown. Unmaps collect the pages they invalidate in a tlb_gather
+// and finish with one shootdown: the addresses are merged into a per-CPU
+// inbox and each target gets at most one IPI, however many pages went
+// away. CPUs running a different address space are skipped (loading CR3
+// flushes them anyway). Idle CPUs get no IPI: they flush on their way out
+// of idle or into an interrupt handler.
+
+// Pages a gather (and an inbox) tracks before falling back to a full flush
+#define TLB_BATCH_MAX 32
+
+struct tlb_gather {
+    uint64_t pml4;              // Address space, 0 for kernel mappings (all CPUs)
+    size_t count;
+    bool full;
+    uint64_t addrs[TLB_BATCH_MAX];
+};
+
+// Start collecting invalidations for an address space
+void tlb_gather_init(struct tlb_gather* gather, uint64_t pml4);
+
+// Page at virt has been unmapped or changed
+void tlb_gather_add(struct tlb_gather* gather, uint64_t virt);
+
+// Flush the collected pages on every CPU that may cache them. Returns once
+// no CPU can use the old translations. Works with interrupts disabled: the
+// caller serves shootdowns aimed at its own CPU while it waits.
+void tlb_gather_finish(struct tlb_gather* gather);
+
+// Per-CPU setup; registers the shootdown IPI on the BSP
+void tlb_init_cpu(void);
+
+// Lazy mode for the idle loop: no IPIs while it is set
+void tlb_enter_lazy(void);
+void tlb_leave_lazy(void);
+
+// Catch up on invalidations queued while lazy (interrupt entry)
+void tlb_irq_enter(void);
+
+struct tlb_stats {
+    uint64_t shootdowns;        // tlb_gather_finish() calls with remote targets
+    uint64_t ipis_sent;
+    uint64_t lazy_skipped;      // Targets that were idle and got no IPI
+    uint64_t pages_flushed;     // invlpg executed on this CPU
+    uint64_t full_flushes;
+};
+
+void tlb_get_stats(unsigned int cpu, struct tlb_stats* stats);
+
+#endif // __VALERN_TLB_H
@@ -0,0 +1,51 @@
+#ifndef __VALERN_VDSO_H
+#define __VALERN_VDSO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Shared time page. Every process gets two read-only pages at fixed user
+// addresses: the clock parameters the kernel publishes (VDSO_DATA) and
+// the code that turns a TSC read into nanoseconds with them (VDSO_CODE),
+// so reading the clock never enters the kernel. The data is guarded by a
+// sequence count like seqlock_t: odd while the kernel rewrites it, and a
+// reader that sees it move retries.
+
+#define VDSO_DATA        0x00007FFFFF000000ULL
+#define VDSO_CODE        (VDSO_DATA + 0x1000)
+#define VDSO_END         (VDSO_DATA + 0x2000)
+
+// User entry points, at fixed offsets into the code page. Clobber rcx,
+// rdx, rsi and r8; everything else is preserved.
+#define VDSO_CLOCK_NS    VDSO_CODE              // rax = ns since boot
+
+// Layout of the data page, read by the user code by offset
+struct vdso_data {
+    volatile uint32_t sequence;
+    uint32_t reserved;
+    uint64_t tsc_base;          // ns = ns_base + ((tsc - tsc_base) * mult) >> 32
+    uint64_t ns_base;
+    uint64_t mult;
+    uint64_t tsc_hz;
+};
+
+#define VDSO_SEQUENCE    0
+#define VDSO_TSC_BASE    8
+#define VDSO_NS_BASE     16
+#define VDSO_MULT        24
+
+_Static_assert(offsetof(struct vdso_data, tsc_base) == VDSO_TSC_BASE, "vdso offsets");
+_Static_assert(offsetof(struct vdso_data, ns_base) == VDSO_NS_BASE, "vdso offsets");
+_Static_assert(offsetof(struct vdso_data, mult) == VDSO_MULT, "vdso offsets");
+
+// Allocate the pages and publish the boot clock (after timer_init())
+void vdso_init(void);
+
+// Publish new clock parameters, e.g. after recalibrating the TSC
+void vdso_set_clock(uint64_t tsc_base, uint64_t ns_base, uint64_t mult, uint64_t tsc_hz);
+
+// Map the pages into an address space; returns -1 if out of memory
+int vdso_map(uint64_t pml4);
+
+#endif // __VALERN_VDSO_H
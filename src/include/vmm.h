@@ -0,0 +1,91 @@
+#ifndef __VALERN_VMM_H
+#define __VALERN_VMM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Page table entry bits
+#define PTE_PRESENT  0x001ULL
+#define PTE_WRITABLE 0x002ULL
+#define PTE_USER     0x004ULL
+#define PTE_PWT      0x008ULL
+#define PTE_PCD      0x010ULL
+#define PTE_ACCESSED 0x020ULL
+#define PTE_DIRTY    0x040ULL
+#define PTE_HUGE     0x080ULL
+#define PTE_PAT      0x080ULL   // Same bit in 4 KiB leaf entries
+#define PTE_GLOBAL   0x100ULL
+#define PTE_SHARED   0x200ULL   // Software bit: frame not owned by the address space
+#define PTE_COW      0x400ULL   // Software bit: write-protected until copied
+#define PTE_DEVICE   0x800ULL   // Software bit: device memory, not inherited by fork
+
+// Write-combining, for 4 KiB leaf entries: PAT entry 5 (see vmm_init_cpu())
+#define PTE_WC       (PTE_PAT | PTE_PWT)
+#define PTE_NX       (1ULL << 63)
+#define PTE_ADDR_MASK 0x000FFFFFFFFFF000ULL
+
+// Virtual window for kernel mappings of physical ranges (device memory,
+// scratch mappings)
+#define MMIO_WINDOW_BASE 0xFFFFFE0000000000ULL
+#define MMIO_WINDOW_SIZE 0x0000004000000000ULL
+
+// User address spaces cover the lower half below USER_TOP. The last page
+// under the canonical boundary stays unmapped: a syscall there would return
+// to a non-canonical address.
+#define USER_BASE        0x0000000000001000ULL
+#define USER_TOP         0x00007FFFFFFFF000ULL
+
+// Pick up the kernel page tables the bootloader built
+void vmm_init(void);
+
+// Per-CPU paging setup: load the PAT layout the PTE_ cache bits assume
+void vmm_init_cpu(void);
+
+// Map one 4 KiB page in the kernel address space, allocating page tables
+// as needed. Returns -1 if out of memory or the range is covered by a
+// large page.
+int vmm_map_page(uint64_t virt, uint64_t phys, uint64_t flags);
+
+// Map a physical range into the kernel mapping window, returns its virtual
+// address or NULL on failure
+void* vmm_map_range(uint64_t phys, size_t size, uint64_t flags);
+
+// Map a device register range uncached, returns its virtual address or
+// NULL on failure
+void* vmm_map_mmio(uint64_t phys, size_t size);
+
+// Unmap kernel pages and flush them from every CPU's TLB in one shootdown.
+// Page tables stay allocated; the memory behind the pages is not freed.
+void vmm_unmap_pages(uint64_t virt, size_t count);
+
+// Physical address of the kernel's top-level page table
+uint64_t vmm_kernel_pml4(void);
+
+// New address space: an empty lower half and the kernel half shared with
+// every other space. Returns its PML4 or 0 if out of memory.
+uint64_t vmm_create_space(void);
+
+// Copy-on-write duplicate of an address space: the page tables are copied,
+// frames gain an owner, and writable pages become read-only PTE_COW in
+// both spaces. Returns the new PML4 or 0 if out of memory.
+uint64_t vmm_clone_space(uint64_t pml4);
+
+// Free an address space that no CPU has loaded: drops its user pages
+// (except PTE_SHARED ones), frees page tables and the PML4
+void vmm_destroy_space(uint64_t pml4);
+
+// Map one user page (PTE_USER is implied). Returns -1 if out of memory or
+// virt is outside user space.
+int vmm_map_user(uint64_t pml4, uint64_t virt, uint64_t phys, uint64_t flags);
+
+// Unmap count user pages from virt and flush them from every CPU running
+// the address space. The frames are not freed.
+void vmm_unmap_user(uint64_t pml4, uint64_t virt, size_t count);
+
+// Page table entry of a user page, 0 if not mapped
+uint64_t vmm_user_pte(uint64_t pml4, uint64_t virt);
+
+// Load an address space on the executing CPU, if not already loaded
+void vmm_switch_space(uint64_t pml4);
+
+#endif // __VALERN_VMM_H
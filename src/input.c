@@ -0,0 +1,170 @@
+#include "input.h"
+#include "stdmem.h"
+#include "cpu.h"
+#include "sched.h"
+#include "idle.h"
+#include "console.h"
+#include "shell.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+static struct input_device* devices[MAX_INPUT_DEVICES];
+
+// Threads sleeping in input_wait(), woken on every publish
+static struct waitqueue input_waiters = WAITQUEUE_INIT;
+static size_t device_count = 0;
+
+int input_register_device(struct input_device* dev) {
+    if (device_count >= MAX_INPUT_DEVICES) {
+        return -1;
+    }
+    dev->head = 0;
+    dev->readers = 0;
+    devices[device_count++] = dev;
+    return 0;
+}
+
+struct input_device* input_find_device(const char* name) {
+    for (size_t i = 0; i < device_count; i++) {
+        if (strcmp(devices[i]->name, name) == 0) {
+            return devices[i];
+        }
+    }
+    return NULL;
+}
+
+size_t input_device_count(void) {
+    return device_count;
+}
+
+struct input_device* input_get_device(size_t index) {
+    return index < device_count ? devices[index] : NULL;
+}
+
+void input_publish(struct input_device* dev, const struct input_event* events, size_t count) {
+    uint64_t head = dev->head;
+
+    // The ring never blocks the producer; slow readers detect overwritten
+    // slots from the head they observe
+    for (size_t i = 0; i < count; i++) {
+        dev->ring[(head + i) % INPUT_RING_SIZE] = events[i];
+        // Publish each slot before moving on, so a reader never sees a
+        // head that is more than one slot ahead of a slot being rewritten
+        __atomic_store_n(&dev->head, head + i + 1, __ATOMIC_RELEASE);
+    }
+
+    waitqueue_wake_all(&input_waiters);
+}
+
+void input_open(struct input_handle* handle, struct input_device* dev) {
+    handle->dev = dev;
+    handle->cursor = __atomic_load_n(&dev->head, __ATOMIC_ACQUIRE);
+    handle->dropped = 0;
+    __atomic_add_fetch(&dev->readers, 1, __ATOMIC_RELAXED);
+}
+
+void input_close(struct input_handle* handle) {
+    if (handle->dev) {
+        __atomic_sub_fetch(&handle->dev->readers, 1, __ATOMIC_RELAXED);
+        handle->dev = NULL;
+    }
+}
+
+size_t input_read(struct input_handle* handle, struct input_event* events, size_t max) {
+    struct input_device* dev = handle->dev;
+    if (!dev || max == 0) {
+        return 0;
+    }
+
+    uint64_t head = __atomic_load_n(&dev->head, __ATOMIC_ACQUIRE);
+    uint64_t cursor = handle->cursor;
+
+    // Fell more than a ring behind, skip to the oldest event still there
+    if (head - cursor > INPUT_RING_SIZE) {
+        handle->dropped += head - INPUT_RING_SIZE - cursor;
+        cursor = head - INPUT_RING_SIZE;
+    }
+
+    size_t count = head - cursor;
+    if (count > max) {
+        count = max;
+    }
+    for (size_t i = 0; i < count; i++) {
+        events[i] = dev->ring[(cursor + i) % INPUT_RING_SIZE];
+    }
+
+    // The producer may have lapped us while copying. Slot s is intact only
+    // if s > head - INPUT_RING_SIZE for the head seen after the copy (the
+    // slot at head - INPUT_RING_SIZE may be mid-write).
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    uint64_t new_head = __atomic_load_n(&dev->head, __ATOMIC_ACQUIRE);
+    if (new_head + 1 > cursor + INPUT_RING_SIZE) {
+        size_t lost = new_head + 1 - INPUT_RING_SIZE - cursor;
+        if (lost > count) {
+            lost = count;
+        }
+        memmove(events, events + lost, (count - lost) * sizeof(struct input_event));
+        handle->dropped += lost;
+        handle->cursor = cursor + count;
+        return count - lost;
+    }
+
+    handle->cursor = cursor + count;
+    return count;
+}
+
+bool input_pending(const struct input_handle* handle) {
+    return handle->dev && __atomic_load_n(&handle->dev->head, __ATOMIC_ACQUIRE) != handle->cursor;
+}
+
+static bool any_pending(struct input_handle* handles, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (input_pending(&handles[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void input_wait(struct input_handle* handles, size_t count) {
+    if (thread_current() != NULL) {
+        struct wait_entry w = { 0 };
+        for (;;) {
+            wait_prepare(&input_waiters, &w);
+            if (any_pending(handles, count)) {
+                break;
+            }
+            schedule();
+        }
+        wait_finish(&input_waiters, &w);
+        return;
+    }
+
+    // No scheduler on this CPU yet
+    for (;;) {
+        // Check with interrupts off; idle_halt() then sleeps without
+        // missing an event published between the check and the halt
+        asm volatile("cli");
+        for (size_t i = 0; i < count; i++) {
+            if (input_pending(&handles[i])) {
+                asm volatile("sti");
+                return;
+            }
+        }
+        idle_halt();
+    }
+}
+
+static void cmd_input(int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+    printf("Input devices:\n", WHITE, BLACK);
+    for (size_t i = 0; i < device_count; i++) {
+        struct input_device* dev = devices[i];
+        printf("  %s: %u events, %u readers\n", GRAY, BLACK, dev->name,
+               (unsigned int)dev->head, dev->readers);
+    }
+}
+
+SHELL_COMMAND(input, "input", "List input devices", cmd_input);
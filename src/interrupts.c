@@ -1,6 +1,16 @@
 #include "interrupts.h"
-#include "keyboard.h"
+#include "tasklet.h"
+#include "port.h"
+#include "gdt.h"
+#include "lapic.h"
+#include "cpu.h"
+#include "sched.h"
+#include "tlb.h"
+#include "console.h"
+#include "process.h"
+#include "syscall.h"
 #include <stdint.h>
+#include <stddef.h>
 
 // IDT entry structure
 struct IDTEntry {
@@ -23,6 +33,12 @@ struct IDTPtr {
 static struct IDTEntry idt[256];
 static struct IDTPtr idtr;
 
+// Registered handlers for the 16 legacy IRQ lines and the local interrupts
+static irq_handler_t irq_handlers[IRQ_COUNT + LOCAL_IRQ_COUNT];
+
+// Registered handlers for CPU exceptions
+static exception_handler_t exception_handlers[EXCEPTION_COUNT];
+
 // PIC (Programmable Interrupt Controller) ports
 #define PIC1_COMMAND 0x20
 #define PIC1_DATA    0x21
@@ -41,22 +57,165 @@ static void idt_set_gate(int num, uint64_t handler, uint16_t selector, uint8_t f
 }
 
 // Assembly interrupt stubs (defined at the end of this file)
-extern void keyboard_interrupt_stub(void);
+extern void irq0_stub(void);
+extern void irq1_stub(void);
+extern void irq2_stub(void);
+extern void irq3_stub(void);
+extern void irq4_stub(void);
+extern void irq5_stub(void);
+extern void irq6_stub(void);
+extern void irq7_stub(void);
+extern void irq8_stub(void);
+extern void irq9_stub(void);
+extern void irq10_stub(void);
+extern void irq11_stub(void);
+extern void irq12_stub(void);
+extern void irq13_stub(void);
+extern void irq14_stub(void);
+extern void irq15_stub(void);
+extern void irq16_stub(void);
+extern void irq17_stub(void);
+extern void irq18_stub(void);
+extern void irq19_stub(void);
+extern void irq20_stub(void);
+extern void irq21_stub(void);
+extern void irq22_stub(void);
+extern void irq23_stub(void);
+extern void irq24_stub(void);
+extern void irq25_stub(void);
+extern void irq26_stub(void);
+extern void irq27_stub(void);
+extern void irq28_stub(void);
+extern void irq29_stub(void);
+extern void irq30_stub(void);
+extern void irq31_stub(void);
+extern void spurious_stub(void);
 
-// Keyboard interrupt handler wrapper
-void keyboard_isr(void) {
-    keyboard_interrupt_handler();
-    
-    // Send End of Interrupt (EOI) to PIC
-    outb(PIC1_COMMAND, 0x20);
+// Exception entry stubs, one per vector (table at the end of this file)
+extern const uint64_t exception_stubs[EXCEPTION_COUNT];
+
+static const char* const exception_names[EXCEPTION_COUNT] = {
+    [0] = "divide error",           [1] = "debug",
+    [2] = "NMI",                    [3] = "breakpoint",
+    [4] = "overflow",               [5] = "bound range",
+    [6] = "invalid opcode",         [7] = "device not available",
+    [8] = "double fault",           [10] = "invalid TSS",
+    [11] = "segment not present",   [12] = "stack fault",
+    [13] = "general protection",    [14] = "page fault",
+    [16] = "x87 error",             [17] = "alignment check",
+    [18] = "machine check",         [19] = "SIMD error",
+};
+
+static void (*const irq_stubs[IRQ_COUNT + LOCAL_IRQ_COUNT])(void) = {
+    irq0_stub,  irq1_stub,  irq2_stub,  irq3_stub,
+    irq4_stub,  irq5_stub,  irq6_stub,  irq7_stub,
+    irq8_stub,  irq9_stub,  irq10_stub, irq11_stub,
+    irq12_stub, irq13_stub, irq14_stub, irq15_stub,
+    irq16_stub, irq17_stub, irq18_stub, irq19_stub,
+    irq20_stub, irq21_stub, irq22_stub, irq23_stub,
+    irq24_stub, irq25_stub, irq26_stub, irq27_stub,
+    irq28_stub, irq29_stub, irq30_stub, irq31_stub
+};
+
+// Common IRQ handler, called from irq_common_stub with interrupts disabled.
+// Drivers only do the minimum in their handler (the top half) and queue a
+// tasklet for the rest, which runs here after EOI with interrupts enabled.
+// Leaving the outermost interrupt is a preemption point.
+void irq_dispatch(uint64_t irq) {
+    struct cpu* cpu = this_cpu();
+    cpu->irq_depth++;
+
+    // An idle CPU may have skipped shootdowns
+    tlb_irq_enter();
+
+    if (irq < IRQ_COUNT + LOCAL_IRQ_COUNT && irq_handlers[irq]) {
+        irq_handlers[irq]();
+    }
+
+    // Send End of Interrupt (EOI) to the local APIC or the PIC(s)
+    if (irq >= LOCAL_IRQ_BASE) {
+        lapic_eoi();
+    } else {
+        if (irq >= 8) {
+            outb(PIC2_COMMAND, 0x20);
+        }
+        outb(PIC1_COMMAND, 0x20);
+    }
+
+    tasklet_run_pending();
+
+    cpu->irq_depth--;
+    sched_preempt_irq();
+}
+
+// Common exception handler, called from exception_common_stub
+void exception_dispatch(struct interrupt_frame* frame) {
+    if (frame->vector < EXCEPTION_COUNT && exception_handlers[frame->vector]) {
+        exception_handlers[frame->vector](frame);
+        return;
+    }
+    exception_unhandled(frame);
+}
+
+void exception_unhandled(struct interrupt_frame* frame) {
+    uint64_t cr2;
+    asm volatile("mov %0, cr2" : "=r"(cr2));
+    const char* name = frame->vector < EXCEPTION_COUNT ? exception_names[frame->vector] : NULL;
+
+    // A fault in user mode ends the process, not the CPU
+    struct process* proc = process_current();
+    if ((frame->cs & 3) && proc) {
+        printf("%s (pid %u): %s at %p, cr2 %p, killed\n", RED, BLACK, proc->name, proc->pid,
+               name ? name : "reserved", (void*)frame->rip, (void*)cr2);
+        process_exit(-EFAULT);
+    }
+
+    panic("CPU %u: exception %u (%s) at %p, error 0x%x, cr2 %p\n", cpu_id(),
+          (unsigned int)frame->vector, name ? name : "reserved", (void*)frame->rip,
+          (unsigned int)frame->error, (void*)cr2);
+}
+
+void exception_register(uint8_t vector, exception_handler_t handler) {
+    if (vector < EXCEPTION_COUNT) {
+        exception_handlers[vector] = handler;
+    }
+}
+
+// Unmask an IRQ line on the PIC
+void irq_unmask(uint8_t irq) {
+    if (irq < 8) {
+        outb(PIC1_DATA, inb(PIC1_DATA) & ~(1 << irq));
+    } else {
+        outb(PIC2_DATA, inb(PIC2_DATA) & ~(1 << (irq - 8)));
+    }
+}
+
+void irq_register_local(uint8_t irq, irq_handler_t handler) {
+    if (irq >= LOCAL_IRQ_BASE && irq < LOCAL_IRQ_BASE + LOCAL_IRQ_COUNT) {
+        irq_handlers[irq] = handler;
+    }
+}
+
+// Mask an IRQ line on the PIC
+void irq_mask(uint8_t irq) {
+    if (irq < 8) {
+        outb(PIC1_DATA, inb(PIC1_DATA) | (1 << irq));
+    } else {
+        outb(PIC2_DATA, inb(PIC2_DATA) | (1 << (irq - 8)));
+    }
+}
+
+// Install a handler for an IRQ line and unmask it
+void irq_register_handler(uint8_t irq, irq_handler_t handler) {
+    if (irq >= IRQ_COUNT) {
+        return;
+    }
+    irq_handlers[irq] = handler;
+    irq_unmask(irq);
 }
 
 // Initialize PIC
 static void pic_init(void) {
-    // Save current interrupt masks
-    uint8_t a1 = inb(PIC1_DATA);
-    uint8_t a2 = inb(PIC2_DATA);
-    
     // Initialize PIC1
     outb(PIC1_COMMAND, 0x11); // Initialize command
     outb(PIC1_DATA, 0x20);    // IRQ 0-7 mapped to interrupts 0x20-0x27
@@ -69,8 +228,8 @@ static void pic_init(void) {
     outb(PIC2_DATA, 0x02);    // PIC2 connected to PIC1 via IRQ2
     outb(PIC2_DATA, 0x01);    // 8086 mode
     
-    // Restore interrupt masks (disable all except keyboard)
-    outb(PIC1_DATA, 0xFD); // Enable only IRQ1 (keyboard)
+    // Mask everything except the cascade, drivers unmask their own lines
+    outb(PIC1_DATA, 0xFB); // Only IRQ2 (cascade) enabled
     outb(PIC2_DATA, 0xFF); // Disable all IRQ8-15
 }
 
@@ -81,8 +240,15 @@ void interrupts_init(void) {
         idt_set_gate(i, 0, 0, 0);
     }
     
-    // Set up keyboard interrupt (IRQ1 -> interrupt 0x21)
-    idt_set_gate(0x21, (uint64_t)keyboard_interrupt_stub, 0x08, 0x8E);
+    for (int i = 0; i < EXCEPTION_COUNT; i++) {
+        idt_set_gate(i, exception_stubs[i], GDT_KERNEL_CODE, 0x8E);
+    }
+
+    // Set up IRQ 0-15 -> interrupts 0x20-0x2F, local interrupts -> 0x30-0x3F
+    for (int i = 0; i < IRQ_COUNT + LOCAL_IRQ_COUNT; i++) {
+        idt_set_gate(IRQ_BASE + i, (uint64_t)irq_stubs[i], GDT_KERNEL_CODE, 0x8E);
+    }
+    idt_set_gate(LAPIC_SPURIOUS_VECTOR, (uint64_t)spurious_stub, GDT_KERNEL_CODE, 0x8E);
     
     // Set up IDT pointer
     idtr.limit = sizeof(idt) - 1;
@@ -98,10 +264,132 @@ void interrupts_init(void) {
     asm volatile("sti");
 }
 
-// Assembly interrupt stub for keyboard
+void interrupts_init_ap(void) {
+    asm volatile("lidt %0" : : "m"(idtr));
+}
+
+// Per-IRQ entry stubs push their IRQ number and share one common path
+#define IRQ_STUB(n)                 \
+    ".global irq" #n "_stub\n"      \
+    "irq" #n "_stub:\n"             \
+    "    push " #n "\n"             \
+    "    jmp irq_common_stub\n"
+
+asm(
+    IRQ_STUB(0)  IRQ_STUB(1)  IRQ_STUB(2)  IRQ_STUB(3)
+    IRQ_STUB(4)  IRQ_STUB(5)  IRQ_STUB(6)  IRQ_STUB(7)
+    IRQ_STUB(8)  IRQ_STUB(9)  IRQ_STUB(10) IRQ_STUB(11)
+    IRQ_STUB(12) IRQ_STUB(13) IRQ_STUB(14) IRQ_STUB(15)
+    IRQ_STUB(16) IRQ_STUB(17) IRQ_STUB(18) IRQ_STUB(19)
+    IRQ_STUB(20) IRQ_STUB(21) IRQ_STUB(22) IRQ_STUB(23)
+    IRQ_STUB(24) IRQ_STUB(25) IRQ_STUB(26) IRQ_STUB(27)
+    IRQ_STUB(28) IRQ_STUB(29) IRQ_STUB(30) IRQ_STUB(31)
+);
+
+// Spurious APIC interrupts need no EOI
+asm(
+    ".global spurious_stub\n"
+    "spurious_stub:\n"
+    "    iretq\n"
+);
+
+// Common IRQ stub: save registers, call irq_dispatch(irq) on an aligned
+// stack. Entries from ring 3 swap in the kernel GS base first.
+asm(
+    "irq_common_stub:\n"
+    "    test qword ptr [%rsp + 16], 3\n"
+    "    jz 1f\n"
+    "    swapgs\n"
+    "1:\n"
+    "    push %rax\n"
+    "    push %rbx\n"
+    "    push %rcx\n"
+    "    push %rdx\n"
+    "    push %rsi\n"
+    "    push %rdi\n"
+    "    push %rbp\n"
+    "    push %r8\n"
+    "    push %r9\n"
+    "    push %r10\n"
+    "    push %r11\n"
+    "    push %r12\n"
+    "    push %r13\n"
+    "    push %r14\n"
+    "    push %r15\n"
+    "    mov %rdi, [%rsp + 120]\n"
+    "    mov %rbp, %rsp\n"
+    "    and %rsp, -16\n"
+    "    call irq_dispatch\n"
+    "    mov %rsp, %rbp\n"
+    "    pop %r15\n"
+    "    pop %r14\n"
+    "    pop %r13\n"
+    "    pop %r12\n"
+    "    pop %r11\n"
+    "    pop %r10\n"
+    "    pop %r9\n"
+    "    pop %r8\n"
+    "    pop %rbp\n"
+    "    pop %rdi\n"
+    "    pop %rsi\n"
+    "    pop %rdx\n"
+    "    pop %rcx\n"
+    "    pop %rbx\n"
+    "    pop %rax\n"
+    "    add %rsp, 8\n"
+    "    test qword ptr [%rsp + 8], 3\n"
+    "    jz 2f\n"
+    "    swapgs\n"
+    "2:\n"
+    "    iretq\n"
+);
+// Exception stubs push a zero where the CPU pushes no error code, then the
+// vector, so every exception leaves the same frame
+#define EXC_STUB(n)                 \
+    "exc" #n "_stub:\n"             \
+    "    push 0\n"                  \
+    "    push " #n "\n"             \
+    "    jmp exception_common_stub\n"
+
+#define EXC_STUB_ERR(n)             \
+    "exc" #n "_stub:\n"             \
+    "    push " #n "\n"             \
+    "    jmp exception_common_stub\n"
+
+asm(
+    EXC_STUB(0)      EXC_STUB(1)      EXC_STUB(2)      EXC_STUB(3)
+    EXC_STUB(4)      EXC_STUB(5)      EXC_STUB(6)      EXC_STUB(7)
+    EXC_STUB_ERR(8)  EXC_STUB(9)      EXC_STUB_ERR(10) EXC_STUB_ERR(11)
+    EXC_STUB_ERR(12) EXC_STUB_ERR(13) EXC_STUB_ERR(14) EXC_STUB(15)
+    EXC_STUB(16)     EXC_STUB_ERR(17) EXC_STUB(18)     EXC_STUB(19)
+    EXC_STUB(20)     EXC_STUB_ERR(21) EXC_STUB(22)     EXC_STUB(23)
+    EXC_STUB(24)     EXC_STUB(25)     EXC_STUB(26)     EXC_STUB(27)
+    EXC_STUB(28)     EXC_STUB_ERR(29) EXC_STUB_ERR(30) EXC_STUB(31)
+);
+
+asm(
+    ".section .rodata\n"
+    ".balign 8\n"
+    ".global exception_stubs\n"
+    "exception_stubs:\n"
+    "    .quad exc0_stub,  exc1_stub,  exc2_stub,  exc3_stub\n"
+    "    .quad exc4_stub,  exc5_stub,  exc6_stub,  exc7_stub\n"
+    "    .quad exc8_stub,  exc9_stub,  exc10_stub, exc11_stub\n"
+    "    .quad exc12_stub, exc13_stub, exc14_stub, exc15_stub\n"
+    "    .quad exc16_stub, exc17_stub, exc18_stub, exc19_stub\n"
+    "    .quad exc20_stub, exc21_stub, exc22_stub, exc23_stub\n"
+    "    .quad exc24_stub, exc25_stub, exc26_stub, exc27_stub\n"
+    "    .quad exc28_stub, exc29_stub, exc30_stub, exc31_stub\n"
+    ".previous\n"
+);
+
+// Common exception stub: save registers, call exception_dispatch(frame)
 asm(
-    ".global keyboard_interrupt_stub\n"
-    "keyboard_interrupt_stub:\n"
+    "exception_common_stub:\n"
+    "    test qword ptr [%rsp + 24], 3\n"
+    "    jz 1f\n"
+    "    swapgs\n"
+    "1:\n"
     "    push %rax\n"
     "    push %rbx\n"
     "    push %rcx\n"
@@ -117,7 +405,11 @@ asm(
     "    push %r13\n"
     "    push %r14\n"
     "    push %r15\n"
-    "    call keyboard_isr\n"
+    "    mov %rdi, %rsp\n"
+    "    mov %rbp, %rsp\n"
+    "    and %rsp, -16\n"
+    "    call exception_dispatch\n"
+    "    mov %rsp, %rbp\n"
     "    pop %r15\n"
     "    pop %r14\n"
     "    pop %r13\n"
@@ -133,5 +425,10 @@ asm(
     "    pop %rcx\n"
     "    pop %rbx\n"
     "    pop %rax\n"
+    "    add %rsp, 16\n"
+    "    test qword ptr [%rsp + 8], 3\n"
+    "    jz 2f\n"
+    "    swapgs\n"
+    "2:\n"
     "    iretq\n"
 );
\ No newline at end of file
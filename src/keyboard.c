@@ -1,277 +1,440 @@
 #include "keyboard.h"
+#include "keymap.h"
+#include "input.h"
+#include "tasklet.h"
 #include "stdmem.h"
-#include "port.h"
+#include "ps2.h"
+#include "cpu.h"
+#include "timer.h"
 #include <stdint.h>
 #include <stdbool.h>
 
-// PS/2 Keyboard ports
-#define KEYBOARD_DATA_PORT    0x60
-#define KEYBOARD_STATUS_PORT  0x64
-#define KEYBOARD_COMMAND_PORT 0x64
+// Keyboard commands and replies
+#define KBD_CMD_SET_TYPEMATIC 0xF3
 
-// Keyboard status register bits
-#define KEYBOARD_STATUS_OUTPUT_FULL 0x01
-#define KEYBOARD_STATUS_INPUT_FULL  0x02
+// Slowest hardware typematic setting (1000 ms delay, 2 cps), used while
+// repeats are generated in software
+#define TYPEMATIC_SLOWEST     0x7F
+
+// Default software repeat
+#define REPEAT_DELAY_MS 500
+#define REPEAT_RATE_HZ  25
 
 // Special scan codes
 #define KEY_RELEASED_MASK 0x80
 #define EXTENDED_SCANCODE 0xE0
+#define PAUSE_SCANCODE    0xE1
+
+// Held modifier keys
+#define MODKEY_LSHIFT 0x01
+#define MODKEY_RSHIFT 0x02
+#define MODKEY_LCTRL  0x04
+#define MODKEY_RCTRL  0x08
+#define MODKEY_LALT   0x10
+#define MODKEY_RALT   0x20
 
 // Modifier key states
 static struct {
-    bool shift_left;
-    bool shift_right;
-    bool ctrl_left;
-    bool ctrl_right;
-    bool alt_left;
-    bool alt_right;
-    bool caps_lock;
-    bool num_lock;
-    bool scroll_lock;
+    uint8_t held;                   // MODKEY_* bits of modifiers held down
+    uint8_t locks;                  // KEYMOD_*_LOCK bits currently toggled on
+    uint64_t down[KC_COUNT / 64];   // Bitmap of keys held down
 } key_state = {0};
 
-// Scancode to ASCII mapping (US QWERTY layout)
-static const char scancode_to_ascii[] = {
-    0,    0,   '1', '2', '3', '4', '5', '6', '7', '8', '9', '0', '-', '=', '\b',
-    '\t', 'q', 'w', 'e', 'r', 't', 'y', 'u', 'i', 'o', 'p', '[', ']', '\n',
-    0,    'a', 's', 'd', 'f', 'g', 'h', 'j', 'k', 'l', ';', '\'', '`',
-    0,    '\\', 'z', 'x', 'c', 'v', 'b', 'n', 'm', ',', '.', '/', 0,
-    '*',  0,   ' '
+// Scancode decoder states; each state selects a scancode-to-keycode table
+enum decode_state {
+    DECODE_NORMAL = 0,  // Plain set-1 codes
+    DECODE_E0,          // After an 0xE0 prefix
+    DECODE_E1,          // After 0xE1 (Pause), first byte of two
+    DECODE_E1_2,        // Pause, second byte
+    DECODE_STATES
+};
+
+// Set-1 make codes to keycodes
+static const uint8_t sc1_normal[128] = {
+    [0x01] = KC_ESC,
+    [0x02] = KC_1, [0x03] = KC_2, [0x04] = KC_3, [0x05] = KC_4, [0x06] = KC_5,
+    [0x07] = KC_6, [0x08] = KC_7, [0x09] = KC_8, [0x0A] = KC_9, [0x0B] = KC_0,
+    [0x0C] = KC_MINUS, [0x0D] = KC_EQUAL, [0x0E] = KC_BACKSPACE, [0x0F] = KC_TAB,
+    [0x10] = KC_Q, [0x11] = KC_W, [0x12] = KC_E, [0x13] = KC_R, [0x14] = KC_T,
+    [0x15] = KC_Y, [0x16] = KC_U, [0x17] = KC_I, [0x18] = KC_O, [0x19] = KC_P,
+    [0x1A] = KC_LEFTBRACE, [0x1B] = KC_RIGHTBRACE, [0x1C] = KC_ENTER, [0x1D] = KC_LEFTCTRL,
+    [0x1E] = KC_A, [0x1F] = KC_S, [0x20] = KC_D, [0x21] = KC_F, [0x22] = KC_G,
+    [0x23] = KC_H, [0x24] = KC_J, [0x25] = KC_K, [0x26] = KC_L,
+    [0x27] = KC_SEMICOLON, [0x28] = KC_APOSTROPHE, [0x29] = KC_GRAVE,
+    [0x2A] = KC_LEFTSHIFT, [0x2B] = KC_BACKSLASH,
+    [0x2C] = KC_Z, [0x2D] = KC_X, [0x2E] = KC_C, [0x2F] = KC_V, [0x30] = KC_B,
+    [0x31] = KC_N, [0x32] = KC_M, [0x33] = KC_COMMA, [0x34] = KC_DOT, [0x35] = KC_SLASH,
+    [0x36] = KC_RIGHTSHIFT, [0x37] = KC_KPASTERISK, [0x38] = KC_LEFTALT,
+    [0x39] = KC_SPACE, [0x3A] = KC_CAPSLOCK,
+    [0x3B] = KC_F1, [0x3C] = KC_F2, [0x3D] = KC_F3, [0x3E] = KC_F4, [0x3F] = KC_F5,
+    [0x40] = KC_F6, [0x41] = KC_F7, [0x42] = KC_F8, [0x43] = KC_F9, [0x44] = KC_F10,
+    [0x45] = KC_NUMLOCK, [0x46] = KC_SCROLLLOCK,
+    [0x47] = KC_KP7, [0x48] = KC_KP8, [0x49] = KC_KP9, [0x4A] = KC_KPMINUS,
+    [0x4B] = KC_KP4, [0x4C] = KC_KP5, [0x4D] = KC_KP6, [0x4E] = KC_KPPLUS,
+    [0x4F] = KC_KP1, [0x50] = KC_KP2, [0x51] = KC_KP3, [0x52] = KC_KP0, [0x53] = KC_KPDOT,
+    [0x56] = KC_102ND, [0x57] = KC_F11, [0x58] = KC_F12,
+};
+
+// 0xE0-prefixed make codes to keycodes. The fake shifts (0x2A/0x36) that
+// some keyboards wrap around navigation keys map to KC_NONE.
+static const uint8_t sc1_extended[128] = {
+    [0x1C] = KC_KPENTER, [0x1D] = KC_RIGHTCTRL, [0x35] = KC_KPSLASH,
+    [0x37] = KC_SYSRQ, [0x38] = KC_RIGHTALT,
+    [0x47] = KC_HOME, [0x48] = KC_UP, [0x49] = KC_PAGEUP,
+    [0x4B] = KC_LEFT, [0x4D] = KC_RIGHT,
+    [0x4F] = KC_END, [0x50] = KC_DOWN, [0x51] = KC_PAGEDOWN,
+    [0x52] = KC_INSERT, [0x53] = KC_DELETE,
+    [0x5B] = KC_LEFTMETA, [0x5C] = KC_RIGHTMETA, [0x5D] = KC_COMPOSE,
+};
+
+// Pause sends E1 1D 45 E1 9D C5; the press is reported on the 0x45 byte
+static const uint8_t sc1_pause[128] = {
+    [0x45] = KC_PAUSE,
+};
+
+static const uint8_t* const decode_tables[DECODE_STATES] = {
+    [DECODE_NORMAL] = sc1_normal,
+    [DECODE_E0]     = sc1_extended,
+    [DECODE_E1]     = NULL,
+    [DECODE_E1_2]   = sc1_pause,
+};
+
+// Modifier role of each keycode
+static const uint8_t keycode_modkey[KC_COUNT] = {
+    [KC_LEFTSHIFT] = MODKEY_LSHIFT, [KC_RIGHTSHIFT] = MODKEY_RSHIFT,
+    [KC_LEFTCTRL]  = MODKEY_LCTRL,  [KC_RIGHTCTRL]  = MODKEY_RCTRL,
+    [KC_LEFTALT]   = MODKEY_LALT,   [KC_RIGHTALT]   = MODKEY_RALT,
 };
 
-// Shifted versions of the above
-static const char scancode_to_ascii_shifted[] = {
-    0,    0,   '!', '@', '#', '$', '%', '^', '&', '*', '(', ')', '_', '+', '\b',
-    '\t', 'Q', 'W', 'E', 'R', 'T', 'Y', 'U', 'I', 'O', 'P', '{', '}', '\n',
-    0,    'A', 'S', 'D', 'F', 'G', 'H', 'J', 'K', 'L', ':', '"', '~',
-    0,    '|', 'Z', 'X', 'C', 'V', 'B', 'N', 'M', '<', '>', '?', 0,
-    '*',  0,   ' '
+static const uint8_t keycode_lock[KC_COUNT] = {
+    [KC_CAPSLOCK]   = KEYMOD_CAPS_LOCK,
+    [KC_NUMLOCK]    = KEYMOD_NUM_LOCK,
+    [KC_SCROLLLOCK] = KEYMOD_SCROLL_LOCK,
 };
 
-// Scancode definitions
-#define SC_LSHIFT     0x2A
-#define SC_RSHIFT     0x36
-#define SC_LCTRL      0x1D
-#define SC_LALT       0x38
-#define SC_CAPS_LOCK  0x3A
-#define SC_NUM_LOCK   0x45
-#define SC_SCROLL_LOCK 0x46
-
-// Key buffer
-#define KEY_BUFFER_SIZE 256
-static char key_buffer[KEY_BUFFER_SIZE];
-static volatile int buffer_head = 0;
-static volatile int buffer_tail = 0;
-static volatile int buffer_count = 0;
-
-// Wait for keyboard controller to be ready for input
-static void keyboard_wait_input(void) {
-    while (inb(KEYBOARD_STATUS_PORT) & KEYBOARD_STATUS_INPUT_FULL);
+// Input device the keyboard publishes to. The keyboard bottom half is its
+// only producer.
+static struct input_device keyboard_device = { .name = "keyboard" };
+
+// Reader behind keyboard_getchar()
+static struct input_handle getchar_handle;
+static char getchar_pending = 0;
+
+// Raw scancodes queued by the interrupt handler for the bottom half.
+// Single producer (IRQ1) and single consumer (keyboard tasklet).
+#define SCANCODE_QUEUE_SIZE 64
+static struct {
+    uint64_t timestamp;
+    uint8_t scancode;
+} scancode_queue[SCANCODE_QUEUE_SIZE];
+static uint32_t scancode_head = 0;
+static uint32_t scancode_tail = 0;
+
+static void keyboard_bottom_half(void* data);
+static struct tasklet keyboard_tasklet = TASKLET_INIT(keyboard_bottom_half, NULL);
+
+// Hardware typematic byte, written again whenever the keyboard attaches
+static uint8_t typematic = TYPEMATIC_SLOWEST;
+
+// Key repeat configuration and state
+static struct {
+    bool software;          // Repeats come from the timer, hardware repeats are dropped
+    uint32_t delay_ms;      // Delay before the first repeat, 0 = repeat disabled
+    uint32_t interval_ms;   // Time between repeats
+    uint8_t keycode;        // Key being repeated, KC_NONE if none
+    uint8_t scancode;
+    volatile bool due;      // Repeat timer fired, bottom half emits the event
+} repeat = {0};
+
+static void repeat_timer_fired(void* data);
+static struct timer repeat_timer = TIMER_INIT(repeat_timer_fired, NULL);
+
+// Current modifier mask for key events
+static uint8_t key_modifiers(void) {
+    uint8_t mods = key_state.locks;
+    if (key_state.held & (MODKEY_LSHIFT | MODKEY_RSHIFT)) mods |= KEYMOD_SHIFT;
+    if (key_state.held & (MODKEY_LCTRL | MODKEY_RCTRL))   mods |= KEYMOD_CTRL;
+    if (key_state.held & (MODKEY_LALT | MODKEY_RALT))     mods |= KEYMOD_ALT;
+    if (key_state.held & MODKEY_RALT)                     mods |= KEYMOD_ALTGR;
+    return mods;
 }
 
-// Wait for keyboard controller to have output ready
-static void keyboard_wait_output(void) {
-    while (!(inb(KEYBOARD_STATUS_PORT) & KEYBOARD_STATUS_OUTPUT_FULL));
+// Publish a key event with the current modifiers, followed by a sync
+static void emit_key(uint8_t keycode, uint8_t scancode, bool pressed, bool is_repeat, uint64_t timestamp) {
+    struct input_event events[2] = {
+        {
+            .timestamp = timestamp,
+            .type = EV_KEY,
+            .code = keycode,
+            .value = !pressed ? KEY_VALUE_RELEASE : is_repeat ? KEY_VALUE_REPEAT : KEY_VALUE_PRESS,
+            .modifiers = key_modifiers(),
+            .raw = scancode,
+        },
+        { .timestamp = timestamp, .type = EV_SYN, .code = SYN_REPORT },
+    };
+    input_publish(&keyboard_device, events, 2);
 }
 
-// Add character to keyboard buffer
-static void keyboard_buffer_add(char c) {
-    if (buffer_count < KEY_BUFFER_SIZE) {
-        key_buffer[buffer_head] = c;
-        buffer_head = (buffer_head + 1) % KEY_BUFFER_SIZE;
-        buffer_count++;
+// Update key state for a decoded key and publish the event
+static void process_key(uint8_t keycode, uint8_t scancode, bool pressed, uint64_t timestamp) {
+    uint64_t bit = 1ULL << (keycode % 64);
+    uint64_t* down = &key_state.down[keycode / 64];
+    bool is_repeat = pressed && (*down & bit);
+    
+    // Hardware repeats are ignored while repeat is done in software
+    if (is_repeat && repeat.software) {
+        return;
     }
+    
+    if (pressed) {
+        *down |= bit;
+        key_state.held |= keycode_modkey[keycode];
+        // Locks toggle on the initial press only, not on typematic repeats
+        if (!is_repeat) {
+            key_state.locks ^= keycode_lock[keycode];
+        }
+    } else {
+        *down &= ~bit;
+        key_state.held &= ~keycode_modkey[keycode];
+    }
+    
+    // The last key pressed repeats until it is released; modifiers and
+    // locks never repeat
+    if (repeat.software) {
+        if (pressed && !keycode_modkey[keycode] && !keycode_lock[keycode] && repeat.delay_ms) {
+            repeat.keycode = keycode;
+            repeat.scancode = scancode;
+            repeat.due = false;
+            timer_start(&repeat_timer, repeat.delay_ms);
+        } else if (!pressed && keycode == repeat.keycode) {
+            repeat.keycode = KC_NONE;
+            timer_cancel(&repeat_timer);
+        }
+    }
+    
+    emit_key(keycode, scancode, pressed, is_repeat, timestamp);
 }
 
-// Get character from keyboard buffer
-static char keyboard_buffer_get(void) {
-    if (buffer_count > 0) {
-        char c = key_buffer[buffer_tail];
-        buffer_tail = (buffer_tail + 1) % KEY_BUFFER_SIZE;
-        buffer_count--;
-        return c;
-    }
-    return 0;
+// Repeat timer callback, the event itself is emitted by the bottom half so
+// the key event ring keeps a single producer
+static void repeat_timer_fired(void* data) {
+    (void)data;
+    repeat.due = true;
+    tasklet_schedule(&keyboard_tasklet);
 }
 
-// Process a scancode
-static void process_scancode(uint8_t scancode) {
-    bool key_released = (scancode & KEY_RELEASED_MASK) != 0;
-    uint8_t key = scancode & ~KEY_RELEASED_MASK;
+// Feed one scancode byte through the decoder state machine
+static void decode_scancode(uint8_t scancode, uint64_t timestamp) {
+    static enum decode_state state = DECODE_NORMAL;
     
-    // Handle modifier keys
-    switch (key) {
-        case SC_LSHIFT:
-            key_state.shift_left = !key_released;
-            return;
-        case SC_RSHIFT:
-            key_state.shift_right = !key_released;
-            return;
-        case SC_LCTRL:
-            key_state.ctrl_left = !key_released;
-            return;
-        case SC_LALT:
-            key_state.alt_left = !key_released;
-            return;
-        case SC_CAPS_LOCK:
-            if (!key_released) {
-                key_state.caps_lock = !key_state.caps_lock;
-            }
-            return;
-        case SC_NUM_LOCK:
-            if (!key_released) {
-                key_state.num_lock = !key_state.num_lock;
-            }
-            return;
-        case SC_SCROLL_LOCK:
-            if (!key_released) {
-                key_state.scroll_lock = !key_state.scroll_lock;
-            }
-            return;
+    if (scancode == EXTENDED_SCANCODE) {
+        state = DECODE_E0;
+        return;
     }
-    
-    // Only process key presses (not releases) for regular keys
-    if (key_released) {
+    if (scancode == PAUSE_SCANCODE) {
+        state = DECODE_E1;
+        return;
+    }
+    if (state == DECODE_E1) {
+        state = DECODE_E1_2;
         return;
     }
     
-    // Convert scancode to ASCII
-    if (key < sizeof(scancode_to_ascii)) {
-        char ascii = 0;
-        bool shift_pressed = key_state.shift_left || key_state.shift_right;
-        bool caps_active = key_state.caps_lock;
-        
-        // Determine if we should use shifted character
-        if (shift_pressed) {
-            ascii = scancode_to_ascii_shifted[key];
-        } else {
-            ascii = scancode_to_ascii[key];
-        }
-        
-        // Handle caps lock for letters
-        if (ascii >= 'a' && ascii <= 'z' && caps_active && !shift_pressed) {
-            ascii = ascii - 'a' + 'A';
-        } else if (ascii >= 'A' && ascii <= 'Z' && caps_active && shift_pressed) {
-            ascii = ascii - 'A' + 'a';
-        }
-        
-        // Handle control key combinations
-        if (key_state.ctrl_left || key_state.ctrl_right) {
-            if (ascii >= 'a' && ascii <= 'z') {
-                ascii = ascii - 'a' + 1; // Ctrl+A = 1, Ctrl+B = 2, etc.
-            } else if (ascii >= 'A' && ascii <= 'Z') {
-                ascii = ascii - 'A' + 1;
-            }
-        }
-        
-        if (ascii != 0) {
-            keyboard_buffer_add(ascii);
-        }
+    uint8_t keycode = decode_tables[state][scancode & ~KEY_RELEASED_MASK];
+    bool pressed = !(scancode & KEY_RELEASED_MASK);
+    state = DECODE_NORMAL;
+    
+    if (keycode != KC_NONE) {
+        process_key(keycode, scancode, pressed, timestamp);
     }
 }
 
-// Keyboard interrupt handler
-void keyboard_interrupt_handler(void) {
-    uint8_t status = inb(KEYBOARD_STATUS_PORT);
+// Keyboard byte handler (top half, called by the PS/2 layer for every
+// byte that is not a command reply): queue it and leave decoding to the
+// bottom half
+static void keyboard_byte(uint8_t scancode) {
+    uint32_t head = scancode_head;
+    if (head - __atomic_load_n(&scancode_tail, __ATOMIC_ACQUIRE) < SCANCODE_QUEUE_SIZE) {
+        scancode_queue[head % SCANCODE_QUEUE_SIZE].timestamp = rdtsc();
+        scancode_queue[head % SCANCODE_QUEUE_SIZE].scancode = scancode;
+        __atomic_store_n(&scancode_head, head + 1, __ATOMIC_RELEASE);
+    }
     
-    if (status & KEYBOARD_STATUS_OUTPUT_FULL) {
-        uint8_t scancode = inb(KEYBOARD_DATA_PORT);
-        
-        // Handle extended scancodes (for now, just ignore them)
-        static bool extended_scancode = false;
-        if (scancode == EXTENDED_SCANCODE) {
-            extended_scancode = true;
-            return;
-        }
+    tasklet_schedule(&keyboard_tasklet);
+}
+
+// Keyboard bottom half: decode queued scancodes with interrupts enabled
+static void keyboard_bottom_half(void* data) {
+    (void)data;
+    
+    uint32_t tail = scancode_tail;
+    while (tail != __atomic_load_n(&scancode_head, __ATOMIC_ACQUIRE)) {
+        uint8_t scancode = scancode_queue[tail % SCANCODE_QUEUE_SIZE].scancode;
+        uint64_t timestamp = scancode_queue[tail % SCANCODE_QUEUE_SIZE].timestamp;
+        tail++;
+        __atomic_store_n(&scancode_tail, tail, __ATOMIC_RELEASE);
         
-        if (extended_scancode) {
-            extended_scancode = false;
-            // Handle extended scancodes here if needed
-            // For now, we'll just ignore them
-            return;
+        decode_scancode(scancode, timestamp);
+    }
+    
+    // Software repeat of the held key
+    if (repeat.due) {
+        repeat.due = false;
+        if (repeat.keycode != KC_NONE) {
+            emit_key(repeat.keycode, repeat.scancode, true, true, rdtsc());
+            timer_start(&repeat_timer, repeat.interval_ms);
         }
-        
-        process_scancode(scancode);
     }
 }
 
-// Initialize keyboard driver
+// Program the hardware typematic byte (command 0xF3). Interrupts must be
+// enabled, the ACKs arrive through IRQ1.
+static int keyboard_write_typematic(uint8_t value) {
+    uint8_t command[2] = { KBD_CMD_SET_TYPEMATIC, value };
+    
+    typematic = value;
+    return ps2_send(PS2_PORT1, command, 2, NULL, 0) < 0 ? -1 : 0;
+}
+
+// Keyboard passed its reset: restore the typematic setting, scanning is
+// already enabled. Runs in the PS/2 bottom half, so nothing may block.
+static void keyboard_attach(int port, const uint8_t* id, size_t id_len) {
+    (void)id;
+    (void)id_len;
+    uint8_t command[2] = { KBD_CMD_SET_TYPEMATIC, typematic };
+    
+    ps2_send_async(port, command, 2, 0, NULL, NULL);
+}
+
+static const struct ps2_driver keyboard_driver = {
+    .byte = keyboard_byte,
+    .attach = keyboard_attach,
+};
+
+// Initialize keyboard driver. The device itself is brought up when the
+// PS/2 probe finds it.
 void keyboard_init(void) {
-    // Clear the buffer
-    buffer_head = 0;
-    buffer_tail = 0;
-    buffer_count = 0;
+    input_register_device(&keyboard_device);
+    input_open(&getchar_handle, &keyboard_device);
     
     // Clear modifier states
     memset(&key_state, 0, sizeof(key_state));
     
-    // Enable keyboard (this is usually already done by BIOS/UEFI)
-    keyboard_wait_input();
-    outb(KEYBOARD_COMMAND_PORT, 0xAE); // Enable keyboard
+    // Layouts must be ready before the first key is decoded
+    keymap_init();
     
-    keyboard_wait_input();
-    outb(KEYBOARD_COMMAND_PORT, 0x20); // Read controller configuration
-    keyboard_wait_output();
-    uint8_t config = inb(KEYBOARD_DATA_PORT);
+    scancode_head = 0;
+    scancode_tail = 0;
     
-    config |= 0x01; // Enable keyboard interrupt
-    config &= ~0x10; // Enable keyboard
+    // Software repeat by default; the controller keeps translation on, so
+    // the keyboard's default scancode set arrives as set 1
+    repeat.delay_ms = REPEAT_DELAY_MS;
+    repeat.interval_ms = 1000 / REPEAT_RATE_HZ;
+    repeat.software = true;
+    typematic = TYPEMATIC_SLOWEST;
     
-    keyboard_wait_input();
-    outb(KEYBOARD_COMMAND_PORT, 0x60); // Write controller configuration
-    keyboard_wait_input();
-    outb(KEYBOARD_DATA_PORT, config);
+    ps2_register_driver(PS2_PORT1, &keyboard_driver);
+}
+
+int keyboard_set_typematic(uint8_t rate, uint8_t delay) {
+    // Hand repeat back to the hardware
+    repeat.software = false;
+    repeat.keycode = KC_NONE;
+    timer_cancel(&repeat_timer);
+    
+    return keyboard_write_typematic(((delay & 0x03) << 5) | (rate & 0x1F));
+}
+
+int keyboard_set_soft_repeat(uint32_t delay_ms, uint32_t rate_hz) {
+    if (rate_hz == 0) {
+        return -1;
+    }
     
-    // Set keyboard to scancode set 1 (default)
-    keyboard_wait_input();
-    outb(KEYBOARD_DATA_PORT, 0xF0);
-    keyboard_wait_output();
-    inb(KEYBOARD_DATA_PORT); // Acknowledge
+    repeat.delay_ms = delay_ms;
+    repeat.interval_ms = 1000 / rate_hz ? 1000 / rate_hz : 1;
+    repeat.software = true;
     
-    keyboard_wait_input();
-    outb(KEYBOARD_DATA_PORT, 0x01); // Scancode set 1
-    keyboard_wait_output();
-    inb(KEYBOARD_DATA_PORT); // Acknowledge
+    // Keep hardware repeats as rare as possible, they are dropped anyway
+    return keyboard_write_typematic(TYPEMATIC_SLOWEST);
 }
 
-// Check if a key is available
-bool keyboard_has_key(void) {
-    return buffer_count > 0;
+int keyboard_disable_repeat(void) {
+    repeat.keycode = KC_NONE;
+    timer_cancel(&repeat_timer);
+    repeat.delay_ms = 0;
+    repeat.software = true;
+    
+    return keyboard_write_typematic(TYPEMATIC_SLOWEST);
 }
 
-// Get a character from keyboard (blocking)
-char keyboard_getchar(void) {
-    while (!keyboard_has_key()) {
-        asm volatile("hlt"); // Wait for interrupt
+// Get the input device the keyboard publishes to
+struct input_device* keyboard_input_device(void) {
+    return &keyboard_device;
+}
+
+// Translate a keyboard event to a character, 0 if it does not type one
+char keyboard_event_to_char(const struct input_event* ev) {
+    if (ev->type != EV_KEY || ev->value == KEY_VALUE_RELEASE) {
+        return 0;
     }
-    return keyboard_buffer_get();
+    return keymap_translate(ev->code, ev->modifiers);
 }
 
 // Get a character from keyboard (non-blocking)
 char keyboard_getchar_nonblock(void) {
-    return keyboard_buffer_get();
+    if (getchar_pending) {
+        char c = getchar_pending;
+        getchar_pending = 0;
+        return c;
+    }
+    
+    struct input_event ev;
+    while (input_read(&getchar_handle, &ev, 1) == 1) {
+        char c = keyboard_event_to_char(&ev);
+        if (c != 0) {
+            return c;
+        }
+    }
+    return 0;
+}
+
+// Check if a character is available (skips over non-character events)
+bool keyboard_has_key(void) {
+    if (!getchar_pending) {
+        getchar_pending = keyboard_getchar_nonblock();
+    }
+    return getchar_pending != 0;
+}
+
+// Get a character from keyboard (blocking)
+char keyboard_getchar(void) {
+    char c;
+    
+    while ((c = keyboard_getchar_nonblock()) == 0) {
+        input_wait(&getchar_handle, 1);
+    }
+    return c;
 }
 
 // Get modifier key states
 bool keyboard_shift_pressed(void) {
-    return key_state.shift_left || key_state.shift_right;
+    return (key_state.held & (MODKEY_LSHIFT | MODKEY_RSHIFT)) != 0;
 }
 
 bool keyboard_ctrl_pressed(void) {
-    return key_state.ctrl_left || key_state.ctrl_right;
+    return (key_state.held & (MODKEY_LCTRL | MODKEY_RCTRL)) != 0;
 }
 
 bool keyboard_alt_pressed(void) {
-    return key_state.alt_left || key_state.alt_right;
+    return (key_state.held & (MODKEY_LALT | MODKEY_RALT)) != 0;
 }
 
 bool keyboard_caps_lock_active(void) {
-    return key_state.caps_lock;
+    return (key_state.locks & KEYMOD_CAPS_LOCK) != 0;
 }
 
-// Clear keyboard buffer
+// Clear keyboard buffer (drop everything keyboard_getchar() has not read)
 void keyboard_clear_buffer(void) {
-    buffer_head = 0;
-    buffer_tail = 0;
-    buffer_count = 0;
+    getchar_pending = 0;
+    getchar_handle.cursor = __atomic_load_n(&keyboard_device.head, __ATOMIC_ACQUIRE);
 }
\ No newline at end of file
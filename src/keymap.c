@@ -0,0 +1,213 @@
+#include "keymap.h"
+#include "keyboard.h"
+#include "modules.h"
+#include "rcu.h"
+#include "stdmem.h"
+#include "console.h"
+#include "shell.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+// Built-in US QWERTY layout
+static const struct keymap keymap_us = {
+    .name = "us",
+    .normal = {
+        [KC_ESC] = 27,
+        [KC_1] = '1', [KC_2] = '2', [KC_3] = '3', [KC_4] = '4', [KC_5] = '5',
+        [KC_6] = '6', [KC_7] = '7', [KC_8] = '8', [KC_9] = '9', [KC_0] = '0',
+        [KC_MINUS] = '-', [KC_EQUAL] = '=', [KC_BACKSPACE] = '\b', [KC_TAB] = '\t',
+        [KC_Q] = 'q', [KC_W] = 'w', [KC_E] = 'e', [KC_R] = 'r', [KC_T] = 't',
+        [KC_Y] = 'y', [KC_U] = 'u', [KC_I] = 'i', [KC_O] = 'o', [KC_P] = 'p',
+        [KC_LEFTBRACE] = '[', [KC_RIGHTBRACE] = ']', [KC_ENTER] = '\n',
+        [KC_A] = 'a', [KC_S] = 's', [KC_D] = 'd', [KC_F] = 'f', [KC_G] = 'g',
+        [KC_H] = 'h', [KC_J] = 'j', [KC_K] = 'k', [KC_L] = 'l',
+        [KC_SEMICOLON] = ';', [KC_APOSTROPHE] = '\'', [KC_GRAVE] = '`', [KC_BACKSLASH] = '\\',
+        [KC_Z] = 'z', [KC_X] = 'x', [KC_C] = 'c', [KC_V] = 'v', [KC_B] = 'b',
+        [KC_N] = 'n', [KC_M] = 'm', [KC_COMMA] = ',', [KC_DOT] = '.', [KC_SLASH] = '/',
+        [KC_SPACE] = ' ', [KC_102ND] = '\\',
+        [KC_KP7] = '7', [KC_KP8] = '8', [KC_KP9] = '9', [KC_KPMINUS] = '-',
+        [KC_KP4] = '4', [KC_KP5] = '5', [KC_KP6] = '6', [KC_KPPLUS] = '+',
+        [KC_KP1] = '1', [KC_KP2] = '2', [KC_KP3] = '3', [KC_KP0] = '0', [KC_KPDOT] = '.',
+        [KC_KPASTERISK] = '*', [KC_KPSLASH] = '/', [KC_KPENTER] = '\n',
+    },
+    .shift = {
+        [KC_ESC] = 27,
+        [KC_1] = '!', [KC_2] = '@', [KC_3] = '#', [KC_4] = '$', [KC_5] = '%',
+        [KC_6] = '^', [KC_7] = '&', [KC_8] = '*', [KC_9] = '(', [KC_0] = ')',
+        [KC_MINUS] = '_', [KC_EQUAL] = '+', [KC_BACKSPACE] = '\b', [KC_TAB] = '\t',
+        [KC_Q] = 'Q', [KC_W] = 'W', [KC_E] = 'E', [KC_R] = 'R', [KC_T] = 'T',
+        [KC_Y] = 'Y', [KC_U] = 'U', [KC_I] = 'I', [KC_O] = 'O', [KC_P] = 'P',
+        [KC_LEFTBRACE] = '{', [KC_RIGHTBRACE] = '}', [KC_ENTER] = '\n',
+        [KC_A] = 'A', [KC_S] = 'S', [KC_D] = 'D', [KC_F] = 'F', [KC_G] = 'G',
+        [KC_H] = 'H', [KC_J] = 'J', [KC_K] = 'K', [KC_L] = 'L',
+        [KC_SEMICOLON] = ':', [KC_APOSTROPHE] = '"', [KC_GRAVE] = '~', [KC_BACKSLASH] = '|',
+        [KC_Z] = 'Z', [KC_X] = 'X', [KC_C] = 'C', [KC_V] = 'V', [KC_B] = 'B',
+        [KC_N] = 'N', [KC_M] = 'M', [KC_COMMA] = '<', [KC_DOT] = '>', [KC_SLASH] = '?',
+        [KC_SPACE] = ' ', [KC_102ND] = '|',
+        [KC_KPMINUS] = '-', [KC_KPPLUS] = '+', [KC_KPASTERISK] = '*',
+        [KC_KPSLASH] = '/', [KC_KPENTER] = '\n',
+    },
+    .altgr = { 0 },
+};
+
+// Loaded keymaps, slot 0 is the built-in layout
+static struct keymap keymaps[MAX_KEYMAPS];
+static size_t keymaps_loaded = 0;
+// Read on every key press, replaced only by keymap_select(); published
+// with RCU so the keyboard path never takes a lock for it
+static const struct keymap* active_keymap = &keymap_us;
+
+static void keymap_set_caps(struct keymap* map, uint8_t keycode) {
+    map->caps[keycode / 8] |= 1 << (keycode % 8);
+}
+
+static bool keymap_caps_applies(const struct keymap* map, uint8_t keycode) {
+    return (map->caps[keycode / 8] >> (keycode % 8)) & 1;
+}
+
+static bool is_keypad_key(uint8_t keycode) {
+    return keycode >= KC_KP7 && keycode <= KC_KPDOT
+        && keycode != KC_KPMINUS && keycode != KC_KPPLUS;
+}
+
+void keymap_init(void) {
+    // Built-in layout; caps lock applies to the letter keys
+    memcpy(&keymaps[0], &keymap_us, sizeof(struct keymap));
+    for (uint8_t kc = 0; kc < KC_COUNT; kc++) {
+        uint8_t c = keymap_us.normal[kc];
+        if (c >= 'a' && c <= 'z') {
+            keymap_set_caps(&keymaps[0], kc);
+        }
+    }
+    keymaps_loaded = 1;
+    active_keymap = &keymaps[0];
+
+    // Keymap modules, the first one loaded becomes active
+    size_t next = 0;
+    struct limine_file* module;
+    bool selected = false;
+    while ((module = modules_find("keymap", &next)) != NULL) {
+        if (keymap_load(module->address, module->size) == 0 && !selected) {
+            active_keymap = &keymaps[keymaps_loaded - 1];
+            selected = true;
+        }
+    }
+}
+
+int keymap_load(const void* data, size_t size) {
+    const struct keymap_file* file = (const struct keymap_file*)data;
+
+    if (!data || size < sizeof(struct keymap_file)) {
+        return -1;
+    }
+    if (memcmp(file->magic, KEYMAP_FILE_MAGIC, 4) != 0 || file->version != KEYMAP_FILE_VERSION) {
+        return -1;
+    }
+    if (keymaps_loaded >= MAX_KEYMAPS) {
+        return -1;
+    }
+
+    struct keymap* map = &keymaps[keymaps_loaded];
+    memcpy(map->name, file->name, KEYMAP_NAME_LEN);
+    map->name[KEYMAP_NAME_LEN - 1] = '\0';
+    memcpy(map->caps, file->caps, sizeof(map->caps));
+    memcpy(map->normal, file->normal, KC_COUNT);
+    memcpy(map->shift, file->shift, KC_COUNT);
+    memcpy(map->altgr, file->altgr, KC_COUNT);
+    keymaps_loaded++;
+    return 0;
+}
+
+int keymap_select(const char* name) {
+    for (size_t i = 0; i < keymaps_loaded; i++) {
+        if (strcmp(keymaps[i].name, name) == 0) {
+            rcu_assign_pointer(active_keymap, (const struct keymap*)&keymaps[i]);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+const struct keymap* keymap_active(void) {
+    return rcu_dereference(active_keymap);
+}
+
+size_t keymap_count(void) {
+    return keymaps_loaded;
+}
+
+const struct keymap* keymap_get(size_t index) {
+    return index < keymaps_loaded ? &keymaps[index] : NULL;
+}
+
+char keymap_translate(uint8_t keycode, uint8_t modifiers) {
+    if (keycode >= KC_COUNT) {
+        return 0;
+    }
+
+    // Keypad digits only type with num lock on
+    if (is_keypad_key(keycode) && !(modifiers & KEYMOD_NUM_LOCK)) {
+        return 0;
+    }
+
+    rcu_read_lock();
+    const struct keymap* map = rcu_dereference(active_keymap);
+
+    // Caps lock inverts shift for the keys it applies to
+    bool shifted = (modifiers & KEYMOD_SHIFT) != 0;
+    if ((modifiers & KEYMOD_CAPS_LOCK) && keymap_caps_applies(map, keycode)) {
+        shifted = !shifted;
+    }
+
+    // Keys without an AltGr character type as if AltGr were not held,
+    // which covers layouts (like the built-in one) without an AltGr layer
+    uint8_t c = 0;
+    if (modifiers & KEYMOD_ALTGR) {
+        c = map->altgr[keycode];
+    }
+    if (c == 0) {
+        c = shifted ? map->shift[keycode] : map->normal[keycode];
+    }
+    rcu_read_unlock();
+
+    // Handle control key combinations (Ctrl+A = 1, Ctrl+B = 2, etc.)
+    if (modifiers & KEYMOD_CTRL) {
+        if (c >= 'a' && c <= 'z') {
+            c = c - 'a' + 1;
+        } else if (c >= 'A' && c <= 'Z') {
+            c = c - 'A' + 1;
+        }
+    }
+
+    return (char)c;
+}
+
+static void cmd_keymap(int argc, char** argv) {
+    if (argc > 1) {
+        if (keymap_select(argv[1]) == 0) {
+            printf("Keymap set to %s\n", GREEN, BLACK, argv[1]);
+        } else {
+            printf("Unknown keymap: %s\n", RED, BLACK, argv[1]);
+        }
+        return;
+    }
+    const struct keymap* active = keymap_active();
+    printf("Loaded keymaps:\n", WHITE, BLACK);
+    for (size_t i = 0; i < keymap_count(); i++) {
+        const struct keymap* map = keymap_get(i);
+        printf("  %s%s\n", map == active ? GREEN : GRAY, BLACK,
+               map->name, map == active ? " (active)" : "");
+    }
+}
+
+static void complete_keymap(int argc, char** argv, struct shell_completion* comp) {
+    (void)argv;
+    if (argc != 1) {
+        return;
+    }
+    for (size_t i = 0; i < keymap_count(); i++) {
+        shell_complete_add(comp, keymap_get(i)->name);
+    }
+}
+
+SHELL_COMMAND_ARGS(keymap, "keymap", "List keymaps, 'keymap <name>' selects one", cmd_keymap, complete_keymap);
@@ -0,0 +1,132 @@
+#include "lapic.h"
+#include "interrupts.h"
+#include "vmm.h"
+#include "timer.h"
+#include "cpu.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// IA32_APIC_BASE MSR
+#define MSR_APIC_BASE        0x1B
+#define APIC_BASE_ENABLE     (1 << 11)
+#define APIC_BASE_X2APIC     (1 << 10)
+#define APIC_BASE_ADDR_MASK  0xFFFFFF000ULL
+
+// Register offsets (xAPIC MMIO; x2APIC MSR = 0x800 + offset / 16)
+#define LAPIC_REG_ID         0x020
+#define LAPIC_REG_TPR        0x080
+#define LAPIC_REG_EOI        0x0B0
+#define LAPIC_REG_SVR        0x0F0
+#define LAPIC_REG_ICR_LOW    0x300
+#define LAPIC_REG_ICR_HIGH   0x310
+#define LAPIC_REG_LVT_TIMER  0x320
+#define LAPIC_REG_TIMER_INIT 0x380
+#define LAPIC_REG_TIMER_CUR  0x390
+#define LAPIC_REG_TIMER_DIV  0x3E0
+
+#define LAPIC_SVR_ENABLE     0x100
+#define LAPIC_LVT_MASKED     0x10000
+#define LAPIC_ICR_PENDING    0x1000
+#define LAPIC_TIMER_DIV_16   0x3
+
+// Timer calibration window
+#define LAPIC_CALIBRATE_US   10000
+
+static bool x2apic = false;
+static volatile uint32_t* lapic_mmio = NULL;
+static uint64_t timer_ticks_per_ms = 0;
+
+static uint32_t lapic_read(uint32_t reg) {
+    if (x2apic) {
+        return (uint32_t)rdmsr(0x800 + reg / 16);
+    }
+    return lapic_mmio[reg / 4];
+}
+
+static void lapic_write(uint32_t reg, uint32_t value) {
+    if (x2apic) {
+        wrmsr(0x800 + reg / 16, value);
+    } else {
+        lapic_mmio[reg / 4] = value;
+    }
+}
+
+// Count the timer down from its maximum over a TSC-timed window
+static void lapic_calibrate(void) {
+    lapic_write(LAPIC_REG_TIMER_DIV, LAPIC_TIMER_DIV_16);
+    lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_REG_TIMER_INIT, UINT32_MAX);
+    timer_udelay(LAPIC_CALIBRATE_US);
+    uint32_t elapsed = UINT32_MAX - lapic_read(LAPIC_REG_TIMER_CUR);
+    lapic_write(LAPIC_REG_TIMER_INIT, 0);
+
+    timer_ticks_per_ms = (uint64_t)elapsed * 1000 / LAPIC_CALIBRATE_US;
+}
+
+void lapic_init(void) {
+    uint64_t base = rdmsr(MSR_APIC_BASE);
+    bool first = timer_ticks_per_ms == 0;
+
+    // The bootloader switches every CPU to x2APIC mode when it can
+    if (first) {
+        x2apic = (base & APIC_BASE_X2APIC) != 0;
+        if (!x2apic) {
+            lapic_mmio = vmm_map_mmio(base & APIC_BASE_ADDR_MASK, 0x1000);
+        }
+    }
+    wrmsr(MSR_APIC_BASE, base | APIC_BASE_ENABLE);
+
+    lapic_write(LAPIC_REG_TPR, 0);
+    lapic_write(LAPIC_REG_SVR, LAPIC_SVR_ENABLE | LAPIC_SPURIOUS_VECTOR);
+
+    if (first) {
+        lapic_calibrate();
+    }
+    lapic_write(LAPIC_REG_TIMER_DIV, LAPIC_TIMER_DIV_16);
+    lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_LVT_MASKED | (IRQ_BASE + LOCAL_IRQ_TIMER));
+}
+
+void lapic_eoi(void) {
+    lapic_write(LAPIC_REG_EOI, 0);
+}
+
+uint32_t lapic_id(void) {
+    uint32_t id = lapic_read(LAPIC_REG_ID);
+    return x2apic ? id : id >> 24;
+}
+
+void lapic_timer_oneshot(uint64_t us) {
+    uint64_t count = timer_ticks_per_ms * us / 1000;
+    if (count == 0) {
+        count = 1;
+    } else if (count > UINT32_MAX) {
+        count = UINT32_MAX;
+    }
+    // One-shot mode is LVT timer mode 0
+    lapic_write(LAPIC_REG_LVT_TIMER, IRQ_BASE + LOCAL_IRQ_TIMER);
+    lapic_write(LAPIC_REG_TIMER_INIT, (uint32_t)count);
+}
+
+void lapic_timer_stop(void) {
+    lapic_write(LAPIC_REG_TIMER_INIT, 0);
+}
+
+void lapic_send_ipi(uint32_t apic_id, uint8_t vector) {
+    if (x2apic) {
+        wrmsr(0x800 + LAPIC_REG_ICR_LOW / 16, ((uint64_t)apic_id << 32) | vector);
+        return;
+    }
+
+    uint64_t flags = irq_save();
+    lapic_write(LAPIC_REG_ICR_HIGH, apic_id << 24);
+    lapic_write(LAPIC_REG_ICR_LOW, vector);
+    while (lapic_read(LAPIC_REG_ICR_LOW) & LAPIC_ICR_PENDING) {
+        cpu_relax();
+    }
+    irq_restore(flags);
+}
+
+bool lapic_x2apic(void) {
+    return x2apic;
+}
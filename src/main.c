@@ -7,6 +7,23 @@
 #include "gdt.h"
 #include "interrupts.h"
 #include "keyboard.h"
+#include "mouse.h"
+#include "ps2.h"
+#include "timer.h"
+#include "smp.h"
+#include "pmm.h"
+#include "vmm.h"
+#include "sched.h"
+#include "task.h"
+#include "rcu.h"
+#include "idle.h"
+#include "tlb.h"
+#include "fpu.h"
+#include "memops.h"
+#include "syscall.h"
+#include "process.h"
+#include "vdso.h"
+#include "shell.h"
 
 // Set the base revision to 3, this is recommended as this is the latest
 // base revision described by the Limine boot protocol specification.
@@ -34,6 +51,11 @@ static void hcf(void) {
     }
 }
 
+static void shell_thread(void* arg) {
+    (void)arg;
+    shell();
+}
+
 // The following will be our kernel's entry point.
 // If renaming kernel() to something else, make sure to change the
 // linker script accordingly.
@@ -43,7 +65,9 @@ void kernel(void) {
         hcf();
     }
 
-    gdt_init_tss();
+    // Own GDT/TSS and the per-CPU area come first, everything after
+    // this may use cpu_id()
+    smp_init_bsp();
 
     // Ensure we got a framebuffer.
     if (framebuffer_request.response == NULL
@@ -61,16 +85,61 @@ void kernel(void) {
     interrupts_init();
     printf("Interrupts initialized!\n", GREEN, BLACK);
 
-    printf("Initializing keyboard...\n", BLUE, BLACK);
-    keyboard_init();
-    printf("Keyboard initialized!\n", GREEN, BLACK);
+    printf("Initializing timer...\n", BLUE, BLACK);
+    timer_init();
+    printf("Timer initialized! TSC: %u MHz\n", GREEN, BLACK, (unsigned int)(timer_tsc_hz() / 1000000));
+
+    printf("Initializing memory and scheduler...\n", BLUE, BLACK);
+    pmm_init();
+    vmm_init();
+    vmm_init_cpu();
+    tlb_init_cpu();
+    fpu_init_cpu();
+    memops_init();
+    syscall_init_cpu();
+    process_init();
+    vdso_init();
+    idle_init();
+    sched_init_cpu();
+    printf("%u MiB free\n", GREEN, BLACK, (unsigned int)(pmm_free_page_count() * PAGE_SIZE / (1024 * 1024)));
+    if (idle_mwait_supported()) {
+        printf("Idle: MWAIT, %u C-states\n", GREEN, BLACK, (unsigned int)idle_cstate_count());
+    } else {
+        printf("Idle: HLT\n", GRAY, BLACK);
+    }
+    printf("FPU: %s, %u byte state, %s memory kernels\n", GREEN, BLACK,
+           fpu_has_xsaveopt() ? "XSAVEOPT" : fpu_has_xsave() ? "XSAVE" : "FXSAVE",
+           (unsigned int)fpu_state_size(), memops_level());
+
+    printf("Starting application processors...\n", BLUE, BLACK);
+    unsigned int online = smp_start_aps();
+    printf("%u of %u CPUs online\n", online == cpu_count() ? GREEN : RED, BLACK, online, cpu_count());
+    rcu_init();
+    task_runtime_init();
+    console_start_renderer();
+
+    printf("Initializing PS/2 controller...\n", BLUE, BLACK);
+    if (ps2_controller_init() == 0) {
+        // Drivers bind to their ports; the devices are reset in the
+        // background and come up whenever they answer
+        keyboard_init();
+        mouse_init();
+        ps2_probe_start();
+        printf("PS/2 controller initialized, probing devices\n", GREEN, BLACK);
+    } else {
+        printf("No PS/2 controller found\n", GRAY, BLACK);
+    }
 
     printf("GDT TSS Started!\n\n", BLUE, BLACK);
 
     printf("Welcome to Valern!\n", GRAY, BLACK);
     printf("A minimal operating system.\n\n", GRAY, BLACK);
         
-    shell();
+    shell_init();
 
-    hcf(); // Nothing else to do currently, halt.
+    // The shell runs as a thread; the boot context becomes the BSP's idle thread
+    if (thread_create("shell", shell_thread, NULL, THREAD_PRIO_NORMAL, 0) == NULL) {
+        panic("Failed to start the shell thread\n");
+    }
+    sched_idle();
 }
\ No newline at end of file
@@ -0,0 +1,183 @@
+#include "memops.h"
+#include "simd.h"
+#include "fpu.h"
+#include "stdmem.h"
+#include "pmm.h"
+#include "smp.h"
+#include "timer.h"
+#include "console.h"
+#include "shell.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Below this, saving the FPU owner and writing CR0 costs more than the
+// vector loop gains
+#define SIMD_MIN_BYTES 512
+
+struct memops {
+    const char* name;
+    void (*fill32)(uint32_t* dst, uint32_t value, size_t count);
+    void (*copy)(void* dst, const void* src, size_t size);
+    uint64_t (*sum32)(const void* data, size_t size);
+};
+
+static const struct memops ops_sse2 = {
+    .name = "SSE2",
+    .fill32 = simd_fill32_sse2,
+    .copy = simd_copy_sse2,
+    .sum32 = simd_sum32_sse2,
+};
+
+static const struct memops ops_avx2 = {
+    .name = "AVX2",
+    .fill32 = simd_fill32_avx2,
+    .copy = simd_copy_avx2,
+    .sum32 = simd_sum32_avx2,
+};
+
+static const struct memops* ops = NULL;
+
+void memops_init(void) {
+    // SSE2 is part of x86-64; AVX2 also needs the OS to save AVX state
+    ops = fpu_has_avx2() ? &ops_avx2 : &ops_sse2;
+}
+
+const char* memops_level(void) {
+    return ops ? ops->name : "scalar";
+}
+
+// Whether size is worth a vector kernel, and this context may run one
+static bool use_vector(size_t size) {
+    return ops != NULL && size >= SIMD_MIN_BYTES && kernel_fpu_usable();
+}
+
+void scalar_fill32(uint32_t* dst, uint32_t value, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        dst[i] = value;
+    }
+}
+
+static uint32_t fold32(uint64_t total) {
+    while (total >> 32) {
+        total = (total & 0xFFFFFFFF) + (total >> 32);
+    }
+    return (uint32_t)total;
+}
+
+uint32_t scalar_checksum(const void* data, size_t size) {
+    const uint8_t* p = data;
+    uint64_t total = 0;
+
+    for (; size >= 4; size -= 4, p += 4) {
+        total += *(const uint32_t*)p;
+    }
+    uint32_t last = 0;
+    for (size_t i = 0; i < size; i++) {
+        last |= (uint32_t)p[i] << (i * 8);
+    }
+    return fold32(total + last);
+}
+
+void fast_memset(void* dst, int value, size_t size) {
+    if (!use_vector(size)) {
+        memset(dst, value, size);
+        return;
+    }
+
+    // Bytes up to a word boundary, words, then the rest
+    uint8_t* p = dst;
+    size_t head = (4 - ((uintptr_t)p & 3)) & 3;
+    memset(p, value, head);
+    p += head;
+    size -= head;
+
+    kernel_fpu_begin();
+    ops->fill32((uint32_t*)p, (uint8_t)value * 0x01010101U, size / 4);
+    kernel_fpu_end();
+    memset(p + (size & ~(size_t)3), value, size & 3);
+}
+
+void fast_memcpy(void* dst, const void* src, size_t size) {
+    if (!use_vector(size)) {
+        memcpy(dst, src, size);
+        return;
+    }
+    kernel_fpu_begin();
+    ops->copy(dst, src, size);
+    kernel_fpu_end();
+}
+
+void fast_fill32(uint32_t* dst, uint32_t value, size_t count) {
+    if (!use_vector(count * 4)) {
+        scalar_fill32(dst, value, count);
+        return;
+    }
+    kernel_fpu_begin();
+    ops->fill32(dst, value, count);
+    kernel_fpu_end();
+}
+
+uint32_t mem_checksum(const void* data, size_t size) {
+    if (!use_vector(size)) {
+        return scalar_checksum(data, size);
+    }
+    kernel_fpu_begin();
+    uint64_t total = ops->sum32(data, size);
+    kernel_fpu_end();
+    return fold32(total);
+}
+
+static void cmd_simd(int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+    // 4 MiB through the scalar loops and the vector kernels
+    size_t pages = 1024;
+    uint64_t phys = pmm_alloc_pages(pages * 2);
+    if (phys == 0) {
+        printf("Out of memory\n", RED, BLACK);
+        return;
+    }
+    uint8_t* src = phys_to_virt(phys);
+    uint8_t* dst = src + pages * PAGE_SIZE;
+    size_t size = pages * PAGE_SIZE;
+    uint64_t scalar[3], vector[3];
+
+    uint64_t start = rdtsc();
+    scalar_fill32((uint32_t*)src, 0x01234567, size / 4);
+    scalar[0] = rdtsc() - start;
+    start = rdtsc();
+    fast_fill32((uint32_t*)src, 0x89ABCDEF, size / 4);
+    vector[0] = rdtsc() - start;
+
+    start = rdtsc();
+    memcpy(dst, src, size);
+    scalar[1] = rdtsc() - start;
+    start = rdtsc();
+    fast_memcpy(dst, src, size);
+    vector[1] = rdtsc() - start;
+
+    start = rdtsc();
+    uint32_t expected = scalar_checksum(dst, size);
+    scalar[2] = rdtsc() - start;
+    start = rdtsc();
+    uint32_t sum = mem_checksum(dst, size);
+    vector[2] = rdtsc() - start;
+    pmm_free_pages(phys, pages * 2);
+
+    static const char* const names[] = { "fill", "copy", "checksum" };
+    printf("Memory kernels: %s, 4 MiB (scalar/vector us)\n", WHITE, BLACK, memops_level());
+    for (int i = 0; i < 3; i++) {
+        printf("  %s: %u/%u\n", GRAY, BLACK, names[i],
+               (unsigned int)(tsc_to_ns(scalar[i]) / 1000), (unsigned int)(tsc_to_ns(vector[i]) / 1000));
+    }
+    printf("  checksums %s\n", sum == expected ? GREEN : RED, BLACK, sum == expected ? "match" : "differ");
+    for (unsigned int i = 0; i < cpu_count(); i++) {
+        struct fpu_stats stats;
+        fpu_get_stats(i, &stats);
+        printf("  cpu%u: %u #NM, %u saves, %u kernel sections\n", GRAY, BLACK, i,
+               (unsigned int)stats.traps, (unsigned int)stats.saves, (unsigned int)stats.kernel_sections);
+    }
+}
+
+SHELL_COMMAND(simd, "simd", "Benchmark the vector memory kernels", cmd_simd);
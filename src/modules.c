@@ -0,0 +1,51 @@
+#include "modules.h"
+#include "stdmem.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+__attribute__((used, section(".limine_requests")))
+static volatile struct limine_module_request module_request = {
+    .id = LIMINE_MODULE_REQUEST,
+    .revision = 0
+};
+
+size_t modules_count(void) {
+    if (module_request.response == NULL) {
+        return 0;
+    }
+    return module_request.response->module_count;
+}
+
+struct limine_file* modules_get(size_t index) {
+    if (index >= modules_count()) {
+        return NULL;
+    }
+    return module_request.response->modules[index];
+}
+
+static bool starts_with(const char* str, const char* prefix) {
+    if (!str) {
+        return false;
+    }
+    while (*prefix) {
+        if (*str++ != *prefix++) {
+            return false;
+        }
+    }
+    return true;
+}
+
+struct limine_file* modules_find(const char* prefix, size_t* next) {
+    size_t count = modules_count();
+
+    for (size_t i = next ? *next : 0; i < count; i++) {
+        struct limine_file* module = module_request.response->modules[i];
+        if (starts_with(module->string, prefix)) {
+            if (next) {
+                *next = i + 1;
+            }
+            return module;
+        }
+    }
+    return NULL;
+}
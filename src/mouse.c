@@ -0,0 +1,233 @@
+#include "mouse.h"
+#include "input.h"
+#include "tasklet.h"
+#include "ps2.h"
+#include "cpu.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Mouse commands
+#define MOUSE_CMD_SET_SAMPLE_RATE 0xF3
+#define MOUSE_CMD_GET_ID          0xF2
+#define MOUSE_CMD_ENABLE_REPORTING 0xF4
+#define MOUSE_CMD_SET_DEFAULTS    0xF6
+
+// Device IDs
+#define MOUSE_ID_STANDARD     0x00
+#define MOUSE_ID_INTELLIMOUSE 0x03
+#define MOUSE_ID_EXPLORER     0x04
+
+// First packet byte
+#define MOUSE_PACKET_BUTTONS    0x07
+#define MOUSE_PACKET_ALWAYS_ONE 0x08
+#define MOUSE_PACKET_X_SIGN     0x10
+#define MOUSE_PACKET_Y_SIGN     0x20
+#define MOUSE_PACKET_OVERFLOW   0xC0
+
+static struct input_device mouse_device = { .name = "mouse" };
+static bool present = false;
+static bool wheel = false;
+static uint8_t packet_size = 3;
+
+// Packet being assembled by the interrupt handler
+static uint8_t packet[4];
+static uint8_t packet_index = 0;
+
+// Complete packets, single producer (IRQ12) and single consumer (tasklet)
+#define PACKET_QUEUE_SIZE 64
+static struct {
+    uint64_t timestamp;
+    uint8_t bytes[4];
+} packet_queue[PACKET_QUEUE_SIZE];
+static uint32_t packet_head = 0;
+static uint32_t packet_tail = 0;
+
+// Button state last published
+static uint8_t buttons = 0;
+
+static void mouse_bottom_half(void* data);
+static struct tasklet mouse_tasklet = TASKLET_INIT(mouse_bottom_half, NULL);
+
+static const uint16_t button_codes[3] = { BTN_LEFT, BTN_RIGHT, BTN_MIDDLE };
+
+// Init script sent once the mouse has passed its reset: defaults, then
+// the IntelliMouse knock (sample rates 200, 100, 80) that unlocks the
+// wheel, then the ID read that tells whether it worked
+static const uint8_t mouse_init_script[] = {
+    MOUSE_CMD_SET_DEFAULTS,
+    MOUSE_CMD_SET_SAMPLE_RATE, 200,
+    MOUSE_CMD_SET_SAMPLE_RATE, 100,
+    MOUSE_CMD_SET_SAMPLE_RATE, 80,
+    MOUSE_CMD_GET_ID,
+};
+
+static const uint8_t mouse_enable = MOUSE_CMD_ENABLE_REPORTING;
+
+// Reporting is on, packets start flowing through mouse_byte()
+static void mouse_enabled(int port, int status, const uint8_t* reply, size_t reply_len, void* data) {
+    (void)port;
+    (void)reply;
+    (void)reply_len;
+    (void)data;
+
+    if (status == 0) {
+        present = true;
+        input_register_device(&mouse_device);
+    }
+}
+
+static void mouse_identified(int port, int status, const uint8_t* reply, size_t reply_len, void* data) {
+    (void)data;
+
+    if (status != 0) {
+        return;
+    }
+    uint8_t id = reply_len ? reply[0] : MOUSE_ID_STANDARD;
+    wheel = (id == MOUSE_ID_INTELLIMOUSE || id == MOUSE_ID_EXPLORER);
+    packet_size = wheel ? 4 : 3;
+    packet_index = 0;
+
+    ps2_send_async(port, &mouse_enable, 1, 0, mouse_enabled, NULL);
+}
+
+// Mouse passed its reset (PS/2 bottom half): run the init script
+static void mouse_attach(int port, const uint8_t* id, size_t id_len) {
+    (void)id;
+    (void)id_len;
+
+    ps2_send_async(port, mouse_init_script, sizeof(mouse_init_script), 1, mouse_identified, NULL);
+}
+
+// Mouse byte handler (top half, called by the PS/2 layer): assemble the
+// packet and only wake the bottom half once a whole packet has arrived
+static void mouse_byte(uint8_t byte) {
+    // Resynchronise on the always-one bit of the first byte
+    if (packet_index == 0 && !(byte & MOUSE_PACKET_ALWAYS_ONE)) {
+        return;
+    }
+    packet[packet_index++] = byte;
+    if (packet_index < packet_size) {
+        return;
+    }
+    packet_index = 0;
+
+    // Overflowed motion is meaningless
+    if (packet[0] & MOUSE_PACKET_OVERFLOW) {
+        return;
+    }
+
+    uint32_t head = packet_head;
+    if (head - __atomic_load_n(&packet_tail, __ATOMIC_ACQUIRE) < PACKET_QUEUE_SIZE) {
+        packet_queue[head % PACKET_QUEUE_SIZE].timestamp = rdtsc();
+        for (int i = 0; i < 4; i++) {
+            packet_queue[head % PACKET_QUEUE_SIZE].bytes[i] = i < packet_size ? packet[i] : 0;
+        }
+        __atomic_store_n(&packet_head, head + 1, __ATOMIC_RELEASE);
+    }
+
+    tasklet_schedule(&mouse_tasklet);
+}
+
+static const struct ps2_driver mouse_driver = {
+    .byte = mouse_byte,
+    .attach = mouse_attach,
+};
+
+void mouse_init(void) {
+    packet_index = 0;
+    packet_head = 0;
+    packet_tail = 0;
+    ps2_register_driver(PS2_PORT2, &mouse_driver);
+}
+
+// Motion accumulated over consecutive packets with unchanged buttons
+struct motion {
+    int32_t dx;
+    int32_t dy;
+    int32_t wheel;
+    uint64_t timestamp;
+};
+
+// Append the accumulated motion (if any) and a sync to events
+static size_t flush_motion(struct motion* m, struct input_event* events, size_t count) {
+    if (m->dx) {
+        events[count++] = (struct input_event){ .timestamp = m->timestamp, .type = EV_REL, .code = REL_X, .value = m->dx };
+    }
+    if (m->dy) {
+        events[count++] = (struct input_event){ .timestamp = m->timestamp, .type = EV_REL, .code = REL_Y, .value = m->dy };
+    }
+    if (m->wheel) {
+        events[count++] = (struct input_event){ .timestamp = m->timestamp, .type = EV_REL, .code = REL_WHEEL, .value = m->wheel };
+    }
+    if (count) {
+        events[count++] = (struct input_event){ .timestamp = m->timestamp, .type = EV_SYN, .code = SYN_REPORT };
+    }
+    m->dx = m->dy = m->wheel = 0;
+    return count;
+}
+
+// Mouse bottom half: merge consecutive motion with the same button state
+// into one report, so a fast-moving mouse costs readers one report per
+// batch instead of one per packet
+static void mouse_bottom_half(void* data) {
+    (void)data;
+    struct input_event events[8];
+    struct motion pending = {0};
+
+    uint32_t tail = packet_tail;
+    while (tail != __atomic_load_n(&packet_head, __ATOMIC_ACQUIRE)) {
+        uint8_t* bytes = packet_queue[tail % PACKET_QUEUE_SIZE].bytes;
+        uint64_t timestamp = packet_queue[tail % PACKET_QUEUE_SIZE].timestamp;
+        uint8_t new_buttons = bytes[0] & MOUSE_PACKET_BUTTONS;
+
+        // 9-bit two's complement deltas; PS/2 Y grows upwards, ours down
+        int32_t dx = (int32_t)bytes[1] - ((bytes[0] & MOUSE_PACKET_X_SIGN) ? 0x100 : 0);
+        int32_t dy = (int32_t)bytes[2] - ((bytes[0] & MOUSE_PACKET_Y_SIGN) ? 0x100 : 0);
+        int32_t dz = wheel ? (int8_t)(bytes[3] << 4) >> 4 : 0;
+
+        tail++;
+        __atomic_store_n(&packet_tail, tail, __ATOMIC_RELEASE);
+
+        // A button change ends the merge: publish motion so far, then the buttons
+        if (new_buttons != buttons) {
+            size_t count = flush_motion(&pending, events, 0);
+            for (int i = 0; i < 3; i++) {
+                uint8_t bit = 1 << i;
+                if ((new_buttons ^ buttons) & bit) {
+                    events[count++] = (struct input_event){
+                        .timestamp = timestamp,
+                        .type = EV_KEY,
+                        .code = button_codes[i],
+                        .value = (new_buttons & bit) ? KEY_VALUE_PRESS : KEY_VALUE_RELEASE,
+                    };
+                }
+            }
+            events[count++] = (struct input_event){ .timestamp = timestamp, .type = EV_SYN, .code = SYN_REPORT };
+            input_publish(&mouse_device, events, count);
+            buttons = new_buttons;
+        }
+
+        pending.dx += dx;
+        pending.dy -= dy;
+        pending.wheel -= dz;
+        pending.timestamp = timestamp;
+    }
+
+    size_t count = flush_motion(&pending, events, 0);
+    if (count) {
+        input_publish(&mouse_device, events, count);
+    }
+}
+
+bool mouse_present(void) {
+    return present;
+}
+
+bool mouse_has_wheel(void) {
+    return wheel;
+}
+
+struct input_device* mouse_input_device(void) {
+    return &mouse_device;
+}
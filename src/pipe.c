@@ -0,0 +1,315 @@
+#include "pipe.h"
+#include "process.h"
+#include "syscall.h"
+#include "vmm.h"
+#include "pmm.h"
+#include "stdmem.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+static struct pipe_stats stats;
+
+struct pipe* pipe_create(uint32_t flags) {
+    uint64_t phys = pmm_alloc_page();
+    if (phys == 0) {
+        return NULL;
+    }
+    struct pipe* pipe = phys_to_virt(phys);
+    memset(pipe, 0, sizeof(struct pipe));
+    pipe->flags = flags;
+    pipe->readers = 1;
+    pipe->writers = 1;
+    pipe->refs = 2;
+    pipe->read_wq = (struct waitqueue)WAITQUEUE_INIT;
+    pipe->write_wq = (struct waitqueue)WAITQUEUE_INIT;
+    return pipe;
+}
+
+void pipe_open(struct pipe* pipe, bool write) {
+    uint64_t flags = spin_lock_irqsave(&pipe->lock);
+    if (write) {
+        pipe->writers++;
+    } else {
+        pipe->readers++;
+    }
+    __atomic_add_fetch(&pipe->refs, 1, __ATOMIC_RELAXED);
+    spin_unlock_irqrestore(&pipe->lock, flags);
+}
+
+void pipe_close(struct pipe* pipe, bool write) {
+    uint64_t flags = spin_lock_irqsave(&pipe->lock);
+    if (write) {
+        pipe->writers--;
+    } else {
+        pipe->readers--;
+    }
+    spin_unlock_irqrestore(&pipe->lock, flags);
+
+    // Readers see end of file, writers a broken pipe. The other side may
+    // close its last end meanwhile; our reference keeps the pipe until
+    // we are done with its waitqueues.
+    waitqueue_wake_all(&pipe->read_wq);
+    waitqueue_wake_all(&pipe->write_wq);
+    if (__atomic_sub_fetch(&pipe->refs, 1, __ATOMIC_ACQ_REL) != 0) {
+        return;
+    }
+    for (size_t i = 0; i < pipe->seg_count; i++) {
+        struct pipe_segment* seg = &pipe->segments[(pipe->seg_head + i) % PIPE_SEGMENTS];
+        if (seg->phys) {
+            pmm_page_put(seg->phys);
+        }
+    }
+    pmm_free_page(virt_to_phys(pipe));
+}
+
+// Sleep on wq until ready(pipe) holds, returns with the pipe locked
+static uint64_t lock_when(struct pipe* pipe, struct waitqueue* wq, bool (*ready)(const struct pipe* pipe)) {
+    struct wait_entry w = { 0 };
+    uint64_t flags;
+    for (;;) {
+        wait_prepare(wq, &w);
+        flags = spin_lock_irqsave(&pipe->lock);
+        if (ready(pipe)) {
+            break;
+        }
+        spin_unlock_irqrestore(&pipe->lock, flags);
+        schedule();
+    }
+    wait_finish(wq, &w);
+    return flags;
+}
+
+static bool writer_free(const struct pipe* pipe) {
+    return !pipe->writing;
+}
+
+static bool reader_free(const struct pipe* pipe) {
+    return !pipe->reading;
+}
+
+static bool has_data(const struct pipe* pipe) {
+    return pipe->seg_count > 0 || pipe->writers == 0;
+}
+
+static size_t tail_index(const struct pipe* pipe) {
+    return (pipe->seg_head + pipe->seg_count - 1) % PIPE_SEGMENTS;
+}
+
+// Whether ring bytes can extend the last segment
+static bool tail_open(const struct pipe* pipe) {
+    if (pipe->seg_count == 0) {
+        return false;
+    }
+    const struct pipe_segment* tail = &pipe->segments[tail_index(pipe)];
+    return tail->phys == 0 && !(tail->flags & SEGMENT_END);
+}
+
+static bool page_space(const struct pipe* pipe) {
+    return pipe->readers == 0 || pipe->seg_count < PIPE_SEGMENTS;
+}
+
+static bool ring_space(const struct pipe* pipe) {
+    return pipe->readers == 0 ||
+           (pipe->ring_used < PIPE_RING_SIZE && (tail_open(pipe) || pipe->seg_count < PIPE_SEGMENTS));
+}
+
+static void push_segment(struct pipe* pipe, uint64_t phys, size_t len, bool end) {
+    struct pipe_segment* seg = &pipe->segments[(pipe->seg_head + pipe->seg_count) % PIPE_SEGMENTS];
+    *seg = (struct pipe_segment){ .phys = phys, .offset = 0, .len = (uint32_t)len, .flags = end ? SEGMENT_END : 0 };
+    pipe->seg_count++;
+}
+
+// Copy into the ring behind the queued bytes (pipe locked)
+static void ring_put(struct pipe* pipe, const uint8_t* src, size_t len) {
+    size_t pos = (pipe->ring_head + pipe->ring_used) % PIPE_RING_SIZE;
+    size_t first = PIPE_RING_SIZE - pos < len ? PIPE_RING_SIZE - pos : len;
+    memcpy(pipe->ring + pos, src, first);
+    memcpy(pipe->ring, src + first, len - first);
+    pipe->ring_used += len;
+}
+
+// Copy out of the ring from pos; the bytes stay queued until consumed, so
+// the writer does not touch them and no lock is needed
+static void ring_get(const struct pipe* pipe, size_t pos, uint8_t* dst, size_t len) {
+    size_t first = PIPE_RING_SIZE - pos < len ? PIPE_RING_SIZE - pos : len;
+    memcpy(dst, pipe->ring + pos, first);
+    memcpy(dst + first, pipe->ring, len - first);
+}
+
+// Take the page at src for the pipe: shared copy-on-write, or copied once
+// if it is not the process's own (file pages). 0 if out of memory.
+static uint64_t lend_page(struct process* proc, uint64_t src) {
+    uint64_t phys = process_share_page(proc, src);
+    if (phys != 0) {
+        __atomic_add_fetch(&stats.pages_lent, 1, __ATOMIC_RELAXED);
+        return phys;
+    }
+    phys = pmm_alloc_page();
+    if (phys != 0) {
+        memcpy(phys_to_virt(phys), (const void*)src, PAGE_SIZE);
+        __atomic_add_fetch(&stats.bytes_copied, PAGE_SIZE, __ATOMIC_RELAXED);
+    }
+    return phys;
+}
+
+int64_t pipe_write(struct pipe* pipe, struct process* proc, uint64_t buf, size_t len) {
+    if (len == 0) {
+        return 0;
+    }
+    // Faults the source in: the copies below run with the pipe locked
+    if (!user_access_ok(buf, len, false)) {
+        return -EFAULT;
+    }
+    bool message = pipe->flags & PIPE_MESSAGE;
+    uint64_t flags = lock_when(pipe, &pipe->write_wq, writer_free);
+    pipe->writing = true;
+    spin_unlock_irqrestore(&pipe->lock, flags);
+
+    size_t done = 0;
+    while (done < len) {
+        uint64_t src = buf + done;
+        size_t left = len - done;
+        size_t n;
+        uint64_t phys = 0;
+
+        if (!(src & (PAGE_SIZE - 1)) && left >= PAGE_SIZE) {
+            phys = lend_page(proc, src);
+        }
+        if (phys != 0) {
+            flags = lock_when(pipe, &pipe->write_wq, page_space);
+            if (pipe->readers == 0) {
+                spin_unlock_irqrestore(&pipe->lock, flags);
+                pmm_page_put(phys);
+                break;
+            }
+            n = PAGE_SIZE;
+            push_segment(pipe, phys, n, message && done + n == len);
+        } else {
+            flags = lock_when(pipe, &pipe->write_wq, ring_space);
+            if (pipe->readers == 0) {
+                spin_unlock_irqrestore(&pipe->lock, flags);
+                break;
+            }
+            n = PIPE_RING_SIZE - pipe->ring_used < left ? PIPE_RING_SIZE - pipe->ring_used : left;
+            ring_put(pipe, (const uint8_t*)src, n);
+            bool end = message && done + n == len;
+            if (tail_open(pipe)) {
+                struct pipe_segment* tail = &pipe->segments[tail_index(pipe)];
+                tail->len += n;
+                tail->flags |= end ? SEGMENT_END : 0;
+            } else {
+                push_segment(pipe, 0, n, end);
+            }
+            __atomic_add_fetch(&stats.bytes_copied, n, __ATOMIC_RELAXED);
+        }
+        spin_unlock_irqrestore(&pipe->lock, flags);
+        waitqueue_wake_all(&pipe->read_wq);
+        done += n;
+    }
+
+    flags = spin_lock_irqsave(&pipe->lock);
+    pipe->writing = false;
+    spin_unlock_irqrestore(&pipe->lock, flags);
+    waitqueue_wake_all(&pipe->write_wq);
+    return done > 0 ? (int64_t)done : -EPIPE;
+}
+
+// Make [dst, dst + len) present and writable for the copy
+static int prefault(struct process* proc, uint64_t dst, size_t len) {
+    for (uint64_t page = dst & ~(uint64_t)(PAGE_SIZE - 1); page < dst + len; page += PAGE_SIZE) {
+        if (process_fault(proc, page, true) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int64_t pipe_read(struct pipe* pipe, struct process* proc, uint64_t buf, size_t len) {
+    if (len == 0) {
+        return 0;
+    }
+    if (buf < USER_BASE || buf >= USER_TOP || len > USER_TOP - buf) {
+        return -EFAULT;
+    }
+    // With the read side to ourselves, the head segment stays put while
+    // the pipe is unlocked
+    uint64_t flags = lock_when(pipe, &pipe->read_wq, reader_free);
+    pipe->reading = true;
+    spin_unlock_irqrestore(&pipe->lock, flags);
+
+    size_t done = 0;
+    bool failed = false;
+    while (done < len) {
+        // Once something was read, return it rather than wait for more
+        if (done > 0) {
+            flags = spin_lock_irqsave(&pipe->lock);
+        } else {
+            flags = lock_when(pipe, &pipe->read_wq, has_data);
+        }
+        if (pipe->seg_count == 0) {
+            spin_unlock_irqrestore(&pipe->lock, flags);
+            break;
+        }
+        struct pipe_segment seg = pipe->segments[pipe->seg_head];
+        size_t ring_pos = pipe->ring_head;
+        spin_unlock_irqrestore(&pipe->lock, flags);
+
+        uint64_t dst = buf + done;
+        size_t left = len - done;
+        size_t n;
+        bool flipped = false;
+        if (seg.phys && seg.offset == 0 && seg.len == PAGE_SIZE && !(dst & (PAGE_SIZE - 1)) &&
+            left >= PAGE_SIZE && process_adopt_page(proc, dst, seg.phys) == 0) {
+            n = PAGE_SIZE;
+            flipped = true;
+            __atomic_add_fetch(&stats.pages_flipped, 1, __ATOMIC_RELAXED);
+        } else {
+            n = seg.len < left ? seg.len : left;
+            if (prefault(proc, dst, n) != 0) {
+                failed = true;
+                break;
+            }
+            if (seg.phys) {
+                memcpy((void*)dst, (const uint8_t*)phys_to_virt(seg.phys) + seg.offset, n);
+            } else {
+                ring_get(pipe, ring_pos, (uint8_t*)dst, n);
+            }
+            __atomic_add_fetch(&stats.bytes_copied, n, __ATOMIC_RELAXED);
+        }
+
+        flags = spin_lock_irqsave(&pipe->lock);
+        struct pipe_segment* head = &pipe->segments[pipe->seg_head];
+        head->offset += n;
+        head->len -= n;
+        if (head->phys == 0) {
+            pipe->ring_head = (pipe->ring_head + n) % PIPE_RING_SIZE;
+            pipe->ring_used -= n;
+        }
+        if (head->len == 0) {
+            pipe->seg_head = (pipe->seg_head + 1) % PIPE_SEGMENTS;
+            pipe->seg_count--;
+        }
+        spin_unlock_irqrestore(&pipe->lock, flags);
+        waitqueue_wake_all(&pipe->write_wq);
+
+        // A flipped page now belongs to the reader's address space
+        if (seg.phys && n == seg.len && !flipped) {
+            pmm_page_put(seg.phys);
+        }
+        done += n;
+        if (n == seg.len && (seg.flags & SEGMENT_END)) {
+            break;
+        }
+    }
+
+    flags = spin_lock_irqsave(&pipe->lock);
+    pipe->reading = false;
+    spin_unlock_irqrestore(&pipe->lock, flags);
+    waitqueue_wake_all(&pipe->read_wq);
+    return failed && done == 0 ? -EFAULT : (int64_t)done;
+}
+
+void pipe_get_stats(struct pipe_stats* out) {
+    *out = stats;
+}
@@ -0,0 +1,203 @@
+#include "pmm.h"
+#include "spinlock.h"
+#include "stdmem.h"
+#include "console.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <limine.h>
+
+__attribute__((used, section(".limine_requests")))
+static volatile struct limine_memmap_request memmap_request = {
+    .id = LIMINE_MEMMAP_REQUEST,
+    .revision = 0
+};
+
+__attribute__((used, section(".limine_requests")))
+static volatile struct limine_hhdm_request hhdm_request = {
+    .id = LIMINE_HHDM_REQUEST,
+    .revision = 0
+};
+
+uint64_t hhdm_offset = 0;
+
+// One bit per page frame up to the highest usable address, set = in use
+static uint64_t* bitmap = NULL;
+static size_t bitmap_pages = 0;     // Frames covered by the bitmap
+static size_t total_pages = 0;      // Usable frames
+static size_t free_pages = 0;
+static size_t next_hint = 0;        // Next-fit search start
+static uint32_t* page_shares = NULL; // Extra owners per frame
+static mcs_lock_t pmm_lock = MCS_LOCK_INIT_NAMED("pmm");
+
+static inline bool page_used(size_t page) {
+    return (bitmap[page / 64] >> (page % 64)) & 1;
+}
+
+static inline void page_set(size_t page) {
+    bitmap[page / 64] |= 1ULL << (page % 64);
+}
+
+static inline void page_clear(size_t page) {
+    bitmap[page / 64] &= ~(1ULL << (page % 64));
+}
+
+void pmm_init(void) {
+    struct limine_memmap_response* memmap = memmap_request.response;
+    if (memmap == NULL || hhdm_request.response == NULL) {
+        return;
+    }
+    hhdm_offset = hhdm_request.response->offset;
+
+    uint64_t highest = 0;
+    for (uint64_t i = 0; i < memmap->entry_count; i++) {
+        struct limine_memmap_entry* e = memmap->entries[i];
+        if (e->type == LIMINE_MEMMAP_USABLE && e->base + e->length > highest) {
+            highest = e->base + e->length;
+        }
+    }
+    bitmap_pages = highest / PAGE_SIZE;
+    size_t bitmap_bytes = ((bitmap_pages + 63) / 64) * 8;
+
+    // The bitmap lives at the start of the first usable region big enough
+    for (uint64_t i = 0; i < memmap->entry_count; i++) {
+        struct limine_memmap_entry* e = memmap->entries[i];
+        if (e->type == LIMINE_MEMMAP_USABLE && e->length >= bitmap_bytes) {
+            bitmap = phys_to_virt(e->base);
+            break;
+        }
+    }
+    if (bitmap == NULL) {
+        return;
+    }
+
+    // Everything starts out used, then the usable regions are released
+    memset(bitmap, 0xFF, bitmap_bytes);
+    for (uint64_t i = 0; i < memmap->entry_count; i++) {
+        struct limine_memmap_entry* e = memmap->entries[i];
+        if (e->type != LIMINE_MEMMAP_USABLE) {
+            continue;
+        }
+        for (uint64_t addr = e->base; addr + PAGE_SIZE <= e->base + e->length; addr += PAGE_SIZE) {
+            page_clear(addr / PAGE_SIZE);
+            total_pages++;
+            free_pages++;
+        }
+    }
+
+    // Reserve the bitmap itself and page zero
+    uint64_t bitmap_phys = virt_to_phys(bitmap);
+    for (size_t p = 0; p < (bitmap_bytes + PAGE_SIZE - 1) / PAGE_SIZE; p++) {
+        page_set(bitmap_phys / PAGE_SIZE + p);
+        free_pages--;
+    }
+    if (!page_used(0)) {
+        page_set(0);
+        free_pages--;
+    }
+
+    // fork and page lending count sharers here, they cannot work without it
+    size_t shares_bytes = bitmap_pages * sizeof(uint32_t);
+    uint64_t shares_phys = pmm_alloc_pages((shares_bytes + PAGE_SIZE - 1) / PAGE_SIZE);
+    if (shares_phys == 0) {
+        panic("PMM: no memory for the page share counts (%u KiB)\n", (unsigned int)(shares_bytes / 1024));
+    }
+    page_shares = phys_to_virt(shares_phys);
+    memset(page_shares, 0, shares_bytes);
+}
+
+// Find count free frames in a row, starting the search at the hint
+static size_t find_free_run(size_t count) {
+    for (int pass = 0; pass < 2; pass++) {
+        size_t start = pass == 0 ? next_hint : 0;
+        size_t end = pass == 0 ? bitmap_pages : next_hint;
+        size_t run = 0;
+
+        for (size_t page = start; page < end; page++) {
+            // Skip fully used words quickly
+            if (run == 0 && page % 64 == 0 && bitmap[page / 64] == UINT64_MAX) {
+                page += 63;
+                continue;
+            }
+            if (page_used(page)) {
+                run = 0;
+                continue;
+            }
+            if (++run == count) {
+                return page + 1 - count;
+            }
+        }
+    }
+    return 0;
+}
+
+uint64_t pmm_alloc_pages(size_t count) {
+    if (count == 0 || bitmap == NULL) {
+        return 0;
+    }
+
+    struct mcs_node node;
+    uint64_t flags = mcs_lock_irqsave(&pmm_lock, &node);
+    size_t first = free_pages >= count ? find_free_run(count) : 0;
+    if (first != 0) {
+        for (size_t p = first; p < first + count; p++) {
+            page_set(p);
+        }
+        free_pages -= count;
+        next_hint = first + count;
+    }
+    mcs_unlock_irqrestore(&pmm_lock, &node, flags);
+
+    return (uint64_t)first * PAGE_SIZE;
+}
+
+uint64_t pmm_alloc_page(void) {
+    return pmm_alloc_pages(1);
+}
+
+void pmm_free_pages(uint64_t phys, size_t count) {
+    size_t first = phys / PAGE_SIZE;
+
+    struct mcs_node node;
+    uint64_t flags = mcs_lock_irqsave(&pmm_lock, &node);
+    for (size_t p = first; p < first + count && p < bitmap_pages; p++) {
+        if (page_used(p)) {
+            page_clear(p);
+            free_pages++;
+        }
+    }
+    mcs_unlock_irqrestore(&pmm_lock, &node, flags);
+}
+
+void pmm_free_page(uint64_t phys) {
+    pmm_free_pages(phys, 1);
+}
+
+void pmm_page_get(uint64_t phys) {
+    __atomic_add_fetch(&page_shares[phys / PAGE_SIZE], 1, __ATOMIC_RELAXED);
+}
+
+bool pmm_page_put(uint64_t phys) {
+    uint32_t* shares = &page_shares[phys / PAGE_SIZE];
+    uint32_t old = __atomic_load_n(shares, __ATOMIC_ACQUIRE);
+
+    while (old != 0) {
+        if (__atomic_compare_exchange_n(shares, &old, old - 1, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            return false;
+        }
+    }
+    pmm_free_page(phys);
+    return true;
+}
+
+uint32_t pmm_page_shares(uint64_t phys) {
+    return __atomic_load_n(&page_shares[phys / PAGE_SIZE], __ATOMIC_ACQUIRE);
+}
+
+size_t pmm_total_pages(void) {
+    return total_pages;
+}
+
+size_t pmm_free_page_count(void) {
+    return free_pages;
+}
@@ -0,0 +1,536 @@
+#include "process.h"
+#include "vmm.h"
+#include "pmm.h"
+#include "gdt.h"
+#include "cpu.h"
+#include "spinlock.h"
+#include "interrupts.h"
+#include "tlb.h"
+#include "vdso.h"
+#include "fbdev.h"
+#include "stdmem.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define XSTR(x) STR(x)
+#define STR(x) #x
+
+// Page fault error code bits
+#define PF_PRESENT  0x1         // Protection violation, not a missing page
+#define PF_WRITE    0x2
+
+// RFLAGS bits user code may set: the arithmetic flags, TF and DF
+#define RFLAGS_USER 0xDD5
+
+// user_resume() reads the frame by offset
+_Static_assert(offsetof(struct syscall_frame, rdi) == 88, "user_resume offsets");
+_Static_assert(offsetof(struct syscall_frame, rsp) == 120, "user_resume offsets");
+
+static spinlock_t process_lock = SPINLOCK_INIT_NAMED("process");
+static struct process* processes = NULL;
+static uint32_t next_pid = 1;
+
+// Drop to ring 3 with the registers in frame (defined below)
+extern __attribute__((noreturn)) void user_resume(const struct syscall_frame* frame);
+
+// Process around an existing address space, on the process list
+static struct process* alloc_process(const char* name, uint64_t pml4, struct process* parent) {
+    uint64_t phys = pmm_alloc_page();
+    if (phys == 0) {
+        return NULL;
+    }
+    struct process* proc = phys_to_virt(phys);
+    memset(proc, 0, sizeof(struct process));
+    proc->pml4 = pml4;
+    proc->parent = parent;
+    for (size_t i = 0; i < PROCESS_NAME_LEN - 1 && name[i]; i++) {
+        proc->name[i] = name[i];
+    }
+    proc->state = PROCESS_NEW;
+    proc->exit_wq = (struct waitqueue)WAITQUEUE_INIT;
+
+    uint64_t flags = spin_lock_irqsave(&process_lock);
+    proc->pid = next_pid++;
+    proc->next = processes;
+    processes = proc;
+    spin_unlock_irqrestore(&process_lock, flags);
+    return proc;
+}
+
+struct process* process_create(const char* name) {
+    uint64_t pml4 = vmm_create_space();
+    if (pml4 == 0) {
+        return NULL;
+    }
+    struct process* proc = vdso_map(pml4) == 0 ? alloc_process(name, pml4, NULL) : NULL;
+    if (proc == NULL) {
+        vmm_destroy_space(pml4);
+    }
+    return proc;
+}
+
+int process_map(struct process* proc, uint64_t virt, size_t size, uint64_t flags) {
+    uint64_t end = virt + size;
+    for (uint64_t page = virt & ~(uint64_t)(PAGE_SIZE - 1); page < end; page += PAGE_SIZE) {
+        if (vmm_user_pte(proc->pml4, page) & PTE_PRESENT) {
+            continue;
+        }
+        uint64_t phys = pmm_alloc_page();
+        if (phys == 0) {
+            return -1;
+        }
+        memset(phys_to_virt(phys), 0, PAGE_SIZE);
+        if (vmm_map_user(proc->pml4, page, phys, flags) != 0) {
+            pmm_free_page(phys);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int process_add_region(struct process* proc, uint64_t start, uint64_t end,
+                       uint64_t file_phys, uint64_t file_end, uint32_t flags) {
+    start &= ~(uint64_t)(PAGE_SIZE - 1);
+    end = (end + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1);
+    if (proc->region_count == PROCESS_MAX_REGIONS || start < USER_BASE || end > USER_TOP || start >= end) {
+        return -1;
+    }
+    if ((start < VDSO_END && VDSO_DATA < end) || (start < FB_USER_BASE + FB_USER_SIZE && FB_USER_BASE < end)) {
+        return -1;
+    }
+    for (size_t i = 0; i < proc->region_count; i++) {
+        if (start < proc->regions[i].end && proc->regions[i].start < end) {
+            return -1;
+        }
+    }
+    proc->regions[proc->region_count++] = (struct vm_region){
+        .start = start,
+        .end = end,
+        .file_end = file_end > start ? file_end : start,
+        .file_phys = file_phys,
+        .flags = flags,
+    };
+    return 0;
+}
+
+uint64_t process_add_stack(struct process* proc) {
+    uint64_t base = USER_STACK_TOP - USER_STACK_PAGES * PAGE_SIZE;
+    if (process_add_region(proc, base, USER_STACK_TOP, 0, base, REGION_WRITE) != 0) {
+        return 0;
+    }
+    return USER_STACK_TOP;
+}
+
+static struct vm_region* find_region(struct process* proc, uint64_t addr) {
+    for (size_t i = 0; i < proc->region_count; i++) {
+        if (addr >= proc->regions[i].start && addr < proc->regions[i].end) {
+            return &proc->regions[i];
+        }
+    }
+    return NULL;
+}
+
+// Replace the page at virt and drop the old translation (only CPUs
+// running this address space can hold it)
+static int remap(struct process* proc, uint64_t virt, uint64_t phys, uint64_t flags) {
+    if (vmm_map_user(proc->pml4, virt, phys, flags) != 0) {
+        return -1;
+    }
+    struct tlb_gather gather;
+    tlb_gather_init(&gather, proc->pml4);
+    tlb_gather_add(&gather, virt);
+    tlb_gather_finish(&gather);
+    return 0;
+}
+
+int process_fault(struct process* proc, uint64_t addr, bool write) {
+    uint64_t page = addr & ~(uint64_t)(PAGE_SIZE - 1);
+    uint64_t pte = vmm_user_pte(proc->pml4, page);
+
+    if ((pte & PTE_PRESENT) && (!write || (pte & PTE_WRITABLE))) {
+        return 0;
+    }
+    struct vm_region* region = find_region(proc, page);
+    if (region == NULL || (write && !(region->flags & REGION_WRITE))) {
+        return -1;
+    }
+
+    uint64_t flags = (region->flags & REGION_EXEC) ? 0 : PTE_NX;
+    uint64_t file_page = region->file_phys + (page - region->start);
+    size_t file_bytes = 0;
+    if (page < region->file_end) {
+        file_bytes = region->file_end - page < PAGE_SIZE ? region->file_end - page : PAGE_SIZE;
+    }
+
+    // Whole file pages are read in place until the first write
+    if (!(pte & PTE_PRESENT) && !write && file_bytes == PAGE_SIZE) {
+        if (vmm_map_user(proc->pml4, page, file_page, flags | PTE_SHARED) != 0) {
+            return -1;
+        }
+        proc->stats.faults++;
+        proc->stats.shared_pages++;
+        return 0;
+    }
+
+    if (region->flags & REGION_WRITE) {
+        flags |= PTE_WRITABLE;
+    }
+    uint64_t old = pte & PTE_ADDR_MASK;
+
+    // Copy-on-write page whose other owners have copied it or exited
+    if ((pte & PTE_COW) && pmm_page_shares(old) == 0) {
+        if (remap(proc, page, old, flags) != 0) {
+            return -1;
+        }
+        proc->stats.faults++;
+        return 0;
+    }
+
+    uint64_t phys = pmm_alloc_page();
+    if (phys == 0) {
+        return -1;
+    }
+    uint8_t* dst = phys_to_virt(phys);
+    if (pte & PTE_PRESENT) {
+        // Write to a shared file or copy-on-write page: take a private copy
+        memcpy(dst, phys_to_virt(old), PAGE_SIZE);
+    } else {
+        memcpy(dst, phys_to_virt(file_page), file_bytes);
+        memset(dst + file_bytes, 0, PAGE_SIZE - file_bytes);
+    }
+    // A missing page has no translation to flush
+    int mapped = (pte & PTE_PRESENT) ? remap(proc, page, phys, flags) : vmm_map_user(proc->pml4, page, phys, flags);
+    if (mapped != 0) {
+        pmm_free_page(phys);
+        return -1;
+    }
+    proc->stats.faults++;
+    if (pte & PTE_COW) {
+        pmm_page_put(old);
+        proc->stats.cow_copies++;
+    } else {
+        if (pte & PTE_PRESENT) {
+            proc->stats.shared_pages--;
+        }
+        proc->stats.private_pages++;
+    }
+    return 0;
+}
+
+uint64_t process_share_page(struct process* proc, uint64_t virt) {
+    uint64_t pte = vmm_user_pte(proc->pml4, virt);
+    if (!(pte & PTE_PRESENT) || (pte & PTE_SHARED)) {
+        return 0;
+    }
+    uint64_t phys = pte & PTE_ADDR_MASK;
+    pmm_page_get(phys);
+    if ((pte & PTE_WRITABLE) && remap(proc, virt, phys, (pte & PTE_NX) | PTE_COW) != 0) {
+        pmm_page_put(phys);
+        return 0;
+    }
+    return phys;
+}
+
+int process_adopt_page(struct process* proc, uint64_t virt, uint64_t phys) {
+    struct vm_region* region = find_region(proc, virt);
+    if (region == NULL || !(region->flags & REGION_WRITE)) {
+        return -1;
+    }
+    uint64_t flags = ((region->flags & REGION_EXEC) ? 0 : PTE_NX) | PTE_COW;
+    uint64_t old = vmm_user_pte(proc->pml4, virt);
+    int mapped = (old & PTE_PRESENT) ? remap(proc, virt, phys, flags) : vmm_map_user(proc->pml4, virt, phys, flags);
+    if (mapped != 0) {
+        return -1;
+    }
+    if (old & PTE_SHARED) {
+        proc->stats.shared_pages--;
+    } else if (old & PTE_PRESENT) {
+        pmm_page_put(old & PTE_ADDR_MASK);
+    }
+    return 0;
+}
+
+static void page_fault(struct interrupt_frame* frame) {
+    uint64_t cr2;
+    asm volatile("mov %0, cr2" : "=r"(cr2));
+    struct process* proc = process_current();
+    bool write = (frame->error & PF_WRITE) != 0;
+
+    // Present pages only fault for writes worth resolving; anything else
+    // (execute from NX, reserved bits) is the program's fault
+    if ((frame->cs & 3) && proc && (!(frame->error & PF_PRESENT) || write) &&
+        process_fault(proc, cr2, write) == 0) {
+        return;
+    }
+    exception_unhandled(frame);
+}
+
+void process_init(void) {
+    exception_register(EXCEPTION_PF, page_fault);
+}
+
+int process_copy_to(struct process* proc, uint64_t virt, const void* src, size_t size) {
+    const uint8_t* from = src;
+    while (size > 0) {
+        uint64_t pte = vmm_user_pte(proc->pml4, virt);
+        if (!(pte & PTE_PRESENT)) {
+            return -1;
+        }
+        size_t offset = virt & (PAGE_SIZE - 1);
+        size_t chunk = PAGE_SIZE - offset < size ? PAGE_SIZE - offset : size;
+        memcpy((uint8_t*)phys_to_virt(pte & PTE_ADDR_MASK) + offset, from, chunk);
+        from += chunk;
+        virt += chunk;
+        size -= chunk;
+    }
+    return 0;
+}
+
+static void process_thread_main(void* arg) {
+    struct process* proc = arg;
+    struct thread* self = thread_current();
+
+    irq_save();
+    self->process = proc;
+    proc->thread = self;
+    process_switch(self);
+    user_resume(&proc->regs);
+}
+
+static int start_thread(struct process* proc) {
+    proc->state = PROCESS_RUNNING;
+    if (thread_create(proc->name, process_thread_main, proc, THREAD_PRIO_NORMAL, THREAD_ANY_CPU) == NULL) {
+        proc->state = PROCESS_NEW;
+        return -1;
+    }
+    return 0;
+}
+
+int process_start(struct process* proc, uint64_t entry, uint64_t stack_top, uint64_t arg) {
+    memset(&proc->regs, 0, sizeof(proc->regs));
+    proc->regs.rip = entry;
+    proc->regs.rsp = stack_top;
+    proc->regs.rdi = arg;
+    proc->regs.rflags = RFLAGS_IF;
+    return start_thread(proc);
+}
+
+struct process* process_fork(struct process* parent, const struct syscall_frame* regs) {
+    uint64_t pml4 = vmm_clone_space(parent->pml4);
+    if (pml4 == 0) {
+        return NULL;
+    }
+    struct process* child = alloc_process(parent->name, pml4, parent);
+    if (child == NULL) {
+        vmm_destroy_space(pml4);
+        return NULL;
+    }
+    memcpy(child->regions, parent->regions, sizeof(parent->regions));
+    memcpy(child->files, parent->files, sizeof(parent->files));
+    for (size_t i = 0; i < PROCESS_MAX_FILES; i++) {
+        if (child->files[i].pipe) {
+            pipe_open(child->files[i].pipe, child->files[i].write);
+        }
+    }
+    child->region_count = parent->region_count;
+    child->entry = parent->entry;
+    child->stack_top = parent->stack_top;
+    // The mappings are inherited, the fault history is not
+    child->stats.private_pages = parent->stats.private_pages;
+    child->stats.shared_pages = parent->stats.shared_pages;
+
+    child->regs = *regs;
+    child->regs.rax = 0;
+    child->regs.rflags = (regs->rflags & RFLAGS_USER) | RFLAGS_IF;
+    if (start_thread(child) != 0) {
+        process_destroy(child);
+        return NULL;
+    }
+    return child;
+}
+
+int process_add_file(struct process* proc, struct pipe* pipe, bool write) {
+    for (size_t i = 0; i < PROCESS_MAX_FILES; i++) {
+        if (proc->files[i].pipe == NULL) {
+            proc->files[i] = (struct process_file){ .pipe = pipe, .write = write };
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+struct process_file* process_get_file(struct process* proc, uint64_t fd) {
+    if (fd >= PROCESS_MAX_FILES || proc->files[fd].pipe == NULL) {
+        return NULL;
+    }
+    return &proc->files[fd];
+}
+
+int process_close_file(struct process* proc, uint64_t fd) {
+    struct process_file* file = process_get_file(proc, fd);
+    if (file == NULL) {
+        return -1;
+    }
+    pipe_close(file->pipe, file->write);
+    file->pipe = NULL;
+    return 0;
+}
+
+static void close_files(struct process* proc) {
+    for (size_t i = 0; i < PROCESS_MAX_FILES; i++) {
+        process_close_file(proc, i);
+    }
+}
+
+void process_destroy(struct process* proc) {
+    close_files(proc);
+    uint64_t flags = spin_lock_irqsave(&process_lock);
+    for (struct process** link = &processes; *link; link = &(*link)->next) {
+        if (*link == proc) {
+            *link = proc->next;
+            break;
+        }
+    }
+    spin_unlock_irqrestore(&process_lock, flags);
+
+    vmm_destroy_space(proc->pml4);
+    pmm_free_page(virt_to_phys(proc));
+}
+
+int64_t process_wait(struct process* proc, struct process_stats* stats) {
+    struct wait_entry w = { 0 };
+    for (;;) {
+        wait_prepare(&proc->exit_wq, &w);
+        if (__atomic_load_n(&proc->state, __ATOMIC_ACQUIRE) == PROCESS_ZOMBIE) {
+            break;
+        }
+        schedule();
+    }
+    wait_finish(&proc->exit_wq, &w);
+
+    int64_t code = proc->exit_code;
+    if (stats) {
+        *stats = proc->stats;
+    }
+    process_destroy(proc);
+    return code;
+}
+
+int64_t process_wait_child(struct process* parent, uint32_t pid) {
+    struct process* child = NULL;
+
+    uint64_t flags = spin_lock_irqsave(&process_lock);
+    for (struct process* proc = processes; proc; proc = proc->next) {
+        if (proc->pid == pid && proc->parent == parent) {
+            child = proc;
+            break;
+        }
+    }
+    spin_unlock_irqrestore(&process_lock, flags);
+
+    // Only parent waits for its children, so child stays valid
+    if (child == NULL) {
+        return -ECHILD;
+    }
+    return process_wait(child, NULL);
+}
+
+struct process* process_current(void) {
+    struct thread* self = thread_current();
+    return self ? self->process : NULL;
+}
+
+void process_exit(int64_t code) {
+    struct process* proc = process_current();
+    proc->exit_code = code;
+    // Readers of our pipes see end of file without waiting for the reaper,
+    // and the console gets the screen back
+    close_files(proc);
+    fbdev_release(proc);
+    thread_exit();
+}
+
+void process_switch(struct thread* next) {
+    vmm_switch_space(next->process ? next->process->pml4 : vmm_kernel_pml4());
+    this_cpu()->syscall_rsp = next->stack_top;
+}
+
+// Orphans are freed from the RCU thread: process_thread_dead() runs in the
+// middle of a context switch, too early to tear down an address space
+static void free_orphan(struct rcu_head* head) {
+    process_destroy((struct process*)((uint8_t*)head - offsetof(struct process, free_head)));
+}
+
+// Called once the CPU has left the thread's address space for good, so
+// the waiter may tear it down
+void process_thread_dead(struct thread* t) {
+    struct process* proc = t->process;
+
+    uint64_t flags = spin_lock_irqsave(&process_lock);
+    // Nobody will wait for our children any more
+    for (struct process* child = processes; child; child = child->next) {
+        if (child->parent != proc) {
+            continue;
+        }
+        child->parent = NULL;
+        child->orphan = true;
+        if (child->state == PROCESS_ZOMBIE) {
+            call_rcu(&child->free_head, free_orphan);
+        }
+    }
+    proc->thread = NULL;
+    __atomic_store_n(&proc->state, PROCESS_ZOMBIE, __ATOMIC_RELEASE);
+    bool orphan = proc->orphan;
+    spin_unlock_irqrestore(&process_lock, flags);
+
+    if (orphan) {
+        call_rcu(&proc->free_head, free_orphan);
+    } else {
+        waitqueue_wake_all(&proc->exit_wq);
+    }
+}
+
+bool user_access_ok(uint64_t ptr, size_t size, bool write) {
+    struct process* proc = process_current();
+    if (proc == NULL || ptr < USER_BASE || ptr >= USER_TOP || size > USER_TOP - ptr) {
+        return false;
+    }
+    for (uint64_t page = ptr & ~(uint64_t)(PAGE_SIZE - 1); page < ptr + size; page += PAGE_SIZE) {
+        if (process_fault(proc, page, write) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// user_resume(frame): build an interrupt frame for ring 3 from a struct
+// syscall_frame and return into it with every register from the frame;
+// rcx and r11 (clobbered by SYSCALL anyway) are cleared
+asm(
+    ".global user_resume\n"
+    "user_resume:\n"
+    "    cli\n"
+    "    push " XSTR(GDT_USER_DATA) " + " XSTR(GDT_RPL_USER) "\n"
+    "    push qword ptr [%rdi + 120]\n"
+    "    push qword ptr [%rdi + 112]\n"
+    "    push " XSTR(GDT_USER_CODE) " + " XSTR(GDT_RPL_USER) "\n"
+    "    push qword ptr [%rdi + 104]\n"
+    "    mov %r15, qword ptr [%rdi + 0]\n"
+    "    mov %r14, qword ptr [%rdi + 8]\n"
+    "    mov %r13, qword ptr [%rdi + 16]\n"
+    "    mov %r12, qword ptr [%rdi + 24]\n"
+    "    mov %rbp, qword ptr [%rdi + 32]\n"
+    "    mov %rbx, qword ptr [%rdi + 40]\n"
+    "    mov %r9, qword ptr [%rdi + 48]\n"
+    "    mov %r8, qword ptr [%rdi + 56]\n"
+    "    mov %r10, qword ptr [%rdi + 64]\n"
+    "    mov %rdx, qword ptr [%rdi + 72]\n"
+    "    mov %rsi, qword ptr [%rdi + 80]\n"
+    "    mov %rax, qword ptr [%rdi + 96]\n"
+    "    mov %rdi, qword ptr [%rdi + 88]\n"
+    "    xor %ecx, %ecx\n"
+    "    xor %r11d, %r11d\n"
+    "    swapgs\n"
+    "    iretq\n"
+);
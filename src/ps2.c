@@ -0,0 +1,541 @@
+#include "ps2.h"
+#include "port.h"
+#include "interrupts.h"
+#include "tasklet.h"
+#include "timer.h"
+#include "cpu.h"
+#include "idle.h"
+#include "sched.h"
+#include "mouse.h"
+#include "console.h"
+#include "shell.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Bound on a single controller handshake (input buffer drain or output
+// byte), the 8042 answers its own commands well within a millisecond
+#define PS2_IO_TIMEOUT_US     10000
+
+// Bytes flushed from the output buffer at most, a stuck status bit must
+// not keep us here
+#define PS2_FLUSH_LIMIT       32
+
+// Device transfer timeouts. A reset takes up to ~750 ms before the BAT
+// code; every other reply follows its command within a few milliseconds.
+#define PS2_ACK_TIMEOUT_MS    20
+#define PS2_REPLY_TIMEOUT_MS  50
+#define PS2_RESET_TIMEOUT_MS  1000
+#define PS2_RESEND_RETRIES    3
+
+#define PS2_TRANSFER_MAX      8
+#define PS2_RX_QUEUE_SIZE     16
+
+// Transfer phases
+enum ps2_phase {
+    PS2_PHASE_IDLE = 0,
+    PS2_PHASE_ACK,      // Waiting for the ACK of bytes[sent]
+    PS2_PHASE_REPLY     // All bytes ACKed, collecting reply bytes
+};
+
+struct ps2_port {
+    enum ps2_port_state state;
+    const struct ps2_driver* driver;
+
+    // Bytes received while a transfer is active. Single producer (the
+    // interrupt handler) and single consumer (the PS/2 bottom half).
+    uint8_t rx[PS2_RX_QUEUE_SIZE];
+    uint32_t rx_head;
+    uint32_t rx_tail;
+
+    // Transfer in flight, owned by the bottom half once started
+    volatile bool busy;
+    enum ps2_phase phase;
+    uint8_t bytes[PS2_TRANSFER_MAX];
+    size_t count;
+    size_t sent;
+    uint8_t reply[PS2_TRANSFER_MAX];
+    size_t reply_len;
+    size_t received;
+    int retries;
+    uint64_t deadline;          // Tick by which the next byte must arrive
+    ps2_done_t done;
+    void* data;
+    struct timer timeout;
+};
+
+static bool controller_present = false;
+static struct ps2_port ports[PS2_NUM_PORTS];
+
+static void ps2_bottom_half(void* data);
+static void ps2_timeout_fired(void* data);
+static struct tasklet ps2_tasklet = TASKLET_INIT(ps2_bottom_half, NULL);
+
+// Wait until the controller can take a byte / has a byte for us
+static int ps2_wait_input(void) {
+    uint64_t deadline = rdtsc() + us_to_tsc(PS2_IO_TIMEOUT_US);
+    while (inb(PS2_STATUS_PORT) & PS2_STATUS_INPUT_FULL) {
+        if (rdtsc() >= deadline) {
+            return -1;
+        }
+        cpu_relax();
+    }
+    return 0;
+}
+
+static int ps2_wait_output(void) {
+    uint64_t deadline = rdtsc() + us_to_tsc(PS2_IO_TIMEOUT_US);
+    while (!(inb(PS2_STATUS_PORT) & PS2_STATUS_OUTPUT_FULL)) {
+        if (rdtsc() >= deadline) {
+            return -1;
+        }
+        cpu_relax();
+    }
+    return 0;
+}
+
+int ps2_write_command(uint8_t command) {
+    if (ps2_wait_input() != 0) {
+        return -1;
+    }
+    outb(PS2_COMMAND_PORT, command);
+    return 0;
+}
+
+int ps2_write_data(uint8_t data) {
+    if (ps2_wait_input() != 0) {
+        return -1;
+    }
+    outb(PS2_DATA_PORT, data);
+    return 0;
+}
+
+int ps2_read_data(uint8_t* data) {
+    if (ps2_wait_output() != 0) {
+        return -1;
+    }
+    *data = inb(PS2_DATA_PORT);
+    return 0;
+}
+
+// Controller command that answers with one byte
+static int ps2_command_reply(uint8_t command, uint8_t* reply) {
+    if (ps2_write_command(command) != 0) {
+        return -1;
+    }
+    return ps2_read_data(reply);
+}
+
+static int ps2_write_config(uint8_t config) {
+    if (ps2_write_command(PS2_CMD_WRITE_CONFIG) != 0) {
+        return -1;
+    }
+    return ps2_write_data(config);
+}
+
+// Drop whatever is left in the output buffer
+static void ps2_flush(void) {
+    for (int i = 0; i < PS2_FLUSH_LIMIT && (inb(PS2_STATUS_PORT) & PS2_STATUS_OUTPUT_FULL); i++) {
+        inb(PS2_DATA_PORT);
+    }
+}
+
+// Send one byte to the device on a port
+static int ps2_port_write(int port, uint8_t byte) {
+    if (port == PS2_PORT2 && ps2_write_command(PS2_CMD_WRITE_PORT2) != 0) {
+        return -1;
+    }
+    return ps2_write_data(byte);
+}
+
+int ps2_controller_init(void) {
+    // Nothing decodes port 0x64 on machines without an 8042, reads float high
+    if (inb(PS2_STATUS_PORT) == 0xFF) {
+        return -1;
+    }
+
+    // Keep the devices quiet while the controller is reconfigured
+    if (ps2_write_command(PS2_CMD_DISABLE_PORT1) != 0) {
+        return -1;
+    }
+    ps2_write_command(PS2_CMD_DISABLE_PORT2);
+    ps2_flush();
+
+    // Interrupts off until probing, translation left as the firmware set it
+    // (the keyboard decoder expects set 1 codes)
+    uint8_t config;
+    if (ps2_command_reply(PS2_CMD_READ_CONFIG, &config) != 0) {
+        return -1;
+    }
+    config &= ~(PS2_CONFIG_PORT1_IRQ | PS2_CONFIG_PORT2_IRQ);
+    ps2_write_config(config);
+
+    // Self-test; some controllers reset their configuration afterwards
+    uint8_t reply;
+    if (ps2_command_reply(PS2_CMD_SELF_TEST, &reply) != 0 || reply != PS2_SELF_TEST_PASSED) {
+        return -1;
+    }
+    ps2_write_config(config);
+
+    // The second channel exists if enabling it clears its clock-off bit
+    bool dual = false;
+    if (config & PS2_CONFIG_PORT2_CLOCK_OFF) {
+        ps2_write_command(PS2_CMD_ENABLE_PORT2);
+        uint8_t check;
+        if (ps2_command_reply(PS2_CMD_READ_CONFIG, &check) == 0) {
+            dual = !(check & PS2_CONFIG_PORT2_CLOCK_OFF);
+        }
+        ps2_write_command(PS2_CMD_DISABLE_PORT2);
+    }
+
+    // Interface tests
+    for (int i = 0; i < PS2_NUM_PORTS; i++) {
+        ports[i].state = PS2_PORT_ABSENT;
+        ports[i].timeout = (struct timer)TIMER_INIT(ps2_timeout_fired, &ports[i]);
+    }
+    if (ps2_command_reply(PS2_CMD_TEST_PORT1, &reply) == 0 && reply == PS2_PORT_TEST_PASSED) {
+        ports[PS2_PORT1].state = PS2_PORT_NO_DEVICE;
+    }
+    if (dual && ps2_command_reply(PS2_CMD_TEST_PORT2, &reply) == 0 && reply == PS2_PORT_TEST_PASSED) {
+        ports[PS2_PORT2].state = PS2_PORT_NO_DEVICE;
+    }
+
+    // Enable the working channels with their interrupts; the IRQ lines stay
+    // masked at the PIC until ps2_probe_start()
+    if (ports[PS2_PORT1].state != PS2_PORT_ABSENT) {
+        ps2_write_command(PS2_CMD_ENABLE_PORT1);
+        config |= PS2_CONFIG_PORT1_IRQ;
+        config &= ~PS2_CONFIG_PORT1_CLOCK_OFF;
+    }
+    if (ports[PS2_PORT2].state != PS2_PORT_ABSENT) {
+        ps2_write_command(PS2_CMD_ENABLE_PORT2);
+        config |= PS2_CONFIG_PORT2_IRQ;
+        config &= ~PS2_CONFIG_PORT2_CLOCK_OFF;
+    }
+    ps2_write_config(config);
+    ps2_flush();
+
+    controller_present = true;
+    return 0;
+}
+
+void ps2_register_driver(int port, const struct ps2_driver* driver) {
+    if (port >= 0 && port < PS2_NUM_PORTS) {
+        ports[port].driver = driver;
+    }
+}
+
+// Hand a byte to the port's driver; the driver expects top-half context
+static void ps2_forward(struct ps2_port* p, uint8_t byte) {
+    if (p->state == PS2_PORT_READY && p->driver && p->driver->byte) {
+        uint64_t flags = irq_save();
+        p->driver->byte(byte);
+        irq_restore(flags);
+    }
+}
+
+// IRQ1 and IRQ12 (top half). Bytes that belong to a transfer go to the
+// bottom half, everything else straight to the driver.
+static void ps2_interrupt_handler(void) {
+    uint8_t status = inb(PS2_STATUS_PORT);
+    if (!(status & PS2_STATUS_OUTPUT_FULL)) {
+        return;
+    }
+    uint8_t byte = inb(PS2_DATA_PORT);
+    struct ps2_port* p = &ports[(status & PS2_STATUS_AUX_DATA) ? PS2_PORT2 : PS2_PORT1];
+
+    if (p->busy) {
+        uint32_t head = p->rx_head;
+        if (head - __atomic_load_n(&p->rx_tail, __ATOMIC_ACQUIRE) < PS2_RX_QUEUE_SIZE) {
+            p->rx[head % PS2_RX_QUEUE_SIZE] = byte;
+            __atomic_store_n(&p->rx_head, head + 1, __ATOMIC_RELEASE);
+        }
+        tasklet_schedule(&ps2_tasklet);
+    } else if (p->state == PS2_PORT_READY && p->driver && p->driver->byte) {
+        p->driver->byte(byte);
+    }
+}
+
+// Finish the transfer on a port and report it
+static void ps2_complete(struct ps2_port* p, int status) {
+    int port = (int)(p - ports);
+    ps2_done_t done = p->done;
+    void* data = p->data;
+
+    timer_cancel(&p->timeout);
+    p->phase = PS2_PHASE_IDLE;
+
+    // Bytes that raced in after the reply belong to the driver
+    uint64_t flags = irq_save();
+    __atomic_store_n(&p->busy, false, __ATOMIC_RELEASE);
+    uint32_t tail = p->rx_tail;
+    while (tail != __atomic_load_n(&p->rx_head, __ATOMIC_ACQUIRE)) {
+        uint8_t byte = p->rx[tail++ % PS2_RX_QUEUE_SIZE];
+        if (p->driver && p->driver->byte && p->state == PS2_PORT_READY) {
+            p->driver->byte(byte);
+        }
+    }
+    __atomic_store_n(&p->rx_tail, tail, __ATOMIC_RELEASE);
+    irq_restore(flags);
+
+    if (done) {
+        done(port, status, p->reply, p->received, data);
+    }
+}
+
+// Wait for the next byte of the transfer until timeout_ms from now
+static void ps2_arm(struct ps2_port* p, uint64_t timeout_ms) {
+    p->deadline = timer_ticks() + timeout_ms;
+    timer_start(&p->timeout, timeout_ms);
+}
+
+// Write bytes[sent] and wait for its ACK
+static void ps2_send_next(struct ps2_port* p) {
+    p->phase = PS2_PHASE_ACK;
+    if (ps2_port_write((int)(p - ports), p->bytes[p->sent]) != 0) {
+        ps2_complete(p, -1);
+        return;
+    }
+    ps2_arm(p, PS2_ACK_TIMEOUT_MS);
+}
+
+// Advance the transfer on a port with the bytes received so far
+static void ps2_port_process(struct ps2_port* p) {
+    uint32_t tail = p->rx_tail;
+    while (p->phase != PS2_PHASE_IDLE && tail != __atomic_load_n(&p->rx_head, __ATOMIC_ACQUIRE)) {
+        uint8_t byte = p->rx[tail++ % PS2_RX_QUEUE_SIZE];
+        __atomic_store_n(&p->rx_tail, tail, __ATOMIC_RELEASE);
+
+        if (p->phase == PS2_PHASE_ACK) {
+            if (byte == PS2_REPLY_ACK) {
+                p->retries = 0;
+                if (++p->sent < p->count) {
+                    ps2_send_next(p);
+                } else if (p->reply_len) {
+                    p->phase = PS2_PHASE_REPLY;
+                    ps2_arm(p, p->bytes[0] == PS2_DEV_RESET ? PS2_RESET_TIMEOUT_MS : PS2_REPLY_TIMEOUT_MS);
+                } else {
+                    ps2_complete(p, 0);
+                }
+            } else if (byte == PS2_REPLY_RESEND) {
+                if (++p->retries > PS2_RESEND_RETRIES) {
+                    ps2_complete(p, -1);
+                } else {
+                    ps2_send_next(p);
+                }
+            } else {
+                // Key or motion data that was already on its way
+                ps2_forward(p, byte);
+            }
+        } else {
+            p->reply[p->received++] = byte;
+            if (p->received == p->reply_len) {
+                ps2_complete(p, 0);
+            } else {
+                ps2_arm(p, PS2_REPLY_TIMEOUT_MS);
+            }
+        }
+        tail = p->rx_tail;
+    }
+}
+
+static void ps2_bottom_half(void* data) {
+    (void)data;
+    for (int i = 0; i < PS2_NUM_PORTS; i++) {
+        if (ports[i].busy) {
+            ps2_port_process(&ports[i]);
+        }
+    }
+}
+
+// Transfer timeout (timer callback, bottom half). A missing ACK fails the
+// transfer; a short reply completes it with what arrived, which is how a
+// variable-length reply such as the BAT code plus device ID ends.
+static void ps2_timeout_fired(void* data) {
+    struct ps2_port* p = data;
+
+    ps2_port_process(p);
+    if (p->phase == PS2_PHASE_IDLE || timer_ticks() < p->deadline) {
+        return;
+    }
+    if (p->phase == PS2_PHASE_ACK) {
+        ps2_complete(p, -1);
+    } else {
+        ps2_complete(p, 0);
+    }
+}
+
+int ps2_send_async(int port, const uint8_t* bytes, size_t count, size_t reply_len, ps2_done_t done, void* data) {
+    if (port < 0 || port >= PS2_NUM_PORTS || count == 0 || count > PS2_TRANSFER_MAX || reply_len > PS2_TRANSFER_MAX) {
+        return -1;
+    }
+    struct ps2_port* p = &ports[port];
+    if (p->state == PS2_PORT_ABSENT || p->state == PS2_PORT_NO_DEVICE) {
+        return -1;
+    }
+
+    uint64_t flags = irq_save();
+    if (p->busy) {
+        irq_restore(flags);
+        return -1;
+    }
+    for (size_t i = 0; i < count; i++) {
+        p->bytes[i] = bytes[i];
+    }
+    p->count = count;
+    p->sent = 0;
+    p->reply_len = reply_len;
+    p->received = 0;
+    p->retries = 0;
+    p->done = done;
+    p->data = data;
+    __atomic_store_n(&p->busy, true, __ATOMIC_RELEASE);
+
+    ps2_send_next(p);
+    irq_restore(flags);
+    return 0;
+}
+
+// Completion state of a synchronous ps2_send()
+struct ps2_sync {
+    volatile bool finished;
+    int result;
+    uint8_t* reply;
+    size_t reply_len;
+};
+
+// Synchronous senders sleep here. Not part of ps2_sync: the sender may
+// return as soon as it sees finished, taking its stack with it.
+static struct waitqueue sync_wq = WAITQUEUE_INIT;
+
+static void ps2_sync_done(int port, int status, const uint8_t* reply, size_t reply_len, void* data) {
+    (void)port;
+    struct ps2_sync* sync = data;
+
+    if (status == 0) {
+        for (size_t i = 0; i < reply_len && i < sync->reply_len; i++) {
+            sync->reply[i] = reply[i];
+        }
+        sync->result = (int)reply_len;
+    } else {
+        sync->result = -1;
+    }
+    __atomic_store_n(&sync->finished, true, __ATOMIC_RELEASE);
+    waitqueue_wake_all(&sync_wq);
+}
+
+// Whether the caller is a thread that may sleep until the bottom half runs
+static bool ps2_can_sleep(void) {
+    struct cpu* cpu = this_cpu();
+    return irqs_enabled() && cpu->irq_depth == 0 && cpu->preempt_count == 0 &&
+           cpu->current != NULL && cpu->current != cpu->idle;
+}
+
+// Blocks until the bottom half reports back, so it must not be called
+// from a tasklet or timer callback
+int ps2_send(int port, const uint8_t* bytes, size_t count, uint8_t* reply, size_t reply_len) {
+    struct ps2_sync sync = { .finished = false, .result = -1, .reply = reply, .reply_len = reply_len };
+
+    if (ps2_send_async(port, bytes, count, reply_len, ps2_sync_done, &sync) != 0) {
+        return -1;
+    }
+    // The bottom halves run on the BSP, a thread elsewhere must not halt
+    // its CPU waiting for them
+    if (ps2_can_sleep()) {
+        struct wait_entry entry = { 0 };
+        for (;;) {
+            wait_prepare(&sync_wq, &entry);
+            if (__atomic_load_n(&sync.finished, __ATOMIC_ACQUIRE)) {
+                break;
+            }
+            schedule();
+        }
+        wait_finish(&sync_wq, &entry);
+        return sync.result;
+    }
+
+    // Boot, before there are threads to switch to
+    for (;;) {
+        asm volatile("cli" ::: "memory");
+        if (__atomic_load_n(&sync.finished, __ATOMIC_ACQUIRE)) {
+            asm volatile("sti" ::: "memory");
+            break;
+        }
+        idle_halt();
+    }
+    return sync.result;
+}
+
+// Reset answered (or not): attach the driver with the bytes after the BAT code
+static void ps2_probe_done(int port, int status, const uint8_t* reply, size_t reply_len, void* data) {
+    (void)data;
+    struct ps2_port* p = &ports[port];
+
+    if (status != 0 || reply_len == 0 || reply[0] != PS2_REPLY_BAT_PASSED) {
+        p->state = PS2_PORT_NO_DEVICE;
+        return;
+    }
+    p->state = PS2_PORT_READY;
+    if (p->driver && p->driver->attach) {
+        p->driver->attach(port, reply + 1, reply_len - 1);
+    }
+}
+
+void ps2_probe_start(void) {
+    static const uint8_t reset = PS2_DEV_RESET;
+
+    if (!controller_present) {
+        return;
+    }
+    irq_register_handler(1, ps2_interrupt_handler);
+    irq_register_handler(12, ps2_interrupt_handler);
+
+    // Both resets run at once; each can take most of a second
+    for (int i = 0; i < PS2_NUM_PORTS; i++) {
+        if (ports[i].state != PS2_PORT_NO_DEVICE) {
+            continue;
+        }
+        ports[i].state = PS2_PORT_PROBING;
+        if (ps2_send_async(i, &reset, 1, 2, ps2_probe_done, NULL) != 0) {
+            ports[i].state = PS2_PORT_NO_DEVICE;
+        }
+    }
+}
+
+enum ps2_port_state ps2_port_state(int port) {
+    return port >= 0 && port < PS2_NUM_PORTS ? ports[port].state : PS2_PORT_ABSENT;
+}
+
+bool ps2_controller_present(void) {
+    return controller_present;
+}
+
+static void cmd_ps2(int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+    static const char* const state_names[] = {
+        [PS2_PORT_ABSENT]    = "absent",
+        [PS2_PORT_PROBING]   = "probing",
+        [PS2_PORT_READY]     = "ready",
+        [PS2_PORT_NO_DEVICE] = "no device",
+    };
+    if (!ps2_controller_present()) {
+        printf("No PS/2 controller\n", GRAY, BLACK);
+        return;
+    }
+    printf("PS/2 controller:\n", WHITE, BLACK);
+    printf("  port 1 (keyboard): %s\n", GRAY, BLACK, state_names[ps2_port_state(PS2_PORT1)]);
+    printf("  port 2 (mouse): %s%s\n", GRAY, BLACK, state_names[ps2_port_state(PS2_PORT2)],
+           mouse_present() && mouse_has_wheel() ? ", wheel" : "");
+}
+
+static void cmd_reboot(int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+    printf("Rebooting...\n", BLUE, BLACK);
+    // Simple reboot via keyboard controller
+    outb(0x64, 0xFE);
+}
+
+SHELL_COMMAND(ps2, "ps2", "Show PS/2 controller and port status", cmd_ps2);
+SHELL_COMMAND(reboot, "reboot", "Reboot the system", cmd_reboot);
@@ -0,0 +1,96 @@
+#include "rcu.h"
+#include "sched.h"
+#include "smp.h"
+#include "lapic.h"
+#include "interrupts.h"
+#include "spinlock.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+volatile uint64_t rcu_gp_seq = 0;
+
+// Callbacks waiting for the next grace period
+static spinlock_t callbacks_lock = SPINLOCK_INIT_NAMED("rcu");
+static struct rcu_head* callbacks = NULL;
+static struct waitqueue callbacks_wq = WAITQUEUE_INIT;
+
+// Whether cpu has been outside any read section since grace period gp began
+static bool cpu_passed(struct cpu* cpu, uint64_t gp) {
+    if (__atomic_load_n(&cpu->rcu_qs_seq, __ATOMIC_ACQUIRE) >= gp) {
+        return true;
+    }
+    // An idle CPU halts without passing the scheduler; it can only be
+    // reading inside an interrupt handler
+    return __atomic_load_n(&cpu->irq_depth, __ATOMIC_ACQUIRE) == 0 &&
+           __atomic_load_n(&cpu->current, __ATOMIC_ACQUIRE) == cpu->idle;
+}
+
+void synchronize_rcu(void) {
+    uint64_t gp = __atomic_add_fetch(&rcu_gp_seq, 1, __ATOMIC_SEQ_CST);
+    unsigned int self = cpu_id();
+
+    // Our own CPU is not in a read section, or we could not be here
+    rcu_quiescent();
+
+    for (unsigned int i = 0; i < cpu_count(); i++) {
+        struct cpu* cpu = &cpus[i];
+        if (i == self || !cpu->online) {
+            continue;
+        }
+        for (bool kicked = false; !cpu_passed(cpu, gp); ) {
+            // A CPU running one thread for a long time passes through the
+            // scheduler only when its slice ends; the interrupt exit path
+            // notes a quiescent state right away
+            if (!kicked) {
+                lapic_send_ipi(cpu->lapic_id, IRQ_BASE + LOCAL_IRQ_RESCHEDULE);
+                kicked = true;
+            }
+            thread_sleep(1);
+        }
+    }
+}
+
+void call_rcu(struct rcu_head* head, void (*func)(struct rcu_head* head)) {
+    head->func = func;
+
+    uint64_t flags = spin_lock_irqsave(&callbacks_lock);
+    head->next = callbacks;
+    callbacks = head;
+    spin_unlock_irqrestore(&callbacks_lock, flags);
+
+    waitqueue_wake_all(&callbacks_wq);
+}
+
+static void rcu_thread(void* arg) {
+    (void)arg;
+
+    for (;;) {
+        struct wait_entry entry = { 0 };
+        for (;;) {
+            wait_prepare(&callbacks_wq, &entry);
+            if (__atomic_load_n(&callbacks, __ATOMIC_RELAXED) != NULL) {
+                break;
+            }
+            schedule();
+        }
+        wait_finish(&callbacks_wq, &entry);
+
+        // Everything queued so far shares one grace period
+        uint64_t flags = spin_lock_irqsave(&callbacks_lock);
+        struct rcu_head* batch = callbacks;
+        callbacks = NULL;
+        spin_unlock_irqrestore(&callbacks_lock, flags);
+
+        synchronize_rcu();
+        while (batch) {
+            struct rcu_head* next = batch->next;
+            batch->func(batch);
+            batch = next;
+        }
+    }
+}
+
+void rcu_init(void) {
+    thread_create("rcu", rcu_thread, NULL, THREAD_PRIO_LOW, THREAD_ANY_CPU);
+}
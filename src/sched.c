@@ -0,0 +1,578 @@
+#include "sched.h"
+#include "smp.h"
+#include "gdt.h"
+#include "lapic.h"
+#include "interrupts.h"
+#include "timer.h"
+#include "pmm.h"
+#include "rcu.h"
+#include "idle.h"
+#include "tlb.h"
+#include "fpu.h"
+#include "process.h"
+#include "stdmem.h"
+#include "console.h"
+#include "shell.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Per-CPU run queue: one FIFO per priority and a bitmap of the non-empty
+// ones, so picking the next thread is a single bit scan
+struct run_queue {
+    spinlock_t lock;
+    uint32_t bitmap;
+    struct thread* head[THREAD_PRIORITIES];
+    struct thread* tail[THREAD_PRIORITIES];
+    uint32_t nr_ready;
+    uint64_t switches;
+    struct thread* dead;        // Exited thread, freed after switching away
+
+    // Written to wake this CPU when it idles in MWAIT; on its own line so
+    // nothing else wakes it
+    volatile uint32_t doorbell __attribute__((aligned(64)));
+} __attribute__((aligned(64)));
+
+static struct run_queue run_queues[MAX_CPUS];
+
+// Idle threads run on the boot stack of their CPU
+static struct thread idle_threads[MAX_CPUS];
+
+// Thread list, written on create and exit, read by listings
+static rwlock_t threads_lock = RWLOCK_INIT_NAMED("threads");
+static struct thread* all_threads = NULL;
+static uint32_t next_thread_id = 1;
+static unsigned int next_cpu = 0;
+
+// Save callee-saved registers on the current stack, store its pointer in
+// *old_rsp and resume the thread whose stack pointer is new_rsp
+extern void switch_context(uint64_t* old_rsp, uint64_t new_rsp);
+
+// First return address of a new thread; r12 = function, r13 = argument
+extern void thread_trampoline(void);
+
+static void rq_enqueue(struct run_queue* rq, struct thread* t) {
+    uint8_t prio = t->priority;
+
+    t->rq_next = NULL;
+    t->rq_prev = rq->tail[prio];
+    if (rq->tail[prio]) {
+        rq->tail[prio]->rq_next = t;
+    } else {
+        rq->head[prio] = t;
+    }
+    rq->tail[prio] = t;
+    rq->bitmap |= 1U << prio;
+    rq->nr_ready++;
+}
+
+static void rq_remove(struct run_queue* rq, struct thread* t) {
+    uint8_t prio = t->priority;
+
+    if (t->rq_prev) {
+        t->rq_prev->rq_next = t->rq_next;
+    } else {
+        rq->head[prio] = t->rq_next;
+    }
+    if (t->rq_next) {
+        t->rq_next->rq_prev = t->rq_prev;
+    } else {
+        rq->tail[prio] = t->rq_prev;
+    }
+    t->rq_prev = t->rq_next = NULL;
+    if (rq->head[prio] == NULL) {
+        rq->bitmap &= ~(1U << prio);
+    }
+    rq->nr_ready--;
+}
+
+static int rq_top_priority(struct run_queue* rq) {
+    return rq->bitmap ? 31 - __builtin_clz(rq->bitmap) : -1;
+}
+
+static struct thread* rq_pick(struct run_queue* rq) {
+    int prio = rq_top_priority(rq);
+    if (prio < 0) {
+        return NULL;
+    }
+    struct thread* t = rq->head[prio];
+    rq_remove(rq, t);
+    return t;
+}
+
+// Second half of a switch, on the new thread's stack: drop the run queue
+// lock taken by schedule() and free a thread that exited
+static void finish_switch(struct run_queue* rq) {
+    struct thread* dead = rq->dead;
+    rq->dead = NULL;
+    raw_spin_unlock(&rq->lock);
+
+    if (dead) {
+        if (dead->process) {
+            process_thread_dead(dead);
+        }
+        pmm_free_pages(dead->stack_phys, THREAD_STACK_PAGES);
+    }
+}
+
+// Called by thread_trampoline before the thread function
+void sched_thread_start(void) {
+    finish_switch(&run_queues[cpu_id()]);
+    asm volatile("sti" ::: "memory");
+}
+
+// Switch to the next thread. A preempted thread is still runnable even if
+// it was about to block: it was stopped between wait_prepare() and its own
+// call to schedule(), which it will still make.
+static void __schedule(bool preempt) {
+    uint64_t flags = irq_save();
+    struct cpu* cpu = this_cpu();
+    struct thread* prev = cpu->current;
+
+    if (prev == NULL) {
+        irq_restore(flags);
+        return;
+    }
+
+    // Read sections never span a context switch
+    rcu_quiescent();
+
+    struct run_queue* rq = &run_queues[cpu->id];
+    raw_spin_lock(&rq->lock);
+    cpu->need_resched = false;
+
+    // A running thread goes to the back of its queue; a blocked one only
+    // comes back through thread_wake()
+    if (prev->state == THREAD_RUNNING || (preempt && prev->state == THREAD_BLOCKED)) {
+        prev->state = THREAD_READY;
+        if (prev != cpu->idle) {
+            rq_enqueue(rq, prev);
+        }
+    }
+
+    struct thread* next = rq_pick(rq);
+    if (next == NULL) {
+        next = cpu->idle;
+    }
+    next->state = THREAD_RUNNING;
+
+    if (next != prev) {
+        uint64_t now = rdtsc();
+        prev->runtime_ns += tsc_to_ns(now - prev->last_switch_tsc);
+        next->last_switch_tsc = now;
+        next->switches++;
+        rq->switches++;
+        if (prev->state == THREAD_DEAD) {
+            rq->dead = prev;
+        }
+
+        cpu->current = next;
+        tss_set_kernel_stack(next->stack_top);
+        fpu_switch(next);
+        process_switch(next);
+
+        // Idle needs no slice, anything else is preempted when it ends
+        if (next == cpu->idle) {
+            lapic_timer_stop();
+        } else {
+            lapic_timer_oneshot(SCHED_SLICE_US);
+        }
+
+        switch_context(&prev->rsp, next->rsp);
+    }
+
+    finish_switch(rq);
+    irq_restore(flags);
+}
+
+void schedule(void) {
+    __schedule(false);
+}
+
+void preempt_schedule(void) {
+    struct cpu* cpu = this_cpu();
+
+    if (cpu->current == NULL || cpu->preempt_count || cpu->irq_depth || !irqs_enabled()) {
+        return;
+    }
+    __schedule(true);
+}
+
+void sched_preempt_irq(void) {
+    struct cpu* cpu = this_cpu();
+
+    if (cpu->current == NULL || cpu->preempt_count || cpu->irq_depth) {
+        return;
+    }
+    // The interrupt arrived outside any read section
+    rcu_quiescent();
+    if (cpu->need_resched) {
+        __schedule(true);
+    }
+}
+
+// Slice over: give way to a ready thread of at least the same priority
+static void sched_timer_interrupt(void) {
+    struct cpu* cpu = this_cpu();
+    struct run_queue* rq = &run_queues[cpu->id];
+
+    if (cpu->current == NULL || cpu->current == cpu->idle) {
+        return;
+    }
+
+    raw_spin_lock(&rq->lock);
+    bool contended = rq_top_priority(rq) >= (int)cpu->current->priority;
+    raw_spin_unlock(&rq->lock);
+
+    if (contended) {
+        cpu->need_resched = true;
+    } else {
+        lapic_timer_oneshot(SCHED_SLICE_US);
+    }
+}
+
+// The waker already set need_resched, leaving the interrupt reschedules
+static void sched_resched_interrupt(void) {
+}
+
+bool thread_wake(struct thread* t) {
+    struct run_queue* rq = &run_queues[t->cpu];
+    struct cpu* target = &cpus[t->cpu];
+    bool resched = false;
+    bool woken = false;
+
+    uint64_t flags = irq_save();
+    raw_spin_lock(&rq->lock);
+    if (t->state == THREAD_BLOCKED) {
+        t->state = THREAD_READY;
+        rq_enqueue(rq, t);
+        woken = true;
+
+        struct thread* curr = target->current;
+        if (curr != NULL && (curr == target->idle || t->priority > curr->priority)) {
+            target->need_resched = true;
+            resched = true;
+        }
+    }
+    raw_spin_unlock(&rq->lock);
+
+    bool local = t->cpu == cpu_id();
+    if (resched && !local) {
+        // A CPU parked in MWAIT wakes from a write to its doorbell, which
+        // is far cheaper than an IPI; need_resched is already visible
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&target->idle_mwait, __ATOMIC_RELAXED)) {
+            __atomic_add_fetch(&rq->doorbell, 1, __ATOMIC_RELAXED);
+        } else {
+            lapic_send_ipi(target->lapic_id, IRQ_BASE + LOCAL_IRQ_RESCHEDULE);
+        }
+    }
+    irq_restore(flags);
+
+    if (resched && local) {
+        preempt_schedule();
+    }
+    return woken;
+}
+
+// Mark the current thread blocked; it stops running at the next schedule()
+static void thread_set_blocked(struct thread* self) {
+    struct run_queue* rq = &run_queues[self->cpu];
+
+    uint64_t flags = irq_save();
+    raw_spin_lock(&rq->lock);
+    self->state = THREAD_BLOCKED;
+    raw_spin_unlock(&rq->lock);
+    irq_restore(flags);
+}
+
+// Back to running after a wait; a wakeup may already have queued us
+static void thread_set_running(struct thread* self) {
+    struct run_queue* rq = &run_queues[self->cpu];
+
+    uint64_t flags = irq_save();
+    raw_spin_lock(&rq->lock);
+    if (self->state == THREAD_READY) {
+        rq_remove(rq, self);
+    }
+    self->state = THREAD_RUNNING;
+    raw_spin_unlock(&rq->lock);
+    irq_restore(flags);
+}
+
+static unsigned int pick_cpu(int cpu) {
+    unsigned int count = cpu_count();
+
+    if (cpu >= 0 && (unsigned int)cpu < count && cpus[cpu].current != NULL) {
+        return (unsigned int)cpu;
+    }
+    for (unsigned int i = 0; i < count; i++) {
+        unsigned int c = __atomic_fetch_add(&next_cpu, 1, __ATOMIC_RELAXED) % count;
+        if (cpus[c].current != NULL) {
+            return c;
+        }
+    }
+    return 0;
+}
+
+struct thread* thread_create(const char* name, thread_func_t func, void* arg, uint8_t priority, int cpu) {
+    uint64_t phys = pmm_alloc_pages(THREAD_STACK_PAGES);
+    if (phys == 0) {
+        return NULL;
+    }
+
+    uint8_t* base = phys_to_virt(phys);
+    uint64_t top = (uint64_t)base + THREAD_STACK_PAGES * PAGE_SIZE;
+    struct thread* t = (struct thread*)((top - sizeof(struct thread)) & ~0x3FULL);
+
+    memset(t, 0, sizeof(struct thread));
+    t->stack_top = (uint64_t)t & ~0xFULL;
+    t->stack_phys = phys;
+    for (size_t i = 0; i < THREAD_NAME_LEN - 1 && name[i]; i++) {
+        t->name[i] = name[i];
+    }
+    if (priority == THREAD_PRIO_IDLE) {
+        priority = THREAD_PRIO_IDLE + 1;
+    } else if (priority >= THREAD_PRIORITIES) {
+        priority = THREAD_PRIORITIES - 1;
+    }
+    t->priority = priority;
+    t->cpu = pick_cpu(cpu);
+
+    // Initial frame popped by switch_context, returning into the trampoline
+    uint64_t* sp = (uint64_t*)t->stack_top;
+    *--sp = (uint64_t)thread_trampoline;
+    *--sp = 0;                  // rbp
+    *--sp = 0;                  // rbx
+    *--sp = (uint64_t)func;     // r12
+    *--sp = (uint64_t)arg;      // r13
+    *--sp = 0;                  // r14
+    *--sp = 0;                  // r15
+    t->rsp = (uint64_t)sp;
+    t->state = THREAD_BLOCKED;
+
+    uint64_t flags = write_lock_irqsave(&threads_lock);
+    t->id = next_thread_id++;
+    t->all_next = all_threads;
+    all_threads = t;
+    write_unlock_irqrestore(&threads_lock, flags);
+
+    thread_wake(t);
+    return t;
+}
+
+struct thread* thread_current(void) {
+    return this_cpu()->current;
+}
+
+void thread_exit(void) {
+    struct thread* self = thread_current();
+
+    uint64_t flags = write_lock_irqsave(&threads_lock);
+    for (struct thread** link = &all_threads; *link; link = &(*link)->all_next) {
+        if (*link == self) {
+            *link = self->all_next;
+            break;
+        }
+    }
+    write_unlock_irqrestore(&threads_lock, flags);
+
+    irq_save();
+    fpu_thread_exit(self);
+    self->state = THREAD_DEAD;
+    schedule();
+    __builtin_unreachable();
+}
+
+void thread_yield(void) {
+    schedule();
+}
+
+static void sleep_timer_fired(void* data) {
+    thread_wake(data);
+}
+
+void thread_sleep(uint64_t ms) {
+    struct thread* self = thread_current();
+    struct timer t = TIMER_INIT(sleep_timer_fired, self);
+    uint64_t deadline = timer_ticks() + ms;
+
+    // Preemption can resume us early, so sleep until the deadline
+    for (uint64_t now = timer_ticks(); now < deadline; now = timer_ticks()) {
+        thread_set_blocked(self);
+        timer_start(&t, deadline - now);
+        schedule();
+    }
+    // t lives on this stack: the callback must be done with it
+    timer_cancel_sync(&t);
+}
+
+void wait_prepare(struct waitqueue* wq, struct wait_entry* w) {
+    struct thread* self = thread_current();
+
+    uint64_t flags = spin_lock_irqsave(&wq->lock);
+    if (!w->queued || w->thread != self) {
+        w->thread = self;
+        w->next = wq->head;
+        wq->head = w;
+        w->queued = true;
+    }
+    // Under the queue lock, so a waker either sees us blocked or ran
+    // before we check the condition
+    thread_set_blocked(self);
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+void wait_finish(struct waitqueue* wq, struct wait_entry* w) {
+    thread_set_running(w->thread);
+
+    uint64_t flags = spin_lock_irqsave(&wq->lock);
+    if (w->queued) {
+        for (struct wait_entry** link = &wq->head; *link; link = &(*link)->next) {
+            if (*link == w) {
+                *link = w->next;
+                break;
+            }
+        }
+        w->queued = false;
+    }
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+void waitqueue_wake_all(struct waitqueue* wq) {
+    uint64_t flags = spin_lock_irqsave(&wq->lock);
+    for (struct wait_entry* w = wq->head; w; w = w->next) {
+        thread_wake(w->thread);
+    }
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+bool waitqueue_wake_one(struct waitqueue* wq) {
+    bool woken = false;
+
+    uint64_t flags = spin_lock_irqsave(&wq->lock);
+    for (struct wait_entry* w = wq->head; w && !woken; w = w->next) {
+        woken = thread_wake(w->thread);
+    }
+    spin_unlock_irqrestore(&wq->lock, flags);
+    return woken;
+}
+
+void sched_init_cpu(void) {
+    struct cpu* cpu = this_cpu();
+    struct thread* idle = &idle_threads[cpu->id];
+
+    memset(idle, 0, sizeof(struct thread));
+    memcpy(idle->name, "idle", 5);
+    idle->priority = THREAD_PRIO_IDLE;
+    idle->cpu = cpu->id;
+    idle->stack_top = cpu->stack_top;
+    idle->state = THREAD_RUNNING;
+    idle->last_switch_tsc = rdtsc();
+
+    if (cpu->id == 0) {
+        irq_register_local(LOCAL_IRQ_TIMER, sched_timer_interrupt);
+        irq_register_local(LOCAL_IRQ_RESCHEDULE, sched_resched_interrupt);
+    }
+    lapic_init();
+
+    uint64_t flags = write_lock_irqsave(&threads_lock);
+    idle->all_next = all_threads;
+    all_threads = idle;
+    write_unlock_irqrestore(&threads_lock, flags);
+
+    cpu->idle = idle;
+    __atomic_store_n(&cpu->current, idle, __ATOMIC_RELEASE);
+}
+
+void sched_idle(void) {
+    struct cpu* cpu = this_cpu();
+    struct run_queue* rq = &run_queues[cpu->id];
+
+    for (;;) {
+        // Check with interrupts off so a wakeup between the check and
+        // parking the CPU is not slept through
+        asm volatile("cli" ::: "memory");
+        if (cpu->need_resched) {
+            asm volatile("sti" ::: "memory");
+            schedule();
+            continue;
+        }
+        rcu_quiescent();
+        tlb_enter_lazy();
+        idle_wait(&rq->doorbell, &cpu->need_resched);
+        tlb_leave_lazy();
+    }
+}
+
+size_t sched_snapshot(struct thread_info* out, size_t max) {
+    size_t count = 0;
+
+    uint64_t flags = read_lock_irqsave(&threads_lock);
+    for (struct thread* t = all_threads; t && count < max; t = t->all_next) {
+        struct thread_info* info = &out[count++];
+        info->id = t->id;
+        memcpy(info->name, t->name, THREAD_NAME_LEN);
+        info->state = t->state;
+        info->priority = t->priority;
+        info->cpu = t->cpu;
+        info->switches = t->switches;
+        info->runtime_ns = t->runtime_ns;
+    }
+    read_unlock_irqrestore(&threads_lock, flags);
+    return count;
+}
+
+uint64_t sched_switch_count(unsigned int cpu) {
+    return cpu < MAX_CPUS ? run_queues[cpu].switches : 0;
+}
+
+asm(
+    ".global switch_context\n"
+    "switch_context:\n"
+    "    push %rbp\n"
+    "    push %rbx\n"
+    "    push %r12\n"
+    "    push %r13\n"
+    "    push %r14\n"
+    "    push %r15\n"
+    "    mov [%rdi], %rsp\n"
+    "    mov %rsp, %rsi\n"
+    "    pop %r15\n"
+    "    pop %r14\n"
+    "    pop %r13\n"
+    "    pop %r12\n"
+    "    pop %rbx\n"
+    "    pop %rbp\n"
+    "    ret\n"
+);
+
+asm(
+    ".global thread_trampoline\n"
+    "thread_trampoline:\n"
+    "    call sched_thread_start\n"
+    "    mov %rdi, %r13\n"
+    "    call %r12\n"
+    "    call thread_exit\n"
+);
+
+static void cmd_threads(int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+    static const char* const state_names[] = {
+        [THREAD_READY]   = "ready",
+        [THREAD_RUNNING] = "running",
+        [THREAD_BLOCKED] = "blocked",
+        [THREAD_DEAD]    = "dead",
+    };
+    static struct thread_info threads[64];
+    size_t count = sched_snapshot(threads, 64);
+    printf("  ID  CPU PRIO STATE    TIME(ms) NAME\n", WHITE, BLACK);
+    for (size_t i = 0; i < count; i++) {
+        printf("  %u   %u   %u   %s  %u  %s\n", GRAY, BLACK, threads[i].id, threads[i].cpu,
+               threads[i].priority, state_names[threads[i].state],
+               (unsigned int)(threads[i].runtime_ns / 1000000), threads[i].name);
+    }
+}
+
+SHELL_COMMAND(threads, "threads", "List kernel threads", cmd_threads);
@@ -0,0 +1,679 @@
+#include "shell.h"
+#include "console.h"
+#include "keyboard.h"
+#include "keymap.h"
+#include "input.h"
+#include "spinlock.h"
+#include "stdmem.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Keyboard events the shell reads per call
+#define SHELL_EVENT_BATCH 16
+
+#define SHELL_QUERY_MAX   64        // Ctrl+R search string
+#define SHELL_SHOWN_MAX   (SHELL_LINE_MAX + SHELL_QUERY_MAX + 32)
+#define NO_CURSOR         ((size_t)-1)
+#define CHUNK_MAX         64        // Characters per printf() of a redraw
+
+// Bounds of the SHELL_COMMAND() entries, from the linker script
+extern struct shell_command* const shell_commands_start[];
+extern struct shell_command* const shell_commands_end[];
+
+// Chains are only ever pushed to, so lookups run without the lock
+static spinlock_t shell_lock = SPINLOCK_INIT_NAMED("shell");
+static struct shell_command* buckets[SHELL_HASH_BUCKETS];
+static struct shell_command* commands[SHELL_MAX_COMMANDS];
+static size_t command_count = 0;
+
+// Prefix trie of the command names, children as a sibling list. Node 0 is
+// the root; 0 also ends child and sibling lists. Nodes are filled in
+// before they are linked, so completion walks it without the lock.
+struct trie_node {
+    char c;
+    uint16_t child;
+    uint16_t sibling;
+    struct shell_command* cmd;  // Name ends here
+};
+
+static struct trie_node trie[SHELL_TRIE_NODES];
+static size_t trie_used = 1;
+
+// FNV-1a
+static uint32_t hash_name(const char* name) {
+    uint32_t hash = 2166136261U;
+    while (*name) {
+        hash = (hash ^ (uint8_t)*name++) * 16777619U;
+    }
+    return hash;
+}
+
+struct shell_command* shell_find(const char* name) {
+    struct shell_command* cmd = __atomic_load_n(&buckets[hash_name(name) & (SHELL_HASH_BUCKETS - 1)],
+                                                __ATOMIC_ACQUIRE);
+    while (cmd != NULL && strcmp(cmd->name, name) != 0) {
+        cmd = cmd->next;
+    }
+    return cmd;
+}
+
+// Child of node for c, 0 if there is none
+static uint16_t trie_child(uint16_t node, char c) {
+    uint16_t next = __atomic_load_n(&trie[node].child, __ATOMIC_ACQUIRE);
+    while (next != 0 && trie[next].c != c) {
+        next = __atomic_load_n(&trie[next].sibling, __ATOMIC_ACQUIRE);
+    }
+    return next;
+}
+
+// Add the name of cmd (shell_lock held). Out of nodes, the command works
+// but does not complete.
+static void trie_insert(struct shell_command* cmd) {
+    uint16_t node = 0;
+    for (const char* p = cmd->name; *p; p++) {
+        uint16_t next = trie_child(node, *p);
+        if (next == 0) {
+            if (trie_used == SHELL_TRIE_NODES) {
+                return;
+            }
+            // Siblings in character order, so candidates list sorted
+            uint16_t* link = &trie[node].child;
+            while (*link != 0 && trie[*link].c < *p) {
+                link = &trie[*link].sibling;
+            }
+            next = (uint16_t)trie_used++;
+            trie[next] = (struct trie_node){ .c = *p, .sibling = *link };
+            __atomic_store_n(link, next, __ATOMIC_RELEASE);
+        }
+        node = next;
+    }
+    __atomic_store_n(&trie[node].cmd, cmd, __ATOMIC_RELEASE);
+}
+
+// Offer every name in the subtree below node
+static void trie_collect(uint16_t node, struct shell_completion* comp) {
+    struct shell_command* cmd = __atomic_load_n(&trie[node].cmd, __ATOMIC_ACQUIRE);
+    if (cmd != NULL) {
+        shell_complete_add(comp, cmd->name);
+    }
+    for (uint16_t next = __atomic_load_n(&trie[node].child, __ATOMIC_ACQUIRE); next != 0;
+         next = __atomic_load_n(&trie[next].sibling, __ATOMIC_ACQUIRE)) {
+        trie_collect(next, comp);
+    }
+}
+
+void shell_complete_command(struct shell_completion* comp) {
+    uint16_t node = 0;
+    for (size_t i = 0; i < comp->word_len; i++) {
+        node = trie_child(node, comp->word[i]);
+        if (node == 0) {
+            return;
+        }
+    }
+    trie_collect(node, comp);
+}
+
+void shell_complete_add(struct shell_completion* comp, const char* candidate) {
+    if (strncmp(candidate, comp->word, comp->word_len) != 0) {
+        return;
+    }
+    size_t len = strlen(candidate);
+    if (comp->matches++ == 0) {
+        comp->common_len = len < sizeof(comp->common) ? len : sizeof(comp->common);
+        memcpy(comp->common, candidate, comp->common_len);
+    } else {
+        size_t same = 0;
+        while (same < comp->common_len && same < len && comp->common[same] == candidate[same]) {
+            same++;
+        }
+        comp->common_len = same;
+    }
+    // Listed two spaces apart, as many as fit
+    if (comp->list_len + len + 3 <= sizeof(comp->list)) {
+        memcpy(comp->list + comp->list_len, candidate, len);
+        memcpy(comp->list + comp->list_len + len, "  ", 3);
+        comp->list_len += len + 2;
+    }
+}
+
+int shell_register(struct shell_command* cmd) {
+    uint64_t flags = spin_lock_irqsave(&shell_lock);
+    if (command_count >= SHELL_MAX_COMMANDS || shell_find(cmd->name) != NULL) {
+        spin_unlock_irqrestore(&shell_lock, flags);
+        return -1;
+    }
+    struct shell_command** bucket = &buckets[hash_name(cmd->name) & (SHELL_HASH_BUCKETS - 1)];
+    cmd->next = *bucket;
+    commands[command_count++] = cmd;
+    __atomic_store_n(bucket, cmd, __ATOMIC_RELEASE);
+    trie_insert(cmd);
+    spin_unlock_irqrestore(&shell_lock, flags);
+    return 0;
+}
+
+void shell_init(void) {
+    for (struct shell_command* const* entry = shell_commands_start; entry < shell_commands_end; entry++) {
+        if (shell_register(*entry) != 0) {
+            printf("Shell command %s defined twice\n", RED, BLACK, (*entry)->name);
+        }
+    }
+}
+
+// Split line at blanks into argv, NULL-terminated. Returns argc, -1 if
+// there are more than SHELL_MAX_ARGS arguments.
+static int tokenize(char* line, char** argv) {
+    int argc = 0;
+    for (;;) {
+        while (*line == ' ' || *line == '\t') {
+            *line++ = '\0';
+        }
+        if (*line == '\0') {
+            break;
+        }
+        if (argc == SHELL_MAX_ARGS) {
+            return -1;
+        }
+        argv[argc++] = line;
+        while (*line != '\0' && *line != ' ' && *line != '\t') {
+            line++;
+        }
+    }
+    argv[argc] = NULL;
+    return argc;
+}
+
+void shell_execute(char* line) {
+    char* argv[SHELL_MAX_ARGS + 1];
+    int argc = tokenize(line, argv);
+    if (argc == 0) {
+        return;
+    }
+    if (argc < 0) {
+        printf("Too many arguments, at most %u\n", RED, BLACK, SHELL_MAX_ARGS);
+        return;
+    }
+    struct shell_command* cmd = shell_find(argv[0]);
+    if (cmd == NULL) {
+        printf("Unknown command: %s\n", RED, BLACK, argv[0]);
+        printf("Type 'help' for available commands.\n", GRAY, BLACK);
+        return;
+    }
+    cmd->handler(argc, argv);
+}
+
+static void cmd_help(int argc, char** argv) {
+    static const char spaces[] = "                ";
+    if (argc > 1) {
+        struct shell_command* cmd = shell_find(argv[1]);
+        if (cmd == NULL) {
+            printf("Unknown command: %s\n", RED, BLACK, argv[1]);
+        } else {
+            printf("  %s - %s\n", GRAY, BLACK, cmd->name, cmd->help);
+        }
+        return;
+    }
+    struct shell_command* sorted[SHELL_MAX_COMMANDS];
+    size_t count = __atomic_load_n(&command_count, __ATOMIC_ACQUIRE);
+    size_t width = 0;
+
+    // Alphabetical, names padded to a common width
+    for (size_t i = 0; i < count; i++) {
+        struct shell_command* cmd = commands[i];
+        size_t j = i;
+        while (j > 0 && strcmp(sorted[j - 1]->name, cmd->name) > 0) {
+            sorted[j] = sorted[j - 1];
+            j--;
+        }
+        sorted[j] = cmd;
+        size_t len = strlen(cmd->name);
+        width = len > width ? len : width;
+    }
+    width = width < sizeof(spaces) - 1 ? width : sizeof(spaces) - 1;
+
+    printf("Available commands:\n", WHITE, BLACK);
+    for (size_t i = 0; i < count; i++) {
+        size_t len = strlen(sorted[i]->name);
+        printf("  %s%s - %s\n", GRAY, BLACK, sorted[i]->name,
+               len < width ? spaces + (sizeof(spaces) - 1) - (width - len) : "", sorted[i]->help);
+    }
+}
+
+static void complete_help(int argc, char** argv, struct shell_completion* comp) {
+    (void)argv;
+    if (argc == 1) {
+        shell_complete_command(comp);
+    }
+}
+
+SHELL_COMMAND_ARGS(help, "help", "Show this help message, 'help <command>' for one", cmd_help, complete_help);
+
+// Line editor. What is on screen after the prompt is mirrored in shown;
+// every edit composes the new text and refresh() redraws only the span of
+// cells that differ, so a keystroke costs a few cells however long the
+// line is. The cursor is the cell drawn in inverse colours.
+struct line_editor {
+    char line[SHELL_LINE_MAX];
+    size_t len;
+    size_t cursor;
+    char shown[SHELL_SHOWN_MAX];
+    size_t shown_len;
+    size_t shown_cursor;
+    size_t screen;              // Console cursor, in cells after the prompt
+    size_t browse;              // History entries back from the newest, 0 = draft
+    char draft[SHELL_LINE_MAX]; // Line being typed while browsing history
+    size_t draft_len;
+    bool searching;             // Ctrl+R
+    char query[SHELL_QUERY_MAX];
+    size_t query_len;
+    size_t match;               // Entry the search shows (browse numbering), 0 = none
+    bool failed;
+};
+
+// Bounded ring of entered lines, newest at history_count - 1
+static char history[SHELL_HISTORY][SHELL_LINE_MAX];
+static size_t history_count = 0;
+static struct line_editor editor;
+
+static size_t history_size(void) {
+    return history_count < SHELL_HISTORY ? history_count : SHELL_HISTORY;
+}
+
+// Entry back entries from the newest (1 = newest)
+static const char* history_entry(size_t back) {
+    return history[(history_count - back) % SHELL_HISTORY];
+}
+
+static void history_add(const char* line) {
+    if (line[0] == '\0' || (history_count > 0 && strcmp(history_entry(1), line) == 0)) {
+        return;
+    }
+    size_t len = strlen(line);
+    memcpy(history[history_count % SHELL_HISTORY], line, len + 1);
+    history_count++;
+}
+
+static void flush_chunk(char* chunk, size_t* n) {
+    if (*n > 0) {
+        chunk[*n] = '\0';
+        printf("%s", WHITE, BLACK, chunk);
+        *n = 0;
+    }
+}
+
+// Print cells [from, to) of text with the cursor cell inverted
+static void emit(const char* text, size_t len, size_t cursor, size_t from, size_t to) {
+    char chunk[CHUNK_MAX + 1];
+    size_t n = 0;
+    for (size_t i = from; i < to; i++) {
+        char c = i < len ? text[i] : ' ';
+        if (i == cursor) {
+            flush_chunk(chunk, &n);
+            printf("%c", BLACK, WHITE, c);
+            continue;
+        }
+        chunk[n++] = c;
+        if (n == CHUNK_MAX) {
+            flush_chunk(chunk, &n);
+        }
+    }
+    flush_chunk(chunk, &n);
+}
+
+// Put the console cursor on cell pos, reprinting what is there to go right
+static void move_to(struct line_editor* ed, size_t pos) {
+    if (pos > ed->screen) {
+        emit(ed->shown, ed->shown_len, ed->shown_cursor, ed->screen, pos);
+    }
+    while (ed->screen > pos) {
+        char back[CHUNK_MAX + 1];
+        size_t n = ed->screen - pos < CHUNK_MAX ? ed->screen - pos : CHUNK_MAX;
+        memset(back, '\b', n);
+        back[n] = '\0';
+        printf("%s", WHITE, BLACK, back);
+        ed->screen -= n;
+    }
+    ed->screen = pos;
+}
+
+// Make the screen show text with the cursor at cursor (NO_CURSOR: none)
+static void refresh(struct line_editor* ed, const char* text, size_t len, size_t cursor) {
+    size_t cells = (len > ed->shown_len ? len : ed->shown_len) + 1;
+    size_t first = cells;
+    size_t last = 0;
+    for (size_t i = 0; i < cells; i++) {
+        char want = i < len ? text[i] : ' ';
+        char have = i < ed->shown_len ? ed->shown[i] : ' ';
+        if (want != have || (i == cursor) != (i == ed->shown_cursor)) {
+            first = first == cells ? i : first;
+            last = i;
+        }
+    }
+    if (first == cells) {
+        return;
+    }
+    move_to(ed, first);
+    emit(text, len, cursor, first, last + 1);
+    ed->screen = last + 1;
+    memcpy(ed->shown, text, len);
+    ed->shown_len = len;
+    ed->shown_cursor = cursor;
+}
+
+// Draw the line being edited, or the search prompt and its match
+static void redraw(struct line_editor* ed) {
+    if (!ed->searching) {
+        refresh(ed, ed->line, ed->len, ed->cursor);
+        return;
+    }
+    static const char head[] = "(search)'";
+    static const char failed[] = "(failed search)'";
+    char text[SHELL_SHOWN_MAX];
+    const char* prefix = ed->failed ? failed : head;
+    size_t n = strlen(prefix);
+    memcpy(text, prefix, n);
+    memcpy(text + n, ed->query, ed->query_len);
+    n += ed->query_len;
+    size_t cursor = n;
+    memcpy(text + n, "': ", 3);
+    n += 3;
+    memcpy(text + n, ed->line, ed->len);
+    refresh(ed, text, n + ed->len, cursor);
+}
+
+static void set_line(struct line_editor* ed, const char* text, size_t len) {
+    memcpy(ed->line, text, len);
+    ed->len = len;
+    ed->cursor = len;
+}
+
+static void insert(struct line_editor* ed, const char* text, size_t n) {
+    if (n > SHELL_LINE_MAX - 1 - ed->len) {
+        n = SHELL_LINE_MAX - 1 - ed->len;
+    }
+    memmove(ed->line + ed->cursor + n, ed->line + ed->cursor, ed->len - ed->cursor);
+    memcpy(ed->line + ed->cursor, text, n);
+    ed->len += n;
+    ed->cursor += n;
+}
+
+// Drop n characters from pos on
+static void erase(struct line_editor* ed, size_t pos, size_t n) {
+    memmove(ed->line + pos, ed->line + pos + n, ed->len - pos - n);
+    ed->len -= n;
+}
+
+// Step through history, from 0 (the draft) back to the oldest entry kept
+static void browse(struct line_editor* ed, size_t back) {
+    if (back > history_size() || back == ed->browse) {
+        return;
+    }
+    if (ed->browse == 0) {
+        memcpy(ed->draft, ed->line, ed->len);
+        ed->draft_len = ed->len;
+    }
+    ed->browse = back;
+    if (back == 0) {
+        set_line(ed, ed->draft, ed->draft_len);
+    } else {
+        const char* entry = history_entry(back);
+        set_line(ed, entry, strlen(entry));
+    }
+}
+
+static bool contains(const char* text, const char* query, size_t len) {
+    for (; *text; text++) {
+        if (strncmp(text, query, len) == 0) {
+            return true;
+        }
+    }
+    return len == 0;
+}
+
+// Newest entry from back on that contains the query
+static void search(struct line_editor* ed, size_t back) {
+    ed->query[ed->query_len] = '\0';
+    for (size_t i = back; i <= history_size(); i++) {
+        if (contains(history_entry(i), ed->query, ed->query_len)) {
+            const char* entry = history_entry(i);
+            ed->match = i;
+            ed->failed = false;
+            set_line(ed, entry, strlen(entry));
+            return;
+        }
+    }
+    ed->failed = true;
+}
+
+// Keys while searching; false once the search is over
+static bool search_key(struct line_editor* ed, char c) {
+    switch (c) {
+        case CTRL_R:
+            search(ed, ed->match + 1);
+            return true;
+        case KEY_BACKSPACE:
+            if (ed->query_len > 0) {
+                ed->query_len--;
+                search(ed, 1);
+            }
+            return true;
+        case KEY_ESCAPE:
+            set_line(ed, ed->draft, ed->draft_len);
+            return false;
+        default:
+            if (c >= 32 && c <= 126 && ed->query_len < SHELL_QUERY_MAX - 1) {
+                ed->query[ed->query_len++] = c;
+                search(ed, ed->match ? ed->match : 1);
+                return true;
+            }
+            // Anything else takes the match as the line
+            return false;
+    }
+}
+
+static void prompt(struct line_editor* ed) {
+    printf("valern> ", GREEN, BLACK);
+    ed->shown_len = 0;
+    ed->shown_cursor = NO_CURSOR;
+    ed->screen = 0;
+    redraw(ed);
+}
+
+// Leave the line as plain text with the console cursor after it
+static void finish(struct line_editor* ed) {
+    ed->searching = false;
+    refresh(ed, ed->line, ed->len, NO_CURSOR);
+    move_to(ed, ed->shown_len);
+}
+
+static void reset(struct line_editor* ed) {
+    ed->len = 0;
+    ed->cursor = 0;
+    ed->browse = 0;
+}
+
+// Complete the word before the cursor: as far as all candidates agree,
+// plus a space once only one is left. If Tab cannot add anything, the
+// candidates are listed under the line.
+static void complete(struct line_editor* ed) {
+    size_t start = ed->cursor;
+    while (start > 0 && ed->line[start - 1] != ' ') {
+        start--;
+    }
+    struct shell_completion comp = { .word = ed->line + start, .word_len = ed->cursor - start };
+
+    // Arguments before the word, split in a copy
+    char before[SHELL_LINE_MAX];
+    char* argv[SHELL_MAX_ARGS + 1];
+    memcpy(before, ed->line, start);
+    before[start] = '\0';
+    int argc = tokenize(before, argv);
+    if (argc < 0) {
+        return;
+    }
+    if (argc == 0) {
+        shell_complete_command(&comp);
+    } else {
+        struct shell_command* cmd = shell_find(argv[0]);
+        if (cmd == NULL || cmd->complete == NULL) {
+            return;
+        }
+        cmd->complete(argc, argv, &comp);
+    }
+
+    if (comp.matches == 0) {
+        return;
+    }
+    if (comp.common_len > comp.word_len) {
+        insert(ed, comp.common + comp.word_len, comp.common_len - comp.word_len);
+    }
+    if (comp.matches == 1) {
+        if (ed->cursor == ed->len || ed->line[ed->cursor] != ' ') {
+            insert(ed, " ", 1);
+        }
+        return;
+    }
+    if (comp.common_len == comp.word_len) {
+        finish(ed);
+        comp.list[comp.list_len] = '\0';
+        printf("\n%s\n", GRAY, BLACK, comp.list);
+        prompt(ed);
+    }
+}
+
+// Cursor and history keys, which type no character
+static void special_key(struct line_editor* ed, uint16_t code) {
+    switch (code) {
+        case KC_LEFT:
+            if (ed->cursor > 0) {
+                ed->cursor--;
+            }
+            break;
+        case KC_RIGHT:
+            if (ed->cursor < ed->len) {
+                ed->cursor++;
+            }
+            break;
+        case KC_HOME:
+            ed->cursor = 0;
+            break;
+        case KC_END:
+            ed->cursor = ed->len;
+            break;
+        case KC_DELETE:
+            if (ed->cursor < ed->len) {
+                erase(ed, ed->cursor, 1);
+            }
+            break;
+        case KC_UP:
+            browse(ed, ed->browse + 1);
+            break;
+        case KC_DOWN:
+            if (ed->browse > 0) {
+                browse(ed, ed->browse - 1);
+            }
+            break;
+    }
+}
+
+static void key(struct line_editor* ed, char c) {
+    switch (c) {
+        case KEY_ENTER:
+            finish(ed);
+            printf("\n", WHITE, BLACK);
+            ed->line[ed->len] = '\0';
+            history_add(ed->line);
+            // shell_execute() splits the line in place
+            shell_execute(ed->line);
+            reset(ed);
+            prompt(ed);
+            break;
+
+        case KEY_BACKSPACE:
+            if (ed->cursor > 0) {
+                ed->cursor--;
+                erase(ed, ed->cursor, 1);
+            }
+            break;
+
+        case CTRL_A:
+            ed->cursor = 0;
+            break;
+
+        case CTRL_C:
+            finish(ed);
+            printf("^C\n", RED, BLACK);
+            reset(ed);
+            prompt(ed);
+            break;
+
+        case CTRL_L:
+            console_clear();
+            prompt(ed);
+            break;
+
+        case KEY_TAB:
+            complete(ed);
+            break;
+
+        case CTRL_R:
+            memcpy(ed->draft, ed->line, ed->len);
+            ed->draft_len = ed->len;
+            ed->searching = true;
+            ed->query_len = 0;
+            ed->match = 0;
+            ed->failed = false;
+            break;
+
+        default:
+            if (c >= 32 && c <= 126) {
+                insert(ed, &c, 1);
+            }
+            break;
+    }
+}
+
+void shell(void) {
+    struct line_editor* ed = &editor;
+    struct input_handle keyboard;
+    struct input_event events[SHELL_EVENT_BATCH];
+    
+    // The shell is one reader of the keyboard among possibly many
+    input_open(&keyboard, keyboard_input_device());
+    
+    reset(ed);
+    prompt(ed);
+    
+    while (true) {
+        input_wait(&keyboard, 1);
+        size_t count = input_read(&keyboard, events, SHELL_EVENT_BATCH);
+        
+        for (size_t i = 0; i < count; i++) {
+            struct input_event* ev = &events[i];
+            char c = keyboard_event_to_char(ev);
+            if (c == 0 && (ev->type != EV_KEY || ev->value == KEY_VALUE_RELEASE)) {
+                continue;
+            }
+
+            if (ed->searching) {
+                if (c != 0 && search_key(ed, c)) {
+                    redraw(ed);
+                    continue;
+                }
+                // Enter runs the match, other keys edit it
+                ed->searching = false;
+                ed->browse = 0;
+                if (c == KEY_ESCAPE) {
+                    redraw(ed);
+                    continue;
+                }
+            }
+            if (c != 0) {
+                key(ed, c);
+            } else {
+                special_key(ed, ev->code);
+            }
+            redraw(ed);
+        }
+    }
+}
@@ -0,0 +1,142 @@
+#include "simd.h"
+#include <stdint.h>
+#include <stddef.h>
+
+// Vectors of 32-bit lanes, unaligned access allowed
+typedef uint32_t v4u32 __attribute__((vector_size(16), aligned(1), may_alias));
+typedef uint32_t v8u32 __attribute__((vector_size(32), aligned(1), may_alias));
+
+#define AVX2 __attribute__((target("avx2")))
+
+void simd_fill32_sse2(uint32_t* dst, uint32_t value, size_t count) {
+    v4u32 v = (v4u32){ 0 } + value;
+
+    // Aligned stores for the bulk
+    for (; count > 0 && ((uintptr_t)dst & 15); count--) {
+        *dst++ = value;
+    }
+    for (; count >= 16; count -= 16, dst += 16) {
+        *(v4u32*)(dst + 0) = v;
+        *(v4u32*)(dst + 4) = v;
+        *(v4u32*)(dst + 8) = v;
+        *(v4u32*)(dst + 12) = v;
+    }
+    for (; count >= 4; count -= 4, dst += 4) {
+        *(v4u32*)dst = v;
+    }
+    for (; count > 0; count--) {
+        *dst++ = value;
+    }
+}
+
+AVX2 void simd_fill32_avx2(uint32_t* dst, uint32_t value, size_t count) {
+    v8u32 v = (v8u32){ 0 } + value;
+
+    for (; count > 0 && ((uintptr_t)dst & 31); count--) {
+        *dst++ = value;
+    }
+    for (; count >= 32; count -= 32, dst += 32) {
+        *(v8u32*)(dst + 0) = v;
+        *(v8u32*)(dst + 8) = v;
+        *(v8u32*)(dst + 16) = v;
+        *(v8u32*)(dst + 24) = v;
+    }
+    for (; count >= 8; count -= 8, dst += 8) {
+        *(v8u32*)dst = v;
+    }
+    for (; count > 0; count--) {
+        *dst++ = value;
+    }
+}
+
+void simd_copy_sse2(void* dst, const void* src, size_t size) {
+    uint8_t* d = dst;
+    const uint8_t* s = src;
+
+    for (; size >= 64; size -= 64, d += 64, s += 64) {
+        v4u32 a = *(const v4u32*)(s + 0);
+        v4u32 b = *(const v4u32*)(s + 16);
+        v4u32 c = *(const v4u32*)(s + 32);
+        v4u32 e = *(const v4u32*)(s + 48);
+        *(v4u32*)(d + 0) = a;
+        *(v4u32*)(d + 16) = b;
+        *(v4u32*)(d + 32) = c;
+        *(v4u32*)(d + 48) = e;
+    }
+    for (; size >= 16; size -= 16, d += 16, s += 16) {
+        *(v4u32*)d = *(const v4u32*)s;
+    }
+    for (; size > 0; size--) {
+        *d++ = *s++;
+    }
+}
+
+AVX2 void simd_copy_avx2(void* dst, const void* src, size_t size) {
+    uint8_t* d = dst;
+    const uint8_t* s = src;
+
+    for (; size >= 128; size -= 128, d += 128, s += 128) {
+        v8u32 a = *(const v8u32*)(s + 0);
+        v8u32 b = *(const v8u32*)(s + 32);
+        v8u32 c = *(const v8u32*)(s + 64);
+        v8u32 e = *(const v8u32*)(s + 96);
+        *(v8u32*)(d + 0) = a;
+        *(v8u32*)(d + 32) = b;
+        *(v8u32*)(d + 64) = c;
+        *(v8u32*)(d + 96) = e;
+    }
+    for (; size >= 32; size -= 32, d += 32, s += 32) {
+        *(v8u32*)d = *(const v8u32*)s;
+    }
+    for (; size > 0; size--) {
+        *d++ = *s++;
+    }
+}
+
+// Words left over by the vector loop; a partial last word is zero-padded
+static uint64_t sum32_tail(const uint8_t* p, size_t size) {
+    uint64_t total = 0;
+    for (; size >= 4; size -= 4, p += 4) {
+        total += *(const uint32_t*)p;
+    }
+    uint32_t last = 0;
+    for (size_t i = 0; i < size; i++) {
+        last |= (uint32_t)p[i] << (i * 8);
+    }
+    return total + last;
+}
+
+// Lanes add 32-bit words and count their carries separately
+uint64_t simd_sum32_sse2(const void* data, size_t size) {
+    const uint8_t* p = data;
+    v4u32 sum = { 0 };
+    v4u32 carry = { 0 };
+
+    for (; size >= 16; size -= 16, p += 16) {
+        v4u32 v = *(const v4u32*)p;
+        sum += v;
+        carry -= (v4u32)(sum < v);
+    }
+    uint64_t total = sum32_tail(p, size);
+    for (int i = 0; i < 4; i++) {
+        total += sum[i] + ((uint64_t)carry[i] << 32);
+    }
+    return total;
+}
+
+AVX2 uint64_t simd_sum32_avx2(const void* data, size_t size) {
+    const uint8_t* p = data;
+    v8u32 sum = { 0 };
+    v8u32 carry = { 0 };
+
+    for (; size >= 32; size -= 32, p += 32) {
+        v8u32 v = *(const v8u32*)p;
+        sum += v;
+        carry -= (v8u32)(sum < v);
+    }
+    uint64_t total = sum32_tail(p, size);
+    for (int i = 0; i < 8; i++) {
+        total += sum[i] + ((uint64_t)carry[i] << 32);
+    }
+    return total;
+}
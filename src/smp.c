@@ -0,0 +1,222 @@
+#include "smp.h"
+#include "gdt.h"
+#include "interrupts.h"
+#include "timer.h"
+#include "sched.h"
+#include "tlb.h"
+#include "vmm.h"
+#include "fpu.h"
+#include "syscall.h"
+#include "idle.h"
+#include "console.h"
+#include "shell.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <limine.h>
+
+// Give up on an AP that has not come online after this long
+#define AP_START_TIMEOUT_US 100000
+
+__attribute__((used, section(".limine_requests")))
+static volatile struct limine_mp_request mp_request = {
+    .id = LIMINE_MP_REQUEST,
+    .revision = 0,
+    .flags = LIMINE_MP_X2APIC
+};
+
+// BSP stack from the linker script
+extern uint8_t kernel_stack_top[];
+
+struct cpu cpus[MAX_CPUS];
+static unsigned int cpus_present = 1;
+static volatile unsigned int cpus_online = 0;
+
+// AP stacks; the BSP keeps the linker-provided one
+static uint8_t cpu_stacks[MAX_CPUS][CPU_STACK_SIZE] __attribute__((aligned(16)));
+
+// Start handshake: an AP claims its slot on entry, the BSP closes the slots
+// still unclaimed when it stops waiting. A late AP then parks instead of
+// coming online behind the back of code that sized per-CPU state already.
+enum {
+    AP_PENDING = 0,
+    AP_STARTING,
+    AP_ABANDONED
+};
+static volatile uint8_t ap_start[MAX_CPUS];
+
+// Load this CPU's GDT/TSS and point GS at its per-CPU area
+static void cpu_setup(struct cpu* cpu) {
+    gdt_init_cpu(cpu->id, cpu->stack_top);
+    cpu->self = cpu;
+    wrmsr(MSR_GS_BASE, (uint64_t)cpu);
+    wrmsr(MSR_KERNEL_GS_BASE, 0);
+}
+
+void smp_init_bsp(void) {
+    struct cpu* cpu = &cpus[0];
+
+    cpu->id = 0;
+    cpu->stack_top = (uint64_t)kernel_stack_top;
+    if (mp_request.response != NULL) {
+        cpu->lapic_id = mp_request.response->bsp_lapic_id;
+    }
+    cpu_setup(cpu);
+    cpu->online = true;
+    cpus_online = 1;
+}
+
+// First C code on an AP, already on its own stack
+__attribute__((noreturn))
+static void ap_main(struct cpu* cpu) {
+    uint8_t pending = AP_PENDING;
+    if (!__atomic_compare_exchange_n(&ap_start[cpu->id], &pending, AP_STARTING, false,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        for (;;) {
+            asm volatile("cli\n\thlt");
+        }
+    }
+    cpu_setup(cpu);
+    interrupts_init_ap();
+    vmm_init_cpu();
+    tlb_init_cpu();
+    fpu_init_cpu();
+    syscall_init_cpu();
+    sched_init_cpu();
+
+    __atomic_store_n(&cpu->online, true, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&cpus_online, 1, __ATOMIC_ACQ_REL);
+
+    // Threads are woken onto this CPU with a reschedule IPI
+    sched_idle();
+}
+
+// Limine jumps here on each AP, on a bootloader stack
+__attribute__((noreturn))
+static void ap_entry(struct limine_mp_info* info) {
+    struct cpu* cpu = (struct cpu*)info->extra_argument;
+
+    asm volatile(
+        "mov rsp, %0\n"
+        "xor rbp, rbp\n"
+        "call %P1\n"
+        :
+        : "r"(cpu->stack_top), "i"(ap_main), "D"(cpu)
+        : "memory");
+    __builtin_unreachable();
+}
+
+unsigned int smp_start_aps(void) {
+    struct limine_mp_response* response = mp_request.response;
+    if (response == NULL) {
+        return cpus_online;
+    }
+
+    // Hand every AP its per-CPU area and stack, then release them all at once
+    unsigned int next = 1;
+    for (uint64_t i = 0; i < response->cpu_count && next < MAX_CPUS; i++) {
+        struct limine_mp_info* info = response->cpus[i];
+        if (info->lapic_id == response->bsp_lapic_id) {
+            continue;
+        }
+        struct cpu* cpu = &cpus[next];
+        cpu->id = next;
+        cpu->lapic_id = info->lapic_id;
+        cpu->stack_top = (uint64_t)&cpu_stacks[next][CPU_STACK_SIZE];
+        info->extra_argument = (uint64_t)cpu;
+        __atomic_store_n(&info->goto_address, ap_entry, __ATOMIC_RELEASE);
+        next++;
+    }
+    cpus_present = next;
+
+    uint64_t deadline = rdtsc() + us_to_tsc(AP_START_TIMEOUT_US);
+    while (__atomic_load_n(&cpus_online, __ATOMIC_ACQUIRE) < cpus_present && rdtsc() < deadline) {
+        cpu_relax();
+    }
+    // An AP that claimed its slot is past the point of no return, wait for it
+    for (unsigned int i = 1; i < cpus_present; i++) {
+        uint8_t pending = AP_PENDING;
+        if (!__atomic_compare_exchange_n(&ap_start[i], &pending, AP_ABANDONED, false,
+                                         __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            while (!__atomic_load_n(&cpus[i].online, __ATOMIC_ACQUIRE)) {
+                cpu_relax();
+            }
+        }
+    }
+    return cpus_online;
+}
+
+unsigned int cpu_count(void) {
+    return cpus_present;
+}
+
+unsigned int cpu_online_count(void) {
+    return __atomic_load_n(&cpus_online, __ATOMIC_ACQUIRE);
+}
+
+// CPU number from a shell argument, -1 if it names none
+static int parse_cpu(const char* arg) {
+    unsigned int id = 0;
+    if (*arg == '\0') {
+        return -1;
+    }
+    for (; *arg; arg++) {
+        if (*arg < '0' || *arg > '9' || id >= MAX_CPUS) {
+            return -1;
+        }
+        id = id * 10 + (unsigned int)(*arg - '0');
+    }
+    return id < cpu_count() ? (int)id : -1;
+}
+
+static void cmd_cpus(int argc, char** argv) {
+    unsigned int first = 0;
+    unsigned int end = cpu_count();
+    if (argc > 1) {
+        int id = parse_cpu(argv[1]);
+        if (id < 0) {
+            printf("No such CPU: %s\n", RED, BLACK, argv[1]);
+            return;
+        }
+        first = (unsigned int)id;
+        end = first + 1;
+    }
+    printf("Processors (%u online):\n", WHITE, BLACK, cpu_online_count());
+    for (unsigned int i = first; i < end; i++) {
+        printf("  cpu%u: LAPIC %u, %s, %u switches%s\n", cpus[i].online ? GRAY : RED, BLACK, i, cpus[i].lapic_id,
+               cpus[i].online ? "online" : "offline", (unsigned int)sched_switch_count(i),
+               i == cpu_id() ? " (this CPU)" : "");
+        for (size_t c = 0; c < idle_cstate_count(); c++) {
+            printf("%s C%u: %u", GRAY, BLACK, c == 0 ? "   " : ",", idle_cstate_get(c)->cstate,
+                   (unsigned int)idle_cstate_usage(i, c));
+        }
+        if (idle_cstate_count() > 0) {
+            printf("\n", GRAY, BLACK);
+        }
+    }
+}
+
+static void complete_cpus(int argc, char** argv, struct shell_completion* comp) {
+    (void)argv;
+    if (argc != 1) {
+        return;
+    }
+    for (unsigned int i = 0; i < cpu_count(); i++) {
+        char number[12];
+        size_t len = 0;
+        unsigned int n = i;
+        do {
+            number[len++] = (char)('0' + n % 10);
+            n /= 10;
+        } while (n > 0);
+        for (size_t j = 0; j < len / 2; j++) {
+            char c = number[j];
+            number[j] = number[len - 1 - j];
+            number[len - 1 - j] = c;
+        }
+        number[len] = '\0';
+        shell_complete_add(comp, number);
+    }
+}
+
+SHELL_COMMAND_ARGS(cpus, "cpus", "List processors, 'cpus <n>' shows one", cmd_cpus, complete_cpus);
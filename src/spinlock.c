@@ -0,0 +1,112 @@
+#include "spinlock.h"
+#include "timer.h"
+#include "console.h"
+#include "shell.h"
+#include "stdmem.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Every lock with statistics that has been taken, newest first. Entries
+// are only ever pushed, so the list can be walked without a lock.
+static struct lock_stats* volatile lockstat_list = NULL;
+static volatile size_t lockstat_entries = 0;
+
+static void lockstat_register(struct lock_stats* stats) {
+    uint32_t expected = 0;
+    if (!__atomic_compare_exchange_n(&stats->registered, &expected, 1, false,
+                                     __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    struct lock_stats* head = __atomic_load_n(&lockstat_list, __ATOMIC_RELAXED);
+    do {
+        stats->next = head;
+    } while (!__atomic_compare_exchange_n(&lockstat_list, &head, stats, true,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    __atomic_add_fetch(&lockstat_entries, 1, __ATOMIC_RELAXED);
+}
+
+// Counters are bumped atomically since read locks have many holders; the
+// maxima may miss a concurrent update, which is fine for statistics
+void lock_stat_acquired(struct lock_stats* stats, uint64_t start, uint64_t now, bool contended) {
+    if (!stats->registered) {
+        lockstat_register(stats);
+    }
+
+    __atomic_add_fetch(&stats->acquisitions, 1, __ATOMIC_RELAXED);
+    if (contended) {
+        uint64_t wait = now - start;
+        __atomic_add_fetch(&stats->contended, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&stats->wait_tsc, wait, __ATOMIC_RELAXED);
+        if (wait > stats->max_wait_tsc) {
+            stats->max_wait_tsc = wait;
+        }
+    }
+}
+
+void lock_stat_released(struct lock_stats* stats, uint64_t since) {
+    uint64_t hold = rdtsc() - since;
+
+    __atomic_add_fetch(&stats->hold_tsc, hold, __ATOMIC_RELAXED);
+    if (hold > stats->max_hold_tsc) {
+        stats->max_hold_tsc = hold;
+    }
+}
+
+size_t lockstat_count(void) {
+    return __atomic_load_n(&lockstat_entries, __ATOMIC_RELAXED);
+}
+
+struct lock_stats* lockstat_get(size_t index) {
+    struct lock_stats* stats = __atomic_load_n(&lockstat_list, __ATOMIC_ACQUIRE);
+    while (stats && index--) {
+        stats = stats->next;
+    }
+    return stats;
+}
+
+void lockstat_reset(void) {
+    for (struct lock_stats* stats = __atomic_load_n(&lockstat_list, __ATOMIC_ACQUIRE); stats; stats = stats->next) {
+        stats->acquisitions = 0;
+        stats->contended = 0;
+        stats->wait_tsc = 0;
+        stats->max_wait_tsc = 0;
+        stats->hold_tsc = 0;
+        stats->max_hold_tsc = 0;
+    }
+}
+
+static void cmd_lockstat(int argc, char** argv) {
+    if (argc > 1 && strcmp(argv[1], "reset") == 0) {
+        lockstat_reset();
+        printf("Lock statistics cleared\n", GREEN, BLACK);
+        return;
+    }
+    // Times in microseconds; waits are averaged over contended acquisitions
+    printf("  NAME      ACQUIRED  CONTENDED  AVG/MAX WAIT  AVG/MAX HOLD\n", WHITE, BLACK);
+    for (size_t i = 0; i < lockstat_count(); i++) {
+        struct lock_stats* stats = lockstat_get(i);
+        if (stats == NULL) {
+            break;
+        }
+        uint64_t acquired = stats->acquisitions;
+        uint64_t contended = stats->contended;
+        printf("  %s  %u  %u  %u/%u  %u/%u\n", contended ? RED : GRAY, BLACK, stats->name,
+               (unsigned int)acquired, (unsigned int)contended,
+               (unsigned int)(contended ? tsc_to_ns(stats->wait_tsc / contended) / 1000 : 0),
+               (unsigned int)(tsc_to_ns(stats->max_wait_tsc) / 1000),
+               (unsigned int)(acquired ? tsc_to_ns(stats->hold_tsc / acquired) / 1000 : 0),
+               (unsigned int)(tsc_to_ns(stats->max_hold_tsc) / 1000));
+    }
+}
+
+static void complete_lockstat(int argc, char** argv, struct shell_completion* comp) {
+    (void)argv;
+    if (argc == 1) {
+        shell_complete_add(comp, "reset");
+    }
+}
+
+SHELL_COMMAND_ARGS(lockstat, "lockstat", "Show lock contention, 'lockstat reset' clears it", cmd_lockstat,
+                   complete_lockstat);
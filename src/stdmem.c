@@ -64,4 +64,16 @@ int strcmp(const char* s1, const char* s2) {
         s2++;
     }
     return *(unsigned char*)s1 - *(unsigned char*)s2;
+}
+
+int strncmp(const char* s1, const char* s2, size_t n) {
+    while (n && *s1 && (*s1 == *s2)) {
+        s1++;
+        s2++;
+        n--;
+    }
+    if (n == 0) {
+        return 0;
+    }
+    return *(unsigned char*)s1 - *(unsigned char*)s2;
 }
\ No newline at end of file
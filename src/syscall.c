@@ -0,0 +1,625 @@
+#include "syscall.h"
+#include "process.h"
+#include "sched.h"
+#include "gdt.h"
+#include "cpu.h"
+#include "vmm.h"
+#include "console.h"
+#include "vdso.h"
+#include "pipe.h"
+#include "fbdev.h"
+#include "pmm.h"
+#include "timer.h"
+#include "shell.h"
+#include "stdmem.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define XSTR(x) STR(x)
+#define STR(x) #x
+
+// RFLAGS bits cleared on entry: interrupts stay off until the kernel stack
+// is loaded, and user direction/trap/alignment flags do not leak in
+#define RFLAGS_TF 0x100
+#define RFLAGS_DF 0x400
+#define RFLAGS_AC 0x40000
+
+// Where the benchmarks load their user code
+#define BENCH_CODE_BASE 0x400000
+
+extern void syscall_entry(void);
+
+// User code of the benchmark (defined below)
+extern const uint8_t user_bench_start[];
+extern const uint8_t user_bench_end[];
+extern const uint8_t user_clock_bench_start[];
+extern const uint8_t user_clock_bench_end[];
+extern const uint8_t user_fork_bench_start[];
+extern const uint8_t user_fork_bench_end[];
+extern const uint8_t user_pipe_bench_start[];
+extern const uint8_t user_pipe_bench_end[];
+extern const uint8_t user_fb_bench_start[];
+extern const uint8_t user_fb_bench_end[];
+
+static int64_t sys_nop(struct syscall_frame* frame) {
+    (void)frame;
+    return 0;
+}
+
+static int64_t sys_exit(struct syscall_frame* frame) {
+    process_exit((int64_t)frame->rdi);
+}
+
+static int64_t sys_write(struct syscall_frame* frame) {
+    uint64_t buf = frame->rdi;
+    size_t len = frame->rsi;
+    char chunk[120];
+
+    if (!user_access_ok(buf, len, false)) {
+        return -EFAULT;
+    }
+    for (size_t done = 0; done < len; ) {
+        size_t n = len - done < sizeof(chunk) - 1 ? len - done : sizeof(chunk) - 1;
+        memcpy(chunk, (const void*)(buf + done), n);
+        chunk[n] = '\0';
+        printf("%s", WHITE, BLACK, chunk);
+        done += n;
+    }
+    return (int64_t)len;
+}
+
+static int64_t sys_yield(struct syscall_frame* frame) {
+    (void)frame;
+    thread_yield();
+    return 0;
+}
+
+static int64_t sys_getpid(struct syscall_frame* frame) {
+    (void)frame;
+    return process_current()->pid;
+}
+
+static int64_t sys_sleep(struct syscall_frame* frame) {
+    thread_sleep(frame->rdi);
+    return 0;
+}
+
+static int64_t sys_fork(struct syscall_frame* frame) {
+    struct process* child = process_fork(process_current(), frame);
+    return child ? (int64_t)child->pid : -ENOMEM;
+}
+
+static int64_t sys_wait(struct syscall_frame* frame) {
+    return process_wait_child(process_current(), (uint32_t)frame->rdi);
+}
+
+static int64_t sys_pipe(struct syscall_frame* frame) {
+    struct process* proc = process_current();
+    uint64_t fds = frame->rdi;
+
+    if (!user_access_ok(fds, 2 * sizeof(uint32_t), true)) {
+        return -EFAULT;
+    }
+    struct pipe* pipe = pipe_create((uint32_t)frame->rsi & PIPE_MESSAGE);
+    if (pipe == NULL) {
+        return -ENOMEM;
+    }
+    int read_fd = process_add_file(proc, pipe, false);
+    if (read_fd < 0) {
+        pipe_close(pipe, false);
+        pipe_close(pipe, true);
+        return -EMFILE;
+    }
+    int write_fd = process_add_file(proc, pipe, true);
+    if (write_fd < 0) {
+        process_close_file(proc, read_fd);
+        pipe_close(pipe, true);
+        return -EMFILE;
+    }
+    ((uint32_t*)fds)[0] = read_fd;
+    ((uint32_t*)fds)[1] = write_fd;
+    return 0;
+}
+
+static int64_t sys_send(struct syscall_frame* frame) {
+    struct process* proc = process_current();
+    struct process_file* file = process_get_file(proc, frame->rdi);
+
+    if (file == NULL || !file->write) {
+        return -EBADF;
+    }
+    return pipe_write(file->pipe, proc, frame->rsi, frame->rdx);
+}
+
+static int64_t sys_recv(struct syscall_frame* frame) {
+    struct process* proc = process_current();
+    struct process_file* file = process_get_file(proc, frame->rdi);
+
+    if (file == NULL || file->write) {
+        return -EBADF;
+    }
+    return pipe_read(file->pipe, proc, frame->rsi, frame->rdx);
+}
+
+static int64_t sys_close(struct syscall_frame* frame) {
+    return process_close_file(process_current(), frame->rdi) == 0 ? 0 : -EBADF;
+}
+
+static int64_t sys_fb_acquire(struct syscall_frame* frame) {
+    struct fb_info info;
+
+    if (!user_access_ok(frame->rdi, sizeof(info), true)) {
+        return -EFAULT;
+    }
+    int64_t result = fbdev_acquire(process_current(), &info);
+    if (result >= 0) {
+        memcpy((void*)frame->rdi, &info, sizeof(info));
+    }
+    return result;
+}
+
+static int64_t sys_fb_release(struct syscall_frame* frame) {
+    (void)frame;
+    return fbdev_release(process_current()) == 0 ? 0 : -EINVAL;
+}
+
+static const syscall_handler_t syscall_table[SYS_COUNT] = {
+    [SYS_NOP]    = sys_nop,
+    [SYS_EXIT]   = sys_exit,
+    [SYS_WRITE]  = sys_write,
+    [SYS_YIELD]  = sys_yield,
+    [SYS_GETPID] = sys_getpid,
+    [SYS_SLEEP]  = sys_sleep,
+    [SYS_FORK]   = sys_fork,
+    [SYS_WAIT]   = sys_wait,
+    [SYS_PIPE]   = sys_pipe,
+    [SYS_SEND]   = sys_send,
+    [SYS_RECV]   = sys_recv,
+    [SYS_CLOSE]  = sys_close,
+    [SYS_FB_ACQUIRE] = sys_fb_acquire,
+    [SYS_FB_RELEASE] = sys_fb_release,
+};
+
+// Called from syscall_entry with interrupts enabled
+void syscall_dispatch(struct syscall_frame* frame) {
+    uint64_t nr = frame->rax;
+
+    if (nr < SYS_COUNT && syscall_table[nr]) {
+        frame->rax = (uint64_t)syscall_table[nr](frame);
+    } else {
+        frame->rax = (uint64_t)-ENOSYS;
+    }
+
+    // SYSRET to a non-canonical address would fault in ring 0
+    if (frame->rip >= USER_TOP) {
+        process_exit(-EFAULT);
+    }
+}
+
+void syscall_init_cpu(void) {
+    wrmsr(MSR_EFER, rdmsr(MSR_EFER) | EFER_SCE);
+    // SYSCALL loads CS from STAR[47:32] and SS from the next selector;
+    // SYSRET loads SS from STAR[63:48] + 8 and CS from + 16
+    wrmsr(MSR_STAR, ((uint64_t)(GDT_KERNEL_DATA | GDT_RPL_USER) << 48) | ((uint64_t)GDT_KERNEL_CODE << 32));
+    wrmsr(MSR_LSTAR, (uint64_t)syscall_entry);
+    wrmsr(MSR_FMASK, RFLAGS_IF | RFLAGS_DF | RFLAGS_TF | RFLAGS_AC);
+}
+
+// Run a benchmark process with rdi = iterations; it exits with the cycles
+// all iterations took
+static uint64_t run_bench(const char* name, const uint8_t* start, const uint8_t* end, uint64_t iterations) {
+    size_t code_size = end - start;
+    struct process* proc = process_create(name);
+    if (proc == NULL) {
+        return 0;
+    }
+    if (process_map(proc, BENCH_CODE_BASE, code_size, 0) != 0 ||
+        process_copy_to(proc, BENCH_CODE_BASE, start, code_size) != 0 ||
+        process_add_stack(proc) == 0 ||
+        process_start(proc, BENCH_CODE_BASE, USER_STACK_TOP, iterations) != 0) {
+        process_destroy(proc);
+        return 0;
+    }
+    return (uint64_t)process_wait(proc, NULL) / iterations;
+}
+
+uint64_t syscall_bench(uint64_t iterations) {
+    return run_bench("syscall_bench", user_bench_start, user_bench_end, iterations);
+}
+
+uint64_t vdso_bench(uint64_t iterations) {
+    return run_bench("vdso_bench", user_clock_bench_start, user_clock_bench_end, iterations);
+}
+
+uint64_t fork_bench(uint64_t iterations) {
+    return run_bench("fork_bench", user_fork_bench_start, user_fork_bench_end, iterations);
+}
+
+uint64_t pipe_bench(uint64_t iterations) {
+    return run_bench("pipe_bench", user_pipe_bench_start, user_pipe_bench_end, iterations);
+}
+
+uint64_t fb_bench(uint64_t frames) {
+    return run_bench("fb_bench", user_fb_bench_start, user_fb_bench_end, frames);
+}
+
+// Entry from SYSCALL: rcx holds the user rip, r11 the user rflags, and rsp
+// is still the user's. Switch to the thread's kernel stack, save the user
+// registers as a struct syscall_frame and return through SYSRET.
+asm(
+    ".global syscall_entry\n"
+    "syscall_entry:\n"
+    "    swapgs\n"
+    "    mov qword ptr gs:[" XSTR(CPU_USER_RSP) "], %rsp\n"
+    "    mov %rsp, qword ptr gs:[" XSTR(CPU_SYSCALL_RSP) "]\n"
+    "    push qword ptr gs:[" XSTR(CPU_USER_RSP) "]\n"
+    "    push %r11\n"
+    "    push %rcx\n"
+    "    push %rax\n"
+    "    push %rdi\n"
+    "    push %rsi\n"
+    "    push %rdx\n"
+    "    push %r10\n"
+    "    push %r8\n"
+    "    push %r9\n"
+    "    push %rbx\n"
+    "    push %rbp\n"
+    "    push %r12\n"
+    "    push %r13\n"
+    "    push %r14\n"
+    "    push %r15\n"
+    "    mov %rdi, %rsp\n"
+    "    sti\n"
+    "    call syscall_dispatch\n"
+    "    cli\n"
+    "    pop %r15\n"
+    "    pop %r14\n"
+    "    pop %r13\n"
+    "    pop %r12\n"
+    "    pop %rbp\n"
+    "    pop %rbx\n"
+    "    pop %r9\n"
+    "    pop %r8\n"
+    "    pop %r10\n"
+    "    pop %rdx\n"
+    "    pop %rsi\n"
+    "    pop %rdi\n"
+    "    pop %rax\n"
+    "    pop %rcx\n"
+    "    pop %r11\n"
+    "    pop %rsp\n"
+    "    swapgs\n"
+    "    sysretq\n"
+);
+
+// Benchmark process: rdi = iterations, exits with the elapsed cycles.
+// Position independent, copied into the process at BENCH_CODE_BASE.
+asm(
+    ".section .rodata\n"
+    ".global user_bench_start\n"
+    ".global user_bench_end\n"
+    "user_bench_start:\n"
+    "    mov %r12, %rdi\n"
+    "    rdtsc\n"
+    "    shl %rdx, 32\n"
+    "    or %rax, %rdx\n"
+    "    mov %r13, %rax\n"
+    "1:\n"
+    "    mov %eax, " XSTR(SYS_NOP) "\n"
+    "    syscall\n"
+    "    dec %r12\n"
+    "    jnz 1b\n"
+    "    rdtsc\n"
+    "    shl %rdx, 32\n"
+    "    or %rax, %rdx\n"
+    "    sub %rax, %r13\n"
+    "    mov %rdi, %rax\n"
+    "    mov %eax, " XSTR(SYS_EXIT) "\n"
+    "    syscall\n"
+    "    ud2\n"
+    "user_bench_end:\n"
+    ".previous\n"
+);
+
+// Clock benchmark: rdi = iterations of the vDSO clock read, exits with the
+// elapsed cycles
+asm(
+    ".section .rodata\n"
+    ".global user_clock_bench_start\n"
+    ".global user_clock_bench_end\n"
+    "user_clock_bench_start:\n"
+    "    mov %r12, %rdi\n"
+    "    movabs %rbx, " XSTR(VDSO_CLOCK_NS) "\n"
+    "    rdtsc\n"
+    "    shl %rdx, 32\n"
+    "    or %rax, %rdx\n"
+    "    mov %r13, %rax\n"
+    "1:\n"
+    "    call %rbx\n"
+    "    dec %r12\n"
+    "    jnz 1b\n"
+    "    rdtsc\n"
+    "    shl %rdx, 32\n"
+    "    or %rax, %rdx\n"
+    "    sub %rax, %r13\n"
+    "    mov %rdi, %rax\n"
+    "    mov %eax, " XSTR(SYS_EXIT) "\n"
+    "    syscall\n"
+    "    ud2\n"
+    "user_clock_bench_end:\n"
+    ".previous\n"
+);
+
+// Fork benchmark: touches FORK_BENCH_PAGES stack pages, then forks
+// children that exit at once and waits for each. Exits with the elapsed
+// cycles, or 0 if a fork failed.
+asm(
+    ".section .rodata\n"
+    ".global user_fork_bench_start\n"
+    ".global user_fork_bench_end\n"
+    "user_fork_bench_start:\n"
+    "    mov %r12, %rdi\n"
+    "    mov %ecx, " XSTR(FORK_BENCH_PAGES) "\n"
+    "    mov %rax, %rsp\n"
+    "1:\n"
+    "    sub %rax, 4096\n"
+    "    mov byte ptr [%rax], 1\n"
+    "    dec %ecx\n"
+    "    jnz 1b\n"
+    "    rdtsc\n"
+    "    shl %rdx, 32\n"
+    "    or %rax, %rdx\n"
+    "    mov %r13, %rax\n"
+    "2:\n"
+    "    mov %eax, " XSTR(SYS_FORK) "\n"
+    "    syscall\n"
+    "    test %rax, %rax\n"
+    "    jle 3f\n"
+    "    mov %rdi, %rax\n"
+    "    mov %eax, " XSTR(SYS_WAIT) "\n"
+    "    syscall\n"
+    "    dec %r12\n"
+    "    jnz 2b\n"
+    "    rdtsc\n"
+    "    shl %rdx, 32\n"
+    "    or %rax, %rdx\n"
+    "    sub %rax, %r13\n"
+    "    mov %rdi, %rax\n"
+    "    mov %eax, " XSTR(SYS_EXIT) "\n"
+    "    syscall\n"
+    "3:\n"
+    // Child, or the fork failed
+    "    xor %edi, %edi\n"
+    "    mov %eax, " XSTR(SYS_EXIT) "\n"
+    "    syscall\n"
+    "    ud2\n"
+    "user_fork_bench_end:\n"
+    ".previous\n"
+);
+
+// Pipe benchmark: rdi = iterations. Opens a pipe, forks a reader that
+// drains it into a page-aligned buffer and exits with the byte count, and
+// sends the same page-aligned buffer that many times. Exits with the
+// elapsed cycles, or 0 if anything failed or bytes went missing.
+asm(
+    ".section .rodata\n"
+    ".global user_pipe_bench_start\n"
+    ".global user_pipe_bench_end\n"
+    "user_pipe_bench_start:\n"
+    "    mov %r12, %rdi\n"
+    "    sub %rsp, 16\n"
+    "    mov %rbx, %rsp\n"                 // [rbx] read fd, [rbx + 4] write fd
+    "    mov qword ptr [%rbx + 8], %rdi\n"
+    "    lea %r14, [%rsp - " XSTR(PIPE_BENCH_BYTES) " - 4096]\n"
+    "    and %r14, -4096\n"
+    "    mov %rax, %r14\n"
+    "    mov %ecx, " XSTR(PIPE_BENCH_BYTES) " / 4096\n"
+    "1:\n"
+    "    mov byte ptr [%rax], 1\n"
+    "    add %rax, 4096\n"
+    "    dec %ecx\n"
+    "    jnz 1b\n"
+    "    mov %rdi, %rbx\n"
+    "    xor %esi, %esi\n"
+    "    mov %eax, " XSTR(SYS_PIPE) "\n"
+    "    syscall\n"
+    "    test %rax, %rax\n"
+    "    jnz 9f\n"
+    "    mov %eax, " XSTR(SYS_FORK) "\n"
+    "    syscall\n"
+    "    test %rax, %rax\n"
+    "    jz 5f\n"
+    "    js 9f\n"
+    "    mov %r15, %rax\n"
+    "    mov %edi, dword ptr [%rbx]\n"
+    "    mov %eax, " XSTR(SYS_CLOSE) "\n"
+    "    syscall\n"
+    "    rdtsc\n"
+    "    shl %rdx, 32\n"
+    "    or %rax, %rdx\n"
+    "    mov %r13, %rax\n"
+    "2:\n"
+    "    mov %edi, dword ptr [%rbx + 4]\n"
+    "    mov %rsi, %r14\n"
+    "    mov %edx, " XSTR(PIPE_BENCH_BYTES) "\n"
+    "    mov %eax, " XSTR(SYS_SEND) "\n"
+    "    syscall\n"
+    "    cmp %rax, " XSTR(PIPE_BENCH_BYTES) "\n"
+    "    jne 9f\n"
+    "    dec %r12\n"
+    "    jnz 2b\n"
+    "    mov %edi, dword ptr [%rbx + 4]\n"
+    "    mov %eax, " XSTR(SYS_CLOSE) "\n"
+    "    syscall\n"
+    "    mov %rdi, %r15\n"
+    "    mov %eax, " XSTR(SYS_WAIT) "\n"
+    "    syscall\n"
+    "    mov %rbp, %rax\n"
+    "    rdtsc\n"
+    "    shl %rdx, 32\n"
+    "    or %rax, %rdx\n"
+    "    sub %rax, %r13\n"
+    "    imul %rcx, qword ptr [%rbx + 8], " XSTR(PIPE_BENCH_BYTES) "\n"
+    "    cmp %rbp, %rcx\n"
+    "    jne 9f\n"
+    "    mov %rdi, %rax\n"
+    "    mov %eax, " XSTR(SYS_EXIT) "\n"
+    "    syscall\n"
+    "5:\n"
+    // Reader: exits with the bytes received
+    "    mov %edi, dword ptr [%rbx + 4]\n"
+    "    mov %eax, " XSTR(SYS_CLOSE) "\n"
+    "    syscall\n"
+    "    xor %ebp, %ebp\n"
+    "6:\n"
+    "    mov %edi, dword ptr [%rbx]\n"
+    "    mov %rsi, %r14\n"
+    "    mov %edx, " XSTR(PIPE_BENCH_BYTES) "\n"
+    "    mov %eax, " XSTR(SYS_RECV) "\n"
+    "    syscall\n"
+    "    test %rax, %rax\n"
+    "    jle 7f\n"
+    "    add %rbp, %rax\n"
+    "    jmp 6b\n"
+    "7:\n"
+    "    mov %rdi, %rbp\n"
+    "    mov %eax, " XSTR(SYS_EXIT) "\n"
+    "    syscall\n"
+    "9:\n"
+    "    xor %edi, %edi\n"
+    "    mov %eax, " XSTR(SYS_EXIT) "\n"
+    "    syscall\n"
+    "    ud2\n"
+    "user_pipe_bench_end:\n"
+    ".previous\n"
+);
+
+// Framebuffer benchmark: rdi = frames. Takes the framebuffer, fills the
+// whole of it once per frame in a different shade, gives it back and
+// exits with the elapsed cycles (0 if it could not get it).
+asm(
+    ".section .rodata\n"
+    ".global user_fb_bench_start\n"
+    ".global user_fb_bench_end\n"
+    "user_fb_bench_start:\n"
+    "    mov %r12, %rdi\n"
+    "    sub %rsp, 32\n"
+    "    mov %rbx, %rsp\n"                 // struct fb_info
+    "    mov %rdi, %rbx\n"
+    "    mov %eax, " XSTR(SYS_FB_ACQUIRE) "\n"
+    "    syscall\n"
+    "    test %rax, %rax\n"
+    "    js 9f\n"
+    "    mov %r14, %rax\n"
+    "    mov %eax, dword ptr [%rbx + 12]\n"
+    "    imul %eax, dword ptr [%rbx + 16]\n"
+    "    shr %eax, 2\n"
+    "    mov %r15d, %eax\n"                // Dwords per frame
+    "    rdtsc\n"
+    "    shl %rdx, 32\n"
+    "    or %rax, %rdx\n"
+    "    mov %r13, %rax\n"
+    "1:\n"
+    "    imul %eax, %r12d, 0x030201\n"
+    "    mov %rdi, %r14\n"
+    "    mov %ecx, %r15d\n"
+    "    rep stosd\n"
+    "    dec %r12\n"
+    "    jnz 1b\n"
+    "    rdtsc\n"
+    "    shl %rdx, 32\n"
+    "    or %rax, %rdx\n"
+    "    sub %rax, %r13\n"
+    "    mov %rbp, %rax\n"
+    "    mov %eax, " XSTR(SYS_FB_RELEASE) "\n"
+    "    syscall\n"
+    "    mov %rdi, %rbp\n"
+    "    mov %eax, " XSTR(SYS_EXIT) "\n"
+    "    syscall\n"
+    "9:\n"
+    "    xor %edi, %edi\n"
+    "    mov %eax, " XSTR(SYS_EXIT) "\n"
+    "    syscall\n"
+    "    ud2\n"
+    "user_fb_bench_end:\n"
+    ".previous\n"
+);
+
+static void cmd_syscall_bench(int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+    uint64_t iterations = 100000;
+    uint64_t cycles = syscall_bench(iterations);
+    if (cycles == 0) {
+        printf("Could not start the benchmark process\n", RED, BLACK);
+        return;
+    }
+    printf("syscall round trip: %u cycles (%u ns), %u calls\n", GREEN, BLACK, (unsigned int)cycles,
+           (unsigned int)tsc_to_ns(cycles), (unsigned int)iterations);
+    cycles = vdso_bench(iterations);
+    printf("vDSO clock read:    %u cycles (%u ns)\n", cycles ? GREEN : RED, BLACK, (unsigned int)cycles,
+           (unsigned int)tsc_to_ns(cycles));
+}
+
+static void cmd_fork_bench(int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+    uint64_t iterations = 1000;
+    uint64_t free_before = pmm_free_page_count();
+    uint64_t cycles = fork_bench(iterations);
+    if (cycles == 0) {
+        printf("Fork benchmark failed\n", RED, BLACK);
+        return;
+    }
+    printf("fork+exit+wait: %u cycles (%u us), %u forks of %u touched pages\n", GREEN, BLACK,
+           (unsigned int)cycles, (unsigned int)(tsc_to_ns(cycles) / 1000), (unsigned int)iterations,
+           FORK_BENCH_PAGES);
+    printf("  free pages %u before, %u after\n", GRAY, BLACK, (unsigned int)free_before,
+           (unsigned int)pmm_free_page_count());
+}
+
+static void cmd_pipe_bench(int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+    uint64_t iterations = 256;
+    struct pipe_stats before, after;
+    pipe_get_stats(&before);
+    uint64_t cycles = pipe_bench(iterations);
+    pipe_get_stats(&after);
+    if (cycles == 0) {
+        printf("Pipe benchmark failed\n", RED, BLACK);
+        return;
+    }
+    uint64_t ns = tsc_to_ns(cycles);
+    printf("pipe send of %u bytes: %u cycles (%u us, %u MiB/s)\n", GREEN, BLACK, PIPE_BENCH_BYTES,
+           (unsigned int)cycles, (unsigned int)(ns / 1000),
+           (unsigned int)(ns ? (uint64_t)PIPE_BENCH_BYTES * 1000000000ULL / ns / (1024 * 1024) : 0));
+    printf("  %u pages lent, %u flipped, %u bytes copied\n", GRAY, BLACK,
+           (unsigned int)(after.pages_lent - before.pages_lent),
+           (unsigned int)(after.pages_flipped - before.pages_flipped),
+           (unsigned int)(after.bytes_copied - before.bytes_copied));
+}
+
+static void cmd_fb_bench(int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+    struct limine_framebuffer* fb = console_framebuffer();
+    uint64_t frames = 60;
+    uint64_t cycles = fb_bench(frames);
+    if (cycles == 0) {
+        printf("Framebuffer benchmark failed\n", RED, BLACK);
+        return;
+    }
+    uint64_t ns = tsc_to_ns(cycles);
+    printf("%ux%u frame fill from user mode: %u us (%u MiB/s), %u frames\n", GREEN, BLACK,
+           (unsigned int)fb->width, (unsigned int)fb->height, (unsigned int)(ns / 1000),
+           (unsigned int)(ns ? fb->pitch * fb->height * 1000000000ULL / ns / (1024 * 1024) : 0),
+           (unsigned int)frames);
+}
+
+SHELL_COMMAND(syscall_bench, "syscall_bench", "Time system calls and vDSO clock reads from user mode",
+              cmd_syscall_bench);
+SHELL_COMMAND(fork_bench, "fork_bench", "Time copy-on-write fork, exit and wait", cmd_fork_bench);
+SHELL_COMMAND(pipe_bench, "pipe_bench", "Time page-flipping pipe transfers between processes", cmd_pipe_bench);
+SHELL_COMMAND(fb_bench, "fb_bench", "Fill the framebuffer from a user process", cmd_fb_bench);
@@ -0,0 +1,485 @@
+#include "task.h"
+#include "sched.h"
+#include "smp.h"
+#include "cpu.h"
+#include "pmm.h"
+#include "spinlock.h"
+#include "stdmem.h"
+#include "memops.h"
+#include "timer.h"
+#include "console.h"
+#include "shell.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Slots in each worker's deque (power of two). A push into a full deque
+// runs the task inline instead.
+#define DEQUE_SIZE 1024
+#define DEQUE_MASK (DEQUE_SIZE - 1)
+
+// parallel_memset chunk size
+#define MEMSET_GRAIN (64 * 1024)
+
+// Unit of work: either fn(arg) or body over [begin, end) split on demand
+struct task {
+    task_func_t fn;
+    void* arg;
+    range_func_t body;
+    size_t begin;
+    size_t end;
+    size_t grain;
+    struct task_group* group;
+    struct task* next;          // Free list and injection queue link
+} __attribute__((aligned(64)));
+
+// Chase-Lev deque: the owner pushes and takes at bottom, thieves take
+// from top. Only the race for the last element needs a CAS.
+struct deque {
+    volatile int64_t top;
+    uint8_t pad[56];            // Thieves and owner on separate lines
+    volatile int64_t bottom;
+    struct task* volatile slots[DEQUE_SIZE];
+};
+
+struct worker {
+    struct deque dq;
+    struct thread* thread;
+    bool active;
+    uint64_t seed;              // Victim selection
+    struct task* free;          // Task cache of this CPU
+    struct task_stats stats;
+} __attribute__((aligned(64)));
+
+static struct worker workers[MAX_CPUS];
+static unsigned int nr_cpus = 0;
+static volatile bool ready = false;
+
+// Tasks submitted by threads that are not workers
+static spinlock_t inject_lock = SPINLOCK_INIT_NAMED("tasks");
+static struct task* inject_head = NULL;
+static struct task* inject_tail = NULL;
+
+// Workers out of work sleep here; sleepers is checked by submitters
+// after publishing a task, workers recheck for work after bumping it
+static struct waitqueue worker_idle = WAITQUEUE_INIT;
+static volatile uint32_t sleepers = 0;
+
+// Threads in task_group_wait(), woken whenever a group drains
+static struct waitqueue group_waiters = WAITQUEUE_INIT;
+
+static bool deque_push(struct deque* dq, struct task* t) {
+    int64_t b = __atomic_load_n(&dq->bottom, __ATOMIC_RELAXED);
+    int64_t top = __atomic_load_n(&dq->top, __ATOMIC_ACQUIRE);
+
+    if (b - top >= DEQUE_SIZE) {
+        return false;
+    }
+    __atomic_store_n(&dq->slots[b & DEQUE_MASK], t, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&dq->bottom, b + 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+static struct task* deque_take(struct deque* dq) {
+    int64_t b = __atomic_load_n(&dq->bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&dq->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t top = __atomic_load_n(&dq->top, __ATOMIC_RELAXED);
+
+    if (top > b) {
+        // Empty
+        __atomic_store_n(&dq->bottom, b + 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    struct task* t = __atomic_load_n(&dq->slots[b & DEQUE_MASK], __ATOMIC_RELAXED);
+    if (top == b) {
+        // Last element, race the thieves for it
+        if (!__atomic_compare_exchange_n(&dq->top, &top, top + 1, false,
+                                         __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            t = NULL;
+        }
+        __atomic_store_n(&dq->bottom, b + 1, __ATOMIC_RELAXED);
+    }
+    return t;
+}
+
+static struct task* deque_steal(struct deque* dq) {
+    int64_t top = __atomic_load_n(&dq->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t b = __atomic_load_n(&dq->bottom, __ATOMIC_ACQUIRE);
+
+    if (top >= b) {
+        return NULL;
+    }
+    struct task* t = __atomic_load_n(&dq->slots[top & DEQUE_MASK], __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&dq->top, &top, top + 1, false,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        return NULL;
+    }
+    return t;
+}
+
+// Worker of the calling thread, NULL if it is not one. Workers are pinned,
+// so the answer cannot change under the caller.
+static struct worker* current_worker(void) {
+    struct worker* w = &workers[cpu_id()];
+    return w->active && w->thread == thread_current() ? w : NULL;
+}
+
+// Whether the caller may block waiting for tasks
+static bool can_defer(void) {
+    if (!__atomic_load_n(&ready, __ATOMIC_ACQUIRE) || !irqs_enabled()) {
+        return false;
+    }
+    struct cpu* cpu = this_cpu();
+    return cpu->irq_depth == 0 && cpu->preempt_count == 0 && cpu->current != cpu->idle;
+}
+
+static struct task* task_alloc(void) {
+    preempt_disable();
+    struct worker* w = &workers[cpu_id()];
+    if (w->free == NULL) {
+        uint64_t phys = pmm_alloc_page();
+        if (phys != 0) {
+            struct task* page = phys_to_virt(phys);
+            for (size_t i = 0; i < PAGE_SIZE / sizeof(struct task); i++) {
+                page[i].next = w->free;
+                w->free = &page[i];
+            }
+        }
+    }
+    struct task* t = w->free;
+    if (t) {
+        w->free = t->next;
+    }
+    preempt_enable();
+    return t;
+}
+
+// Tasks go back to the cache of the CPU that ran them
+static void task_free(struct task* t) {
+    preempt_disable();
+    struct worker* w = &workers[cpu_id()];
+    t->next = w->free;
+    w->free = t;
+    preempt_enable();
+}
+
+static void wake_worker(void) {
+    // Pairs with the fence in worker_sleep(): either we see the sleeper or
+    // it sees the task we just published
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&sleepers, __ATOMIC_RELAXED) > 0) {
+        waitqueue_wake_one(&worker_idle);
+    }
+}
+
+static void task_execute(struct task* t);
+
+// Queue a task, or run it right away if there is nowhere to put it
+static void task_submit(struct task* t) {
+    struct worker* w = current_worker();
+
+    if (w != NULL) {
+        if (!deque_push(&w->dq, t)) {
+            task_execute(t);
+            return;
+        }
+    } else {
+        t->next = NULL;
+        uint64_t flags = spin_lock_irqsave(&inject_lock);
+        if (inject_tail) {
+            inject_tail->next = t;
+        } else {
+            inject_head = t;
+        }
+        inject_tail = t;
+        spin_unlock_irqrestore(&inject_lock, flags);
+    }
+    wake_worker();
+}
+
+static struct task* inject_pop(void) {
+    if (__atomic_load_n(&inject_head, __ATOMIC_RELAXED) == NULL) {
+        return NULL;
+    }
+    uint64_t flags = spin_lock_irqsave(&inject_lock);
+    struct task* t = inject_head;
+    if (t) {
+        inject_head = t->next;
+        if (inject_head == NULL) {
+            inject_tail = NULL;
+        }
+    }
+    spin_unlock_irqrestore(&inject_lock, flags);
+    return t;
+}
+
+// Next task for w: its own newest, then submitted ones, then the oldest of
+// a random victim. *stolen tells the caller to wake another worker, there
+// may be more to steal where that one came from.
+static struct task* find_work(struct worker* w, bool* stolen) {
+    *stolen = false;
+
+    struct task* t = deque_take(&w->dq);
+    if (t) {
+        return t;
+    }
+    if ((t = inject_pop()) != NULL) {
+        return t;
+    }
+
+    // Steal, starting from a random victim
+    w->seed ^= w->seed << 13;
+    w->seed ^= w->seed >> 7;
+    w->seed ^= w->seed << 17;
+    unsigned int start = w->seed % nr_cpus;
+    for (unsigned int i = 0; i < nr_cpus; i++) {
+        struct worker* victim = &workers[(start + i) % nr_cpus];
+        if (victim == w || !victim->active) {
+            continue;
+        }
+        if ((t = deque_steal(&victim->dq)) != NULL) {
+            w->stats.stolen++;
+            *stolen = true;
+            return t;
+        }
+    }
+    return NULL;
+}
+
+// Split off the upper halves of the range for others to steal, run what
+// is left of the lower end
+static void run_range(struct task* t) {
+    size_t begin = t->begin;
+    size_t end = t->end;
+
+    while (end - begin > t->grain) {
+        size_t mid = begin + (end - begin) / 2;
+        struct task* half = task_alloc();
+        if (half == NULL) {
+            break;
+        }
+        *half = *t;
+        half->begin = mid;
+        half->end = end;
+        __atomic_add_fetch(&t->group->pending, 1, __ATOMIC_RELAXED);
+        task_submit(half);
+        end = mid;
+    }
+    t->body(begin, end, t->arg);
+}
+
+static void task_execute(struct task* t) {
+    struct task_group* group = t->group;
+
+    if (t->body) {
+        run_range(t);
+    } else {
+        t->fn(t->arg);
+    }
+    task_free(t);
+
+    // The group may be gone once the count hits zero
+    if (__atomic_sub_fetch(&group->pending, 1, __ATOMIC_ACQ_REL) == 0) {
+        waitqueue_wake_all(&group_waiters);
+    }
+}
+
+// Sleep until a submitter wakes us, unless work shows up after we are
+// counted as a sleeper. Returns that work, if any.
+static struct task* worker_sleep(struct worker* w, bool* stolen) {
+    struct wait_entry entry = { 0 };
+
+    wait_prepare(&worker_idle, &entry);
+    __atomic_add_fetch(&sleepers, 1, __ATOMIC_SEQ_CST);
+    struct task* t = find_work(w, stolen);
+    if (t == NULL) {
+        w->stats.sleeps++;
+        schedule();
+    }
+    __atomic_sub_fetch(&sleepers, 1, __ATOMIC_RELAXED);
+    wait_finish(&worker_idle, &entry);
+    return t;
+}
+
+static void worker_main(void* arg) {
+    struct worker* w = arg;
+
+    for (;;) {
+        bool stolen;
+        struct task* t = find_work(w, &stolen);
+        if (t == NULL) {
+            // The CPU drops to its idle thread and halts
+            t = worker_sleep(w, &stolen);
+        }
+        if (t) {
+            if (stolen) {
+                wake_worker();
+            }
+            w->stats.executed++;
+            task_execute(t);
+        }
+    }
+}
+
+void task_runtime_init(void) {
+    nr_cpus = cpu_count();
+
+    for (unsigned int i = 0; i < nr_cpus; i++) {
+        if (!cpus[i].online) {
+            continue;
+        }
+        struct worker* w = &workers[i];
+        char name[THREAD_NAME_LEN] = "worker";
+        size_t len = 6;
+        if (i >= 10) {
+            name[len++] = '0' + i / 10;
+        }
+        name[len++] = '0' + i % 10;
+
+        w->seed = 0x9E3779B97F4A7C15ULL * (i + 1);
+        w->thread = thread_create(name, worker_main, w, THREAD_PRIO_NORMAL, (int)i);
+        w->active = w->thread != NULL;
+    }
+    __atomic_store_n(&ready, true, __ATOMIC_RELEASE);
+}
+
+bool task_runtime_ready(void) {
+    return __atomic_load_n(&ready, __ATOMIC_ACQUIRE);
+}
+
+void task_spawn(struct task_group* group, task_func_t fn, void* arg) {
+    struct task* t = can_defer() ? task_alloc() : NULL;
+    if (t == NULL) {
+        fn(arg);
+        return;
+    }
+
+    memset(t, 0, sizeof(struct task));
+    t->fn = fn;
+    t->arg = arg;
+    t->group = group;
+    __atomic_add_fetch(&group->pending, 1, __ATOMIC_RELAXED);
+    task_submit(t);
+}
+
+void task_group_wait(struct task_group* group) {
+    struct worker* w = current_worker();
+
+    while (__atomic_load_n(&group->pending, __ATOMIC_ACQUIRE) != 0) {
+        // Workers help out instead of leaving their CPU idle
+        if (w != NULL) {
+            bool stolen;
+            struct task* t = find_work(w, &stolen);
+            if (t) {
+                if (stolen) {
+                    wake_worker();
+                }
+                w->stats.executed++;
+                task_execute(t);
+                continue;
+            }
+        }
+
+        struct wait_entry entry = { 0 };
+        wait_prepare(&group_waiters, &entry);
+        if (__atomic_load_n(&group->pending, __ATOMIC_ACQUIRE) != 0) {
+            schedule();
+        }
+        wait_finish(&group_waiters, &entry);
+    }
+}
+
+void parallel_for(size_t begin, size_t end, size_t grain, range_func_t body, void* arg) {
+    if (grain == 0) {
+        grain = 1;
+    }
+    if (end <= begin) {
+        return;
+    }
+
+    struct task* t = NULL;
+    if (end - begin > grain && can_defer()) {
+        t = task_alloc();
+    }
+    if (t == NULL) {
+        for (size_t i = begin; i < end; i += grain) {
+            body(i, end - i > grain ? i + grain : end, arg);
+        }
+        return;
+    }
+
+    struct task_group group = TASK_GROUP_INIT;
+    memset(t, 0, sizeof(struct task));
+    t->body = body;
+    t->arg = arg;
+    t->begin = begin;
+    t->end = end;
+    t->grain = grain;
+    t->group = &group;
+    group.pending = 1;
+
+    struct worker* w = current_worker();
+    if (w != NULL) {
+        // Split right here and let the others steal the halves
+        w->stats.executed++;
+        task_execute(t);
+    } else {
+        task_submit(t);
+    }
+    task_group_wait(&group);
+}
+
+struct memset_args {
+    uint8_t* dst;
+    int value;
+};
+
+static void memset_range(size_t begin, size_t end, void* arg) {
+    struct memset_args* args = arg;
+    fast_memset(args->dst + begin, args->value, end - begin);
+}
+
+void parallel_memset(void* dst, int value, size_t size) {
+    struct memset_args args = { .dst = dst, .value = value };
+    parallel_for(0, size, MEMSET_GRAIN, memset_range, &args);
+}
+
+void task_get_stats(unsigned int cpu, struct task_stats* stats) {
+    *stats = workers[cpu].stats;
+}
+
+static void cmd_tasks(int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+    // Clear 16 MiB once on this CPU and once on all of them
+    size_t pages = 4096;
+    uint64_t phys = pmm_alloc_pages(pages);
+    if (phys == 0) {
+        printf("Out of memory\n", RED, BLACK);
+        return;
+    }
+    void* buf = phys_to_virt(phys);
+    size_t size = pages * PAGE_SIZE;
+
+    uint64_t start = rdtsc();
+    memset(buf, 0xA5, size);
+    uint64_t serial = tsc_to_ns(rdtsc() - start);
+    start = rdtsc();
+    parallel_memset(buf, 0x5A, size);
+    uint64_t parallel = tsc_to_ns(rdtsc() - start);
+    pmm_free_pages(phys, pages);
+
+    printf("memset 16 MiB: serial %u us, parallel %u us\n", WHITE, BLACK,
+           (unsigned int)(serial / 1000), (unsigned int)(parallel / 1000));
+    for (unsigned int i = 0; i < cpu_count(); i++) {
+        struct task_stats stats;
+        task_get_stats(i, &stats);
+        printf("  cpu%u: %u tasks, %u stolen, %u sleeps\n", GRAY, BLACK, i,
+               (unsigned int)stats.executed, (unsigned int)stats.stolen, (unsigned int)stats.sleeps);
+    }
+}
+
+SHELL_COMMAND(tasks, "tasks", "Benchmark the parallel task runtime", cmd_tasks);
@@ -0,0 +1,78 @@
+#include "tasklet.h"
+#include "cpu.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+// Per-CPU queue of scheduled tasklets. Only the owning CPU touches its queue:
+// producers run with interrupts disabled and the consumer is the drain loop,
+// so head and tail form a single-producer/single-consumer ring.
+#define TASKLET_QUEUE_SIZE 256
+
+struct tasklet_queue {
+    struct tasklet* slots[TASKLET_QUEUE_SIZE];
+    uint32_t head;      // Next slot to fill (producer)
+    uint32_t tail;      // Next slot to run (consumer)
+    bool running;       // Drain loop active on this CPU
+    uint32_t dropped;   // Tasklets lost to a full queue
+} __attribute__((aligned(64)));
+
+static struct tasklet_queue tasklet_queues[MAX_CPUS];
+
+void tasklet_schedule(struct tasklet* t) {
+    // Already queued, the pending run will pick up the new work
+    if (__atomic_fetch_or(&t->state, TASKLET_STATE_PENDING, __ATOMIC_ACQ_REL) & TASKLET_STATE_PENDING) {
+        return;
+    }
+
+    uint64_t flags = irq_save();
+    struct tasklet_queue* q = &tasklet_queues[cpu_id()];
+    uint32_t head = q->head;
+    uint32_t tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+
+    if (head - tail < TASKLET_QUEUE_SIZE) {
+        q->slots[head % TASKLET_QUEUE_SIZE] = t;
+        __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+    } else {
+        __atomic_and_fetch(&t->state, ~TASKLET_STATE_PENDING, __ATOMIC_RELEASE);
+        q->dropped++;
+    }
+    irq_restore(flags);
+}
+
+bool tasklet_has_pending(void) {
+    struct tasklet_queue* q = &tasklet_queues[cpu_id()];
+    return __atomic_load_n(&q->head, __ATOMIC_ACQUIRE) != q->tail;
+}
+
+void tasklet_run_pending(void) {
+    struct tasklet_queue* q = &tasklet_queues[cpu_id()];
+
+    // An interrupt that arrives while we drain only queues its work,
+    // the outer loop below runs it
+    if (q->running) {
+        return;
+    }
+    q->running = true;
+
+    while (__atomic_load_n(&q->head, __ATOMIC_ACQUIRE) != q->tail) {
+        asm volatile("sti" ::: "memory");
+
+        uint32_t tail = q->tail;
+        while (tail != __atomic_load_n(&q->head, __ATOMIC_ACQUIRE)) {
+            struct tasklet* t = q->slots[tail % TASKLET_QUEUE_SIZE];
+            tail++;
+            __atomic_store_n(&q->tail, tail, __ATOMIC_RELEASE);
+
+            // Clear pending before running so the tasklet can be requeued
+            // by an interrupt that fires while it runs
+            __atomic_and_fetch(&t->state, ~TASKLET_STATE_PENDING, __ATOMIC_ACQ_REL);
+            t->func(t->data);
+        }
+
+        // Recheck with interrupts off so nothing queued after the last
+        // check is left behind until the next interrupt
+        asm volatile("cli" ::: "memory");
+    }
+
+    q->running = false;
+}
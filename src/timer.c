@@ -0,0 +1,193 @@
+#include "timer.h"
+#include "interrupts.h"
+#include "tasklet.h"
+#include "port.h"
+#include "cpu.h"
+#include "spinlock.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// PIT (8253/8254) ports and input clock
+#define PIT_CHANNEL0  0x40
+#define PIT_CHANNEL2  0x42
+#define PIT_COMMAND   0x43
+#define PIT_GATE_PORT 0x61
+#define PIT_FREQUENCY 1193182
+
+// Calibration window for the TSC (10 ms)
+#define CALIBRATE_HZ 100
+
+static volatile uint64_t ticks = 0;
+static uint64_t tsc_hz = 0;
+static uint64_t tsc_ns_mult = 0;    // ns = (cycles * mult) >> 32
+
+// Pending timers sorted by expiry. Any CPU may arm a timer; they all fire
+// from the BSP's tick.
+static struct timer* timer_list = NULL;
+static spinlock_t timer_lock = SPINLOCK_INIT_NAMED("timer");
+static volatile uint64_t next_expiry = UINT64_MAX;
+
+static void timer_bottom_half(void* data);
+static struct tasklet timer_tasklet = TASKLET_INIT(timer_bottom_half, NULL);
+
+// Measure the TSC against a one-shot count on PIT channel 2
+static void calibrate_tsc(void) {
+    uint16_t count = PIT_FREQUENCY / CALIBRATE_HZ;
+
+    // Gate channel 2 on, speaker off
+    outb(PIT_GATE_PORT, (inb(PIT_GATE_PORT) & ~0x02) | 0x01);
+
+    // Channel 2, lobyte/hibyte, mode 0 (interrupt on terminal count)
+    outb(PIT_COMMAND, 0xB0);
+    outb(PIT_CHANNEL2, count & 0xFF);
+    outb(PIT_CHANNEL2, count >> 8);
+
+    // Restart the count by toggling the gate
+    uint8_t gate = inb(PIT_GATE_PORT) & ~0x01;
+    outb(PIT_GATE_PORT, gate);
+    outb(PIT_GATE_PORT, gate | 0x01);
+
+    uint64_t start = rdtsc();
+    while (!(inb(PIT_GATE_PORT) & 0x20));
+    uint64_t end = rdtsc();
+
+    tsc_hz = (end - start) * CALIBRATE_HZ;
+    tsc_ns_mult = (1000000000ULL << 32) / tsc_hz;
+}
+
+// IRQ0 (top half): count the tick, defer expired timers to the tasklet
+static void timer_interrupt_handler(void) {
+    uint64_t now = ++ticks;
+
+    if (now >= next_expiry) {
+        tasklet_schedule(&timer_tasklet);
+    }
+}
+
+// Run all expired timers with interrupts enabled
+static void timer_bottom_half(void* data) {
+    (void)data;
+
+    for (;;) {
+        uint64_t flags = spin_lock_irqsave(&timer_lock);
+        struct timer* t = timer_list;
+        if (t == NULL || t->expires > ticks) {
+            next_expiry = t ? t->expires : UINT64_MAX;
+            spin_unlock_irqrestore(&timer_lock, flags);
+            return;
+        }
+        timer_list = t->next;
+        t->next = NULL;
+        t->pending = false;
+        t->running = true;
+        next_expiry = timer_list ? timer_list->expires : UINT64_MAX;
+        void (*func)(void* data) = t->func;
+        void* arg = t->data;
+        spin_unlock_irqrestore(&timer_lock, flags);
+
+        func(arg);
+
+        // timer_cancel_sync() waits for this before the timer may go away
+        flags = spin_lock_irqsave(&timer_lock);
+        t->running = false;
+        spin_unlock_irqrestore(&timer_lock, flags);
+    }
+}
+
+void timer_init(void) {
+    calibrate_tsc();
+
+    // Channel 0, lobyte/hibyte, mode 2 (rate generator)
+    uint16_t divisor = PIT_FREQUENCY / TIMER_HZ;
+    outb(PIT_COMMAND, 0x34);
+    outb(PIT_CHANNEL0, divisor & 0xFF);
+    outb(PIT_CHANNEL0, divisor >> 8);
+
+    irq_register_handler(0, timer_interrupt_handler);
+}
+
+uint64_t timer_ticks(void) {
+    return ticks;
+}
+
+uint64_t timer_tsc_hz(void) {
+    return tsc_hz;
+}
+
+uint64_t tsc_to_ns(uint64_t cycles) {
+    return (uint64_t)(((unsigned __int128)cycles * tsc_ns_mult) >> 32);
+}
+
+uint64_t us_to_tsc(uint64_t us) {
+    return us * (tsc_hz / 1000000);
+}
+
+uint64_t timer_ns(void) {
+    return tsc_to_ns(rdtsc());
+}
+
+void timer_udelay(uint64_t us) {
+    uint64_t deadline = rdtsc() + us_to_tsc(us);
+    while (rdtsc() < deadline) {
+        cpu_relax();
+    }
+}
+
+// Unlink a pending timer, timer_lock must be held
+static bool timer_unlink(struct timer* t) {
+    if (!t->pending) {
+        return false;
+    }
+    for (struct timer** link = &timer_list; *link; link = &(*link)->next) {
+        if (*link == t) {
+            *link = t->next;
+            break;
+        }
+    }
+    t->next = NULL;
+    t->pending = false;
+    return true;
+}
+
+void timer_start(struct timer* t, uint64_t delay_ms) {
+    uint64_t flags = spin_lock_irqsave(&timer_lock);
+
+    timer_unlink(t);
+    t->expires = ticks + (delay_ms ? delay_ms : 1);
+    t->pending = true;
+
+    // Keep the list sorted by expiry
+    struct timer** link = &timer_list;
+    while (*link && (*link)->expires <= t->expires) {
+        link = &(*link)->next;
+    }
+    t->next = *link;
+    *link = t;
+    next_expiry = timer_list->expires;
+
+    spin_unlock_irqrestore(&timer_lock, flags);
+}
+
+bool timer_cancel(struct timer* t) {
+    uint64_t flags = spin_lock_irqsave(&timer_lock);
+    bool was_pending = timer_unlink(t);
+    next_expiry = timer_list ? timer_list->expires : UINT64_MAX;
+    spin_unlock_irqrestore(&timer_lock, flags);
+    return was_pending;
+}
+
+bool timer_cancel_sync(struct timer* t) {
+    bool was_pending = false;
+    for (;;) {
+        uint64_t flags = spin_lock_irqsave(&timer_lock);
+        was_pending |= timer_unlink(t);
+        next_expiry = timer_list ? timer_list->expires : UINT64_MAX;
+        bool running = t->running;
+        spin_unlock_irqrestore(&timer_lock, flags);
+        if (!running) {
+            return was_pending;
+        }
+        cpu_relax();
+    }
+}
@@ -0,0 +1,267 @@
+#include "tlb.h"
+#include "cpu.h"
+#include "smp.h"
+#include "lapic.h"
+#include "interrupts.h"
+#include "spinlock.h"
+#include "vmm.h"
+#include "pmm.h"
+#include "task.h"
+#include "timer.h"
+#include "console.h"
+#include "shell.h"
+#include "stdmem.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define CR4_PGE (1ULL << 7)
+
+// Invalidations other CPUs queued for this one. Requests from several
+// senders merge; requested/completed tell a sender when its own is done.
+struct tlb_inbox {
+    spinlock_t lock;
+    size_t count;
+    bool full;
+    uint64_t addrs[TLB_BATCH_MAX];
+    volatile uint64_t requested;
+    volatile uint64_t completed;
+    volatile bool lazy;         // Idle, flushes before running anything
+    struct tlb_stats stats;
+} __attribute__((aligned(64)));
+
+static struct tlb_inbox inboxes[MAX_CPUS];
+
+static inline void invlpg(uint64_t virt) {
+    asm volatile("invlpg [%0]" : : "r"(virt) : "memory");
+}
+
+// Drop every translation, global kernel pages included
+static void flush_all(void) {
+    uint64_t cr4;
+    asm volatile("mov %0, cr4" : "=r"(cr4));
+    if (cr4 & CR4_PGE) {
+        asm volatile("mov cr4, %0" : : "r"(cr4 & ~CR4_PGE) : "memory");
+        asm volatile("mov cr4, %0" : : "r"(cr4) : "memory");
+    } else {
+        uint64_t cr3;
+        asm volatile("mov %0, cr3" : "=r"(cr3));
+        asm volatile("mov cr3, %0" : : "r"(cr3) : "memory");
+    }
+}
+
+static void flush_local(struct tlb_inbox* self, const uint64_t* addrs, size_t count, bool full) {
+    if (full) {
+        flush_all();
+        __atomic_add_fetch(&self->stats.full_flushes, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    for (size_t i = 0; i < count; i++) {
+        invlpg(addrs[i]);
+    }
+    __atomic_add_fetch(&self->stats.pages_flushed, count, __ATOMIC_RELAXED);
+}
+
+// Run what other CPUs queued for this one
+static void process_inbox(void) {
+    struct tlb_inbox* self = &inboxes[cpu_id()];
+    uint64_t addrs[TLB_BATCH_MAX];
+
+    if (__atomic_load_n(&self->requested, __ATOMIC_ACQUIRE) ==
+        __atomic_load_n(&self->completed, __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    // Interrupts stay off until completed is published: a shootdown IPI
+    // nested in between would report a newer request done before these
+    // addresses are flushed, and our store would then move completed back
+    uint64_t flags = irq_save();
+    raw_spin_lock(&self->lock);
+    size_t count = self->count;
+    bool full = self->full;
+    uint64_t requested = self->requested;
+    for (size_t i = 0; i < count; i++) {
+        addrs[i] = self->addrs[i];
+    }
+    self->count = 0;
+    self->full = false;
+    raw_spin_unlock(&self->lock);
+
+    flush_local(self, addrs, count, full);
+    __atomic_store_n(&self->completed, requested, __ATOMIC_RELEASE);
+    irq_restore(flags);
+}
+
+static void tlb_interrupt(void) {
+    process_inbox();
+}
+
+void tlb_gather_init(struct tlb_gather* gather, uint64_t pml4) {
+    gather->pml4 = pml4;
+    gather->count = 0;
+    gather->full = false;
+}
+
+void tlb_gather_add(struct tlb_gather* gather, uint64_t virt) {
+    if (gather->full) {
+        return;
+    }
+    if (gather->count == TLB_BATCH_MAX) {
+        gather->full = true;
+        return;
+    }
+    gather->addrs[gather->count++] = virt & ~(uint64_t)(PAGE_SIZE - 1);
+}
+
+// Queue the gather on target, returns the request number to wait for
+static uint64_t queue_remote(struct tlb_inbox* target, const struct tlb_gather* gather) {
+    uint64_t flags = spin_lock_irqsave(&target->lock);
+    if (gather->full || target->count + gather->count > TLB_BATCH_MAX) {
+        target->full = true;
+    } else if (!target->full) {
+        for (size_t i = 0; i < gather->count; i++) {
+            target->addrs[target->count++] = gather->addrs[i];
+        }
+    }
+    uint64_t ticket = ++target->requested;
+    spin_unlock_irqrestore(&target->lock, flags);
+    return ticket;
+}
+
+void tlb_gather_finish(struct tlb_gather* gather) {
+    if (gather->count == 0 && !gather->full) {
+        return;
+    }
+
+    // Stay on this CPU: it is excluded from the targets below
+    preempt_disable();
+    unsigned int self_id = cpu_id();
+    struct tlb_inbox* self = &inboxes[self_id];
+    uint64_t tickets[MAX_CPUS];
+    bool wait[MAX_CPUS];
+    bool remote = false;
+
+    flush_local(self, gather->addrs, gather->count, gather->full);
+
+    for (unsigned int i = 0; i < cpu_count(); i++) {
+        struct cpu* cpu = &cpus[i];
+        wait[i] = false;
+        if (i == self_id || !cpu->online) {
+            continue;
+        }
+        // Another address space: switching back to ours reloads CR3
+        if (gather->pml4 != 0 && __atomic_load_n(&cpu->active_pml4, __ATOMIC_RELAXED) != gather->pml4) {
+            continue;
+        }
+
+        struct tlb_inbox* target = &inboxes[i];
+        tickets[i] = queue_remote(target, gather);
+        remote = true;
+
+        // Pairs with tlb_leave_lazy(): either it sees the request or we
+        // see it is no longer lazy
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&target->lazy, __ATOMIC_RELAXED)) {
+            __atomic_add_fetch(&self->stats.lazy_skipped, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+        lapic_send_ipi(cpu->lapic_id, IRQ_BASE + LOCAL_IRQ_TLB);
+        __atomic_add_fetch(&self->stats.ipis_sent, 1, __ATOMIC_RELAXED);
+        wait[i] = true;
+    }
+
+    for (unsigned int i = 0; i < cpu_count(); i++) {
+        if (!wait[i]) {
+            continue;
+        }
+        struct tlb_inbox* target = &inboxes[i];
+        while (__atomic_load_n(&target->completed, __ATOMIC_ACQUIRE) < tickets[i]) {
+            // The target may be waiting on us with interrupts off
+            process_inbox();
+            if (__atomic_load_n(&target->lazy, __ATOMIC_ACQUIRE)) {
+                break;
+            }
+            cpu_relax();
+        }
+    }
+    if (remote) {
+        __atomic_add_fetch(&self->stats.shootdowns, 1, __ATOMIC_RELAXED);
+    }
+    preempt_enable();
+}
+
+void tlb_init_cpu(void) {
+    struct cpu* cpu = this_cpu();
+    uint64_t cr3;
+
+    asm volatile("mov %0, cr3" : "=r"(cr3));
+    cpu->active_pml4 = cr3 & PTE_ADDR_MASK;
+    if (cpu->id == 0) {
+        irq_register_local(LOCAL_IRQ_TLB, tlb_interrupt);
+    }
+}
+
+void tlb_enter_lazy(void) {
+    __atomic_store_n(&inboxes[cpu_id()].lazy, true, __ATOMIC_RELAXED);
+}
+
+void tlb_leave_lazy(void) {
+    struct tlb_inbox* self = &inboxes[cpu_id()];
+
+    __atomic_store_n(&self->lazy, false, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    process_inbox();
+}
+
+void tlb_irq_enter(void) {
+    if (__atomic_load_n(&inboxes[cpu_id()].lazy, __ATOMIC_RELAXED)) {
+        process_inbox();
+    }
+}
+
+void tlb_get_stats(unsigned int cpu, struct tlb_stats* stats) {
+    *stats = inboxes[cpu].stats;
+}
+
+// Map scratch pages, pull them into every CPU's TLB, then unmap
+static void unmap_test(void) {
+    size_t pages = TLB_BATCH_MAX;
+    uint64_t phys = pmm_alloc_pages(pages);
+    uint8_t* map = phys ? vmm_map_range(phys, pages * PAGE_SIZE, PTE_WRITABLE) : NULL;
+    if (map == NULL) {
+        if (phys) {
+            pmm_free_pages(phys, pages);
+        }
+        printf("Out of memory\n", RED, BLACK);
+        return;
+    }
+    parallel_memset(map, 0, pages * PAGE_SIZE);
+    uint64_t start = rdtsc();
+    vmm_unmap_pages((uint64_t)map, pages);
+    uint64_t elapsed = tsc_to_ns(rdtsc() - start);
+    pmm_free_pages(phys, pages);
+    printf("Unmapped %u pages in %u us\n", GREEN, BLACK, (unsigned int)pages, (unsigned int)(elapsed / 1000));
+}
+
+static void cmd_tlb(int argc, char** argv) {
+    if (argc > 1 && strcmp(argv[1], "test") == 0) {
+        unmap_test();
+    }
+    printf("  CPU SHOOTDOWNS IPIS LAZY PAGES FULL\n", WHITE, BLACK);
+    for (unsigned int i = 0; i < cpu_count(); i++) {
+        struct tlb_stats* stats = &inboxes[i].stats;
+        printf("  %u   %u  %u  %u  %u  %u\n", GRAY, BLACK, i, (unsigned int)stats->shootdowns,
+               (unsigned int)stats->ipis_sent, (unsigned int)stats->lazy_skipped,
+               (unsigned int)stats->pages_flushed, (unsigned int)stats->full_flushes);
+    }
+}
+
+static void complete_tlb(int argc, char** argv, struct shell_completion* comp) {
+    (void)argv;
+    if (argc == 1) {
+        shell_complete_add(comp, "test");
+    }
+}
+
+SHELL_COMMAND_ARGS(tlb, "tlb", "Show TLB shootdown counters, 'tlb test' unmaps on all CPUs", cmd_tlb,
+                   complete_tlb);
@@ -0,0 +1,98 @@
+#include "vdso.h"
+#include "vmm.h"
+#include "pmm.h"
+#include "timer.h"
+#include "spinlock.h"
+#include "stdmem.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define XSTR(x) STR(x)
+#define STR(x) #x
+
+// User code of the page (defined below)
+extern const uint8_t vdso_code_start[];
+extern const uint8_t vdso_code_end[];
+
+static struct vdso_data* data = NULL;
+static uint64_t data_phys = 0;
+static uint64_t code_phys = 0;
+static spinlock_t vdso_lock = SPINLOCK_INIT_NAMED("vdso");
+
+void vdso_init(void) {
+    data_phys = pmm_alloc_page();
+    code_phys = pmm_alloc_page();
+    if (data_phys == 0 || code_phys == 0) {
+        return;
+    }
+    data = phys_to_virt(data_phys);
+    memset(data, 0, PAGE_SIZE);
+
+    // Fill the rest of the code page with int3
+    uint8_t* code = phys_to_virt(code_phys);
+    memset(code, 0xCC, PAGE_SIZE);
+    memcpy(code, vdso_code_start, vdso_code_end - vdso_code_start);
+
+    // Same conversion as tsc_to_ns(), whose multiplier is the result
+    // for 2^32 cycles
+    vdso_set_clock(0, 0, tsc_to_ns(1ULL << 32), timer_tsc_hz());
+}
+
+void vdso_set_clock(uint64_t tsc_base, uint64_t ns_base, uint64_t mult, uint64_t tsc_hz) {
+    if (data == NULL) {
+        return;
+    }
+    uint64_t flags = spin_lock_irqsave(&vdso_lock);
+    __atomic_store_n(&data->sequence, data->sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    data->tsc_base = tsc_base;
+    data->ns_base = ns_base;
+    data->mult = mult;
+    data->tsc_hz = tsc_hz;
+    __atomic_store_n(&data->sequence, data->sequence + 1, __ATOMIC_RELEASE);
+    spin_unlock_irqrestore(&vdso_lock, flags);
+}
+
+int vdso_map(uint64_t pml4) {
+    if (data == NULL) {
+        return -1;
+    }
+    // PTE_SHARED: the pages outlive every address space
+    if (vmm_map_user(pml4, VDSO_DATA, data_phys, PTE_NX | PTE_SHARED) != 0 ||
+        vmm_map_user(pml4, VDSO_CODE, code_phys, PTE_SHARED) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+// vdso_clock_ns: loads are not reordered with other loads on x86, so
+// reading the sequence before and after the data is enough; an odd or
+// changed sequence means a concurrent update and the read is redone. The
+// 128-bit product keeps the conversion exact for any TSC value.
+asm(
+    ".section .rodata\n"
+    ".global vdso_code_start\n"
+    ".global vdso_code_end\n"
+    "vdso_code_start:\n"
+    "    movabs %r8, " XSTR(VDSO_DATA) "\n"
+    "1:\n"
+    "    mov %esi, dword ptr [%r8 + " XSTR(VDSO_SEQUENCE) "]\n"
+    "    test %esi, 1\n"
+    "    jnz 2f\n"
+    "    rdtsc\n"
+    "    shl %rdx, 32\n"
+    "    or %rax, %rdx\n"
+    "    sub %rax, qword ptr [%r8 + " XSTR(VDSO_TSC_BASE) "]\n"
+    "    mul qword ptr [%r8 + " XSTR(VDSO_MULT) "]\n"
+    "    shrd %rax, %rdx, 32\n"
+    "    add %rax, qword ptr [%r8 + " XSTR(VDSO_NS_BASE) "]\n"
+    "    cmp %esi, dword ptr [%r8 + " XSTR(VDSO_SEQUENCE) "]\n"
+    "    jne 1b\n"
+    "    ret\n"
+    "2:\n"
+    "    pause\n"
+    "    jmp 1b\n"
+    "vdso_code_end:\n"
+    ".previous\n"
+);
@@ -0,0 +1,308 @@
+#include "vmm.h"
+#include "pmm.h"
+#include "spinlock.h"
+#include "tlb.h"
+#include "stdmem.h"
+#include "cpu.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Top-level entries from here on map the kernel half
+#define PML4_KERNEL_FIRST 256
+
+// PAT entries 0-7: WB, WT, UC-, UC, WP, WC, UC-, UC. The first four are
+// the power-on defaults, so PWT/PCD without PTE_PAT keep their meaning.
+#define PAT_LAYOUT 0x0007010500070406ULL
+
+static uint64_t kernel_pml4 = 0;
+static uint64_t pte_nx = 0;     // PTE_NX if the CPU honours it, else 0
+static uint64_t mmio_next = MMIO_WINDOW_BASE;
+static spinlock_t vmm_lock = SPINLOCK_INIT_NAMED("vmm");
+
+static inline void invlpg(uint64_t virt) {
+    asm volatile("invlpg [%0]" : : "r"(virt) : "memory");
+}
+
+static uint64_t* next_table(uint64_t* table, size_t index, uint64_t flags);
+
+void vmm_init(void) {
+    uint64_t cr3;
+    asm volatile("mov %0, cr3" : "=r"(cr3));
+    kernel_pml4 = cr3 & PTE_ADDR_MASK;
+    if (rdmsr(MSR_EFER) & EFER_NXE) {
+        pte_nx = PTE_NX;
+    }
+
+    // Address spaces copy the kernel's top-level entries when created, so
+    // the mapping window needs its own before the first one exists
+    next_table(phys_to_virt(kernel_pml4), (MMIO_WINDOW_BASE >> 39) & 0x1FF, 0);
+}
+
+void vmm_init_cpu(void) {
+    if (rdmsr(MSR_PAT) == PAT_LAYOUT) {
+        return;
+    }
+    // Cached lines must not outlive a change of their memory type
+    asm volatile("wbinvd" ::: "memory");
+    wrmsr(MSR_PAT, PAT_LAYOUT);
+    asm volatile("wbinvd" ::: "memory");
+    uint64_t cr3;
+    asm volatile("mov %0, cr3" : "=r"(cr3));
+    asm volatile("mov cr3, %0" : : "r"(cr3) : "memory");
+}
+
+uint64_t vmm_kernel_pml4(void) {
+    return kernel_pml4;
+}
+
+// Entry of the next-level table, allocating it if missing
+static uint64_t* next_table(uint64_t* table, size_t index, uint64_t flags) {
+    uint64_t entry = table[index];
+
+    if (entry & PTE_PRESENT) {
+        if (entry & PTE_HUGE) {
+            return NULL;
+        }
+        // Intermediate levels must allow what the leaf allows
+        table[index] |= flags & (PTE_WRITABLE | PTE_USER);
+        return phys_to_virt(entry & PTE_ADDR_MASK);
+    }
+
+    uint64_t phys = pmm_alloc_page();
+    if (phys == 0) {
+        return NULL;
+    }
+    memset(phys_to_virt(phys), 0, PAGE_SIZE);
+    table[index] = phys | PTE_PRESENT | PTE_WRITABLE | (flags & PTE_USER);
+    return phys_to_virt(phys);
+}
+
+// Set the leaf entry of virt in the tables under root (vmm_lock held)
+static int map_in(uint64_t root, uint64_t virt, uint64_t phys, uint64_t flags) {
+    uint64_t* table = phys_to_virt(root);
+    for (int shift = 39; shift > 12 && table; shift -= 9) {
+        table = next_table(table, (virt >> shift) & 0x1FF, flags);
+    }
+    if (table == NULL) {
+        return -1;
+    }
+    if (!pte_nx) {
+        flags &= ~PTE_NX;
+    }
+    table[(virt >> 12) & 0x1FF] = (phys & PTE_ADDR_MASK) | flags | PTE_PRESENT;
+    return 0;
+}
+
+// Leaf entry of virt under root, NULL if a level is missing
+static uint64_t* find_pte(uint64_t root, uint64_t virt) {
+    uint64_t* table = phys_to_virt(root);
+    for (int shift = 39; shift > 12 && table; shift -= 9) {
+        uint64_t entry = table[(virt >> shift) & 0x1FF];
+        table = (entry & PTE_PRESENT) && !(entry & PTE_HUGE) ? phys_to_virt(entry & PTE_ADDR_MASK) : NULL;
+    }
+    return table ? &table[(virt >> 12) & 0x1FF] : NULL;
+}
+
+int vmm_map_page(uint64_t virt, uint64_t phys, uint64_t flags) {
+    uint64_t irq = spin_lock_irqsave(&vmm_lock);
+    int result = map_in(kernel_pml4, virt, phys, flags);
+    if (result == 0) {
+        invlpg(virt);
+    }
+    spin_unlock_irqrestore(&vmm_lock, irq);
+    return result;
+}
+
+void vmm_unmap_pages(uint64_t virt, size_t count) {
+    struct tlb_gather gather;
+    tlb_gather_init(&gather, 0);
+
+    uint64_t irq = spin_lock_irqsave(&vmm_lock);
+    for (size_t i = 0; i < count; i++) {
+        uint64_t addr = virt + i * PAGE_SIZE;
+        uint64_t* pte = find_pte(kernel_pml4, addr);
+        if (pte && (*pte & PTE_PRESENT)) {
+            *pte = 0;
+            tlb_gather_add(&gather, addr);
+        }
+    }
+    spin_unlock_irqrestore(&vmm_lock, irq);
+
+    // One shootdown for the whole range
+    tlb_gather_finish(&gather);
+}
+
+void* vmm_map_range(uint64_t phys, size_t size, uint64_t flags) {
+    uint64_t offset = phys & (PAGE_SIZE - 1);
+    size_t pages = (offset + size + PAGE_SIZE - 1) / PAGE_SIZE;
+
+    uint64_t base = __atomic_fetch_add(&mmio_next, pages * PAGE_SIZE, __ATOMIC_RELAXED);
+    if (base + pages * PAGE_SIZE > MMIO_WINDOW_BASE + MMIO_WINDOW_SIZE) {
+        return NULL;
+    }
+    for (size_t i = 0; i < pages; i++) {
+        if (vmm_map_page(base + i * PAGE_SIZE, (phys - offset) + i * PAGE_SIZE, flags) != 0) {
+            vmm_unmap_pages(base, i);
+            return NULL;
+        }
+    }
+    return (void*)(base + offset);
+}
+
+void* vmm_map_mmio(uint64_t phys, size_t size) {
+    return vmm_map_range(phys, size, PTE_WRITABLE | PTE_PCD | PTE_PWT);
+}
+
+uint64_t vmm_create_space(void) {
+    uint64_t phys = pmm_alloc_page();
+    if (phys == 0) {
+        return 0;
+    }
+    uint64_t* pml4 = phys_to_virt(phys);
+    uint64_t* kernel = phys_to_virt(kernel_pml4);
+    for (size_t i = 0; i < PML4_KERNEL_FIRST; i++) {
+        pml4[i] = 0;
+    }
+    for (size_t i = PML4_KERNEL_FIRST; i < 512; i++) {
+        pml4[i] = kernel[i];
+    }
+    return phys;
+}
+
+// Free a page table and everything below it; level 1 holds the leaves
+static void free_table(uint64_t phys, int level) {
+    uint64_t* table = phys_to_virt(phys);
+    for (size_t i = 0; i < 512; i++) {
+        uint64_t entry = table[i];
+        if (!(entry & PTE_PRESENT)) {
+            continue;
+        }
+        if (level == 1) {
+            if (!(entry & PTE_SHARED)) {
+                pmm_page_put(entry & PTE_ADDR_MASK);
+            }
+        } else if (!(entry & PTE_HUGE)) {
+            free_table(entry & PTE_ADDR_MASK, level - 1);
+        }
+    }
+    pmm_free_page(phys);
+}
+
+// Copy the tables under src into dst (level 1 holds the leaves), sharing
+// the frames. Parent pages made read-only are queued for a flush.
+static int clone_table(uint64_t* src, uint64_t* dst, int level, uint64_t base, struct tlb_gather* gather) {
+    size_t count = level == 4 ? PML4_KERNEL_FIRST : 512;
+    int shift = 12 + 9 * (level - 1);
+
+    for (size_t i = 0; i < count; i++) {
+        uint64_t entry = src[i];
+        uint64_t virt = base + ((uint64_t)i << shift);
+        if (!(entry & PTE_PRESENT) || (level == 1 && (entry & PTE_DEVICE))) {
+            continue;
+        }
+        if (level > 1) {
+            uint64_t phys = pmm_alloc_page();
+            if (phys == 0) {
+                return -1;
+            }
+            memset(phys_to_virt(phys), 0, PAGE_SIZE);
+            dst[i] = phys | (entry & ~PTE_ADDR_MASK);
+            if (clone_table(phys_to_virt(entry & PTE_ADDR_MASK), phys_to_virt(phys), level - 1, virt, gather) != 0) {
+                return -1;
+            }
+            continue;
+        }
+        if (!(entry & PTE_SHARED)) {
+            pmm_page_get(entry & PTE_ADDR_MASK);
+            if (entry & PTE_WRITABLE) {
+                entry = (entry & ~PTE_WRITABLE) | PTE_COW;
+                src[i] = entry;
+                tlb_gather_add(gather, virt);
+            }
+        }
+        dst[i] = entry;
+    }
+    return 0;
+}
+
+uint64_t vmm_clone_space(uint64_t pml4) {
+    uint64_t child = vmm_create_space();
+    if (child == 0) {
+        return 0;
+    }
+    struct tlb_gather gather;
+    tlb_gather_init(&gather, pml4);
+
+    uint64_t irq = spin_lock_irqsave(&vmm_lock);
+    int result = clone_table(phys_to_virt(pml4), phys_to_virt(child), 4, 0, &gather);
+    spin_unlock_irqrestore(&vmm_lock, irq);
+
+    // The parent must not keep writing through stale writable entries
+    tlb_gather_finish(&gather);
+    if (result != 0) {
+        vmm_destroy_space(child);
+        return 0;
+    }
+    return child;
+}
+
+void vmm_destroy_space(uint64_t pml4) {
+    uint64_t* table = phys_to_virt(pml4);
+    for (size_t i = 0; i < PML4_KERNEL_FIRST; i++) {
+        if (table[i] & PTE_PRESENT) {
+            free_table(table[i] & PTE_ADDR_MASK, 3);
+        }
+    }
+    pmm_free_page(pml4);
+}
+
+int vmm_map_user(uint64_t pml4, uint64_t virt, uint64_t phys, uint64_t flags) {
+    if (virt < USER_BASE || virt >= USER_TOP) {
+        return -1;
+    }
+    uint64_t irq = spin_lock_irqsave(&vmm_lock);
+    int result = map_in(pml4, virt, phys, flags | PTE_USER);
+    spin_unlock_irqrestore(&vmm_lock, irq);
+    return result;
+}
+
+void vmm_unmap_user(uint64_t pml4, uint64_t virt, size_t count) {
+    struct tlb_gather gather;
+    tlb_gather_init(&gather, pml4);
+
+    uint64_t irq = spin_lock_irqsave(&vmm_lock);
+    for (size_t i = 0; i < count; i++) {
+        uint64_t addr = virt + i * PAGE_SIZE;
+        uint64_t* pte = find_pte(pml4, addr);
+        if (pte && (*pte & PTE_PRESENT)) {
+            *pte = 0;
+            tlb_gather_add(&gather, addr);
+        }
+    }
+    spin_unlock_irqrestore(&vmm_lock, irq);
+    tlb_gather_finish(&gather);
+}
+
+uint64_t vmm_user_pte(uint64_t pml4, uint64_t virt) {
+    if (virt < USER_BASE || virt >= USER_TOP) {
+        return 0;
+    }
+    uint64_t irq = spin_lock_irqsave(&vmm_lock);
+    uint64_t* pte = find_pte(pml4, virt);
+    uint64_t entry = pte ? *pte : 0;
+    spin_unlock_irqrestore(&vmm_lock, irq);
+    return entry;
+}
+
+void vmm_switch_space(uint64_t pml4) {
+    struct cpu* cpu = this_cpu();
+    if (cpu->active_pml4 == pml4) {
+        return;
+    }
+    // Published first: a shootdown that misses us then happens before the
+    // CR3 load, which flushes what it would have
+    __atomic_store_n(&cpu->active_pml4, pml4, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    asm volatile("mov cr3, %0" : : "r"(pml4) : "memory");
+}